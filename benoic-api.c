@@ -0,0 +1,300 @@
+/**
+ *
+ * Benoic House Automation service
+ *
+ * Command house automation devices via an HTTP REST interface
+ *
+ * Embedding API functions
+ * Typed access to the elements for programs running benoic in the same process
+ *
+ * Copyright 2016 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+#include "benoic.h"
+
+/**
+ * Fill value with the json value of an element
+ * j_value is the value returned by the module or the last known value, it's not modified
+ * return B_OK on success, B_ERROR_PARAM if j_value has no value
+ */
+int element_value_from_json(json_t * j_value, const int element_type, time_t date, struct _benoic_element_value * value) {
+  json_t * j_element_value = json_object_get(j_value, (element_type == BENOIC_ELEMENT_TYPE_HEATER)?"command":"value");
+  
+  value->element_type = element_type;
+  value->value_type = BENOIC_VALUE_NONE;
+  value->integer_value = 0;
+  value->double_value = 0;
+  value->string_value[0] = '\0';
+  value->mode[0] = '\0';
+  value->on = 0;
+  value->date = date;
+  
+  if (json_is_integer(j_element_value)) {
+    value->value_type = BENOIC_VALUE_INTEGER;
+    value->integer_value = json_integer_value(j_element_value);
+    value->double_value = (double)value->integer_value;
+  } else if (json_is_real(j_element_value)) {
+    value->value_type = BENOIC_VALUE_DOUBLE;
+    value->double_value = json_real_value(j_element_value);
+  } else if (json_is_string(j_element_value)) {
+    value->value_type = BENOIC_VALUE_STRING;
+    snprintf(value->string_value, sizeof(value->string_value), "%s", json_string_value(j_element_value));
+  } else {
+    return B_ERROR_PARAM;
+  }
+  
+  if (element_type == BENOIC_ELEMENT_TYPE_HEATER) {
+    if (json_is_string(json_object_get(j_value, "mode"))) {
+      snprintf(value->mode, sizeof(value->mode), "%s", json_string_value(json_object_get(j_value, "mode")));
+    }
+    value->on = (json_object_get(j_value, "on") == json_true());
+  }
+  return B_OK;
+}
+
+/**
+ * Read the last known value of the element if it's not older than max_age seconds
+ * No json is allocated, the value is copied directly from the values cache
+ * return B_OK on success, B_ERROR_NOT_FOUND if there is no such value
+ */
+int benoic_read_element_cached(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, const time_t max_age, struct _benoic_element_value * value) {
+  int i, to_return = B_ERROR_NOT_FOUND;
+  time_t now;
+  
+  if (config == NULL || device_name == NULL || element_name == NULL || value == NULL || max_age <= 0) {
+    return B_ERROR_PARAM;
+  }
+  
+  time(&now);
+  pthread_mutex_lock(&config->element_index_lock);
+  for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+    if (config->element_index_list[i].element_type == element_type &&
+        0 == o_strcmp(config->element_index_list[i].element_name, element_name) &&
+        0 == o_strcmp(config->element_index_list[i].device_name, device_name)) {
+      if (config->element_index_list[i].value != NULL && config->element_index_list[i].value_date + max_age >= now) {
+        to_return = element_value_from_json(config->element_index_list[i].value, element_type, config->element_index_list[i].value_date, value);
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  return to_return;
+}
+
+/**
+ * Open a handle to the device for the embedding API
+ * The device is resolved once, and again only when the devices registry changes
+ * return NULL if the device doesn't exist or on error
+ * returned value must be closed with benoic_device_close after use
+ */
+struct _benoic_device_handle * benoic_device_open(struct _benoic_config * config, const char * device_name) {
+  struct _benoic_device_handle * handle;
+  
+  if (config == NULL || device_name == NULL) {
+    return NULL;
+  }
+  
+  handle = o_malloc(sizeof(struct _benoic_device_handle));
+  if (handle == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "benoic_device_open - Error allocating resources for handle");
+    return NULL;
+  }
+  handle->config = config;
+  handle->registry_generation = get_registry_generation(config);
+  handle->device = get_device(config, device_name);
+  handle->device_name = o_strdup(device_name);
+  if (handle->device == NULL || handle->device_name == NULL) {
+    json_decref(handle->device);
+    o_free(handle->device_name);
+    o_free(handle);
+    return NULL;
+  }
+  pthread_mutex_init(&handle->lock, NULL);
+  return handle;
+}
+
+/**
+ * Close the handle to the device
+ */
+void benoic_device_close(struct _benoic_device_handle * handle) {
+  if (handle != NULL) {
+    pthread_mutex_destroy(&handle->lock);
+    json_decref(handle->device);
+    o_free(handle->device_name);
+    o_free(handle);
+  }
+}
+
+/**
+ * Return a copy of the device of the handle, the copy can be modified for a single request
+ * The device is reloaded from the database only if the devices registry has changed since it was resolved
+ * return NULL if the device doesn't exist anymore
+ * returned value must be free'd after use
+ */
+json_t * benoic_device_resolve(struct _benoic_device_handle * handle) {
+  unsigned long registry_generation = get_registry_generation(handle->config);
+  json_t * device;
+  
+  pthread_mutex_lock(&handle->lock);
+  if (handle->device == NULL || handle->registry_generation != registry_generation) {
+    json_decref(handle->device);
+    handle->device = get_device(handle->config, handle->device_name);
+    handle->registry_generation = registry_generation;
+  }
+  device = json_deep_copy(handle->device);
+  pthread_mutex_unlock(&handle->lock);
+  return device;
+}
+
+/**
+ * Read the value of the element
+ * If max_age is positive and the last known value is not older than max_age seconds, the device is not called
+ * The device is called through get_element, so identical reads running at the same time share the same module call
+ */
+int benoic_read_element(struct _benoic_device_handle * handle, const int element_type, const char * element_name, const time_t max_age, const long timeout, struct _benoic_element_value * value) {
+  json_t * device, * j_element;
+  long remaining = timeout;
+  int res, timed_out = 0;
+  
+  if (handle == NULL || element_name == NULL || value == NULL) {
+    return B_ERROR_PARAM;
+  }
+  
+  if (max_age > 0 && benoic_read_element_cached(handle->config, handle->device_name, element_type, element_name, max_age, value) == B_OK) {
+    return B_OK;
+  }
+  
+  device = benoic_device_resolve(handle);
+  if (device == NULL) {
+    return B_ERROR_NOT_FOUND;
+  } else if (json_object_get(device, "enabled") == json_false() || json_object_get(device, "connected") == json_false()) {
+    json_decref(device);
+    return B_ERROR_PARAM;
+  }
+  
+  res = device_admission_enter(handle->config, device, &remaining, NULL);
+  if (res == B_OK) {
+    j_element = get_element(handle->config, device, element_type, element_name, 0, remaining, &timed_out);
+    device_slot_release(handle->config, device);
+    if (j_element != NULL) {
+      res = element_value_from_json(j_element, element_type, time(NULL), value);
+      json_decref(j_element);
+    } else if (timed_out) {
+      res = B_ERROR_TIMEOUT;
+    } else {
+      res = B_ERROR_NOT_FOUND;
+    }
+  }
+  json_decref(device);
+  return res;
+}
+
+/**
+ * Convert an HTTP status of a command result to a B_* result
+ */
+int status_to_result(const json_int_t status) {
+  switch (status) {
+    case 200:
+      return B_OK;
+    case 400:
+      return B_ERROR_PARAM;
+    case 404:
+      return B_ERROR_NOT_FOUND;
+    case 429:
+      return B_ERROR_BUSY;
+    case 503:
+      return B_ERROR_UNAVAILABLE;
+    case 504:
+      return B_ERROR_TIMEOUT;
+    default:
+      return B_ERROR_IO;
+  }
+}
+
+/**
+ * Send a command to the element through the queue of the device
+ * The command is sent as is to the module, without being formatted and parsed again
+ * If result isn't NULL, it's set to the result of the command and must be free'd after use
+ */
+int benoic_send_command(struct _benoic_device_handle * handle, const struct _b_element_command * command, const long timeout, json_t ** result) {
+  json_t * device, * j_result;
+  long remaining = timeout;
+  int res;
+  
+  if (handle == NULL || command == NULL || command->element_name == NULL) {
+    return B_ERROR_PARAM;
+  }
+  
+  device = benoic_device_resolve(handle);
+  if (device == NULL) {
+    return B_ERROR_NOT_FOUND;
+  } else if (json_object_get(device, "enabled") == json_false() || json_object_get(device, "connected") == json_false()) {
+    json_decref(device);
+    return B_ERROR_PARAM;
+  }
+  
+  res = device_admission_enter(handle->config, device, &remaining, NULL);
+  if (res == B_OK) {
+    j_result = device_send_element_command(handle->config, device, command, remaining);
+    device_slot_release(handle->config, device);
+    res = status_to_result(json_integer_value(json_object_get(j_result, "status")));
+    if (result != NULL) {
+      *result = j_result;
+    } else {
+      json_decref(j_result);
+    }
+  }
+  json_decref(device);
+  return res;
+}
+
+/**
+ * Set the switch, command is 0 (off), 1 (on) or -1 (toggle)
+ */
+int benoic_set_switch(struct _benoic_device_handle * handle, const char * switch_name, const int command, const long timeout) {
+  struct _b_element_command b_command = {BENOIC_ELEMENT_TYPE_SWITCH, switch_name, command, 0, NULL};
+  
+  return benoic_send_command(handle, &b_command, timeout, NULL);
+}
+
+/**
+ * Set the dimmer, command is between 0 and 100, or 101 to set the last value
+ * new_value is set to the value of the dimmer after the command if it's not NULL
+ */
+int benoic_set_dimmer(struct _benoic_device_handle * handle, const char * dimmer_name, const int command, const long timeout, int * new_value) {
+  struct _b_element_command b_command = {BENOIC_ELEMENT_TYPE_DIMMER, dimmer_name, command, 0, NULL};
+  json_t * j_result = NULL;
+  int res;
+  
+  res = benoic_send_command(handle, &b_command, timeout, &j_result);
+  if (res == B_OK && new_value != NULL && json_is_integer(json_object_get(j_result, "value"))) {
+    *new_value = (int)json_integer_value(json_object_get(j_result, "value"));
+  }
+  json_decref(j_result);
+  return res;
+}
+
+/**
+ * Set the heater mode and command, mode is off, manual or auto, or NULL to keep the current mode
+ */
+int benoic_set_heater(struct _benoic_device_handle * handle, const char * heater_name, const char * mode, const float command, const long timeout) {
+  struct _b_element_command b_command = {BENOIC_ELEMENT_TYPE_HEATER, heater_name, 0, command, mode};
+  
+  return benoic_send_command(handle, &b_command, timeout, NULL);
+}
@@ -0,0 +1,430 @@
+/**
+ *
+ * Benoic House Automation service
+ *
+ * Command house automation devices via an HTTP REST interface
+ *
+ * Live events stream functions
+ *
+ * Copyright 2016 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include "benoic.h"
+
+/**
+ * Initialize the event bus
+ */
+int init_event_bus(struct _benoic_event_bus * bus) {
+  if (bus == NULL) {
+    return B_ERROR_PARAM;
+  }
+  if (pthread_mutex_init(&bus->lock, NULL) || pthread_cond_init(&bus->cond, NULL)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "init_event_bus - Error initializing lock");
+    return B_ERROR;
+  }
+  bus->subscriber_list = o_malloc(sizeof(struct _benoic_event_subscriber *));
+  if (bus->subscriber_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "init_event_bus - Error allocating resources for subscriber_list");
+    return B_ERROR_MEMORY;
+  }
+  bus->subscriber_list[0] = NULL;
+  bus->nb_subscribers = 0;
+  bus->closed = 0;
+  if (bus->max_subscribers == 0) {
+    bus->max_subscribers = BENOIC_STREAM_DEFAULT_MAX_SUBSCRIBERS;
+  }
+  if (bus->queue_size == 0) {
+    bus->queue_size = BENOIC_STREAM_DEFAULT_QUEUE_SIZE;
+  }
+  if (bus->heartbeat <= 0) {
+    bus->heartbeat = BENOIC_STREAM_DEFAULT_HEARTBEAT;
+  }
+  if (bus->journal_size == 0) {
+    bus->journal_size = BENOIC_JOURNAL_DEFAULT_SIZE;
+  }
+  bus->journal = o_malloc(bus->journal_size * sizeof(struct _benoic_journal_entry));
+  if (bus->journal == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "init_event_bus - Error allocating resources for journal");
+    return B_ERROR_MEMORY;
+  }
+  bus->journal_start = 0;
+  bus->journal_count = 0;
+  // Sequence numbers start from the current time so they keep growing after a restart
+  bus->last_seq = ((json_int_t)time(NULL)) << 16;
+  return B_OK;
+}
+
+/**
+ * Close all the streams and wait for them to be released
+ */
+void close_event_bus(struct _benoic_event_bus * bus) {
+  struct timespec deadline;
+  int i, res = 0;
+  size_t j;
+  
+  pthread_mutex_lock(&bus->lock);
+  bus->closed = 1;
+  for (j=0; j<bus->journal_count; j++) {
+    free_journal_entry(&bus->journal[(bus->journal_start + j) % bus->journal_size]);
+  }
+  o_free(bus->journal);
+  bus->journal = NULL;
+  bus->journal_count = 0;
+  for (i=0; bus->subscriber_list != NULL && bus->subscriber_list[i] != NULL; i++) {
+    pthread_mutex_lock(&bus->subscriber_list[i]->lock);
+    bus->subscriber_list[i]->closed = 1;
+    pthread_cond_signal(&bus->subscriber_list[i]->cond);
+    pthread_mutex_unlock(&bus->subscriber_list[i]->lock);
+  }
+  
+  // Streams end on their next call, the webservice then releases them
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += BENOIC_STREAM_CLOSE_TIMEOUT;
+  while (bus->nb_subscribers > 0 && res != ETIMEDOUT) {
+    res = pthread_cond_timedwait(&bus->cond, &bus->lock, &deadline);
+  }
+  if (bus->nb_subscribers > 0) {
+    y_log_message(Y_LOG_LEVEL_WARNING, "close_event_bus - %zu stream(s) still open", bus->nb_subscribers);
+    pthread_mutex_unlock(&bus->lock);
+  } else {
+    o_free(bus->subscriber_list);
+    bus->subscriber_list = NULL;
+    pthread_mutex_unlock(&bus->lock);
+    pthread_mutex_destroy(&bus->lock);
+    pthread_cond_destroy(&bus->cond);
+  }
+}
+
+/**
+ * Free the content of a journal entry
+ */
+void free_journal_entry(struct _benoic_journal_entry * entry) {
+  o_free(entry->event);
+  o_free(entry->device_name);
+  json_decref(entry->data);
+}
+
+/**
+ * Free a subscriber and its queued events
+ */
+void free_event_subscriber(struct _benoic_event_subscriber * subscriber) {
+  size_t i;
+  
+  if (subscriber != NULL) {
+    for (i=0; i<subscriber->queue_count; i++) {
+      o_free(subscriber->queue[(subscriber->queue_start + i) % subscriber->queue_size]);
+    }
+    o_free(subscriber->queue);
+    o_free(subscriber->pending);
+    o_free(subscriber->device_name);
+    pthread_mutex_destroy(&subscriber->lock);
+    pthread_cond_destroy(&subscriber->cond);
+    o_free(subscriber);
+  }
+}
+
+/**
+ * Create a new subscriber and add it to the bus
+ * device_name is optional, if set only the events of this device are sent to the subscriber
+ * return NULL if the bus is closed or full
+ */
+struct _benoic_event_subscriber * add_event_subscriber(struct _benoic_event_bus * bus, const char * device_name) {
+  struct _benoic_event_subscriber * subscriber;
+  struct _benoic_event_subscriber ** subscriber_list;
+  
+  pthread_mutex_lock(&bus->lock);
+  if (bus->closed || bus->nb_subscribers >= bus->max_subscribers) {
+    pthread_mutex_unlock(&bus->lock);
+    return NULL;
+  }
+  
+  subscriber = o_malloc(sizeof(struct _benoic_event_subscriber));
+  if (subscriber == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "add_event_subscriber - Error allocating resources for subscriber");
+    pthread_mutex_unlock(&bus->lock);
+    return NULL;
+  }
+  subscriber->bus = bus;
+  subscriber->device_name = o_strdup(device_name);
+  subscriber->queue = o_malloc(bus->queue_size * sizeof(char *));
+  subscriber->queue_size = bus->queue_size;
+  subscriber->queue_start = 0;
+  subscriber->queue_count = 0;
+  subscriber->pending = NULL;
+  subscriber->pending_offset = 0;
+  subscriber->heartbeat = bus->heartbeat;
+  subscriber->overflow = 0;
+  subscriber->closed = 0;
+  pthread_mutex_init(&subscriber->lock, NULL);
+  pthread_cond_init(&subscriber->cond, NULL);
+  
+  subscriber_list = o_realloc(bus->subscriber_list, (bus->nb_subscribers + 2) * sizeof(struct _benoic_event_subscriber *));
+  if (subscriber->queue == NULL || subscriber_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "add_event_subscriber - Error allocating resources for subscriber_list");
+    if (subscriber_list != NULL) {
+      bus->subscriber_list = subscriber_list;
+    }
+    pthread_mutex_unlock(&bus->lock);
+    free_event_subscriber(subscriber);
+    return NULL;
+  }
+  bus->subscriber_list = subscriber_list;
+  bus->subscriber_list[bus->nb_subscribers] = subscriber;
+  bus->subscriber_list[bus->nb_subscribers + 1] = NULL;
+  bus->nb_subscribers++;
+  pthread_mutex_unlock(&bus->lock);
+  return subscriber;
+}
+
+/**
+ * Remove the subscriber from the bus and free it
+ * Used as the stream free callback
+ */
+void remove_event_subscriber(void * cls) {
+  struct _benoic_event_subscriber * subscriber = (struct _benoic_event_subscriber *)cls;
+  struct _benoic_event_bus * bus = subscriber->bus;
+  size_t i;
+  
+  pthread_mutex_lock(&bus->lock);
+  for (i=0; i<bus->nb_subscribers; i++) {
+    if (bus->subscriber_list[i] == subscriber) {
+      // Keep the list NULL-terminated
+      bus->subscriber_list[i] = bus->subscriber_list[bus->nb_subscribers - 1];
+      bus->subscriber_list[bus->nb_subscribers - 1] = NULL;
+      bus->nb_subscribers--;
+      break;
+    }
+  }
+  pthread_cond_signal(&bus->cond);
+  pthread_mutex_unlock(&bus->lock);
+  free_event_subscriber(subscriber);
+}
+
+/**
+ * Send an event to all the subscribers
+ * data is serialized once, it's not stolen
+ * If a subscriber queue is full, its oldest event is dropped and it will receive a resync event
+ * If journaled is true, the event is added to the changes journal, the oldest change is dropped if the journal is full
+ */
+int publish_event(struct _benoic_config * config, const char * event, const char * device_name, json_t * data, const int journaled) {
+  struct _benoic_event_bus * bus;
+  struct _benoic_event_subscriber * subscriber;
+  struct _benoic_journal_entry * entry;
+  char * str_data, * message;
+  size_t i, index;
+  
+  if (config == NULL || event == NULL || data == NULL) {
+    return B_ERROR_PARAM;
+  }
+  bus = &config->event_bus;
+  
+  pthread_mutex_lock(&bus->lock);
+  if (bus->closed) {
+    pthread_mutex_unlock(&bus->lock);
+    return B_OK;
+  }
+  if (journaled) {
+    if (bus->journal_count == bus->journal_size) {
+      free_journal_entry(&bus->journal[bus->journal_start]);
+      bus->journal_start = (bus->journal_start + 1) % bus->journal_size;
+      bus->journal_count--;
+    }
+    entry = &bus->journal[(bus->journal_start + bus->journal_count) % bus->journal_size];
+    entry->seq = ++bus->last_seq;
+    entry->date = time(NULL);
+    entry->event = o_strdup(event);
+    entry->device_name = o_strdup(device_name);
+    entry->data = json_deep_copy(data);
+    bus->journal_count++;
+  }
+  if (bus->nb_subscribers == 0) {
+    pthread_mutex_unlock(&bus->lock);
+    return B_OK;
+  }
+  str_data = json_dumps(data, JSON_COMPACT);
+  if (journaled) {
+    // The id can be used with the changes endpoint to get the changes missed after a disconnection
+    message = msprintf("id: %" JSON_INTEGER_FORMAT "\nevent: %s\ndata: %s\n\n", bus->last_seq, event, str_data);
+  } else {
+    message = msprintf("event: %s\ndata: %s\n\n", event, str_data);
+  }
+  o_free(str_data);
+  if (message == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "publish_event - Error allocating resources for message");
+    pthread_mutex_unlock(&bus->lock);
+    return B_ERROR_MEMORY;
+  }
+  for (i=0; i<bus->nb_subscribers; i++) {
+    subscriber = bus->subscriber_list[i];
+    if (subscriber->device_name != NULL && device_name != NULL && 0 != o_strcmp(subscriber->device_name, device_name)) {
+      continue;
+    }
+    pthread_mutex_lock(&subscriber->lock);
+    if (subscriber->queue_count == subscriber->queue_size) {
+      // Slow subscriber, drop the oldest event
+      o_free(subscriber->queue[subscriber->queue_start]);
+      subscriber->queue_start = (subscriber->queue_start + 1) % subscriber->queue_size;
+      subscriber->queue_count--;
+      subscriber->overflow = 1;
+    }
+    index = (subscriber->queue_start + subscriber->queue_count) % subscriber->queue_size;
+    subscriber->queue[index] = o_strdup(message);
+    subscriber->queue_count++;
+    pthread_cond_signal(&subscriber->cond);
+    pthread_mutex_unlock(&subscriber->lock);
+  }
+  pthread_mutex_unlock(&bus->lock);
+  o_free(message);
+  return B_OK;
+}
+
+/**
+ * Stream callback for a subscriber
+ * Wait for the next event and send it, send a heartbeat comment if nothing happens
+ */
+ssize_t stream_event_subscriber(void * cls, uint64_t offset, char * out_buf, size_t max) {
+  struct _benoic_event_subscriber * subscriber = (struct _benoic_event_subscriber *)cls;
+  struct timespec deadline;
+  size_t len;
+  int res;
+  
+  UNUSED(offset);
+  pthread_mutex_lock(&subscriber->lock);
+  if (subscriber->pending == NULL) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += subscriber->heartbeat;
+    while (subscriber->pending == NULL) {
+      if (subscriber->closed) {
+        pthread_mutex_unlock(&subscriber->lock);
+        return U_STREAM_END;
+      } else if (subscriber->overflow) {
+        // Some events were lost, the client must reload its state
+        subscriber->overflow = 0;
+        subscriber->pending = o_strdup("event: resync\ndata: {}\n\n");
+      } else if (subscriber->queue_count > 0) {
+        subscriber->pending = subscriber->queue[subscriber->queue_start];
+        subscriber->queue_start = (subscriber->queue_start + 1) % subscriber->queue_size;
+        subscriber->queue_count--;
+      } else {
+        res = pthread_cond_timedwait(&subscriber->cond, &subscriber->lock, &deadline);
+        if (res == ETIMEDOUT) {
+          subscriber->pending = o_strdup(": heartbeat\n\n");
+        }
+      }
+    }
+    subscriber->pending_offset = 0;
+  }
+  
+  len = strlen(subscriber->pending + subscriber->pending_offset);
+  if (len > max) {
+    len = max;
+  }
+  memcpy(out_buf, subscriber->pending + subscriber->pending_offset, len);
+  subscriber->pending_offset += len;
+  if (subscriber->pending[subscriber->pending_offset] == '\0') {
+    o_free(subscriber->pending);
+    subscriber->pending = NULL;
+  }
+  pthread_mutex_unlock(&subscriber->lock);
+  return len;
+}
+
+/**
+ * Publish the new value of an element
+ */
+void publish_element_value(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, json_t * value) {
+  json_t * j_event = json_pack("{ssssss}", "device", device_name, "type", element_type_to_string(element_type), "name", element_name);
+  
+  if (j_event != NULL) {
+    if (json_is_object(value)) {
+      // Send the fields of the value, e.g. mode, command and on for a heater
+      json_object_update(j_event, value);
+    }
+    publish_event(config, "value", device_name, j_event, 1);
+    json_decref(j_event);
+  }
+}
+
+/**
+ * Publish the connection status of a device
+ */
+void publish_device_connection(struct _benoic_config * config, const char * device_name, const int connected) {
+  json_t * j_event = json_pack("{sssb}", "device", device_name, "connected", connected);
+  
+  if (j_event != NULL) {
+    publish_event(config, "device", device_name, j_event, 1);
+    json_decref(j_event);
+  }
+}
+
+/**
+ * Callback given to the modules to publish an alert sent by a device
+ */
+int device_alert(void * cls, const char * device_name, const char * source, const char * message) {
+  json_t * j_event;
+  
+  if (cls == NULL || device_name == NULL) {
+    return B_ERROR_PARAM;
+  }
+  j_event = json_pack("{ssssss}", "device", device_name, "source", source!=NULL?source:"", "message", message!=NULL?message:"");
+  if (j_event == NULL) {
+    return B_ERROR_MEMORY;
+  }
+  publish_event((struct _benoic_config *)cls, "alert", device_name, j_event, 0);
+  json_decref(j_event);
+  return B_OK;
+}
+
+/**
+ * Return the changes journaled after the sequence since
+ * device_name is optional, if set only the changes of this device are returned
+ * If the changes after since are not in the journal anymore, resync is true and the changes list is empty,
+ * the client must reload the state of the devices, then use the returned seq value
+ * returned value must be free'd after use
+ */
+json_t * get_changes_since(struct _benoic_config * config, const json_int_t since, const char * device_name) {
+  struct _benoic_event_bus * bus = &config->event_bus;
+  struct _benoic_journal_entry * entry;
+  json_t * j_changes = json_array(), * to_return;
+  json_int_t first_seq;
+  size_t i;
+  int resync = 0;
+  
+  if (j_changes == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_changes_since - Error allocating resources for j_changes");
+    return NULL;
+  }
+  
+  pthread_mutex_lock(&bus->lock);
+  first_seq = bus->journal_count>0?bus->journal[bus->journal_start].seq:(bus->last_seq + 1);
+  if (since < first_seq - 1 || since > bus->last_seq) {
+    // The client missed changes that are not in the journal anymore, or it comes from a previous run
+    resync = 1;
+  } else {
+    for (i=(size_t)(since - first_seq + 1); i<bus->journal_count; i++) {
+      entry = &bus->journal[(bus->journal_start + i) % bus->journal_size];
+      if (device_name == NULL || 0 == o_strcmp(device_name, entry->device_name)) {
+        json_array_append_new(j_changes, json_pack("{sIsIsssO}", "seq", entry->seq, "date", (json_int_t)entry->date, "event", entry->event, "data", entry->data));
+      }
+    }
+  }
+  to_return = json_pack("{sIsbso}", "seq", bus->last_seq, "resync", resync, "changes", j_changes);
+  pthread_mutex_unlock(&bus->lock);
+  return to_return;
+}
@@ -0,0 +1,320 @@
+/**
+ *
+ * Benoic House Automation service
+ *
+ * Command house automation devices via an HTTP REST interface
+ *
+ * Asynchronous commands functions
+ *
+ * Copyright 2016 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "benoic.h"
+
+/**
+ * Initialize the jobs queue and start the workers
+ */
+int init_job_queue(struct _benoic_config * config) {
+  struct _benoic_job_queue * queue = &config->job_queue;
+  int i;
+  
+  queue->config = config;
+  if (pthread_mutex_init(&queue->lock, NULL) || pthread_cond_init(&queue->cond, NULL)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "init_job_queue - Error initializing lock");
+    return B_ERROR;
+  }
+  if (queue->nb_workers <= 0) {
+    queue->nb_workers = BENOIC_JOB_DEFAULT_WORKERS;
+  }
+  if (queue->max_jobs == 0) {
+    queue->max_jobs = BENOIC_JOB_DEFAULT_MAX;
+  }
+  queue->job_list = o_malloc(sizeof(struct _benoic_job *));
+  queue->worker_list = o_malloc(queue->nb_workers * sizeof(pthread_t));
+  if (queue->job_list == NULL || queue->worker_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "init_job_queue - Error allocating resources");
+    o_free(queue->job_list);
+    o_free(queue->worker_list);
+    return B_ERROR_MEMORY;
+  }
+  queue->job_list[0] = NULL;
+  queue->nb_jobs = 0;
+  queue->last_id = 0;
+  queue->closed = 0;
+  
+  for (i=0; i<queue->nb_workers; i++) {
+    if (pthread_create(&queue->worker_list[i], NULL, thread_job_worker_run, (void *)queue)) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "init_job_queue - Error creating worker %d", i);
+      queue->nb_workers = i;
+      close_job_queue(queue);
+      return B_ERROR;
+    }
+  }
+  return B_OK;
+}
+
+/**
+ * Stop the workers and free the jobs
+ * Running commands are finished before the workers stop, pending ones are dropped
+ */
+void close_job_queue(struct _benoic_job_queue * queue) {
+  size_t i;
+  int j;
+  
+  pthread_mutex_lock(&queue->lock);
+  queue->closed = 1;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->lock);
+  
+  for (j=0; j<queue->nb_workers; j++) {
+    pthread_join(queue->worker_list[j], NULL);
+  }
+  o_free(queue->worker_list);
+  queue->worker_list = NULL;
+  
+  for (i=0; i<queue->nb_jobs; i++) {
+    free_job(queue->job_list[i]);
+  }
+  o_free(queue->job_list);
+  queue->job_list = NULL;
+  queue->nb_jobs = 0;
+  pthread_mutex_destroy(&queue->lock);
+  pthread_cond_destroy(&queue->cond);
+}
+
+/**
+ * Free a job
+ */
+void free_job(struct _benoic_job * job) {
+  if (job != NULL) {
+    json_decref(job->device);
+    o_free(job->element_name);
+    o_free(job->command);
+    o_free(job->mode);
+    json_decref(job->result);
+    o_free(job);
+  }
+}
+
+/**
+ * Return the json representation of the job
+ * returned value must be free'd after use
+ */
+json_t * job_to_json(struct _benoic_job * job) {
+  json_t * to_return = json_pack("{sIsssssssssIsI}",
+                                 "id", job->id,
+                                 "status", job->status==BENOIC_JOB_STATUS_PENDING?"pending":(job->status==BENOIC_JOB_STATUS_RUNNING?"running":"done"),
+                                 "device", json_string_value(json_object_get(job->device, "name")),
+                                 "element_type", element_type_to_string(job->element_type),
+                                 "element_name", job->element_name,
+                                 "command", job->command,
+                                 "created", (json_int_t)job->created,
+                                 "done_date", (json_int_t)job->done_date);
+  
+  if (to_return != NULL) {
+    if (job->mode != NULL) {
+      json_object_set_new(to_return, "mode", json_string(job->mode));
+    }
+    if (job->result != NULL) {
+      json_object_set(to_return, "result", job->result);
+    }
+  }
+  return to_return;
+}
+
+/**
+ * Add a new command to the queue
+ * Finished jobs older than BENOIC_JOB_RETENTION seconds are removed
+ * A pending job of the same element is superseded by the new one: it's done without being run,
+ * with the result superseded, and its job event is published
+ * If max_pending isn't 0, the device can't have more than max_pending jobs not run yet
+ * return the id of the new job, 0 if the queue is full, -1 if the device has too many pending jobs
+ */
+json_int_t add_job(struct _benoic_job_queue * queue, json_t * device, const int element_type, const char * element_name, const char * command, const char * mode, const size_t max_pending) {
+  struct _benoic_job * job, ** job_list;
+  json_t * j_superseded_list = json_array(), * j_event;
+  time_t now;
+  size_t i, j, nb_pending = 0;
+  json_int_t id;
+  
+  time(&now);
+  pthread_mutex_lock(&queue->lock);
+  for (i=0, j=0; i<queue->nb_jobs; i++) {
+    if (queue->job_list[i]->status == BENOIC_JOB_STATUS_DONE && queue->job_list[i]->done_date + BENOIC_JOB_RETENTION < now) {
+      free_job(queue->job_list[i]);
+    } else {
+      queue->job_list[j++] = queue->job_list[i];
+    }
+  }
+  queue->nb_jobs = j;
+  queue->job_list[queue->nb_jobs] = NULL;
+  
+  if (queue->closed || queue->nb_jobs >= queue->max_jobs || j_superseded_list == NULL) {
+    pthread_mutex_unlock(&queue->lock);
+    json_decref(j_superseded_list);
+    return 0;
+  }
+  
+  // The pending jobs of the same element don't count, they're superseded by the new one
+  for (i=0; i<queue->nb_jobs; i++) {
+    if (queue->job_list[i]->status == BENOIC_JOB_STATUS_PENDING && 
+        0 == o_strcmp(json_string_value(json_object_get(queue->job_list[i]->device, "name")), json_string_value(json_object_get(device, "name"))) &&
+        !is_job_element(queue->job_list[i], element_type, element_name)) {
+      nb_pending++;
+    }
+  }
+  if (max_pending > 0 && nb_pending >= max_pending) {
+    pthread_mutex_unlock(&queue->lock);
+    json_decref(j_superseded_list);
+    return -1;
+  }
+  
+  job = o_malloc(sizeof(struct _benoic_job));
+  job_list = o_realloc(queue->job_list, (queue->nb_jobs + 2) * sizeof(struct _benoic_job *));
+  if (job == NULL || job_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "add_job - Error allocating resources for job");
+    if (job_list != NULL) {
+      queue->job_list = job_list;
+    }
+    o_free(job);
+    pthread_mutex_unlock(&queue->lock);
+    json_decref(j_superseded_list);
+    return 0;
+  }
+  queue->job_list = job_list;
+  
+  for (i=0; i<queue->nb_jobs; i++) {
+    if (queue->job_list[i]->status == BENOIC_JOB_STATUS_PENDING && 
+        0 == o_strcmp(json_string_value(json_object_get(queue->job_list[i]->device, "name")), json_string_value(json_object_get(device, "name"))) &&
+        is_job_element(queue->job_list[i], element_type, element_name)) {
+      queue->job_list[i]->result = json_pack("{sisb}", "status", 200, "superseded", 1);
+      queue->job_list[i]->status = BENOIC_JOB_STATUS_DONE;
+      queue->job_list[i]->done_date = now;
+      json_array_append_new(j_superseded_list, job_to_json(queue->job_list[i]));
+    }
+  }
+
+  job->id = ++queue->last_id;
+  job->status = BENOIC_JOB_STATUS_PENDING;
+  job->device = json_deep_copy(device);
+  job->element_type = element_type;
+  job->element_name = o_strdup(element_name);
+  job->command = o_strdup(command);
+  job->mode = o_strdup(mode);
+  job->result = NULL;
+  job->created = now;
+  job->done_date = 0;
+  queue->job_list[queue->nb_jobs] = job;
+  queue->job_list[queue->nb_jobs + 1] = NULL;
+  queue->nb_jobs++;
+  id = job->id;
+  pthread_cond_signal(&queue->cond);
+  pthread_mutex_unlock(&queue->lock);
+  
+  json_array_foreach(j_superseded_list, i, j_event) {
+    publish_event(queue->config, "job", json_string_value(json_object_get(j_event, "device")), j_event, 0);
+  }
+  json_decref(j_superseded_list);
+  return id;
+}
+
+/**
+ * Check if the job is a command to the element
+ */
+int is_job_element(struct _benoic_job * job, const int element_type, const char * element_name) {
+  return job->element_type == element_type && 0 == o_strcmp(job->element_name, element_name);
+}
+
+/**
+ * Return the json representation of the job id
+ * return NULL if the job doesn't exist
+ * returned value must be free'd after use
+ */
+json_t * get_job(struct _benoic_job_queue * queue, const json_int_t id) {
+  json_t * to_return = NULL;
+  size_t i;
+  
+  pthread_mutex_lock(&queue->lock);
+  for (i=0; i<queue->nb_jobs; i++) {
+    if (queue->job_list[i]->id == id) {
+      to_return = job_to_json(queue->job_list[i]);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return to_return;
+}
+
+/**
+ * Worker thread, run the pending jobs in the order they were added
+ */
+void * thread_job_worker_run(void * args) {
+  struct _benoic_job_queue * queue = (struct _benoic_job_queue *)args;
+  struct _benoic_job * job;
+  json_t * result, * j_event;
+  size_t i, j;
+  int res;
+  
+  pthread_mutex_lock(&queue->lock);
+  while (!queue->closed) {
+    job = NULL;
+    for (i=0; i<queue->nb_jobs && job == NULL; i++) {
+      if (queue->job_list[i]->status == BENOIC_JOB_STATUS_PENDING) {
+        job = queue->job_list[i];
+        // Commands sent to the same device are run one at a time, in order
+        for (j=0; j<i; j++) {
+          if (queue->job_list[j]->status != BENOIC_JOB_STATUS_DONE && 
+              0 == o_strcmp(json_string_value(json_object_get(queue->job_list[j]->device, "name")), json_string_value(json_object_get(job->device, "name")))) {
+            job = NULL;
+            break;
+          }
+        }
+      }
+    }
+    if (job == NULL) {
+      pthread_cond_wait(&queue->cond, &queue->lock);
+    } else {
+      // The job can't be removed while it's running, so it's safe to use it without the lock
+      // The command enters the queue of the device when it's run, the previous jobs of the device are done by then
+      job->status = BENOIC_JOB_STATUS_RUNNING;
+      pthread_mutex_unlock(&queue->lock);
+      // The job waits for a slot of the device like a direct command, without timeout
+      res = device_slot_acquire(queue->config, job->device, NULL);
+      if (res == B_OK) {
+        result = device_send_command(queue->config, job->device, job->element_type, job->element_name, job->command, job->mode, 0);
+        device_slot_release(queue->config, job->device);
+      } else if (res == B_ERROR_BUSY) {
+        result = json_pack("{siss}", "status", 429, "error", "too many requests");
+      } else {
+        result = json_pack("{si}", "status", 500);
+      }
+      pthread_mutex_lock(&queue->lock);
+      job->result = result;
+      job->status = BENOIC_JOB_STATUS_DONE;
+      time(&job->done_date);
+      // Next command of the same device can be run now
+      pthread_cond_broadcast(&queue->cond);
+      j_event = job_to_json(job);
+      pthread_mutex_unlock(&queue->lock);
+      publish_event(queue->config, "job", json_string_value(json_object_get(j_event, "device")), j_event, 0);
+      json_decref(j_event);
+      pthread_mutex_lock(&queue->lock);
+    }
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return NULL;
+}
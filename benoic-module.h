@@ -0,0 +1,181 @@
+/**
+ *
+ * Benoic House Automation service
+ *
+ * Command house automation devices via an HTTP REST interface
+ *
+ * Device modules interface
+ * Declarations shared by benoic and the device modules
+ *
+ * Copyright 2016 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BENOIC_MODULE_H_
+#define __BENOIC_MODULE_H_
+
+#include <stddef.h>
+#include <time.h>
+#include <jansson.h>
+
+// Version of the modules interface described by struct _b_device_module
+#define BENOIC_MODULE_ABI_VERSION 3
+
+// Oldest version of struct _b_device_module still accepted, the fields added since are not used
+#define BENOIC_MODULE_ABI_VERSION_MIN 2
+
+// Name of the symbol exported by the modules using struct _b_device_module
+#define BENOIC_MODULE_DESCRIPTOR "b_device_module_descriptor"
+
+// Concurrency contract declared by the module with the value concurrency of the type handshake
+#define BENOIC_MODULE_CONCURRENCY_THREAD_SAFE "thread_safe" // the module can be called from many threads at once
+#define BENOIC_MODULE_CONCURRENCY_DEVICE      "device"      // calls for the same device must not overlap
+#define BENOIC_MODULE_CONCURRENCY_MODULE      "module"      // calls to the module must not overlap, the default
+
+#define DEVICE_RESULT_ERROR     0
+#define DEVICE_RESULT_OK        1
+#define DEVICE_RESULT_NOT_FOUND 2
+#define DEVICE_RESULT_TIMEOUT   3
+#define DEVICE_RESULT_PARAM     4
+
+#define BENOIC_ELEMENT_TYPE_NONE   0
+#define BENOIC_ELEMENT_TYPE_SENSOR 1
+#define BENOIC_ELEMENT_TYPE_SWITCH 2
+#define BENOIC_ELEMENT_TYPE_DIMMER 3
+#define BENOIC_ELEMENT_TYPE_HEATER 4
+
+// Element value types
+#define BENOIC_VALUE_NONE    0
+#define BENOIC_VALUE_INTEGER 1
+#define BENOIC_VALUE_DOUBLE  2
+#define BENOIC_VALUE_STRING  3
+
+#define BENOIC_VALUE_STRING_LENGTH 64
+#define BENOIC_HEATER_MODE_LENGTH  16
+
+/**
+ * Callback given to the modules to push element value changes
+ * value is the new value of the element, timestamp is the date of the change
+ */
+typedef int (* b_device_value_callback) (void * cls, const char * device_name, const int element_type, const char * element_name, json_t * value, time_t timestamp);
+
+/**
+ * Callback given to the modules to push alerts sent by the devices
+ */
+typedef int (* b_device_alert_callback) (void * cls, const char * device_name, const char * source, const char * message);
+
+/**
+ * Result of a get or a set on an element
+ * result is a DEVICE_RESULT_* value
+ * value_type tells which of integer_value, double_value or string_value is set
+ * Switches and dimmers values are integers, sensors values can be of any type
+ * Heaters command is set in double_value, mode and on are only used for heaters
+ * extra is optional, it contains additional properties of the element like a sensor unit,
+ * it's free'd by benoic after use
+ */
+struct _b_element_result {
+  int        result;
+  int        value_type;
+  json_int_t integer_value;
+  double     double_value;
+  char       string_value[BENOIC_VALUE_STRING_LENGTH + 1];
+  char       mode[BENOIC_HEATER_MODE_LENGTH + 1];
+  int        on;
+  json_t   * extra;
+};
+
+/**
+ * Command to send to an element
+ * command is used for switches (-1, 0 or 1) and dimmers (0 to 101)
+ * heater_command and mode are used for heaters, mode is NULL to keep the current mode
+ */
+struct _b_element_command {
+  int          element_type;
+  const char * element_name;
+  int          command;
+  float        heater_command;
+  const char * mode;
+};
+
+/**
+ * Element of a batch get, the module fills result for each element
+ */
+struct _b_element_get {
+  int                      element_type;
+  const char             * element_name;
+  struct _b_element_result result;
+};
+
+/**
+ * Element of a batch set, the module fills result for each command
+ */
+struct _b_element_set {
+  struct _b_element_command command;
+  struct _b_element_result  result;
+};
+
+/**
+ * Callback given to the asynchronous element functions of a module
+ * It must be called exactly once with the result of the operation, from any thread,
+ * possibly before the asynchronous function returns
+ * cls is the value given to the asynchronous function, result->extra is free'd by benoic
+ */
+typedef void (* b_element_completion_callback) (void * cls, struct _b_element_result * result);
+
+/**
+ * Callback given to the asynchronous overview function of a module
+ * overview is the value the synchronous overview function would return, it's free'd by benoic
+ */
+typedef void (* b_overview_completion_callback) (void * cls, json_t * overview);
+
+/**
+ * Description of a module, exported by the module as
+ * const struct _b_device_module b_device_module_descriptor
+ * abi_version must be set to BENOIC_MODULE_ABI_VERSION
+ * get_elements, set_elements, set_value_callback and set_alert_callback are optional and can be NULL,
+ * all the other functions are mandatory
+ * get_element, set_element and ping return a DEVICE_RESULT_* value
+ * get_elements and set_elements return DEVICE_RESULT_OK if the result of each element is set
+ * 
+ * get_element_async, set_element_async and overview_async are optional, they were added in the version 3.
+ * They start the operation and return DEVICE_RESULT_OK, the callback is then called when it's complete,
+ * any other value means the operation wasn't started and the callback won't be called,
+ * benoic then uses the synchronous function.
+ * device and command are only valid during the call, the module must copy what it needs afterwards
+ */
+struct _b_device_module {
+  unsigned int abi_version;
+  
+  json_t * (* type_init) ();
+  json_t * (* connect) (json_t * device, void ** device_ptr);
+  json_t * (* disconnect) (json_t * device, void * device_ptr);
+  int      (* ping) (json_t * device, void * device_ptr);
+  json_t * (* overview) (json_t * device, void * device_ptr);
+  int      (* has_element) (json_t * device, int element_type, const char * element_name, void * device_ptr);
+  int      (* get_element) (json_t * device, const int element_type, const char * element_name, struct _b_element_result * result, void * device_ptr);
+  int      (* set_element) (json_t * device, const struct _b_element_command * command, struct _b_element_result * result, void * device_ptr);
+  
+  int      (* get_elements) (json_t * device, struct _b_element_get * element_list, size_t nb_elements, void * device_ptr);
+  int      (* set_elements) (json_t * device, struct _b_element_set * element_list, size_t nb_elements, void * device_ptr);
+  void     (* set_value_callback) (b_device_value_callback callback, void * cls);
+  void     (* set_alert_callback) (b_device_alert_callback callback, void * cls);
+  
+  int      (* get_element_async) (json_t * device, const int element_type, const char * element_name, b_element_completion_callback callback, void * cls, void * device_ptr);
+  int      (* set_element_async) (json_t * device, const struct _b_element_command * command, b_element_completion_callback callback, void * cls, void * device_ptr);
+  int      (* overview_async) (json_t * device, b_overview_completion_callback callback, void * cls, void * device_ptr);
+};
+
+#endif
@@ -27,6 +27,9 @@
 #include <getopt.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include "benoic.h"
 
@@ -40,13 +43,29 @@
 #define BENOIC_DEFAULT_PREFIX "benoic"
 #define BENOIC_DEFAULT_PORT   2642
 
+// HTTP server threading model
+#define BENOIC_HTTP_THREAD_DEFAULT        0
+#define BENOIC_HTTP_THREAD_PER_CONNECTION 1
+#define BENOIC_HTTP_THREAD_POOL           2
+
+#define BENOIC_DEFAULT_HTTP_THREAD_POOL_SIZE 16
+
 struct config_elements {
   char *                  config_file;
   char *                  url_prefix;
   unsigned long           log_mode;
   unsigned long           log_level;
   char *                  log_file;
+  int                     http_thread_model;
+  unsigned int            http_thread_pool_size;
+  unsigned int            http_max_connections;
+  unsigned int            http_max_connections_per_ip;
+  unsigned int            http_connection_timeout;
+  char *                  unix_socket_path;
+  mode_t                  unix_socket_mode;
+  int                     unix_socket_only;
   struct _u_instance    * instance;
+  struct _u_instance    * unix_instance;
   struct _benoic_config * b_config;
 };
 
@@ -55,6 +74,10 @@ int global_handler_variable;
 int  build_config_from_args(int argc, char ** argv, struct config_elements * config);
 int  build_config_from_file(struct config_elements * config);
 int  check_config(struct config_elements * config);
+int  parse_http_thread_model(const char * value);
+int  start_http_server(struct config_elements * config, struct _u_instance * instance, const int listen_socket);
+int  open_unix_socket(const char * path, const mode_t mode);
+int  start_unix_socket_server(struct config_elements * config);
 void exit_handler(int handler);
 void exit_server(struct config_elements ** config, int exit_value);
 void print_help(FILE * output);
@@ -66,7 +89,7 @@ int callback_default (const struct _u_request * request, struct _u_response * re
  */
 int build_config_from_args(int argc, char ** argv, struct config_elements * config) {
   int next_option;
-  const char * short_options = "c::p::b::u::d::a::s::m::l::f::r::h::";
+  const char * short_options = "c::p::b::u::d::a::s::m::l::f::r::h::t::n::x::i::w::k::";
   char * tmp = NULL, * to_free = NULL, * one_log_mode = NULL;
   static const struct option long_options[]= {
     {"config-file", optional_argument,NULL, 'c'},
@@ -77,6 +100,12 @@ int build_config_from_args(int argc, char ** argv, struct config_elements * conf
     {"log-file", optional_argument,NULL, 'f'},
     {"help", optional_argument,NULL, 'h'},
     {"modules-path", optional_argument,NULL, 'o'},
+    {"http-thread-model", optional_argument,NULL, 't'},
+    {"http-thread-pool-size", optional_argument,NULL, 'n'},
+    {"http-max-connections", optional_argument,NULL, 'x'},
+    {"http-max-connections-per-ip", optional_argument,NULL, 'i'},
+    {"http-connection-timeout", optional_argument,NULL, 'w'},
+    {"unix-socket", optional_argument,NULL, 'k'},
     {NULL, 0, NULL, 0}
   };
   
@@ -183,6 +212,62 @@ int build_config_from_args(int argc, char ** argv, struct config_elements * conf
             return 0;
           }
           break;
+        case 't':
+          if (optarg != NULL) {
+            config->http_thread_model = parse_http_thread_model(optarg);
+            if (config->http_thread_model == BENOIC_HTTP_THREAD_DEFAULT) {
+              fprintf(stderr, "Error!\nInvalid HTTP thread model\n\tPlease specify connection or pool\n");
+              return 0;
+            }
+          } else {
+            fprintf(stderr, "Error!\nNo HTTP thread model specified\n");
+            return 0;
+          }
+          break;
+        case 'n':
+          if (optarg != NULL && strtol(optarg, NULL, 10) > 0) {
+            config->http_thread_pool_size = strtol(optarg, NULL, 10);
+          } else {
+            fprintf(stderr, "Error!\nInvalid HTTP thread pool size\n");
+            return 0;
+          }
+          break;
+        case 'x':
+          if (optarg != NULL && strtol(optarg, NULL, 10) > 0) {
+            config->http_max_connections = strtol(optarg, NULL, 10);
+          } else {
+            fprintf(stderr, "Error!\nInvalid HTTP max connections\n");
+            return 0;
+          }
+          break;
+        case 'i':
+          if (optarg != NULL && strtol(optarg, NULL, 10) > 0) {
+            config->http_max_connections_per_ip = strtol(optarg, NULL, 10);
+          } else {
+            fprintf(stderr, "Error!\nInvalid HTTP max connections per IP address\n");
+            return 0;
+          }
+          break;
+        case 'w':
+          if (optarg != NULL && strtol(optarg, NULL, 10) > 0) {
+            config->http_connection_timeout = strtol(optarg, NULL, 10);
+          } else {
+            fprintf(stderr, "Error!\nInvalid HTTP connection timeout\n");
+            return 0;
+          }
+          break;
+        case 'k':
+          if (optarg != NULL) {
+            config->unix_socket_path = o_strdup(optarg);
+            if (config->unix_socket_path == NULL) {
+              fprintf(stderr, "Error allocating config->unix_socket_path, exiting\n");
+              exit_server(&config, BENOIC_STOP);
+            }
+          } else {
+            fprintf(stderr, "Error!\nNo unix socket path specified\n");
+            return 0;
+          }
+          break;
         case 'h':
           exit_server(&config, BENOIC_STOP);
           break;
@@ -228,6 +313,21 @@ void print_help(FILE * output) {
   fprintf(output, "\tdefault: ERROR\n");
   fprintf(output, "-f --log-file=PATH\n");
   fprintf(output, "\tPath for log file if log mode file is specified\n");
+  fprintf(output, "-t --http-thread-model=MODEL\n");
+  fprintf(output, "\tThreading model of the HTTP server\n");
+  fprintf(output, "\tconnection: one thread per connection, pool: fixed pool of threads\n");
+  fprintf(output, "\tdefault: connection\n");
+  fprintf(output, "-n --http-thread-pool-size=SIZE\n");
+  fprintf(output, "\tNumber of threads in the pool if the thread model is pool\n");
+  fprintf(output, "\tdefault: %d\n", BENOIC_DEFAULT_HTTP_THREAD_POOL_SIZE);
+  fprintf(output, "-x --http-max-connections=NUMBER\n");
+  fprintf(output, "\tMaximum number of concurrent connections\n");
+  fprintf(output, "-i --http-max-connections-per-ip=NUMBER\n");
+  fprintf(output, "\tMaximum number of concurrent connections from the same IP address\n");
+  fprintf(output, "-w --http-connection-timeout=SECONDS\n");
+  fprintf(output, "\tTimeout of an inactive connection\n");
+  fprintf(output, "-k --unix-socket=PATH\n");
+  fprintf(output, "\tPath of a unix domain socket to listen to, in addition to the TCP port\n");
   fprintf(output, "-h --help\n");
   fprintf(output, "\tPrint this message\n\n");
 }
@@ -242,10 +342,17 @@ void exit_server(struct config_elements ** config, int exit_value) {
 
     h_close_db((*config)->b_config->conn);
     h_clean_connection((*config)->b_config->conn);
+    if ((*config)->unix_instance != NULL) {
+      ulfius_stop_framework((*config)->unix_instance);
+      ulfius_clean_instance((*config)->unix_instance);
+      free((*config)->unix_instance);
+      unlink((*config)->unix_socket_path);
+    }
     ulfius_stop_framework((*config)->instance);
     ulfius_clean_instance((*config)->instance);
     clean_benoic((*config)->b_config);
     free((*config)->instance);
+    free((*config)->unix_socket_path);
     free((*config)->config_file);
     free((*config)->url_prefix);
     free((*config)->log_file);
@@ -272,10 +379,13 @@ void exit_handler(int signal) {
 int build_config_from_file(struct config_elements * config) {
   
   config_t cfg;
-  config_setting_t * root, * database;
+  config_setting_t * root, * database, * device_type_limits, * cur_limits;
   const char * cur_prefix, * cur_log_mode, * cur_log_level, * cur_log_file = NULL, * one_log_mode, * modules_path, 
-             * db_type, * db_sqlite_path, * db_mariadb_host = NULL, * db_mariadb_user = NULL, * db_mariadb_password = NULL, * db_mariadb_dbname = NULL;
-  int db_mariadb_port = 0;
+             * db_type, * db_sqlite_path, * db_mariadb_host = NULL, * db_mariadb_user = NULL, * db_mariadb_password = NULL, * db_mariadb_dbname = NULL, * type_uid, * http_thread_model, 
+             * unix_socket_path, * unix_socket_mode;
+  int db_mariadb_port = 0, limit_value, i, int_value;
+  double rate_limit;
+  json_t * j_limits;
   
   config_init(&cfg);
   
@@ -316,6 +426,106 @@ int build_config_from_file(struct config_elements * config) {
     }
   }
 
+  if (config->http_thread_model == BENOIC_HTTP_THREAD_DEFAULT) {
+    // Get HTTP server threading model
+    if (config_lookup_string(&cfg, "http_thread_model", &http_thread_model)) {
+      config->http_thread_model = parse_http_thread_model(http_thread_model);
+      if (config->http_thread_model == BENOIC_HTTP_THREAD_DEFAULT) {
+        fprintf(stderr, "Error, invalid http_thread_model %s\n", http_thread_model);
+        config_destroy(&cfg);
+        return 0;
+      }
+    }
+  }
+  
+  if (config->http_thread_pool_size == 0 && config_lookup_int(&cfg, "http_thread_pool_size", &int_value) && int_value > 0) {
+    config->http_thread_pool_size = (unsigned int)int_value;
+  }
+  
+  if (config->http_max_connections == 0 && config_lookup_int(&cfg, "http_max_connections", &int_value) && int_value > 0) {
+    config->http_max_connections = (unsigned int)int_value;
+  }
+  
+  if (config->http_max_connections_per_ip == 0 && config_lookup_int(&cfg, "http_max_connections_per_ip", &int_value) && int_value > 0) {
+    config->http_max_connections_per_ip = (unsigned int)int_value;
+  }
+  
+  if (config->http_connection_timeout == 0 && config_lookup_int(&cfg, "http_connection_timeout", &int_value) && int_value > 0) {
+    config->http_connection_timeout = (unsigned int)int_value;
+  }
+  
+  // Get live events stream and background commands sizes
+  if (config_lookup_bool(&cfg, "stream_enabled", &int_value)) {
+    config->b_config->event_bus.disabled = !int_value;
+  }
+  if (config_lookup_int(&cfg, "stream_max_subscribers", &int_value) && int_value > 0) {
+    config->b_config->event_bus.max_subscribers = (size_t)int_value;
+  }
+  if (config_lookup_int(&cfg, "stream_heartbeat", &int_value) && int_value > 0) {
+    config->b_config->event_bus.heartbeat = int_value;
+  }
+  if (config_lookup_int(&cfg, "changes_journal_size", &int_value) && int_value > 0) {
+    config->b_config->event_bus.journal_size = (size_t)int_value;
+  }
+  if (config_lookup_int(&cfg, "job_workers", &int_value) && int_value > 0) {
+    config->b_config->job_queue.nb_workers = int_value;
+  }
+  if (config_lookup_int(&cfg, "job_max", &int_value) && int_value > 0) {
+    config->b_config->job_queue.max_jobs = (size_t)int_value;
+  }
+  
+  // Get the number of devices called at the same time by a request on several devices
+  if (config_lookup_int(&cfg, "fanout_concurrency", &int_value) && int_value > 0) {
+    config->b_config->fanout_concurrency = (unsigned int)int_value;
+  }
+  
+  // Get the devices connection at startup values
+  if (config_lookup_int(&cfg, "connect_concurrency", &int_value) && int_value > 0) {
+    config->b_config->connect_concurrency = (unsigned int)int_value;
+  }
+  if (config_lookup_int(&cfg, "connect_timeout", &int_value) && int_value > 0) {
+    config->b_config->connect_timeout = int_value;
+  }
+  
+  // Get the supervisor values
+  if (config_lookup_int(&cfg, "supervisor_interval", &int_value) && int_value > 0) {
+    config->b_config->supervisor.interval = int_value;
+  }
+  if (config_lookup_int(&cfg, "reconnect_backoff_min", &int_value) && int_value > 0) {
+    config->b_config->supervisor.backoff_min = int_value;
+  }
+  if (config_lookup_int(&cfg, "reconnect_backoff_max", &int_value) && int_value > 0) {
+    config->b_config->supervisor.backoff_max = int_value;
+  }
+  
+  if (config->unix_socket_path == NULL) {
+    // Get unix domain socket path
+    if (config_lookup_string(&cfg, "unix_socket_path", &unix_socket_path)) {
+      config->unix_socket_path = o_strdup(unix_socket_path);
+      if (config->unix_socket_path == NULL) {
+        fprintf(stderr, "Error allocating config->unix_socket_path, exiting\n");
+        config_destroy(&cfg);
+        return 0;
+      }
+    }
+  }
+  
+  if (config_lookup_string(&cfg, "unix_socket_mode", &unix_socket_mode)) {
+    config->unix_socket_mode = (mode_t)strtol(unix_socket_mode, NULL, 8);
+  }
+  
+  if (config_lookup_bool(&cfg, "unix_socket_only", &int_value)) {
+    config->unix_socket_only = int_value;
+  }
+  
+  if (config->b_config->request_timeout == 0) {
+    // Get default request timeout in milliseconds
+    int request_timeout;
+    if (config_lookup_int(&cfg, "request_timeout", &request_timeout)) {
+      config->b_config->request_timeout = request_timeout;
+    }
+  }
+
   if (config->log_mode == Y_LOG_MODE_NONE) {
     // Get log mode
     if (config_lookup_string(&cfg, "log_mode", &cur_log_mode)) {
@@ -411,6 +621,33 @@ int build_config_from_file(struct config_elements * config) {
     return 0;
   }
   
+  // Get admission limits per device type
+  device_type_limits = config_setting_get_member(root, "device_type_limits");
+  if (device_type_limits != NULL) {
+    config->b_config->device_type_limits = json_object();
+    for (i=0; i<config_setting_length(device_type_limits); i++) {
+      cur_limits = config_setting_get_elem(device_type_limits, i);
+      if (config_setting_lookup_string(cur_limits, "type_uid", &type_uid) == CONFIG_TRUE) {
+        j_limits = json_object();
+        if (config_setting_lookup_float(cur_limits, "rate_limit", &rate_limit) == CONFIG_TRUE) {
+          json_object_set_new(j_limits, "rate_limit", json_real(rate_limit));
+        }
+        if (config_setting_lookup_int(cur_limits, "rate_burst", &limit_value) == CONFIG_TRUE) {
+          json_object_set_new(j_limits, "rate_burst", json_integer(limit_value));
+        }
+        if (config_setting_lookup_int(cur_limits, "max_concurrency", &limit_value) == CONFIG_TRUE) {
+          json_object_set_new(j_limits, "max_concurrency", json_integer(limit_value));
+        }
+        if (config_setting_lookup_int(cur_limits, "max_queued", &limit_value) == CONFIG_TRUE) {
+          json_object_set_new(j_limits, "max_queued", json_integer(limit_value));
+        }
+        json_object_set_new(config->b_config->device_type_limits, type_uid, j_limits);
+      } else {
+        fprintf(stderr, "Error, device_type_limits entry %d has no type_uid\n", i);
+      }
+    }
+  }
+  
   config_destroy(&cfg);
   return 1;
 }
@@ -443,9 +680,168 @@ int check_config(struct config_elements * config) {
     return 0;
   }
   
+  if (config->unix_socket_only && config->unix_socket_path == NULL) {
+    fprintf(stderr, "Error, you must specify unix_socket_path if unix_socket_only is set\n");
+    return 0;
+  }
+  
+  if (config->http_thread_model == BENOIC_HTTP_THREAD_DEFAULT) {
+    config->http_thread_model = BENOIC_HTTP_THREAD_PER_CONNECTION;
+  }
+  
+  if (config->http_thread_model == BENOIC_HTTP_THREAD_POOL && config->http_thread_pool_size == 0) {
+    config->http_thread_pool_size = BENOIC_DEFAULT_HTTP_THREAD_POOL_SIZE;
+  }
+  
+  // An open live events stream keeps its connection thread until the client leaves, it would take a thread of the pool away from the other requests
+  if (config->http_thread_model == BENOIC_HTTP_THREAD_POOL && !config->b_config->event_bus.disabled) {
+    fprintf(stderr, "Error, http_thread_model pool can't be used with the live events stream, set stream_enabled to false\n");
+    return 0;
+  }
+  
   return 1;
 }
 
+/**
+ * Return the HTTP thread model from its name, BENOIC_HTTP_THREAD_DEFAULT if the name is invalid
+ */
+int parse_http_thread_model(const char * value) {
+  if (0 == o_strcmp("connection", value)) {
+    return BENOIC_HTTP_THREAD_PER_CONNECTION;
+  } else if (0 == o_strcmp("pool", value)) {
+    return BENOIC_HTTP_THREAD_POOL;
+  } else {
+    return BENOIC_HTTP_THREAD_DEFAULT;
+  }
+}
+
+/**
+ * Start the HTTP server with the threading model, the connections limits and timeout of the configuration
+ * If listen_socket is a valid socket, the server listens to it instead of the port of the instance
+ */
+int start_http_server(struct config_elements * config, struct _u_instance * instance, const int listen_socket) {
+  struct MHD_OptionItem mhd_ops[8];
+  unsigned int mhd_flags;
+  int i = 0;
+  
+  // Those options are required by ulfius
+  mhd_ops[i].option = MHD_OPTION_NOTIFY_COMPLETED;
+  mhd_ops[i].value = (intptr_t)mhd_request_completed;
+  mhd_ops[i++].ptr_value = NULL;
+  mhd_ops[i].option = MHD_OPTION_URI_LOG_CALLBACK;
+  mhd_ops[i].value = (intptr_t)ulfius_uri_logger;
+  mhd_ops[i++].ptr_value = NULL;
+  
+  if (config->http_connection_timeout > 0) {
+    mhd_ops[i].option = MHD_OPTION_CONNECTION_TIMEOUT;
+    mhd_ops[i].value = config->http_connection_timeout;
+    mhd_ops[i++].ptr_value = NULL;
+  }
+  if (config->http_max_connections > 0) {
+    mhd_ops[i].option = MHD_OPTION_CONNECTION_LIMIT;
+    mhd_ops[i].value = config->http_max_connections;
+    mhd_ops[i++].ptr_value = NULL;
+  }
+  if (listen_socket >= 0) {
+    mhd_ops[i].option = MHD_OPTION_LISTEN_SOCKET;
+    mhd_ops[i].value = listen_socket;
+    mhd_ops[i++].ptr_value = NULL;
+  } else if (config->http_max_connections_per_ip > 0) {
+    mhd_ops[i].option = MHD_OPTION_PER_IP_CONNECTION_LIMIT;
+    mhd_ops[i].value = config->http_max_connections_per_ip;
+    mhd_ops[i++].ptr_value = NULL;
+  }
+  
+  if (config->http_thread_model == BENOIC_HTTP_THREAD_POOL) {
+    mhd_flags = MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG;
+    mhd_ops[i].option = MHD_OPTION_THREAD_POOL_SIZE;
+    mhd_ops[i].value = config->http_thread_pool_size;
+    mhd_ops[i++].ptr_value = NULL;
+    y_log_message(Y_LOG_LEVEL_INFO, "HTTP server uses a pool of %u threads", config->http_thread_pool_size);
+  } else {
+    mhd_flags = MHD_USE_THREAD_PER_CONNECTION | MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG;
+    y_log_message(Y_LOG_LEVEL_INFO, "HTTP server uses one thread per connection");
+  }
+  mhd_ops[i].option = MHD_OPTION_END;
+  mhd_ops[i].value = 0;
+  mhd_ops[i].ptr_value = NULL;
+  
+  return ulfius_start_framework_with_mhd_options(instance, mhd_flags, mhd_ops);
+}
+
+/**
+ * Create a unix domain socket bound to path and listen to it
+ * A socket file left by a previous run is removed
+ * return the socket, -1 on error
+ */
+int open_unix_socket(const char * path, const mode_t mode) {
+  struct sockaddr_un address;
+  struct stat socket_stat;
+  int listen_socket;
+  
+  if (o_strlen(path) >= sizeof(address.sun_path)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "open_unix_socket - Error, path %s too long", path);
+    return -1;
+  }
+  if (lstat(path, &socket_stat) == 0) {
+    if (!S_ISSOCK(socket_stat.st_mode) || unlink(path)) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "open_unix_socket - Error, %s already exists and is not a socket", path);
+      return -1;
+    }
+  }
+  
+  listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_socket < 0) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "open_unix_socket - Error creating socket");
+    return -1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+  if (bind(listen_socket, (struct sockaddr *)&address, sizeof(address)) || chmod(path, mode) || listen(listen_socket, SOMAXCONN)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "open_unix_socket - Error binding socket to %s", path);
+    close(listen_socket);
+    unlink(path);
+    return -1;
+  }
+  return listen_socket;
+}
+
+/**
+ * Start a second HTTP server listening to the unix domain socket, with the same endpoints as the TCP server
+ */
+int start_unix_socket_server(struct config_elements * config) {
+  int listen_socket, i;
+  
+  config->unix_instance = malloc(sizeof(struct _u_instance));
+  // The port is required by ulfius but unused, the server listens to the unix socket
+  if (config->unix_instance == NULL || ulfius_init_instance(config->unix_instance, config->instance->port, NULL, NULL) != U_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "start_unix_socket_server - Error initializing instance");
+    free(config->unix_instance);
+    config->unix_instance = NULL;
+    return U_ERROR;
+  }
+  for (i=0; i<config->instance->nb_endpoints; i++) {
+    if (ulfius_add_endpoint(config->unix_instance, &config->instance->endpoint_list[i]) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "start_unix_socket_server - Error adding endpoint %s %s", config->instance->endpoint_list[i].http_method, config->instance->endpoint_list[i].url_format);
+    }
+  }
+  ulfius_set_default_endpoint(config->unix_instance, &callback_default, (void*)config);
+  
+  listen_socket = open_unix_socket(config->unix_socket_path, config->unix_socket_mode);
+  if (listen_socket < 0 || start_http_server(config, config->unix_instance, listen_socket) != U_OK) {
+    if (listen_socket >= 0) {
+      close(listen_socket);
+      unlink(config->unix_socket_path);
+    }
+    ulfius_clean_instance(config->unix_instance);
+    free(config->unix_instance);
+    config->unix_instance = NULL;
+    return U_ERROR;
+  }
+  return U_OK;
+}
+
 int callback_default (const struct _u_request * request, struct _u_response * response, void * user_data) {
   set_response_json_body_and_clean(response, 404, json_pack("{ssssss}", "error", "page not found", "message", "The page can not be found, check documentation", "url", request->http_url));
   return U_CALLBACK_CONTINUE;
@@ -460,6 +856,7 @@ int callback_default (const struct _u_request * request, struct _u_response * re
  */
 int main(int argc, char ** argv) {
   struct config_elements * config = malloc(sizeof(struct config_elements));
+  int res = U_OK;
   
   global_handler_variable = BENOIC_RUNNING;
   // Catch end signals to make a clean exit
@@ -478,6 +875,15 @@ int main(int argc, char ** argv) {
   config->log_mode = Y_LOG_MODE_NONE;
   config->log_level = Y_LOG_LEVEL_NONE;
   config->log_file = NULL;
+  config->http_thread_model = BENOIC_HTTP_THREAD_DEFAULT;
+  config->http_thread_pool_size = 0;
+  config->http_max_connections = 0;
+  config->http_max_connections_per_ip = 0;
+  config->http_connection_timeout = 0;
+  config->unix_socket_path = NULL;
+  config->unix_socket_mode = 0660;
+  config->unix_socket_only = 0;
+  config->unix_instance = NULL;
   config->instance = malloc(sizeof(struct _u_instance));
   config->b_config = malloc(sizeof(struct _benoic_config));
   if (config->instance == NULL || config->b_config == NULL) {
@@ -488,8 +894,29 @@ int main(int argc, char ** argv) {
   config->b_config->conn = NULL;
   config->b_config->device_type_list = NULL;
   config->b_config->device_data_list = NULL;
+  config->b_config->element_index_list = NULL;
+  config->b_config->flight_list = NULL;
+  config->b_config->device_state_list = NULL;
+  config->b_config->request_timeout = 0;
+  config->b_config->fanout_concurrency = 0;
+  config->b_config->connect_concurrency = 0;
+  config->b_config->connect_timeout = 0;
+  config->b_config->device_type_limits = NULL;
+  config->b_config->event_bus.max_subscribers = 0;
+  config->b_config->event_bus.disabled = 0;
+  config->b_config->event_bus.queue_size = 0;
+  config->b_config->event_bus.heartbeat = 0;
+  config->b_config->event_bus.journal_size = 0;
+  config->b_config->job_queue.nb_workers = 0;
+  config->b_config->job_queue.max_jobs = 0;
+  config->b_config->supervisor.interval = 0;
+  config->b_config->supervisor.backoff_min = 0;
+  config->b_config->supervisor.backoff_max = 0;
   config->b_config->benoic_status = BENOIC_STATUS_STOP;
-  ulfius_init_instance(config->instance, BENOIC_DEFAULT_PORT, NULL, NULL);
+  if (ulfius_init_instance(config->instance, BENOIC_DEFAULT_PORT, NULL, NULL) != U_OK) {
+    fprintf(stderr, "Error initializing instance\n");
+    return 1;
+  }
 
   // First we parse command line arguments
   if (!build_config_from_args(argc, argv, config)) {
@@ -520,9 +947,16 @@ int main(int argc, char ** argv) {
   // Default endpoint
   ulfius_set_default_endpoint(config->instance, &callback_default, (void*)config);
   
-  // Start the webservice
-  y_log_message(Y_LOG_LEVEL_INFO, "Start benoic on port %d, prefix: %s", config->instance->port, config->url_prefix);
-  if (ulfius_start_framework(config->instance) == U_OK) {
+  // Start the webservice on the TCP port, the unix domain socket, or both
+  if (config->unix_socket_path != NULL) {
+    y_log_message(Y_LOG_LEVEL_INFO, "Start benoic on unix socket %s, prefix: %s", config->unix_socket_path, config->url_prefix);
+    res = start_unix_socket_server(config);
+  }
+  if (res == U_OK && !config->unix_socket_only) {
+    y_log_message(Y_LOG_LEVEL_INFO, "Start benoic on port %d, prefix: %s", config->instance->port, config->url_prefix);
+    res = start_http_server(config, config->instance, -1);
+  }
+  if (res == U_OK) {
     while (global_handler_variable == BENOIC_RUNNING) {
       sleep(1);
     }
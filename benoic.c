@@ -24,6 +24,7 @@
  */
 
 #include <string.h>
+#include <errno.h>
 #include "benoic.h"
 
 /**
@@ -41,6 +42,7 @@ int init_benoic(struct _u_instance * instance, const char * url_prefix, struct _
     // Devices management
     ulfius_add_endpoint_by_val(instance, "GET", url_prefix, "/deviceTypes/", 2, &callback_benoic_device_get_types, (void*)config);
     ulfius_add_endpoint_by_val(instance, "PUT", url_prefix, "/deviceTypes/reload", 2, &callback_benoic_device_reload_types, (void*)config);
+    ulfius_add_endpoint_by_val(instance, "PUT", url_prefix, "/deviceTypes/@type_uid/reload", 2, &callback_benoic_device_reload_type, (void*)config);
     ulfius_add_endpoint_by_val(instance, "GET", url_prefix, "/device/", 2, &callback_benoic_device_get_list, (void*)config);
     ulfius_add_endpoint_by_val(instance, "GET", url_prefix, "/device/@device_name", 2, &callback_benoic_device_get, (void*)config);
     ulfius_add_endpoint_by_val(instance, "POST", url_prefix, "/device/", 2, &callback_benoic_device_add, (void*)config);
@@ -60,8 +62,54 @@ int init_benoic(struct _u_instance * instance, const char * url_prefix, struct _
     ulfius_add_endpoint_by_val(instance, "PUT", url_prefix, "/device/@device_name/@element_type/@element_name/@tag", 2, &callback_benoic_device_element_add_tag, (void*)config);
     ulfius_add_endpoint_by_val(instance, "DELETE", url_prefix, "/device/@device_name/@element_type/@element_name/@tag", 2, &callback_benoic_device_element_remove_tag, (void*)config);
     ulfius_add_endpoint_by_val(instance, "GET", url_prefix, "/monitor/@device_name/@element_type/@element_name/", 2, &callback_benoic_device_element_monitor, (void*)config);
+    ulfius_add_endpoint_by_val(instance, "POST", url_prefix, "/command/", 2, &callback_benoic_element_command_batch, (void*)config);
+    ulfius_add_endpoint_by_val(instance, "POST", url_prefix, "/read/", 2, &callback_benoic_element_read_batch, (void*)config);
+    ulfius_add_endpoint_by_val(instance, "GET", url_prefix, "/overview/", 2, &callback_benoic_overview, (void*)config);
+    ulfius_add_endpoint_by_val(instance, "GET", url_prefix, "/job/@job_id", 2, &callback_benoic_job_get, (void*)config);
+    
+    // Live events stream
+    ulfius_add_endpoint_by_val(instance, "GET", url_prefix, "/stream/", 2, &callback_benoic_stream, (void*)config);
+    ulfius_add_endpoint_by_val(instance, "GET", url_prefix, "/changes/", 2, &callback_benoic_changes, (void*)config);
+    
+    // Registry generation starts at the current time so ETags are not reused after a restart
+    pthread_mutex_init(&config->registry_generation_lock, NULL);
+    config->registry_generation = (unsigned long)time(NULL);
+    config->last_seen_generation = 0;
+    config->value_generation = 0;
+    
+    if (init_event_bus(&config->event_bus) != B_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "init_benoic - Error initializing event bus");
+      return B_ERROR;
+    }
+    
+    if (init_device_state_list(config) != B_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "init_benoic - Error initializing device states");
+      return B_ERROR;
+    }
+    
+    if (init_job_queue(config) != B_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "init_benoic - Error initializing jobs queue");
+      return B_ERROR;
+    }
+    
+    pthread_mutex_init(&config->flight_lock, NULL);
+    config->flight_list = o_malloc(sizeof(struct _benoic_flight *));
+    if (config->flight_list == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "init_benoic - Error allocating resources for flight_list");
+      return B_ERROR_MEMORY;
+    }
+    config->flight_list[0] = NULL;
+    
+    // Load elements index from the database
+    pthread_mutex_init(&config->element_index_lock, NULL);
+    if (load_element_index(config) != B_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "init_benoic - Error loading elements index");
+      return B_ERROR_DB;
+    }
     
     // Get differents types available for devices by loading library files in module_path
+    // then connect the devices concurrently, device_data_list is shared by the connection threads
+    pthread_mutex_init(&config->device_data_lock, NULL);
     if (init_device_type_list(config) != B_OK) {
       y_log_message(Y_LOG_LEVEL_ERROR, "init_benoic - Error loading device types list");
       return B_ERROR_IO;
@@ -70,6 +118,12 @@ int init_benoic(struct _u_instance * instance, const char * url_prefix, struct _
       return B_ERROR_IO;
     }
     
+    // Start the supervisor of the connected devices
+    if (init_supervisor(config) != B_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "init_benoic - Error starting supervisor");
+      return B_ERROR;
+    }
+    
     // Start monitor thread
     config->benoic_status = BENOIC_STATUS_RUN;
     thread_ret_monitor = pthread_create(&thread_monitor, NULL, thread_monitor_run, (void *)config);
@@ -99,6 +153,7 @@ int close_benoic(struct _u_instance * instance, const char * url_prefix, struct
   if (instance != NULL && url_prefix != NULL && config != NULL) {
     ulfius_remove_endpoint_by_val(instance, "GET", url_prefix, "/deviceTypes/");
     ulfius_remove_endpoint_by_val(instance, "PUT", url_prefix, "/deviceTypes/reload");
+    ulfius_remove_endpoint_by_val(instance, "PUT", url_prefix, "/deviceTypes/@type_uid/reload");
     ulfius_remove_endpoint_by_val(instance, "GET", url_prefix, "/device/");
     ulfius_remove_endpoint_by_val(instance, "GET", url_prefix, "/device/@device_name");
     ulfius_remove_endpoint_by_val(instance, "POST", url_prefix, "/device/");
@@ -114,6 +169,12 @@ int close_benoic(struct _u_instance * instance, const char * url_prefix, struct
     ulfius_remove_endpoint_by_val(instance, "PUT", url_prefix, "/device/@device_name/@element_type/@element_name/@tag");
     ulfius_remove_endpoint_by_val(instance, "DELETE", url_prefix, "/device/@device_name/@element_type/@element_name/@tag");
     ulfius_remove_endpoint_by_val(instance, "GET", url_prefix, "/monitor/@device_name/@element_type/@element_name/");
+    ulfius_remove_endpoint_by_val(instance, "POST", url_prefix, "/command/");
+    ulfius_remove_endpoint_by_val(instance, "POST", url_prefix, "/read/");
+    ulfius_remove_endpoint_by_val(instance, "GET", url_prefix, "/overview/");
+    ulfius_remove_endpoint_by_val(instance, "GET", url_prefix, "/job/@job_id");
+    ulfius_remove_endpoint_by_val(instance, "GET", url_prefix, "/stream/");
+    ulfius_remove_endpoint_by_val(instance, "GET", url_prefix, "/changes/");
     
     if (config->benoic_status == BENOIC_STATUS_RUN) {
       config->benoic_status = BENOIC_STATUS_STOPPING;
@@ -122,7 +183,14 @@ int close_benoic(struct _u_instance * instance, const char * url_prefix, struct
       }
     }
     
+    // Running commands end before the devices are disconnected, the device states are used until then
+    close_supervisor(&config->supervisor);
+    close_job_queue(&config->job_queue);
     res = disconnect_all_devices(config);
+    close_device_state_list(config);
+    
+    // Streams are closed after the devices, so their clients receive the disconnections
+    close_event_bus(&config->event_bus);
     if (res != B_OK) {
       y_log_message(Y_LOG_LEVEL_ERROR, "close_benoic - Error disconnecting all devices");
       return res;
@@ -130,6 +198,13 @@ int close_benoic(struct _u_instance * instance, const char * url_prefix, struct
     res = close_device_type_list(config->device_type_list);
     o_free(config->device_type_list);
     config->device_type_list = NULL;
+    close_element_index(config);
+    pthread_mutex_destroy(&config->element_index_lock);
+    pthread_mutex_destroy(&config->registry_generation_lock);
+    o_free(config->flight_list);
+    config->flight_list = NULL;
+    pthread_mutex_destroy(&config->flight_lock);
+    pthread_mutex_destroy(&config->device_data_lock);
     if (res != B_OK) {
       y_log_message(Y_LOG_LEVEL_ERROR, "close_benoic - Error closing device type list");
       return res;
@@ -150,6 +225,7 @@ int close_benoic(struct _u_instance * instance, const char * url_prefix, struct
  */
 void clean_benoic(struct _benoic_config * config) {
   o_free(config->modules_path);
+  json_decref(config->device_type_limits);
   o_free(config);
 }
 
@@ -158,6 +234,7 @@ void clean_benoic(struct _benoic_config * config) {
  * 
  * thread for monitoring data
  * loop every minutes and get data to monitor (sensor values, switches, dimmers and heaters commands)
+ * and disconnect the idle lazy devices
  * end when benoic_status is different than BENOIC_STATUS_RUN
  * 
  */
@@ -168,7 +245,6 @@ void * thread_monitor_run(void * args) {
   int res;
   json_t * j_query, * j_result, * j_element, * device, * value;
   size_t index;
-  char * s_value, * s_next_time;
   
   if (config != NULL) {
     while (config->benoic_status == BENOIC_STATUS_RUN) {
@@ -188,64 +264,21 @@ void * thread_monitor_run(void * args) {
                   // Getting value
                   value = NULL;
                   if (has_element(config, device, json_integer_value(json_object_get(j_element, "be_type")), json_string_value(json_object_get(j_element, "be_name")))) {
-                    switch (json_integer_value(json_object_get(j_element, "be_type"))) {
-                      case BENOIC_ELEMENT_TYPE_SENSOR:
-                        value = get_sensor(config, device, json_string_value(json_object_get(j_element, "be_name")));
-                        break;
-                      case BENOIC_ELEMENT_TYPE_SWITCH:
-                        value = get_switch(config, device, json_string_value(json_object_get(j_element, "be_name")));
-                        break;
-                      case BENOIC_ELEMENT_TYPE_DIMMER:
-                        value = get_dimmer(config, device, json_string_value(json_object_get(j_element, "be_name")));
-                        break;
-                      case BENOIC_ELEMENT_TYPE_HEATER:
-                        value = get_heater(config, device, json_string_value(json_object_get(j_element, "be_name")));
-                        break;
-                    }
+                    value = get_element(config, device, json_integer_value(json_object_get(j_element, "be_type")), json_string_value(json_object_get(j_element, "be_name")), 0, 0, NULL);
                   }
                   
                   // Inserting value in monitor table
                   if (value != NULL) {
-                    s_value = NULL;
-                    if (json_is_integer(json_object_get(value, "value"))) {
-                      s_value = msprintf("%" JSON_INTEGER_FORMAT, json_integer_value(json_object_get(value, "value")));
-                    } else if (json_is_number(json_object_get(value, "value"))) {
-                      s_value = msprintf("%.2f", json_number_value(json_object_get(value, "value")));
-                    } else if (json_is_string(json_object_get(value, "value"))) {
-                      s_value = o_strdup(json_string_value(json_object_get(value, "value")));
-                    }
-                    if (s_value != NULL) {
-                      j_query = json_pack("{sss{sIss}}", 
-                                          "table", 
-                                          BENOIC_TABLE_MONITOR, 
-                                          "values", 
-                                            "be_id", 
-                                            json_integer_value(json_object_get(j_element, "be_id")), 
-                                            "bm_value", 
-                                            s_value);
-                      res = h_insert(config->conn, j_query, NULL);
-                      json_decref(j_query);
-                      if (res != H_OK) {
-                        y_log_message(Y_LOG_LEVEL_ERROR, "thread_monitor_run - Error inserting data for monitor %s/%s", json_string_value(json_object_get(j_element, "bd_name")), json_string_value(json_object_get(j_element, "be_name")));
-                      }
-                      o_free(s_value);
+                    if (json_integer_value(json_object_get(j_element, "be_type")) == BENOIC_ELEMENT_TYPE_HEATER) {
+                      monitor_store_heater(config, json_integer_value(json_object_get(j_element, "be_id")), value, 0);
+                    } else {
+                      monitor_store_value(config, json_integer_value(json_object_get(j_element, "be_id")), json_object_get(value, "value"), 0);
                     }
                     json_decref(value);
                   }
                   
                   // Updating next monitor time
-                  if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
-                    s_next_time = msprintf("CURRENT_TIMESTAMP + INTERVAL %" JSON_INTEGER_FORMAT " SECOND", json_integer_value(json_object_get(j_element, "be_monitored_every")));
-                  } else {
-                    s_next_time = msprintf("strftime('%%s','now')+%" JSON_INTEGER_FORMAT, json_integer_value(json_object_get(j_element, "be_monitored_every")));
-                  }
-                  j_query = json_pack("{sss{s{ss}}s{sI}}", "table", BENOIC_TABLE_ELEMENT, "set", "be_monitored_next", "raw", s_next_time, "where", "be_id", json_integer_value(json_object_get(j_element, "be_id")));
-                  res = h_update(config->conn, j_query, NULL);
-                  json_decref(j_query);
-                  o_free(s_next_time);
-                  if (res != H_OK) {
-                    y_log_message(Y_LOG_LEVEL_ERROR, "thread_monitor_run - Error updating next_time for monitor %s/%s", json_string_value(json_object_get(j_element, "bd_name")), json_string_value(json_object_get(j_element, "be_name")));
-                  }
+                  monitor_set_next(config, json_integer_value(json_object_get(j_element, "be_id")), json_integer_value(json_object_get(j_element, "be_monitored_every")), 0);
                 }
               } else {
                 y_log_message(Y_LOG_LEVEL_ERROR, "thread_monitor_run - device %s not found", json_string_value(json_object_get(j_element, "bd_name")));
@@ -258,6 +291,9 @@ void * thread_monitor_run(void * args) {
           y_log_message(Y_LOG_LEVEL_ERROR, "thread_monitor_run - Error allocating resources for j_query");
         }
       }
+      
+      // Disconnect the lazy devices not used anymore
+      device_idle_disconnect(config);
       sleep(1);
     }
     config->benoic_status = BENOIC_STATUS_STOP;
@@ -270,6 +306,7 @@ void * thread_monitor_run(void * args) {
  * return NULL if not found
  */
 void * get_device_ptr(struct _benoic_config * config, const char * device_name) {
+  void * device_ptr = NULL;
   int i;
   
   if (config == NULL || device_name == NULL) {
@@ -277,13 +314,16 @@ void * get_device_ptr(struct _benoic_config * config, const char * device_name)
     return NULL;
   }
   
+  pthread_mutex_lock(&config->device_data_lock);
   for (i=0; config->device_data_list != NULL && config->device_data_list[i].device_name != NULL; i++) {
     if (0 == o_strcmp(config->device_data_list[i].device_name, device_name)) {
-      return config->device_data_list[i].device_ptr;
+      device_ptr = config->device_data_list[i].device_ptr;
+      break;
     }
   }
+  pthread_mutex_unlock(&config->device_data_lock);
   
-  return NULL;
+  return device_ptr;
 }
 
 /**
@@ -299,15 +339,18 @@ int set_device_data(struct _benoic_config * config, const char * device_name, vo
   }
   
   // Append new device_ptr
+  pthread_mutex_lock(&config->device_data_lock);
   if (config->device_data_list == NULL) {
     config->device_data_list = o_malloc(2 * sizeof(struct _benoic_device_data));
     if (config->device_data_list == NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "set_device_data - Error allocating resources for config->device_data_list");
+      pthread_mutex_unlock(&config->device_data_lock);
       return B_ERROR_MEMORY;
     }
     config->device_data_list[0].device_name = o_strdup(device_name);
     if (config->device_data_list[0].device_name == NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "set_device_data - Error allocating resources for config->device_data_list[0].device_name");
+      pthread_mutex_unlock(&config->device_data_lock);
       return B_ERROR_MEMORY;
     }
     config->device_data_list[0].device_ptr = device_ptr;
@@ -318,18 +361,21 @@ int set_device_data(struct _benoic_config * config, const char * device_name, vo
     tmp = o_realloc(config->device_data_list, (device_data_list_size + 2)*sizeof(struct _benoic_device_data));
     if (tmp == NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "set_device_data - Error reallocating resources for config->device_data_list");
+      pthread_mutex_unlock(&config->device_data_lock);
       return B_ERROR_MEMORY;
     }
     config->device_data_list = tmp;
     config->device_data_list[device_data_list_size].device_name = o_strdup(device_name);
     if (config->device_data_list[device_data_list_size].device_name == NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "set_device_data - Error allocating resources for config->device_data_list[device_data_list_size].device_name");
+      pthread_mutex_unlock(&config->device_data_lock);
       return B_ERROR_MEMORY;
     }
     config->device_data_list[device_data_list_size].device_ptr = device_ptr;
     config->device_data_list[device_data_list_size + 1].device_name = NULL;
     config->device_data_list[device_data_list_size + 1].device_ptr = NULL;
   }
+  pthread_mutex_unlock(&config->device_data_lock);
   return B_OK;
 }
 
@@ -344,30 +390,396 @@ int remove_device_data(struct _benoic_config * config, const char * device_name)
     return B_ERROR_PARAM;
   }
   
+  pthread_mutex_lock(&config->device_data_lock);
   if (config->device_data_list != NULL) {
     for (i=0; config->device_data_list[i].device_name != NULL; i++) {
       if (0 == o_strcmp(config->device_data_list[i].device_name, device_name)) {
         // device_data found, remove it and move next device_data to previous index
         o_free(config->device_data_list[i].device_name);
-        config->device_data_list[i].device_name = NULL;
-        config->device_data_list[i].device_ptr = NULL;
         while (config->device_data_list[i+1].device_name != NULL) {
           config->device_data_list[i].device_name = config->device_data_list[i+1].device_name;
           config->device_data_list[i].device_ptr = config->device_data_list[i+1].device_ptr;
           i++;
         }
-        config->device_data_list[i+1].device_name = NULL;
-        config->device_data_list[i+1].device_ptr = NULL;
+        // The last entry was moved to the previous index, it's now the end of the list
+        config->device_data_list[i].device_name = NULL;
+        config->device_data_list[i].device_ptr = NULL;
         break;
       }
     }
+    pthread_mutex_unlock(&config->device_data_lock);
     return B_OK;
   } else {
+    pthread_mutex_unlock(&config->device_data_lock);
     y_log_message(Y_LOG_LEVEL_ERROR, "remove_device_data - Error input parameters");
     return B_ERROR_PARAM;
   }
 }
 
+/**
+ * Join the module call in flight identified by key, or start a new one
+ * leader is set to 1 if the caller must run the call and give its result with flight_complete,
+ * 0 if the caller must get the result with flight_wait
+ * return NULL on error, the caller must then run the call on its own
+ */
+struct _benoic_flight * flight_join(struct _benoic_config * config, const char * key, const char * device_name, int * leader) {
+  struct _benoic_flight * flight = NULL, ** flight_list;
+  int i;
+  
+  pthread_mutex_lock(&config->flight_lock);
+  for (i=0; config->flight_list[i] != NULL; i++) {
+    if (0 == o_strcmp(config->flight_list[i]->key, key)) {
+      flight = config->flight_list[i];
+      flight->refcount++;
+      *leader = 0;
+      break;
+    }
+  }
+  if (flight == NULL) {
+    flight_list = o_realloc(config->flight_list, (i + 2) * sizeof(struct _benoic_flight *));
+    flight = o_malloc(sizeof(struct _benoic_flight));
+    if (flight_list == NULL || flight == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "flight_join - Error allocating resources for flight");
+      if (flight_list != NULL) {
+        config->flight_list = flight_list;
+      }
+      o_free(flight);
+      pthread_mutex_unlock(&config->flight_lock);
+      return NULL;
+    }
+    config->flight_list = flight_list;
+    flight->key = o_strdup(key);
+    flight->device_name = o_strdup(device_name);
+    flight->nb_held_slots = 0;
+    pthread_cond_init(&flight->cond, NULL);
+    flight->result = NULL;
+    flight->done = 0;
+    flight->refcount = 1;
+    flight->config = config;
+    flight->call = NULL;
+    flight->args = NULL;
+    config->flight_list[i] = flight;
+    config->flight_list[i + 1] = NULL;
+    *leader = 1;
+  }
+  pthread_mutex_unlock(&config->flight_lock);
+  return flight;
+}
+
+/**
+ * Wait for the result of the flight and release it
+ * If timeout is positive and the flight isn't done after timeout milliseconds,
+ * return NULL and set timed_out to 1, the module call then keeps a slot of the device until it returns
+ * returned value must be free'd after use
+ */
+json_t * flight_wait(struct _benoic_config * config, struct _benoic_flight * flight, const long timeout, int * timed_out) {
+  json_t * to_return = NULL;
+  struct timespec deadline;
+  int res = 0;
+  
+  pthread_mutex_lock(&config->flight_lock);
+  if (timeout > 0) {
+    set_deadline(&deadline, timeout);
+    while (!flight->done && res != ETIMEDOUT) {
+      res = pthread_cond_timedwait(&flight->cond, &config->flight_lock, &deadline);
+    }
+  } else {
+    while (!flight->done) {
+      pthread_cond_wait(&flight->cond, &config->flight_lock);
+    }
+  }
+  if (flight->done) {
+    to_return = json_deep_copy(flight->result);
+  } else {
+    if (flight->device_name != NULL) {
+      flight->nb_held_slots++;
+      device_slot_hold(config, flight->device_name);
+    }
+    if (timed_out != NULL) {
+      *timed_out = 1;
+    }
+  }
+  pthread_mutex_unlock(&config->flight_lock);
+  flight_release(config, flight);
+  return to_return;
+}
+
+/**
+ * Set deadline to now + timeout milliseconds
+ */
+void set_deadline(struct timespec * deadline, const long timeout) {
+  clock_gettime(CLOCK_REALTIME, deadline);
+  deadline->tv_sec += timeout / 1000;
+  deadline->tv_nsec += (timeout % 1000) * 1000000;
+  if (deadline->tv_nsec >= 1000000000) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000;
+  }
+}
+
+/**
+ * Return the number of milliseconds left before deadline, 0 if it's expired
+ */
+long get_deadline_remaining(const struct timespec * deadline) {
+  struct timespec now;
+  long remaining;
+  
+  clock_gettime(CLOCK_REALTIME, &now);
+  remaining = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+  return remaining>0?remaining:0;
+}
+
+/**
+ * Run call with args, shared with the identical calls in flight
+ * If args contains a device with a request timeout, the call is run in a separate thread
+ * and the caller gives up when the timeout expires, timed_out is then set to 1
+ * returned value must be free'd after use
+ */
+json_t * flight_run(struct _benoic_config * config, const char * key, json_t * (* call) (struct _benoic_config * config, json_t * args), json_t * args, int * timed_out) {
+  return flight_run_async(config, key, NULL, call, args, timed_out);
+}
+
+/**
+ * Run call with args like flight_run, but let start run it first if it's not NULL
+ * start must return B_OK if it started the call without blocking, the result is then given later with flight_complete,
+ * no thread is blocked by the call while it's running.
+ * If start returns anything else, call is used as in flight_run
+ * returned value must be free'd after use
+ */
+json_t * flight_run_async(struct _benoic_config * config, const char * key, int (* start) (struct _benoic_config * config, json_t * args, struct _benoic_flight * flight), json_t * (* call) (struct _benoic_config * config, json_t * args), json_t * args, int * timed_out) {
+  struct _benoic_flight * flight;
+  pthread_t thread_flight;
+  json_t * to_return;
+  long timeout = get_device_request_timeout(json_object_get(args, "device"));
+  int leader = 1;
+  
+  if (timed_out != NULL) {
+    *timed_out = 0;
+  }
+  flight = flight_join(config, key, json_string_value(json_object_get(json_object_get(args, "device"), "name")), &leader);
+  if (flight == NULL) {
+    return call(config, args);
+  } else if (leader) {
+    if (start != NULL) {
+      // The reference of the started call is released by flight_complete
+      pthread_mutex_lock(&config->flight_lock);
+      flight->refcount++;
+      pthread_mutex_unlock(&config->flight_lock);
+      if (start(config, args, flight) == B_OK) {
+        return flight_wait(config, flight, timeout, timed_out);
+      }
+      flight_release(config, flight);
+    }
+    if (timeout > 0) {
+      // The thread has its own reference to the flight, the call can end after the caller gave up
+      pthread_mutex_lock(&config->flight_lock);
+      flight->call = call;
+      flight->args = json_deep_copy(args);
+      flight->refcount++;
+      pthread_mutex_unlock(&config->flight_lock);
+      if (!pthread_create(&thread_flight, NULL, thread_flight_run, (void *)flight)) {
+        pthread_detach(thread_flight);
+        return flight_wait(config, flight, timeout, timed_out);
+      }
+      y_log_message(Y_LOG_LEVEL_ERROR, "flight_run - Error creating thread, run %s without timeout", key);
+      flight_release(config, flight);
+    }
+    to_return = call(config, args);
+    flight_complete(config, flight, to_return);
+    return to_return;
+  } else {
+    return flight_wait(config, flight, timeout, timed_out);
+  }
+}
+
+/**
+ * Run the call of the flight and give its result to the callers waiting for it
+ */
+void * thread_flight_run(void * args) {
+  struct _benoic_flight * flight = (struct _benoic_flight *)args;
+  json_t * result = flight->call(flight->config, flight->args);
+  
+  flight_complete(flight->config, flight, result);
+  json_decref(result);
+  return NULL;
+}
+
+/**
+ * Return the timeout of the request in milliseconds, 0 if there is none
+ * The timeout is the url parameter timeout, or the header X-Request-Timeout, or the default value
+ */
+long get_request_timeout(struct _benoic_config * config, const struct _u_request * request) {
+  const char * str_timeout = u_map_get(request->map_url, BENOIC_REQUEST_TIMEOUT_PARAM);
+  char * endptr;
+  long timeout;
+  
+  if (str_timeout == NULL) {
+    str_timeout = u_map_get_case(request->map_header, BENOIC_REQUEST_TIMEOUT_HEADER);
+  }
+  if (str_timeout != NULL) {
+    timeout = strtol(str_timeout, &endptr, 10);
+    if (*endptr == '\0' && timeout > 0) {
+      return timeout;
+    }
+  }
+  return config->request_timeout>0?config->request_timeout:0;
+}
+
+/**
+ * Check the admission limits of the device before sending it the request
+ * If the request can't be sent, the response is set to 429 or 504
+ * timeout is the request timeout, the time spent waiting for a slot is taken from it
+ * return B_OK if the request can be sent, the slot must then be released with device_slot_release
+ */
+int admit_request(struct _benoic_config * config, json_t * device, long * timeout, struct _u_response * response) {
+  long retry_after = 1;
+  int res = device_admission_enter(config, device, timeout, &retry_after);
+  
+  if (res == B_ERROR_BUSY) {
+    set_response_too_many_requests(response, retry_after);
+  } else if (res == B_ERROR_UNAVAILABLE) {
+    set_response_unavailable(response, retry_after);
+  } else if (res == B_ERROR_TIMEOUT) {
+    set_response_json_body_and_clean(response, 504, json_pack("{ss}", "error", "timeout"));
+  } else if (res != B_OK) {
+    response->status = 500;
+  }
+  return res;
+}
+
+/**
+ * Set the response to 429 with the number of seconds to wait before trying again
+ */
+void set_response_too_many_requests(struct _u_response * response, const long retry_after) {
+  char * str_retry_after = msprintf("%ld", retry_after);
+  
+  u_map_put(response->map_header, "Retry-After", str_retry_after);
+  o_free(str_retry_after);
+  set_response_json_body_and_clean(response, 429, json_pack("{ss}", "error", "too many requests"));
+}
+
+/**
+ * Set the response to 503 with the number of seconds before the device is reconnected
+ */
+void set_response_unavailable(struct _u_response * response, const long retry_after) {
+  char * str_retry_after = msprintf("%ld", retry_after);
+  
+  u_map_put(response->map_header, "Retry-After", str_retry_after);
+  o_free(str_retry_after);
+  set_response_json_body_and_clean(response, 503, json_pack("{ss}", "error", "device unavailable"));
+}
+
+/**
+ * Give the result of the flight to the callers waiting for it and release it
+ * result is not stolen, a copy is kept for the waiters
+ * The next identical call will start a new flight
+ */
+void flight_complete(struct _benoic_config * config, struct _benoic_flight * flight, json_t * result) {
+  unsigned int nb_held_slots;
+  int i;
+  
+  pthread_mutex_lock(&config->flight_lock);
+  flight->result = json_deep_copy(result);
+  flight->done = 1;
+  nb_held_slots = flight->nb_held_slots;
+  flight->nb_held_slots = 0;
+  for (i=0; config->flight_list[i] != NULL; i++) {
+    if (config->flight_list[i] == flight) {
+      for (; config->flight_list[i] != NULL; i++) {
+        config->flight_list[i] = config->flight_list[i + 1];
+      }
+      break;
+    }
+  }
+  pthread_cond_broadcast(&flight->cond);
+  pthread_mutex_unlock(&config->flight_lock);
+  // The slots kept for the callers who gave up are free now that the module call returned
+  device_slot_release_held(config, flight->device_name, nb_held_slots);
+  flight_release(config, flight);
+}
+
+/**
+ * Release a reference to the flight, free it when it's not used anymore
+ */
+void flight_release(struct _benoic_config * config, struct _benoic_flight * flight) {
+  int refcount;
+  
+  pthread_mutex_lock(&config->flight_lock);
+  refcount = --flight->refcount;
+  pthread_mutex_unlock(&config->flight_lock);
+  if (refcount == 0) {
+    o_free(flight->key);
+    o_free(flight->device_name);
+    json_decref(flight->result);
+    json_decref(flight->args);
+    pthread_cond_destroy(&flight->cond);
+    o_free(flight);
+  }
+}
+
+/**
+ * Increment the registry generation
+ * Must be called after every change of devices, device types or elements data
+ */
+void bump_registry_generation(struct _benoic_config * config) {
+  pthread_mutex_lock(&config->registry_generation_lock);
+  config->registry_generation++;
+  pthread_mutex_unlock(&config->registry_generation_lock);
+}
+
+/**
+ * Return the current registry generation
+ */
+unsigned long get_registry_generation(struct _benoic_config * config) {
+  unsigned long generation;
+  
+  pthread_mutex_lock(&config->registry_generation_lock);
+  generation = config->registry_generation;
+  pthread_mutex_unlock(&config->registry_generation_lock);
+  return generation;
+}
+
+/**
+ * Increment the last seen generation
+ * Called when the last seen date of a device is written, it only changes the device data,
+ * so the caches depending on the registry generation are kept
+ */
+void bump_last_seen_generation(struct _benoic_config * config) {
+  pthread_mutex_lock(&config->registry_generation_lock);
+  config->last_seen_generation++;
+  pthread_mutex_unlock(&config->registry_generation_lock);
+}
+
+/**
+ * Return the current last seen generation
+ */
+unsigned long get_last_seen_generation(struct _benoic_config * config) {
+  unsigned long generation;
+  
+  pthread_mutex_lock(&config->registry_generation_lock);
+  generation = config->last_seen_generation;
+  pthread_mutex_unlock(&config->registry_generation_lock);
+  return generation;
+}
+
+/**
+ * Set the ETag header of the response and compare it to the If-None-Match header of the request
+ * return 1 if the request already has this version, so 304 can be sent
+ */
+int check_etag(const struct _u_request * request, struct _u_response * response, const char * etag) {
+  const char * if_none_match = u_map_get_case(request->map_header, "If-None-Match");
+  
+  u_map_put(response->map_header, "ETag", etag);
+  if (if_none_match == NULL) {
+    return 0;
+  } else if (0 == o_strcmp(if_none_match, "*")) {
+    return 1;
+  } else {
+    // Weak comparison, ignore the W/ prefix
+    return (strstr(if_none_match, etag + 2) != NULL);
+  }
+}
+
 /**
  * Disconnect all connected devices
  * return B_OK on success
@@ -384,8 +796,10 @@ int disconnect_all_devices(struct _benoic_config * config) {
       }
     }
     json_decref(device_list);
+    pthread_mutex_lock(&config->device_data_lock);
     o_free(config->device_data_list);
     config->device_data_list = NULL;
+    pthread_mutex_unlock(&config->device_data_lock);
     return B_OK;
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "disconnect_all_devices - Error input parameters");
@@ -397,32 +811,73 @@ int disconnect_all_devices(struct _benoic_config * config) {
  * Callback functions declaration
  */
 int callback_benoic_device_get_types (const struct _u_request * request, struct _u_response * response, void * user_data) {
-  UNUSED(request);
+  char * etag;
+  
   if (user_data == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get_types - Error, user_data is NULL");
     return U_CALLBACK_ERROR;
   } else {
-    set_response_json_body_and_clean(response, 200, get_device_types_list((struct _benoic_config *)user_data));
+    etag = msprintf("W/\"%lu\"", get_registry_generation((struct _benoic_config *)user_data));
+    if (check_etag(request, response, etag)) {
+      response->status = 304;
+    } else {
+      set_response_json_body_and_clean(response, 200, get_device_types_list((struct _benoic_config *)user_data));
+    }
+    o_free(etag);
     return U_CALLBACK_CONTINUE;
   }
 }
 
 int callback_benoic_device_reload_types (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  struct _benoic_config * config = (struct _benoic_config *)user_data;
+  int i, res, to_return = B_OK;
+  
   UNUSED(request);
   if (user_data == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get_types - Error, user_data is NULL");
     return U_CALLBACK_ERROR;
   } else {
-    if (close_device_type_list(((struct _benoic_config *)user_data)->device_type_list) == B_OK) {
-      o_free(((struct _benoic_config *)user_data)->device_type_list);
-      if (init_device_type_list((struct _benoic_config *)user_data) == B_OK) {
-        set_response_json_body_and_clean(response, 200, get_device_types_list((struct _benoic_config *)user_data));
-      } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get_types - Error reopening device type list");
-        response->status = 500;
+    // Each module is reloaded on its own, the calls in progress to the other ones keep running
+    for (i=0; config->device_type_list != NULL && config->device_type_list[i].uid != NULL; i++) {
+      res = reload_device_type(config, config->device_type_list[i].uid);
+      if (res != B_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get_types - Error reloading device type %s, reason: %d", config->device_type_list[i].uid, res);
+        if (to_return == B_OK) {
+          to_return = res;
+        }
       }
+    }
+    if (to_return == B_OK) {
+      set_response_json_body_and_clean(response, 200, get_device_types_list(config));
+    } else if (to_return == B_ERROR_BUSY) {
+      set_response_json_body_and_clean(response, 409, json_pack("{ss}", "message", "Device type already reloading"));
+    } else if (to_return == B_ERROR_TIMEOUT) {
+      set_response_json_body_and_clean(response, 504, json_pack("{ss}", "error", "timeout"));
+    } else {
+      response->status = 500;
+    }
+    return U_CALLBACK_CONTINUE;
+  }
+}
+
+int callback_benoic_device_reload_type (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  int res;
+  
+  if (user_data == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_reload_type - Error, user_data is NULL");
+    return U_CALLBACK_ERROR;
+  } else {
+    res = reload_device_type((struct _benoic_config *)user_data, u_map_get(request->map_url, "type_uid"));
+    if (res == B_OK) {
+      set_response_json_body_and_clean(response, 200, get_device_types_list((struct _benoic_config *)user_data));
+    } else if (res == B_ERROR_NOT_FOUND) {
+      set_response_json_body_and_clean(response, 404, json_pack("{ss}", "message", "Device type not found"));
+    } else if (res == B_ERROR_BUSY) {
+      set_response_json_body_and_clean(response, 409, json_pack("{ss}", "message", "Device type already reloading"));
+    } else if (res == B_ERROR_TIMEOUT) {
+      set_response_json_body_and_clean(response, 504, json_pack("{ss}", "error", "timeout"));
     } else {
-      y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get_types - Error closing device type list");
+      y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_reload_type - Error reloading device type");
       response->status = 500;
     }
     return U_CALLBACK_CONTINUE;
@@ -430,28 +885,51 @@ int callback_benoic_device_reload_types (const struct _u_request * request, stru
 }
 
 int callback_benoic_device_get_list (const struct _u_request * request, struct _u_response * response, void * user_data) {
-  UNUSED(request);
+  json_t * json_body, * device;
+  size_t index;
+  char * etag;
+  
   if (user_data == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get_list - Error, user_data is NULL");
     return U_CALLBACK_ERROR;
   } else {
-    set_response_json_body_and_clean(response, 200, get_device((struct _benoic_config *)user_data, NULL));
+    etag = msprintf("W/\"%lu-%lu\"", get_registry_generation((struct _benoic_config *)user_data), get_last_seen_generation((struct _benoic_config *)user_data));
+    if (check_etag(request, response, etag)) {
+      response->status = 304;
+    } else {
+      json_body = get_device((struct _benoic_config *)user_data, NULL);
+      json_array_foreach(json_body, index, device) {
+        json_object_set_new(device, "breaker", device_breaker_to_json((struct _benoic_config *)user_data, json_string_value(json_object_get(device, "name"))));
+      }
+      set_response_json_body_and_clean(response, 200, json_body);
+    }
+    o_free(etag);
     return U_CALLBACK_CONTINUE;
   }
 }
 
 int callback_benoic_device_get (const struct _u_request * request, struct _u_response * response, void * user_data) {
   json_t * json_body;
+  char * etag;
+  
   if (user_data == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get - Error, user_data is NULL");
     return U_CALLBACK_ERROR;
   } else {
-    json_body = get_device((struct _benoic_config *)user_data, u_map_get(request->map_url, "device_name"));
-    if (json_body == NULL) {
-      response->status = 404;
+    etag = msprintf("W/\"%lu-%lu\"", get_registry_generation((struct _benoic_config *)user_data), get_last_seen_generation((struct _benoic_config *)user_data));
+    if (check_etag(request, response, etag)) {
+      response->status = 304;
     } else {
-      set_response_json_body_and_clean(response, 200, json_body);
+      json_body = get_device((struct _benoic_config *)user_data, u_map_get(request->map_url, "device_name"));
+      if (json_body == NULL) {
+        u_map_remove_from_key(response->map_header, "ETag");
+        response->status = 404;
+      } else {
+        json_object_set_new(json_body, "breaker", device_breaker_to_json((struct _benoic_config *)user_data, json_string_value(json_object_get(json_body, "name"))));
+        set_response_json_body_and_clean(response, 200, json_body);
+      }
     }
+    o_free(etag);
   }
   return U_CALLBACK_CONTINUE;
 }
@@ -569,7 +1047,7 @@ int callback_benoic_device_connect (const struct _u_request * request, struct _u
     if (device == NULL) {
       response->status = 404;
     } else {
-      response->status = connect_device((struct _benoic_config *)user_data, device)==B_OK?200:500;
+      response->status = connect_device((struct _benoic_config *)user_data, device, 1, 0)==B_OK?200:500;
     }
     json_decref(device);
   }
@@ -596,6 +1074,8 @@ int callback_benoic_device_disconnect (const struct _u_request * request, struct
 
 int callback_benoic_device_ping (const struct _u_request * request, struct _u_response * response, void * user_data) {
   json_t * device;
+  long timeout;
+  int res;
   
   if (user_data == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get - Error, user_data is NULL");
@@ -611,10 +1091,17 @@ int callback_benoic_device_ping (const struct _u_request * request, struct _u_re
       json_decref(device);
       set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "device disconnected"));
     } else {
-      if (ping_device((struct _benoic_config *)user_data, device) == B_OK) {
-        response->status = 200;
-      } else {
-        response->status = 503;
+      timeout = get_request_timeout((struct _benoic_config *)user_data, request);
+      if (admit_request((struct _benoic_config *)user_data, device, &timeout, response) == B_OK) {
+        res = ping_device((struct _benoic_config *)user_data, device, timeout);
+        device_slot_release((struct _benoic_config *)user_data, device);
+        if (res == B_OK) {
+          response->status = 200;
+        } else if (res == B_ERROR_TIMEOUT) {
+          set_response_json_body_and_clean(response, 504, json_pack("{ss}", "error", "timeout"));
+        } else {
+          response->status = 503;
+        }
       }
       json_decref(device);
     }
@@ -623,12 +1110,35 @@ int callback_benoic_device_ping (const struct _u_request * request, struct _u_re
 }
 
 int callback_benoic_device_overview (const struct _u_request * request, struct _u_response * response, void * user_data) {
-  json_t * device, * overview;
+  json_t * device, * overview = NULL;
+  long int max_age = 0, timeout;
+  unsigned long value_generation;
+  int timed_out = 0;
+  char * etag, * endptr = NULL;
   
   if (user_data == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get - Error, user_data is NULL");
     return U_CALLBACK_ERROR;
   } else {
+    if (u_map_get(request->map_url, "max_age") != NULL) {
+      max_age = strtol(u_map_get(request->map_url, "max_age"), &endptr, 10);
+      if (max_age < 0 || *endptr != '\0' || endptr == u_map_get(request->map_url, "max_age")) {
+        set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "max_age parameter must be a positive number of seconds"));
+        return U_CALLBACK_CONTINUE;
+      }
+    }
+    
+    // If all values are in the cache, the overview can be validated without accessing the database or the device
+    if (max_age > 0 && get_device_value_generation((struct _benoic_config *)user_data, u_map_get(request->map_url, "device_name"), max_age, &value_generation) == B_OK) {
+      etag = msprintf("W/\"%lu-%lu\"", get_registry_generation((struct _benoic_config *)user_data), value_generation);
+      if (check_etag(request, response, etag)) {
+        response->status = 304;
+        o_free(etag);
+        return U_CALLBACK_CONTINUE;
+      }
+      o_free(etag);
+    }
+    
     device = get_device((struct _benoic_config *)user_data, u_map_get(request->map_url, "device_name"));
     if (device == NULL) {
       response->status = 404;
@@ -639,9 +1149,23 @@ int callback_benoic_device_overview (const struct _u_request * request, struct _
       json_decref(device);
       set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "device disconnected"));
     } else {
-      overview = overview_device((struct _benoic_config *)user_data, device);
+      if (max_age > 0) {
+        overview = overview_device_cached((struct _benoic_config *)user_data, device, max_age);
+      }
+      if (overview == NULL) {
+        u_map_remove_from_key(response->map_header, "ETag");
+        timeout = get_request_timeout((struct _benoic_config *)user_data, request);
+        if (admit_request((struct _benoic_config *)user_data, device, &timeout, response) != B_OK) {
+          json_decref(device);
+          return U_CALLBACK_CONTINUE;
+        }
+        overview = overview_device((struct _benoic_config *)user_data, device, timeout, &timed_out);
+        device_slot_release((struct _benoic_config *)user_data, device);
+      }
       if (overview != NULL) {
         set_response_json_body_and_clean(response, 200, overview);
+      } else if (timed_out) {
+        set_response_json_body_and_clean(response, 504, json_pack("{ss}", "error", "timeout"));
       } else {
         y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get - Error getting overview for device %s", u_map_get(request->map_url, "device_name"));
         response->status = 500;
@@ -652,62 +1176,349 @@ int callback_benoic_device_overview (const struct _u_request * request, struct _
   return U_CALLBACK_CONTINUE;
 }
 
-int callback_benoic_device_element_get (const struct _u_request * request, struct _u_response * response, void * user_data) {
-  json_t * device, * result = NULL;
+/**
+ * Release a reference to the overview fan-out, free it when it's not used anymore
+ */
+void overview_fanout_release(struct _benoic_overview_fanout * fanout) {
+  size_t i;
+  int refcount;
   
-  if (user_data == NULL) {
-    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get - Error, user_data is NULL");
-    return U_CALLBACK_ERROR;
-  } else {
-    device = get_device((struct _benoic_config *)user_data, u_map_get(request->map_url, "device_name"));
-    if (device == NULL) {
-      response->status = 404;
-    } else if (json_object_get(device, "enabled") == json_false()) {
-      json_decref(device);
-      set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "device disabled"));
-    } else if (json_object_get(device, "connected") == json_false()) {
-      json_decref(device);
-      set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "device disconnected"));
+  pthread_mutex_lock(&fanout->lock);
+  refcount = --fanout->refcount;
+  pthread_mutex_unlock(&fanout->lock);
+  if (refcount == 0) {
+    for (i=0; i<fanout->nb_devices; i++) {
+      json_decref(fanout->slot_list[i].device);
+      json_decref(fanout->slot_list[i].overview);
+    }
+    pthread_mutex_destroy(&fanout->lock);
+    pthread_cond_destroy(&fanout->cond);
+    o_free(fanout->slot_list);
+    o_free(fanout);
+  }
+}
+
+/**
+ * Get the overview of the devices of the fan-out until there is none left
+ * The thread is detached and may end after the deadline, its results are then dropped
+ */
+void * thread_overview_run(void * args) {
+  struct _benoic_overview_fanout * fanout = (struct _benoic_overview_fanout *)args;
+  struct _benoic_overview_slot * slot;
+  struct timespec start, end;
+  json_t * overview;
+  long remaining;
+  int res, timed_out;
+  
+  while (1) {
+    pthread_mutex_lock(&fanout->lock);
+    while (fanout->next < fanout->nb_devices && !fanout->slot_list[fanout->next].started) {
+      fanout->next++;
+    }
+    slot = fanout->next<fanout->nb_devices?&fanout->slot_list[fanout->next++]:NULL;
+    pthread_mutex_unlock(&fanout->lock);
+    if (slot == NULL) {
+      break;
+    }
+    
+    overview = NULL;
+    timed_out = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // The devices still waiting for a worker when the deadline is reached aren't called
+    if ((remaining = get_deadline_remaining(&fanout->deadline)) == 0) {
+      res = B_ERROR_TIMEOUT;
     } else {
-      if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "sensor")) {
-        result = get_sensor((struct _benoic_config *)user_data, device, u_map_get(request->map_url, "element_name"));
-      } else if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "switch")) {
-        result = get_switch((struct _benoic_config *)user_data, device, u_map_get(request->map_url, "element_name"));
-      } else if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "dimmer")) {
-        result = get_dimmer((struct _benoic_config *)user_data, device, u_map_get(request->map_url, "element_name"));
-      } else if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "heater")) {
-        result = get_heater((struct _benoic_config *)user_data, device, u_map_get(request->map_url, "element_name"));
-      } else {
-        set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "element type incorrect"));
-      }
-      if (result != NULL) {
-        set_response_json_body_and_clean(response, 200, result);
-      } else {
-        response->status = 404;
+      res = device_admission_enter(fanout->config, slot->device, &remaining, NULL);
+      if (res == B_OK) {
+        overview = overview_device(fanout->config, slot->device, remaining, &timed_out);
+        device_slot_release(fanout->config, slot->device);
+        if (timed_out) {
+          res = B_ERROR_TIMEOUT;
+        } else if (overview == NULL) {
+          res = B_ERROR;
+        }
       }
-      json_decref(device);
     }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    pthread_mutex_lock(&fanout->lock);
+    slot->overview = overview;
+    slot->result = res;
+    slot->latency = ((end.tv_sec - start.tv_sec) * 1000) + ((end.tv_nsec - start.tv_nsec) / 1000000);
+    slot->done = 1;
+    fanout->nb_pending--;
+    pthread_cond_signal(&fanout->cond);
+    pthread_mutex_unlock(&fanout->lock);
   }
-  return U_CALLBACK_CONTINUE;
+  overview_fanout_release(fanout);
+  return NULL;
 }
 
-int callback_benoic_device_element_put (const struct _u_request * request, struct _u_response * response, void * user_data) {
-  json_t * device, * element = NULL, * valid;
-  int element_type = BENOIC_ELEMENT_TYPE_NONE;
-  json_t * json_body = ulfius_get_json_body_request(request, NULL);
+/**
+ * Get the overview of all the devices
+ * Connected devices are called concurrently by at most fanout_concurrency workers,
+ * all the devices share the request timeout to answer
+ * Devices that didn't answer in time are returned with a timeout error
+ */
+int callback_benoic_overview (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  struct _benoic_config * config = (struct _benoic_config *)user_data;
+  json_t * device_list, * device, * to_return;
+  struct _benoic_overview_fanout * fanout;
+  pthread_t thread_overview;
+  long int timeout;
+  char * endptr;
+  size_t index, i, nb_workers, nb_started = 0;
+  int res = 0;
   
-  if (json_body == NULL) {
-    set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "invalid input json format"));
-    return U_CALLBACK_CONTINUE;
-  } else if (user_data == NULL) {
-    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_element_put - Error, user_data is NULL");
-    json_decref(json_body);
+  if (user_data == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_overview - Error, user_data is NULL");
     return U_CALLBACK_ERROR;
-  } else {
-    device = get_device((struct _benoic_config *)user_data, u_map_get(request->map_url, "device_name"));
-    if (device == NULL) {
-      response->status = 404;
-    } else {
+  }
+  
+  if (u_map_get(request->map_url, BENOIC_REQUEST_TIMEOUT_PARAM) != NULL) {
+    timeout = strtol(u_map_get(request->map_url, BENOIC_REQUEST_TIMEOUT_PARAM), &endptr, 10);
+    if (*endptr != '\0' || timeout <= 0) {
+      set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "timeout parameter must be a positive number of milliseconds"));
+      return U_CALLBACK_CONTINUE;
+    }
+  }
+  timeout = get_request_timeout(config, request);
+  if (timeout == 0) {
+    timeout = BENOIC_OVERVIEW_DEFAULT_TIMEOUT;
+  }
+  
+  device_list = get_device(config, NULL);
+  fanout = o_malloc(sizeof(struct _benoic_overview_fanout));
+  to_return = json_object();
+  if (device_list == NULL || fanout == NULL || to_return == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_overview - Error allocating resources");
+    json_decref(device_list);
+    json_decref(to_return);
+    o_free(fanout);
+    return U_CALLBACK_ERROR;
+  }
+  
+  fanout->config = config;
+  fanout->nb_devices = json_array_size(device_list);
+  fanout->nb_pending = 0;
+  fanout->next = 0;
+  fanout->refcount = 1;
+  fanout->slot_list = o_malloc((fanout->nb_devices + 1) * sizeof(struct _benoic_overview_slot));
+  if (fanout->slot_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_overview - Error allocating resources for slot_list");
+    json_decref(device_list);
+    json_decref(to_return);
+    o_free(fanout);
+    return U_CALLBACK_ERROR;
+  }
+  pthread_mutex_init(&fanout->lock, NULL);
+  pthread_cond_init(&fanout->cond, NULL);
+  set_deadline(&fanout->deadline, timeout);
+  
+  // Queue the connected devices, then start the workers
+  pthread_mutex_lock(&fanout->lock);
+  json_array_foreach(device_list, index, device) {
+    fanout->slot_list[index].device = json_incref(device);
+    fanout->slot_list[index].overview = NULL;
+    fanout->slot_list[index].latency = 0;
+    fanout->slot_list[index].result = B_OK;
+    fanout->slot_list[index].done = 0;
+    fanout->slot_list[index].started = 0;
+    if (json_object_get(device, "enabled") == json_true() && json_object_get(device, "connected") == json_true()) {
+      fanout->slot_list[index].started = 1;
+      fanout->nb_pending++;
+    }
+  }
+  nb_workers = config->fanout_concurrency>0?config->fanout_concurrency:BENOIC_FANOUT_DEFAULT_CONCURRENCY;
+  if (nb_workers > fanout->nb_pending) {
+    nb_workers = fanout->nb_pending;
+  }
+  for (nb_started = 0; nb_started < nb_workers; nb_started++) {
+    fanout->refcount++;
+    if (pthread_create(&thread_overview, NULL, thread_overview_run, (void *)fanout) || pthread_detach(thread_overview)) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_overview - Error creating thread, %zu threads running", nb_started);
+      fanout->refcount--;
+      break;
+    }
+  }
+  
+  // Without any worker, no device is called
+  if (nb_started == 0) {
+    for (i=0; i<fanout->nb_devices; i++) {
+      fanout->slot_list[i].started = 0;
+    }
+    fanout->nb_pending = 0;
+  }
+  
+  // Wait until all devices answered or the deadline is reached
+  while (fanout->nb_pending > 0 && res != ETIMEDOUT) {
+    res = pthread_cond_timedwait(&fanout->cond, &fanout->lock, &fanout->deadline);
+  }
+  
+  for (i=0; i<fanout->nb_devices; i++) {
+    device = fanout->slot_list[i].device;
+    if (json_object_get(device, "enabled") != json_true()) {
+      json_object_set_new(to_return, json_string_value(json_object_get(device, "name")), json_pack("{ss}", "error", "device disabled"));
+    } else if (json_object_get(device, "connected") != json_true()) {
+      json_object_set_new(to_return, json_string_value(json_object_get(device, "name")), json_pack("{ss}", "error", "device disconnected"));
+    } else if (!fanout->slot_list[i].started) {
+      json_object_set_new(to_return, json_string_value(json_object_get(device, "name")), json_pack("{ss}", "error", "internal error"));
+    } else if (!fanout->slot_list[i].done || fanout->slot_list[i].result == B_ERROR_TIMEOUT) {
+      json_object_set_new(to_return, json_string_value(json_object_get(device, "name")), json_pack("{sssI}", "error", "timeout", "latency", (json_int_t)timeout));
+    } else if (fanout->slot_list[i].result == B_ERROR_BUSY) {
+      json_object_set_new(to_return, json_string_value(json_object_get(device, "name")), json_pack("{ss}", "error", "too many requests"));
+    } else if (fanout->slot_list[i].result == B_ERROR_UNAVAILABLE) {
+      json_object_set_new(to_return, json_string_value(json_object_get(device, "name")), json_pack("{ss}", "error", "device unavailable"));
+    } else if (fanout->slot_list[i].overview == NULL) {
+      json_object_set_new(to_return, json_string_value(json_object_get(device, "name")), json_pack("{sssI}", "error", "error getting overview", "latency", (json_int_t)fanout->slot_list[i].latency));
+    } else {
+      json_object_set_new(to_return, json_string_value(json_object_get(device, "name")), json_pack("{sOsI}", "overview", fanout->slot_list[i].overview, "latency", (json_int_t)fanout->slot_list[i].latency));
+    }
+  }
+  pthread_mutex_unlock(&fanout->lock);
+  overview_fanout_release(fanout);
+  json_decref(device_list);
+  
+  set_response_json_body_and_clean(response, 200, to_return);
+  return U_CALLBACK_CONTINUE;
+}
+
+/**
+ * Live events stream using Server-Sent Events
+ * Optional url parameter device restricts the events to a single device
+ */
+int callback_benoic_stream (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  struct _benoic_event_subscriber * subscriber;
+  
+  if (user_data == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_stream - Error, user_data is NULL");
+    return U_CALLBACK_ERROR;
+  }
+  
+  if (((struct _benoic_config *)user_data)->event_bus.disabled) {
+    set_response_json_body_and_clean(response, 503, json_pack("{ss}", "error", "live events stream disabled"));
+    return U_CALLBACK_CONTINUE;
+  }
+  
+  subscriber = add_event_subscriber(&((struct _benoic_config *)user_data)->event_bus, u_map_get(request->map_url, "device"));
+  if (subscriber == NULL) {
+    set_response_json_body_and_clean(response, 503, json_pack("{ss}", "error", "too many streams"));
+  } else if (ulfius_set_stream_response(response, 200, &stream_event_subscriber, &remove_event_subscriber, U_STREAM_SIZE_UNKOWN, BENOIC_STREAM_BLOCK_SIZE, subscriber) == U_OK) {
+    u_map_put(response->map_header, "Content-Type", "text/event-stream");
+    u_map_put(response->map_header, "Cache-Control", "no-cache");
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_stream - Error setting stream response");
+    remove_event_subscriber(subscriber);
+    response->status = 500;
+  }
+  return U_CALLBACK_CONTINUE;
+}
+
+/**
+ * Changes of elements values and devices status after the sequence number since
+ * Optional url parameter device restricts the changes to a single device
+ */
+int callback_benoic_changes (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  json_t * changes;
+  json_int_t since = 0;
+  const char * str_since = u_map_get(request->map_url, "since");
+  char * endptr = NULL;
+  
+  if (user_data == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_changes - Error, user_data is NULL");
+    return U_CALLBACK_ERROR;
+  }
+  
+  if (str_since != NULL) {
+    since = strtoll(str_since, &endptr, 10);
+    if (*str_since == '\0' || *endptr != '\0' || since < 0) {
+      set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "since parameter must be a positive sequence number"));
+      return U_CALLBACK_CONTINUE;
+    }
+  }
+  changes = get_changes_since((struct _benoic_config *)user_data, since, u_map_get(request->map_url, "device"));
+  if (changes != NULL) {
+    set_response_json_body_and_clean(response, 200, changes);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_changes - Error getting changes");
+    response->status = 500;
+  }
+  return U_CALLBACK_CONTINUE;
+}
+
+int callback_benoic_device_element_get (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  json_t * device, * result = NULL;
+  int element_type, timed_out = 0;
+  long int max_age = 0, timeout;
+  char * endptr = NULL;
+  
+  if (user_data == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_get - Error, user_data is NULL");
+    return U_CALLBACK_ERROR;
+  } else {
+    device = get_device((struct _benoic_config *)user_data, u_map_get(request->map_url, "device_name"));
+    if (device == NULL) {
+      response->status = 404;
+    } else if (json_object_get(device, "enabled") == json_false()) {
+      json_decref(device);
+      set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "device disabled"));
+    } else if (json_object_get(device, "connected") == json_false()) {
+      json_decref(device);
+      set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "device disconnected"));
+    } else {
+      if (u_map_get(request->map_url, "max_age") != NULL) {
+        max_age = strtol(u_map_get(request->map_url, "max_age"), &endptr, 10);
+      }
+      element_type = element_type_from_string(u_map_get(request->map_url, "element_type"));
+      if (element_type == BENOIC_ELEMENT_TYPE_NONE) {
+        set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "element type incorrect"));
+      } else if (max_age < 0 || (endptr != NULL && (*endptr != '\0' || endptr == u_map_get(request->map_url, "max_age")))) {
+        set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "max_age parameter must be a positive number of seconds"));
+      } else {
+        timeout = get_request_timeout((struct _benoic_config *)user_data, request);
+        // A value recent enough is returned without calling the device, so without admission
+        if (max_age > 0) {
+          result = get_element_cached((struct _benoic_config *)user_data, device, element_type, u_map_get(request->map_url, "element_name"), (time_t)max_age);
+        }
+        if (result == NULL) {
+          if (admit_request((struct _benoic_config *)user_data, device, &timeout, response) != B_OK) {
+            json_decref(device);
+            return U_CALLBACK_CONTINUE;
+          }
+          result = get_element((struct _benoic_config *)user_data, device, element_type, u_map_get(request->map_url, "element_name"), (time_t)max_age, timeout, &timed_out);
+          device_slot_release((struct _benoic_config *)user_data, device);
+        }
+        if (result != NULL) {
+          set_response_json_body_and_clean(response, 200, result);
+        } else if (timed_out) {
+          set_response_json_body_and_clean(response, 504, json_pack("{ss}", "error", "timeout"));
+        } else {
+          response->status = 404;
+        }
+      }
+      json_decref(device);
+    }
+  }
+  return U_CALLBACK_CONTINUE;
+}
+
+int callback_benoic_device_element_put (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  json_t * device, * element = NULL, * valid;
+  int element_type = BENOIC_ELEMENT_TYPE_NONE;
+  json_t * json_body = ulfius_get_json_body_request(request, NULL);
+  
+  if (json_body == NULL) {
+    set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "invalid input json format"));
+    return U_CALLBACK_CONTINUE;
+  } else if (user_data == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_element_put - Error, user_data is NULL");
+    json_decref(json_body);
+    return U_CALLBACK_ERROR;
+  } else {
+    device = get_device((struct _benoic_config *)user_data, u_map_get(request->map_url, "device_name"));
+    if (device == NULL) {
+      response->status = 404;
+    } else {
       if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "sensor")) {
         element_type = BENOIC_ELEMENT_TYPE_SENSOR;
       } else if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "switch")) {
@@ -752,10 +1563,12 @@ int callback_benoic_device_element_put (const struct _u_request * request, struc
 }
 
 int callback_benoic_device_element_set (const struct _u_request * request, struct _u_response * response, void * user_data) {
-  json_t * device, * element = NULL;
-  int element_type = BENOIC_ELEMENT_TYPE_NONE, i_command, res = 0;
-  float f_command;
-  char * endptr;
+  json_t * device, * result;
+  struct _benoic_device_limits limits;
+  json_int_t job_id;
+  long retry_after = 1, timeout;
+  int element_type = element_type_from_string(u_map_get(request->map_url, "element_type"));
+  const char * prefer = u_map_get_case(request->map_header, "Prefer");
   
   if (user_data == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_device_element_set - Error, user_data is NULL");
@@ -768,73 +1581,573 @@ int callback_benoic_device_element_set (const struct _u_request * request, struc
       set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "device disabled"));
     } else if (json_object_get(device, "connected") == json_false()) {
       set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "device disconnected"));
+    } else if (element_type == BENOIC_ELEMENT_TYPE_NONE) {
+      set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "element type incorrect"));
+    } else if (0 == o_strcmp(u_map_get(request->map_url, "async"), "1") || (prefer != NULL && strstr(prefer, "respond-async") != NULL)) {
+      // The command is run by a worker, the client gets the result with the job id
+      // The request is accepted without waiting, the worker takes the slot of the device when it runs the command,
+      // so the pending jobs of the device are limited by max_queued instead
+      if (device_health_check((struct _benoic_config *)user_data, device, &retry_after) != B_OK) {
+        set_response_unavailable(response, retry_after);
+      } else if (device_rate_check((struct _benoic_config *)user_data, device, &retry_after) != B_OK) {
+        set_response_too_many_requests(response, retry_after);
+      } else {
+        get_device_limits((struct _benoic_config *)user_data, device, &limits);
+        job_id = add_job(&((struct _benoic_config *)user_data)->job_queue, device, element_type, u_map_get(request->map_url, "element_name"), u_map_get(request->map_url, "command"), u_map_get(request->map_url, "mode"), limits.max_concurrency>0?limits.max_queued + 1:0);
+        if (job_id > 0) {
+          set_response_json_body_and_clean(response, 202, json_pack("{sI}", "job", job_id));
+        } else if (job_id < 0) {
+          set_response_too_many_requests(response, 1);
+        } else {
+          set_response_json_body_and_clean(response, 503, json_pack("{ss}", "error", "too many jobs"));
+        }
+      }
     } else {
-      if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "sensor")) {
-        element_type = BENOIC_ELEMENT_TYPE_SENSOR;
-      } else if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "switch")) {
-        element_type = BENOIC_ELEMENT_TYPE_SWITCH;
-      } else if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "dimmer")) {
-        element_type = BENOIC_ELEMENT_TYPE_DIMMER;
-      } else if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "heater")) {
-        element_type = BENOIC_ELEMENT_TYPE_HEATER;
+      timeout = get_request_timeout((struct _benoic_config *)user_data, request);
+      if (admit_request((struct _benoic_config *)user_data, device, &timeout, response) == B_OK) {
+        result = device_send_command((struct _benoic_config *)user_data, device, element_type, u_map_get(request->map_url, "element_name"), u_map_get(request->map_url, "command"), u_map_get(request->map_url, "mode"), timeout);
+        device_slot_release((struct _benoic_config *)user_data, device);
+        response->status = json_integer_value(json_object_get(result, "status"));
+        json_object_del(result, "status");
+        if (json_object_size(result) > 0) {
+          set_response_json_body_and_clean(response, response->status, json_copy(result));
+        }
+        json_decref(result);
       }
-      if (element_type != BENOIC_ELEMENT_TYPE_NONE) {
-        element = get_element_data((struct _benoic_config *)user_data, device, element_type, u_map_get(request->map_url, "element_name"), 0);
-        if (element != NULL) {
+    }
+    json_decref(device);
+    return U_CALLBACK_CONTINUE;
+  }
+}
+
+/**
+ * Get the status and the result of an asynchronous command
+ */
+int callback_benoic_job_get (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  json_t * job;
+  
+  if (user_data == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_job_get - Error, user_data is NULL");
+    return U_CALLBACK_ERROR;
+  }
+  
+  job = get_job(&((struct _benoic_config *)user_data)->job_queue, strtoll(u_map_get(request->map_url, "job_id"), NULL, 10));
+  if (job == NULL) {
+    set_response_json_body_and_clean(response, 404, json_pack("{ss}", "error", "job not found"));
+  } else {
+    set_response_json_body_and_clean(response, 200, job);
+  }
+  return U_CALLBACK_CONTINUE;
+}
+
+/**
+ * Run all the commands of a batch sent to the same device, in order
+ */
+void * thread_device_batch_run(void * args) {
+  struct _benoic_device_batch * batch = (struct _benoic_device_batch *)args;
+  json_t * device = get_device(batch->config, batch->device_name), * command, * result;
+  struct timespec deadline;
+  size_t index;
+  long remaining = 0;
+  int res;
+  
+  // The timeout applies to the whole batch of the device
+  if (batch->timeout > 0) {
+    set_deadline(&deadline, batch->timeout);
+  }
+  // The commands are sent in one module call if the module can
+  if (device != NULL && json_object_get(device, "enabled") == json_true() && json_object_get(device, "connected") == json_true() &&
+      json_array_size(batch->commands) > 1 && module_has_set_elements(get_device_type(batch->config, device))) {
+    remaining = batch->timeout>0?batch->timeout:0;
+    res = device_admission_enter(batch->config, device, &remaining, NULL);
+    if (res == B_OK) {
+      result = device_send_command_list(batch->config, device, batch->commands, remaining);
+      device_slot_release(batch->config, device);
+      if (json_is_array(json_object_get(result, "results"))) {
+        json_array_extend(batch->results, json_object_get(result, "results"));
+      } else {
+        json_array_foreach(batch->commands, index, command) {
+          json_array_append(batch->results, result);
+        }
+      }
+      json_decref(result);
+    } else {
+      json_array_foreach(batch->commands, index, command) {
+        if (res == B_ERROR_BUSY) {
+          json_array_append_new(batch->results, json_pack("{siss}", "status", 429, "error", "too many requests"));
+        } else if (res == B_ERROR_UNAVAILABLE) {
+          json_array_append_new(batch->results, json_pack("{siss}", "status", 503, "error", "device unavailable"));
+        } else if (res == B_ERROR_TIMEOUT) {
+          json_array_append_new(batch->results, json_pack("{siss}", "status", 504, "error", "timeout"));
+        } else {
+          json_array_append_new(batch->results, json_pack("{si}", "status", 500));
+        }
+      }
+    }
+    json_decref(device);
+    return NULL;
+  }
+  json_array_foreach(batch->commands, index, command) {
+    if (device == NULL) {
+      result = json_pack("{siss}", "status", 404, "error", "device not found");
+    } else if (json_object_get(device, "enabled") == json_false()) {
+      result = json_pack("{siss}", "status", 400, "error", "device disabled");
+    } else if (json_object_get(device, "connected") == json_false()) {
+      result = json_pack("{siss}", "status", 400, "error", "device disconnected");
+    } else if (batch->timeout > 0 && (remaining = get_deadline_remaining(&deadline)) == 0) {
+      result = json_pack("{siss}", "status", 504, "error", "timeout");
+    } else {
+      res = device_admission_enter(batch->config, device, &remaining, NULL);
+      if (res == B_OK) {
+        result = device_send_command(batch->config, 
+                                     device, 
+                                     element_type_from_string(json_string_value(json_object_get(command, "element_type"))), 
+                                     json_string_value(json_object_get(command, "element_name")), 
+                                     json_string_value(json_object_get(command, "command")), 
+                                     json_string_value(json_object_get(command, "mode")), 
+                                     remaining);
+        device_slot_release(batch->config, device);
+      } else if (res == B_ERROR_BUSY) {
+        result = json_pack("{siss}", "status", 429, "error", "too many requests");
+      } else if (res == B_ERROR_UNAVAILABLE) {
+        result = json_pack("{siss}", "status", 503, "error", "device unavailable");
+      } else if (res == B_ERROR_TIMEOUT) {
+        result = json_pack("{siss}", "status", 504, "error", "timeout");
+      } else {
+        result = json_pack("{si}", "status", 500);
+      }
+    }
+    if (result == NULL) {
+      result = json_pack("{siss}", "status", 500, "error", "internal error");
+    }
+    json_array_append_new(batch->results, result);
+  }
+  json_decref(device);
+  return NULL;
+}
+
+/**
+ * Run the batches of the pool until there is none left
+ */
+void * thread_device_batch_pool_run(void * args) {
+  struct _benoic_device_batch_pool * pool = (struct _benoic_device_batch_pool *)args;
+  struct _benoic_device_batch * batch;
+  json_t * command;
+  size_t index;
+  
+  while (1) {
+    pthread_mutex_lock(&pool->lock);
+    batch = pool->next<pool->nb_batches?&pool->batch_list[pool->next++]:NULL;
+    pthread_mutex_unlock(&pool->lock);
+    if (batch == NULL) {
+      break;
+    }
+    // The timeout applies to the whole request, a batch waiting for a worker uses what's left of it
+    if (batch->timeout > 0 && (batch->timeout = get_deadline_remaining(&pool->deadline)) == 0) {
+      json_array_foreach(batch->commands, index, command) {
+        json_array_append_new(batch->results, json_pack("{siss}", "status", 504, "error", "timeout"));
+      }
+    } else {
+      pool->thread_run((void *)batch);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Group the entries by device and run thread_run for each device concurrently,
+ * at most config->fanout_concurrency devices at the same time
+ * j_entries contains the entries to run, or json null for the invalid ones
+ * the result of each entry is set in j_results, at the same index as the entry
+ * return B_OK on success
+ */
+int run_device_batch(struct _benoic_config * config, json_t * j_entries, json_t * j_results, void * (* thread_run) (void *), const time_t max_age, const long timeout) {
+  json_t * j_devices = json_object(), * j_entry, * j_indexes, * j_index, * j_result;
+  struct _benoic_device_batch_pool pool;
+  pthread_t * thread_list;
+  const char * device_name;
+  size_t index, index_entry, nb_threads, nb_started = 0, i;
+  
+  if (j_devices == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "run_device_batch - Error allocating resources for j_devices");
+    return B_ERROR_MEMORY;
+  }
+  
+  // Group entries by device
+  json_array_foreach(j_entries, index, j_entry) {
+    if (json_is_object(j_entry)) {
+      if (json_object_get(j_devices, json_string_value(json_object_get(j_entry, "device"))) == NULL) {
+        json_object_set_new(j_devices, json_string_value(json_object_get(j_entry, "device")), json_array());
+      }
+      json_array_append_new(json_object_get(j_devices, json_string_value(json_object_get(j_entry, "device"))), json_integer(index));
+    }
+  }
+  
+  pool.nb_batches = json_object_size(j_devices);
+  if (pool.nb_batches > 0) {
+    nb_threads = config->fanout_concurrency>0?config->fanout_concurrency:BENOIC_FANOUT_DEFAULT_CONCURRENCY;
+    if (nb_threads > pool.nb_batches) {
+      nb_threads = pool.nb_batches;
+    }
+    pool.batch_list = o_malloc(pool.nb_batches * sizeof(struct _benoic_device_batch));
+    thread_list = o_malloc(nb_threads * sizeof(pthread_t));
+    if (pool.batch_list == NULL || thread_list == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "run_device_batch - Error allocating resources for batch_list or thread_list");
+      o_free(pool.batch_list);
+      o_free(thread_list);
+      json_decref(j_devices);
+      return B_ERROR_MEMORY;
+    }
+    pool.next = 0;
+    pool.thread_run = thread_run;
+    if (timeout > 0) {
+      set_deadline(&pool.deadline, timeout);
+    }
+    
+    i = 0;
+    json_object_foreach(j_devices, device_name, j_indexes) {
+      pool.batch_list[i].config = config;
+      pool.batch_list[i].device_name = device_name;
+      pool.batch_list[i].max_age = max_age;
+      pool.batch_list[i].timeout = timeout;
+      pool.batch_list[i].commands = json_array();
+      pool.batch_list[i].results = json_array();
+      json_array_foreach(j_indexes, index, j_index) {
+        json_array_append(pool.batch_list[i].commands, json_array_get(j_entries, json_integer_value(j_index)));
+      }
+      i++;
+    }
+    
+    pthread_mutex_init(&pool.lock, NULL);
+    for (nb_started = 0; nb_started < nb_threads; nb_started++) {
+      if (pthread_create(&thread_list[nb_started], NULL, thread_device_batch_pool_run, (void *)&pool)) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "run_device_batch - Error creating thread, %zu threads running", nb_started);
+        break;
+      }
+    }
+    
+    // Without any thread, the devices are run sequentially
+    if (nb_started == 0) {
+      thread_device_batch_pool_run((void *)&pool);
+    }
+    for (i=0; i<nb_started; i++) {
+      pthread_join(thread_list[i], NULL);
+    }
+    pthread_mutex_destroy(&pool.lock);
+    
+    // Put results in the entries order, an entry without a proper result is an error
+    for (i=0; i<pool.nb_batches; i++) {
+      j_indexes = json_object_get(j_devices, pool.batch_list[i].device_name);
+      json_array_foreach(j_indexes, index_entry, j_index) {
+        j_result = json_array_get(pool.batch_list[i].results, index_entry);
+        if (json_is_integer(json_object_get(j_result, "status")) && json_integer_value(json_object_get(j_result, "status")) > 0) {
+          json_array_set(j_results, json_integer_value(j_index), j_result);
+        } else {
+          json_array_set_new(j_results, json_integer_value(j_index), json_pack("{siss}", "status", 500, "error", "internal error"));
+        }
+      }
+      json_decref(pool.batch_list[i].commands);
+      json_decref(pool.batch_list[i].results);
+    }
+    o_free(pool.batch_list);
+    o_free(thread_list);
+  }
+  json_decref(j_devices);
+  return B_OK;
+}
+
+/**
+ * Send a list of commands to elements
+ * Commands are grouped by device, each device runs its commands in order
+ * and the different devices run concurrently
+ */
+int callback_benoic_element_command_batch (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  json_t * json_body = ulfius_get_json_body_request(request, NULL), * j_entries, * j_command, * j_cmd, * j_results;
+  char * s_command;
+  size_t index;
+  
+  if (json_body == NULL || !json_is_array(json_body)) {
+    set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "invalid input json format, must be an array of commands"));
+    json_decref(json_body);
+    return U_CALLBACK_CONTINUE;
+  } else if (user_data == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_element_command_batch - Error, user_data is NULL");
+    json_decref(json_body);
+    return U_CALLBACK_ERROR;
+  }
+  
+  j_results = json_array();
+  j_entries = json_array();
+  if (j_results == NULL || j_entries == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_element_command_batch - Error allocating resources for j_results or j_entries");
+    json_decref(j_results);
+    json_decref(j_entries);
+    json_decref(json_body);
+    return U_CALLBACK_ERROR;
+  }
+  
+  // Check and normalize commands
+  json_array_foreach(json_body, index, j_command) {
+    if (!json_is_object(j_command) || 
+        !json_is_string(json_object_get(j_command, "device")) || 
+        !json_is_string(json_object_get(j_command, "element_type")) || 
+        !json_is_string(json_object_get(j_command, "element_name")) || 
+        (!json_is_string(json_object_get(j_command, "command")) && !json_is_number(json_object_get(j_command, "command"))) || 
+        (json_object_get(j_command, "mode") != NULL && !json_is_string(json_object_get(j_command, "mode")))) {
+      json_array_append_new(j_results, json_pack("{siss}", "status", 400, "error", "command must have a device, an element_type, an element_name, a command and optionally a mode"));
+      json_array_append_new(j_entries, json_null());
+    } else {
+      if (json_is_string(json_object_get(j_command, "command"))) {
+        s_command = o_strdup(json_string_value(json_object_get(j_command, "command")));
+      } else if (json_is_integer(json_object_get(j_command, "command"))) {
+        s_command = msprintf("%" JSON_INTEGER_FORMAT, json_integer_value(json_object_get(j_command, "command")));
+      } else {
+        s_command = msprintf("%f", json_number_value(json_object_get(j_command, "command")));
+      }
+      j_cmd = json_pack("{sOsOsOss}", 
+                        "device", json_object_get(j_command, "device"), 
+                        "element_type", json_object_get(j_command, "element_type"), 
+                        "element_name", json_object_get(j_command, "element_name"), 
+                        "command", s_command);
+      if (json_object_get(j_command, "mode") != NULL) {
+        json_object_set(j_cmd, "mode", json_object_get(j_command, "mode"));
+      }
+      o_free(s_command);
+      json_array_append_new(j_results, json_null());
+      json_array_append_new(j_entries, j_cmd);
+    }
+  }
+  
+  if (run_device_batch((struct _benoic_config *)user_data, j_entries, j_results, thread_device_batch_run, 0, get_request_timeout((struct _benoic_config *)user_data, request)) == B_OK) {
+    set_response_json_body_and_clean(response, 200, j_results);
+  } else {
+    json_decref(j_results);
+    response->status = 500;
+  }
+  json_decref(j_entries);
+  json_decref(json_body);
+  return U_CALLBACK_CONTINUE;
+}
+
+/**
+ * Read the values of all the elements of a batch sent to the same device
+ * Elements are read from the cache if possible, then with an overview of the device
+ * if enough elements are missing, or one by one otherwise
+ */
+void * thread_device_read_run(void * args) {
+  struct _benoic_device_batch * batch = (struct _benoic_device_batch *)args;
+  json_t * device = get_device(batch->config, batch->device_name), * j_read, * element, * overview = NULL, * j_element_list, * element_list = NULL;
+  struct timespec deadline;
+  size_t index, i, nb_missing = 0;
+  long remaining = 0;
+  int element_type, timed_out = 0, res = B_OK;
+  const char * overview_key;
+  
+  // The timeout applies to the whole batch of the device
+  if (batch->timeout > 0) {
+    set_deadline(&deadline, batch->timeout);
+  }
+  // Read from the cache first
+  json_array_foreach(batch->commands, index, j_read) {
+    element_type = element_type_from_string(json_string_value(json_object_get(j_read, "element_type")));
+    if (device == NULL) {
+      json_array_append_new(batch->results, json_pack("{siss}", "status", 404, "error", "device not found"));
+    } else if (json_object_get(device, "enabled") == json_false()) {
+      json_array_append_new(batch->results, json_pack("{siss}", "status", 400, "error", "device disabled"));
+    } else if (json_object_get(device, "connected") == json_false()) {
+      json_array_append_new(batch->results, json_pack("{siss}", "status", 400, "error", "device disconnected"));
+    } else if (element_type == BENOIC_ELEMENT_TYPE_NONE) {
+      json_array_append_new(batch->results, json_pack("{siss}", "status", 400, "error", "element type incorrect"));
+    } else {
+      element = get_element_cached(batch->config, device, element_type, json_string_value(json_object_get(j_read, "element_name")), batch->max_age);
+      if (element != NULL) {
+        json_array_append_new(batch->results, json_pack("{siso}", "status", 200, "element", element));
+      } else {
+        json_array_append_new(batch->results, json_null());
+        nb_missing++;
+      }
+    }
+  }
+  
+  // Read the missing elements in one module call if the module can
+  if (nb_missing > 1 && module_has_get_elements(get_device_type(batch->config, device))) {
+    j_element_list = json_array();
+    json_array_foreach(batch->commands, index, j_read) {
+      if (json_is_null(json_array_get(batch->results, index))) {
+        json_array_append_new(j_element_list, json_pack("{siss}", 
+                                                        "element_type", element_type_from_string(json_string_value(json_object_get(j_read, "element_type"))), 
+                                                        "element_name", json_string_value(json_object_get(j_read, "element_name"))));
+      }
+    }
+    if (batch->timeout > 0 && (remaining = get_deadline_remaining(&deadline)) == 0) {
+      res = B_ERROR_TIMEOUT;
+    } else {
+      res = device_admission_enter(batch->config, device, &remaining, NULL);
+      if (res == B_OK) {
+        element_list = get_element_list(batch->config, device, j_element_list, remaining, &timed_out);
+        device_slot_release(batch->config, device);
+        if (timed_out) {
+          res = B_ERROR_TIMEOUT;
+        }
+      }
+    }
+    i = 0;
+    json_array_foreach(batch->commands, index, j_read) {
+      if (json_is_null(json_array_get(batch->results, index))) {
+        element = json_array_get(element_list, i++);
+        if (json_is_object(element)) {
+          json_array_set_new(batch->results, index, json_pack("{siso}", "status", 200, "element", json_copy(element)));
+        } else if (res == B_ERROR_BUSY) {
+          json_array_set_new(batch->results, index, json_pack("{siss}", "status", 429, "error", "too many requests"));
+        } else if (res == B_ERROR_UNAVAILABLE) {
+          json_array_set_new(batch->results, index, json_pack("{siss}", "status", 503, "error", "device unavailable"));
+        } else if (res == B_ERROR_TIMEOUT) {
+          json_array_set_new(batch->results, index, json_pack("{siss}", "status", 504, "error", "timeout"));
+        } else {
+          json_array_set_new(batch->results, index, json_pack("{siss}", "status", 404, "error", "element not found"));
+        }
+      }
+    }
+    json_decref(element_list);
+    json_decref(j_element_list);
+    json_decref(device);
+    return NULL;
+  }
+  
+  // Get the device overview if many elements are missing
+  if (nb_missing >= BENOIC_BULK_READ_OVERVIEW_MIN) {
+    if (batch->timeout > 0 && (remaining = get_deadline_remaining(&deadline)) == 0) {
+      timed_out = 1;
+    } else {
+      res = device_admission_enter(batch->config, device, &remaining, NULL);
+      if (res == B_OK) {
+        overview = overview_device(batch->config, device, remaining, &timed_out);
+        device_slot_release(batch->config, device);
+      } else if (res == B_ERROR_TIMEOUT) {
+        timed_out = 1;
+      }
+    }
+  }
+  
+  if (nb_missing > 0) {
+    json_array_foreach(batch->commands, index, j_read) {
+      if (json_is_null(json_array_get(batch->results, index))) {
+        element_type = element_type_from_string(json_string_value(json_object_get(j_read, "element_type")));
+        if (overview != NULL) {
           switch (element_type) {
+            case BENOIC_ELEMENT_TYPE_SENSOR:
+              overview_key = "sensors";
+              break;
             case BENOIC_ELEMENT_TYPE_SWITCH:
-              i_command = strtol(u_map_get(request->map_url, "command"), &endptr, 10);
-              if (*endptr == '\0' && i_command >= -1 && i_command <= 1) {
-                if (set_switch((struct _benoic_config *)user_data, device, u_map_get(request->map_url, "element_name"), i_command) != B_OK) {
-                  response->status = 500;
-                }
-              } else {
-                set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "incorrect command, must be -1 (toggle), 0 (off) or 1 (on)"));
-              }
+              overview_key = "switches";
               break;
             case BENOIC_ELEMENT_TYPE_DIMMER:
-              i_command = strtol(u_map_get(request->map_url, "command"), &endptr, 10);
-              if (*endptr == '\0' && i_command >= 0 && i_command <= 101) {
-                json_t * j_result = set_dimmer((struct _benoic_config *)user_data, device, u_map_get(request->map_url, "element_name"), i_command);
-                if (json_integer_value(json_object_get(j_result, "result")) != B_OK) {
-                  response->status = 500;
-                } else {
-                  json_object_del(j_result, "result");
-                  set_response_json_body_and_clean(response, 200, json_copy(j_result));
-                }
-                json_decref(j_result);
-              } else {
-                set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "incorrect command, must be between 0 and 101"));
-              }
-              break;
-            case BENOIC_ELEMENT_TYPE_HEATER:
-              f_command = strtof(u_map_get(request->map_url, "command"), &endptr);
-              if (*endptr == '\0') {
-                res = set_heater((struct _benoic_config *)user_data, device, u_map_get(request->map_url, "element_name"), u_map_get(request->map_url, "mode"), f_command);
-                if (res == B_ERROR_PARAM) {
-                  response->status = 400;
-                } else if (res != B_OK) {
-                  response->status = 500;
-                }
-              } else {
-                set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "mode (optional) must be off, manual or auto, command must be a numeric value"));
-              }
+              overview_key = "dimmers";
               break;
             default:
-            set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "element type incorrect"));
+              overview_key = "heaters";
               break;
           }
-          json_decref(element);
+          element = json_copy(json_object_get(json_object_get(overview, overview_key), json_string_value(json_object_get(j_read, "element_name"))));
+          // A heater is read with its fields at the top level, like get_heater gives it
+          if (element_type == BENOIC_ELEMENT_TYPE_HEATER && json_is_object(json_object_get(element, "value"))) {
+            json_object_update(element, json_object_get(element, "value"));
+            json_object_del(element, "value");
+          }
+        } else if (!timed_out && (batch->timeout <= 0 || (remaining = get_deadline_remaining(&deadline)) > 0)) {
+          element = NULL;
+          res = device_admission_enter(batch->config, device, &remaining, NULL);
+          if (res == B_OK) {
+            element = get_element(batch->config, device, element_type, json_string_value(json_object_get(j_read, "element_name")), 0, remaining, &timed_out);
+            device_slot_release(batch->config, device);
+          } else if (res == B_ERROR_TIMEOUT) {
+            timed_out = 1;
+          }
         } else {
-          set_response_json_body_and_clean(response, 404, json_pack("{ss}", "error", "element not found"));
+          element = NULL;
+          res = B_ERROR_TIMEOUT;
+          timed_out = 1;
+        }
+        if (element != NULL) {
+          json_array_set_new(batch->results, index, json_pack("{siso}", "status", 200, "element", element));
+        } else if (res == B_ERROR_BUSY) {
+          json_array_set_new(batch->results, index, json_pack("{siss}", "status", 429, "error", "too many requests"));
+        } else if (res == B_ERROR_UNAVAILABLE) {
+          json_array_set_new(batch->results, index, json_pack("{siss}", "status", 503, "error", "device unavailable"));
+        } else if (timed_out) {
+          json_array_set_new(batch->results, index, json_pack("{siss}", "status", 504, "error", "timeout"));
+        } else {
+          json_array_set_new(batch->results, index, json_pack("{siss}", "status", 404, "error", "element not found"));
         }
-      } else {
-        set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "element type incorrect"));
       }
-      json_decref(device);
     }
+  }
+  json_decref(overview);
+  json_decref(device);
+  return NULL;
+}
+
+/**
+ * Read the values of a list of elements
+ * Elements are grouped by device and the different devices are read concurrently
+ */
+int callback_benoic_element_read_batch (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  json_t * json_body = ulfius_get_json_body_request(request, NULL), * j_entries, * j_read, * j_results;
+  long int max_age = 0;
+  char * endptr;
+  size_t index;
+  
+  if (json_body == NULL || !json_is_array(json_body)) {
+    set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "invalid input json format, must be an array of elements"));
+    json_decref(json_body);
     return U_CALLBACK_CONTINUE;
+  } else if (user_data == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_element_read_batch - Error, user_data is NULL");
+    json_decref(json_body);
+    return U_CALLBACK_ERROR;
   }
+  
+  if (u_map_get(request->map_url, "max_age") != NULL) {
+    max_age = strtol(u_map_get(request->map_url, "max_age"), &endptr, 10);
+    if (*endptr != '\0' || endptr == u_map_get(request->map_url, "max_age") || max_age < 0) {
+      set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "max_age parameter must be a positive number of seconds"));
+      json_decref(json_body);
+      return U_CALLBACK_CONTINUE;
+    }
+  }
+  
+  j_results = json_array();
+  j_entries = json_array();
+  if (j_results == NULL || j_entries == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "callback_benoic_element_read_batch - Error allocating resources for j_results or j_entries");
+    json_decref(j_results);
+    json_decref(j_entries);
+    json_decref(json_body);
+    return U_CALLBACK_ERROR;
+  }
+  
+  json_array_foreach(json_body, index, j_read) {
+    if (!json_is_object(j_read) || 
+        !json_is_string(json_object_get(j_read, "device")) || 
+        !json_is_string(json_object_get(j_read, "element_type")) || 
+        !json_is_string(json_object_get(j_read, "element_name"))) {
+      json_array_append_new(j_results, json_pack("{siss}", "status", 400, "error", "element must have a device, an element_type and an element_name"));
+      json_array_append_new(j_entries, json_null());
+    } else {
+      json_array_append_new(j_results, json_null());
+      json_array_append(j_entries, j_read);
+    }
+  }
+  
+  if (run_device_batch((struct _benoic_config *)user_data, j_entries, j_results, thread_device_read_run, (time_t)max_age, get_request_timeout((struct _benoic_config *)user_data, request)) == B_OK) {
+    set_response_json_body_and_clean(response, 200, j_results);
+  } else {
+    json_decref(j_results);
+    response->status = 500;
+  }
+  json_decref(j_entries);
+  json_decref(json_body);
+  return U_CALLBACK_CONTINUE;
 }
 
 int callback_benoic_device_element_add_tag (const struct _u_request * request, struct _u_response * response, void * user_data) {
@@ -975,6 +2288,20 @@ int callback_benoic_device_element_monitor(const struct _u_request * request, st
         }
         json_object_set_new(params, "to", json_integer(dt_param));
       }
+      if (u_map_get(request->map_url, "field") != NULL) {
+        if (0 != o_strcmp(u_map_get(request->map_url, "element_type"), "heater")) {
+          set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "field parameter is only available for heaters"));
+          json_decref(device);
+          json_decref(params);
+          return U_CALLBACK_CONTINUE;
+        } else if (0 != o_strcmp(u_map_get(request->map_url, "field"), "mode") && 0 != o_strcmp(u_map_get(request->map_url, "field"), "command") && 0 != o_strcmp(u_map_get(request->map_url, "field"), "on")) {
+          set_response_json_body_and_clean(response, 400, json_pack("{ss}", "error", "field parameter must be mode, command or on"));
+          json_decref(device);
+          json_decref(params);
+          return U_CALLBACK_CONTINUE;
+        }
+        json_object_set_new(params, "field", json_string(u_map_get(request->map_url, "field")));
+      }
       if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "sensor")) {
         element_type = BENOIC_ELEMENT_TYPE_SENSOR;
       } else if (0 == o_strcmp(u_map_get(request->map_url, "element_type"), "switch")) {
@@ -31,6 +31,9 @@
 /** Macro to avoid compiler warning when some parameters are unused and that's ok **/
 #define UNUSED(x) (void)(x)
 
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
 #include <jansson.h>
 
 /** Angharad libraries **/
@@ -41,6 +44,8 @@
 #define _HOEL_SQLITE
 #include <hoel.h>
 
+#include "benoic-module.h"
+
 #define B_OK              0
 #define B_ERROR           1
 #define B_ERROR_MEMORY    2
@@ -48,23 +53,81 @@
 #define B_ERROR_DB        4
 #define B_ERROR_IO        5
 #define B_ERROR_NOT_FOUND 6
+#define B_ERROR_TIMEOUT   7
+#define B_ERROR_BUSY      8
+#define B_ERROR_UNAVAILABLE 9
+
+#define BENOIC_TABLE_DEVICE_TYPE    "b_device_type"
+#define BENOIC_TABLE_DEVICE         "b_device"
+#define BENOIC_TABLE_ELEMENT        "b_element"
+#define BENOIC_TABLE_MONITOR        "b_monitor"
+#define BENOIC_TABLE_MONITOR_HEATER "b_monitor_heater"
+
+// Minimum number of elements to read on the same device to use the device overview
+#define BENOIC_BULK_READ_OVERVIEW_MIN 3
+
+// Minimum number of seconds between two updates of the last seen date of a device
+#define BENOIC_LAST_SEEN_RESOLUTION 60
+
+// Number of seconds an element missing in the database is remembered by the element index
+#define BENOIC_ELEMENT_MISSING_TTL 60
+
+// Default time given to each device to answer a global overview, in milliseconds
+#define BENOIC_OVERVIEW_DEFAULT_TIMEOUT 5000
+
+// Live events stream default values
+#define BENOIC_STREAM_DEFAULT_MAX_SUBSCRIBERS 64
+#define BENOIC_STREAM_DEFAULT_QUEUE_SIZE      64
+#define BENOIC_STREAM_DEFAULT_HEARTBEAT       15 // seconds
+#define BENOIC_STREAM_CLOSE_TIMEOUT           5  // seconds
+#define BENOIC_STREAM_BLOCK_SIZE              1024
+
+// Number of changes kept in the changes journal
+#define BENOIC_JOURNAL_DEFAULT_SIZE 1024
+
+// Asynchronous commands default values
+#define BENOIC_JOB_DEFAULT_WORKERS 4
+#define BENOIC_JOB_DEFAULT_MAX     1024
+#define BENOIC_JOB_RETENTION       300 // seconds
+
+#define BENOIC_JOB_STATUS_PENDING 0
+#define BENOIC_JOB_STATUS_RUNNING 1
+#define BENOIC_JOB_STATUS_DONE    2
+
+// Request timeout, in milliseconds, given as an url parameter or a header
+#define BENOIC_REQUEST_TIMEOUT_PARAM  "timeout"
+#define BENOIC_REQUEST_TIMEOUT_HEADER "X-Request-Timeout"
+
+// Locking enforced by benoic around the module calls
+#define BENOIC_CONCURRENCY_THREAD_SAFE 0
+#define BENOIC_CONCURRENCY_DEVICE      1
+#define BENOIC_CONCURRENCY_MODULE      2
+
+// Time given to the calls in progress to a module before its reload is cancelled, in milliseconds
+#define BENOIC_MODULE_RELOAD_DRAIN_TIMEOUT 30000
+
+// Number of devices connected at the same time when benoic starts
+#define BENOIC_CONNECT_DEFAULT_CONCURRENCY 8
+#define BENOIC_FANOUT_DEFAULT_CONCURRENCY 8
 
-#define DEVICE_RESULT_ERROR     0
-#define DEVICE_RESULT_OK        1
-#define DEVICE_RESULT_NOT_FOUND 2
-#define DEVICE_RESULT_TIMEOUT   3
-#define DEVICE_RESULT_PARAM     4
+// Seconds without request before a lazy device is disconnected
+#define BENOIC_LAZY_DEFAULT_IDLE_TIMEOUT 300
 
-#define BENOIC_TABLE_DEVICE_TYPE "b_device_type"
-#define BENOIC_TABLE_DEVICE      "b_device"
-#define BENOIC_TABLE_ELEMENT     "b_element"
-#define BENOIC_TABLE_MONITOR     "b_monitor"
+// Connection supervisor default values, in seconds
+#define BENOIC_SUPERVISOR_TICK                5
+#define BENOIC_SUPERVISOR_DEFAULT_INTERVAL    60
+#define BENOIC_SUPERVISOR_DEFAULT_BACKOFF_MIN 5
+#define BENOIC_SUPERVISOR_DEFAULT_BACKOFF_MAX 300
+#define BENOIC_SUPERVISOR_DEFAULT_TIMEOUT     5000 // milliseconds, used if request_timeout is not set
 
-#define BENOIC_ELEMENT_TYPE_NONE   0
-#define BENOIC_ELEMENT_TYPE_SENSOR 1
-#define BENOIC_ELEMENT_TYPE_SWITCH 2
-#define BENOIC_ELEMENT_TYPE_DIMMER 3
-#define BENOIC_ELEMENT_TYPE_HEATER 4
+// Circuit breaker of the module calls of a device
+#define BENOIC_BREAKER_CLOSED            0 // the module is called
+#define BENOIC_BREAKER_OPEN              1 // the calls fail immediately until the cooldown expires
+#define BENOIC_BREAKER_HALF_OPEN         2 // one call is sent to probe the device, the other ones fail
+#define BENOIC_BREAKER_DEFAULT_THRESHOLD 5  // consecutive failed calls before the circuit opens
+#define BENOIC_BREAKER_DEFAULT_COOLDOWN  30 // seconds before the device is probed again
+#define BENOIC_BREAKER_NO_RESULT         -1 // the call tells nothing about the device, e.g. an asynchronous call started
+#define BENOIC_BREAKER_REJECTED          -2 // the module wasn't called, the device is down or its circuit is open
 
 #define BENOIC_STATUS_RUN      0
 #define BENOIC_STATUS_STOPPING 1
@@ -73,6 +136,11 @@
 /**
  * Structure for a device type
  * contains the handle to the library and handles for all the functions
+ * module is set for the modules exporting a struct _b_device_module,
+ * the element functions of the older modules are used otherwise
+ * concurrency is the contract declared by the module, module_lock is used if calls to the module must not overlap
+ * gate counts the calls in progress, so the module can be reloaded when there is none left
+ * dl_handle is NULL if the module couldn't be opened again after a reload
  */
 struct _device_type {
   char   * uid;
@@ -80,6 +148,14 @@ struct _device_type {
   char   * name;
   char   * description;
   json_t * options;
+  json_t * limits;
+  char   * file_path;
+  
+  unsigned int abi_version;
+  const struct _b_device_module * module;
+  int                          concurrency;
+  pthread_mutex_t            * module_lock;
+  struct _benoic_module_gate * gate;
   
   // dl files functions available
   json_t * (* b_device_type_init) ();
@@ -95,6 +171,22 @@ struct _device_type {
   json_t * (* b_device_get_heater) (json_t * device, const char * heater_name, void * device_ptr);
   json_t * (* b_device_set_heater) (json_t * device, const char * heater_name, const char * mode, const float command, void * device_ptr);
   int      (* b_device_has_element) (json_t * device, int element_type, const char * element_name, void * device_ptr);
+  
+  // dl files optional functions
+  void     (* b_device_type_set_value_callback) (b_device_value_callback callback, void * cls);
+  void     (* b_device_type_set_alert_callback) (b_device_alert_callback callback, void * cls);
+};
+
+/**
+ * Gate of the calls to a module
+ * A reload closes the gate: the new calls wait until it's open again, except the ones of the reloading thread
+ */
+struct _benoic_module_gate {
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  unsigned int    nb_calls;
+  int             reloading;
+  pthread_t       reload_thread;
 };
 
 struct _benoic_device_data {
@@ -102,13 +194,385 @@ struct _benoic_device_data {
   void * device_ptr;
 };
 
+/**
+ * Devices to connect when benoic starts, shared by the connection threads
+ * Each thread takes the next device of device_list until there is none left
+ * done_list tells which devices are connected, closed is set when connect_enabled_devices stops waiting
+ * The pool is free'd by the last of connect_enabled_devices and the threads to release it
+ */
+struct _benoic_connect_pool {
+  struct _benoic_config * config;
+  pthread_mutex_t         lock;
+  pthread_cond_t          cond;
+  json_t                * device_list;
+  int                   * done_list;
+  size_t                  next;
+  long                    timeout;
+  size_t                  nb_running;
+  int                     nb_holds;
+  int                     closed;
+};
+
+/**
+ * In-memory index of the elements stored in the database
+ * Used to resolve (device, type, name) into be_id without a SQL round trip
+ * and to keep the data, the last known value and the monitor settings of each element
+ * data is read from the database on the first use and dropped when the element is modified
+ * An entry with element_id 0 is an element missing in the database since missing_date
+ */
+struct _benoic_element_index {
+  char          * device_name;
+  int             element_type;
+  char          * element_name;
+  json_int_t      element_id;
+  time_t          missing_date;
+  int             monitored;
+  json_int_t      monitored_every;
+  time_t          monitored_next;
+  json_t        * data;
+  json_t        * value;
+  time_t          value_date;
+  unsigned long   value_generation;
+};
+
+struct _benoic_event_bus;
+
+/**
+ * Change kept in the journal
+ */
+struct _benoic_journal_entry {
+  json_int_t   seq;
+  time_t       date;
+  char       * event;
+  char       * device_name;
+  json_t     * data;
+};
+
+/**
+ * Client of the live events stream
+ * events are queued in a ring buffer, if it's full the oldest event is dropped
+ * and the client receives a resync event
+ */
+struct _benoic_event_subscriber {
+  struct _benoic_event_bus * bus;
+  char                     * device_name;
+  pthread_mutex_t            lock;
+  pthread_cond_t             cond;
+  char                    ** queue;
+  size_t                     queue_size;
+  size_t                     queue_start;
+  size_t                     queue_count;
+  char                     * pending;
+  size_t                     pending_offset;
+  int                        heartbeat;
+  int                        overflow;
+  int                        closed;
+};
+
+/**
+ * Dispatch events to the live stream subscribers and keep the last changes in a journal
+ * Lock order is the bus lock, then the subscriber lock
+ */
+struct _benoic_event_bus {
+  pthread_mutex_t                    lock;
+  pthread_cond_t                     cond;
+  struct _benoic_event_subscriber ** subscriber_list;
+  size_t                             nb_subscribers;
+  size_t                             max_subscribers;
+  size_t                             queue_size;
+  int                                heartbeat;
+  int                                disabled;
+  int                                closed;
+  struct _benoic_journal_entry     * journal;
+  size_t                             journal_size;
+  size_t                             journal_start;
+  size_t                             journal_count;
+  json_int_t                         last_seq;
+};
+
+/**
+ * Command waiting in the queue of a device
+ * A pending command is superseded by a newer command sent to the same element
+ * command_list is set for a list of commands sent together, they are never superseded
+ * nb_held_slots is the number of slots of the device kept for the callers who gave up, until the command returns
+ */
+struct _benoic_device_command {
+  int                       element_type;
+  char                    * element_name;
+  char                    * mode;
+  struct _b_element_command element_command;
+  json_t                  * command_list;
+  json_t                  * result;
+  int                       done;
+  int                       refcount;
+  unsigned int              nb_held_slots;
+  json_t                  * device;
+  struct _benoic_config   * config;
+};
+
+/**
+ * Admission limits of a device
+ * A value of 0 means no limit
+ */
+struct _benoic_device_limits {
+  double       rate_limit;      // requests per second
+  unsigned int rate_burst;      // requests allowed at once when the device was idle
+  unsigned int max_concurrency; // requests sent to the device at the same time
+  unsigned int max_queued;      // requests waiting for their turn when max_concurrency is reached
+};
+
+/**
+ * Runtime state of a device
+ * Commands are run one at a time, in the order they were queued
+ * Requests are admitted according to the limits of the device
+ * module_lock keeps the module calls for the device from overlapping if the module requires it
+ * linked is true when the device is connected, link_busy while link_thread connects or disconnects it,
+ * a lazy device is disconnected when it had no module call for idle_timeout seconds
+ * down is set by the supervisor when the device stopped answering, until it's connected again,
+ * next_check is the date of its next ping or reconnection attempt, reconnecting is set while it runs
+ * last_seen_saved is the date last_seen was last written in the database
+ * breaker_state is the circuit breaker of the module calls, opened at breaker_opened after breaker_failures
+ * consecutive failed calls, breaker_probe is set while the call probing a half-open circuit runs
+ */
+struct _benoic_device_state {
+  char                           * device_name;
+  pthread_cond_t                   cond;
+  struct _benoic_device_command ** command_list;
+  size_t                           nb_commands;
+  int                              running;
+  double                           tokens;
+  struct timespec                  last_refill;
+  unsigned int                     nb_requests;
+  unsigned int                     nb_waiting_requests;
+  pthread_mutex_t                  module_lock;
+  int                              linked;
+  int                              link_busy;
+  pthread_t                        link_thread;
+  unsigned int                     nb_link_calls;
+  time_t                           last_used;
+  time_t                           idle_timeout;
+  int                              down;
+  unsigned int                     nb_failures;
+  time_t                           next_check;
+  int                              reconnecting;
+  time_t                           last_seen_saved;
+  int                              breaker_state;
+  unsigned int                     breaker_failures;
+  time_t                           breaker_opened;
+  int                              breaker_probe;
+};
+
+/**
+ * Element command run asynchronously
+ */
+struct _benoic_job {
+  json_int_t                      id;
+  int                             status;
+  json_t                        * device;
+  int                             element_type;
+  char                          * element_name;
+  char                          * command;
+  char                          * mode;
+  json_t                        * result;
+  time_t                          created;
+  time_t                          done_date;
+};
+
+/**
+ * Asynchronous commands queue, run by a fixed number of workers
+ * Finished jobs are kept BENOIC_JOB_RETENTION seconds so the clients can get their result
+ */
+struct _benoic_job_queue {
+  struct _benoic_config  * config;
+  pthread_mutex_t          lock;
+  pthread_cond_t           cond;
+  struct _benoic_job    ** job_list;
+  size_t                   nb_jobs;
+  size_t                   max_jobs;
+  json_int_t               last_id;
+  pthread_t              * worker_list;
+  int                      nb_workers;
+  int                      closed;
+};
+
+/**
+ * Supervisor of the connected devices
+ * Each device is pinged every interval seconds, a device not answering is disconnected,
+ * then reconnected after a delay doubling from backoff_min up to backoff_max seconds, with a random part
+ * nb_reconnects reconnections run at the same time, at most config->connect_concurrency
+ */
+struct _benoic_supervisor {
+  struct _benoic_config * config;
+  pthread_mutex_t         lock;
+  pthread_cond_t          cond;
+  pthread_t               thread;
+  int                     interval;
+  int                     backoff_min;
+  int                     backoff_max;
+  unsigned int            seed;
+  unsigned int            nb_reconnects;
+  int                     closed;
+};
+
+/**
+ * Reconnection of a device down, run by its own thread so the supervisor keeps pinging the other devices
+ */
+struct _benoic_supervisor_reconnect {
+  struct _benoic_supervisor * supervisor;
+  json_t                    * device;
+};
+
+/**
+ * Module call in flight, shared by all the identical concurrent calls
+ * The first caller runs it, the other ones wait for its result
+ * nb_held_slots is the number of slots of the device kept for the callers who gave up, until the call returns
+ */
+struct _benoic_flight {
+  char                  * key;
+  char                  * device_name;
+  unsigned int            nb_held_slots;
+  pthread_cond_t          cond;
+  json_t                * result;
+  int                     done;
+  int                     refcount;
+  struct _benoic_config * config;
+  json_t               * (* call) (struct _benoic_config * config, json_t * args);
+  json_t                * args;
+};
+
+/**
+ * Asynchronous module call in progress
+ * device is a copy, so the call can complete after the caller gave up
+ * The result is given to flight if it's set, to callback otherwise
+ * Once started, the call is held by the starting thread and by the completion,
+ * the module call ends when both released it, with result as the result of the call
+ */
+struct _benoic_async_call {
+  struct _benoic_config   * config;
+  struct _device_type     * device_type;
+  pthread_mutex_t           lock;
+  int                       nb_holds;
+  int                       result;
+  json_t                  * device;
+  int                       element_type;
+  char                    * element_name;
+  char                    * mode;
+  struct _b_element_command command;
+  struct _benoic_flight   * flight;
+  void                   (* callback) (void * cls, json_t * result);
+  void                    * cls;
+};
+
 struct _benoic_config {
-  char                       * modules_path;
-  struct _h_connection       * conn;
-  struct _device_type        * device_type_list;
-  struct _benoic_device_data * device_data_list;
-  int                          benoic_status;
-  char                       * alert_url;
+  char                         * modules_path;
+  struct _h_connection         * conn;
+  struct _device_type          * device_type_list;
+  struct _benoic_device_data   * device_data_list;
+  pthread_mutex_t                device_data_lock;
+  struct _benoic_element_index * element_index_list;
+  pthread_mutex_t                element_index_lock;
+  unsigned long                  value_generation;
+  unsigned long                  registry_generation;
+  unsigned long                  last_seen_generation;
+  pthread_mutex_t                registry_generation_lock;
+  struct _benoic_event_bus       event_bus;
+  struct _benoic_job_queue       job_queue;
+  struct _benoic_supervisor      supervisor;
+  struct _benoic_flight       ** flight_list;
+  pthread_mutex_t                flight_lock;
+  struct _benoic_device_state ** device_state_list;
+  pthread_mutex_t                device_state_lock;
+  long                           request_timeout;
+  unsigned int                   fanout_concurrency;
+  unsigned int                   connect_concurrency;
+  long                           connect_timeout;
+  json_t                       * device_type_limits;
+  int                            benoic_status;
+  char                         * alert_url;
+};
+
+/**
+ * Commands or reads of a batch sent to the same device
+ */
+struct _benoic_device_batch {
+  struct _benoic_config * config;
+  const char            * device_name;
+  time_t                  max_age;
+  long                    timeout;
+  json_t                * commands;
+  json_t                * results;
+};
+
+/**
+ * Batches of the devices of a request, shared by the worker threads
+ * Each worker takes the next batch of batch_list until there is none left
+ * Batches taken after the deadline aren't run, their entries get a timeout
+ */
+struct _benoic_device_batch_pool {
+  pthread_mutex_t               lock;
+  struct _benoic_device_batch * batch_list;
+  size_t                        nb_batches;
+  size_t                        next;
+  struct timespec               deadline;
+  void                       * (* thread_run) (void *);
+};
+
+/**
+ * Overview of one device in a global overview
+ */
+struct _benoic_overview_slot {
+  json_t * device;
+  json_t * overview;
+  long     latency;
+  int      result;
+  int      started;
+  int      done;
+};
+
+/**
+ * Global overview of all the devices, shared between the request and the worker threads
+ * Each worker takes the next started slot until there is none left
+ * The last one to release it frees it, so slow devices can end after the request
+ */
+struct _benoic_overview_fanout {
+  struct _benoic_config        * config;
+  pthread_mutex_t                lock;
+  pthread_cond_t                 cond;
+  struct timespec                deadline;
+  size_t                         nb_devices;
+  size_t                         nb_pending;
+  size_t                         next;
+  int                            refcount;
+  struct _benoic_overview_slot * slot_list;
+};
+
+/**
+ * Value of an element, filled by the embedding API
+ * value_type tells which of integer_value, double_value or string_value is set
+ * Switches and dimmers values are integers, sensors values can be of any type
+ * Heaters command is a double, mode and on are only set for heaters
+ */
+struct _benoic_element_value {
+  int        element_type;
+  int        value_type;
+  json_int_t integer_value;
+  double     double_value;
+  char       string_value[BENOIC_VALUE_STRING_LENGTH + 1];
+  char       mode[BENOIC_HEATER_MODE_LENGTH + 1];
+  int        on;
+  time_t     date;
+};
+
+/**
+ * Handle to a device for the embedding API
+ * device is the last resolved device, it's resolved again when the devices registry generation changes
+ */
+struct _benoic_device_handle {
+  struct _benoic_config * config;
+  char                  * device_name;
+  pthread_mutex_t         lock;
+  json_t                * device;
+  unsigned long           registry_generation;
 };
 
 struct _device_type * get_device_type(struct _benoic_config * config, json_t * device);
@@ -130,20 +594,86 @@ int update_last_seen_device(struct _benoic_config * config, json_t * device);
 
 // Device hardware management functions
 int connect_enabled_devices(struct _benoic_config * config);
-int connect_device(struct _benoic_config * config, json_t * device);
+void * thread_connect_pool_run(void * args);
+void connect_pool_late_complete(struct _benoic_config * config, const char * device_name, const int result);
+void connect_pool_release(struct _benoic_connect_pool * pool);
+int connect_device(struct _benoic_config * config, json_t * device, int update_db_status, const long timeout);
 int disconnect_device(struct _benoic_config * config, json_t * device, int update_db_status);
-int ping_device(struct _benoic_config * config, json_t * device);
-json_t * overview_device(struct _benoic_config * config, json_t * device);
+int ping_device(struct _benoic_config * config, json_t * device, const long timeout);
+int call_ping_device(struct _benoic_config * config, json_t * device);
+json_t * flight_call_ping_device(struct _benoic_config * config, json_t * args);
+json_t * overview_device(struct _benoic_config * config, json_t * device, const long timeout, int * timed_out);
+json_t * call_overview_device(struct _benoic_config * config, json_t * device);
+json_t * flight_call_overview_device(struct _benoic_config * config, json_t * args);
+int flight_start_overview_device(struct _benoic_config * config, json_t * args, struct _benoic_flight * flight);
+void overview_device_complete(void * cls, json_t * overview);
+json_t * overview_from_module(struct _benoic_config * config, json_t * device, json_t * overview);
+json_t * device_with_request_timeout(json_t * device, const long timeout);
+long get_device_request_timeout(json_t * device);
+void overview_update_value_cache(struct _benoic_config * config, json_t * device, json_t * element_list, const int element_type);
+json_t * overview_device_cached(struct _benoic_config * config, json_t * device, const time_t max_age);
 
 // Elements hardware management functions
 int has_element(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name);
+json_t * element_from_result(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, const struct _b_element_result * result);
+json_t * call_get_element(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name);
 json_t * get_sensor(struct _benoic_config * config, json_t * device, const char * sensor_name);
 json_t * get_switch(struct _benoic_config * config, json_t * device, const char * switch_name);
-int set_switch(struct _benoic_config * config, json_t * device, const char * switch_name, const int command);
 json_t * get_dimmer(struct _benoic_config * config, json_t * device, const char * dimmer_name);
-json_t * set_dimmer(struct _benoic_config * config, json_t * device, const char * dimmer_name, const int command);
 json_t * get_heater(struct _benoic_config * config, json_t * device, const char * heater_name);
-int set_heater(struct _benoic_config * config, json_t * device, const char * heater_name, const char * mode, const float command);
+json_t * call_get_element_list(struct _benoic_config * config, json_t * device, json_t * j_element_list);
+json_t * element_command_result(struct _benoic_config * config, json_t * device, const struct _b_element_command * command, const struct _b_element_result * result);
+int element_type_from_string(const char * element_type);
+const char * element_type_to_string(const int element_type);
+json_t * get_element(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, const time_t max_age, const long timeout, int * timed_out);
+json_t * flight_call_get_element(struct _benoic_config * config, json_t * args);
+int flight_start_get_element(struct _benoic_config * config, json_t * args, struct _benoic_flight * flight);
+void element_get_complete(void * cls, struct _b_element_result * result);
+json_t * get_element_list(struct _benoic_config * config, json_t * device, json_t * j_element_list, const long timeout, int * timed_out);
+json_t * flight_call_get_element_list(struct _benoic_config * config, json_t * args);
+json_t * get_element_cached(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, const time_t max_age);
+json_t * element_parse_command(const int element_type, const char * element_name, const char * command, const char * mode, struct _b_element_command * b_command);
+json_t * element_command_error(const int element_type);
+json_t * element_check_command(struct _benoic_config * config, json_t * device, const struct _b_element_command * b_command);
+json_t * element_send_command(struct _benoic_config * config, json_t * device, const struct _b_element_command * b_command);
+json_t * element_send_command_list(struct _benoic_config * config, json_t * device, json_t * j_command_list);
+int element_send_command_async(struct _benoic_config * config, json_t * device, const struct _b_element_command * b_command, void (* callback) (void * cls, json_t * result), void * cls);
+void element_set_complete(void * cls, struct _b_element_result * result);
+
+// Device modules interface functions
+int load_device_module(struct _device_type * device_type, const char * file_path);
+void element_result_init(struct _b_element_result * result);
+void element_result_clean(struct _b_element_result * result);
+int element_result_from_json(json_t * j_result, const int element_type, struct _b_element_result * result);
+json_t * element_result_to_json(const struct _b_element_result * result, const int element_type);
+int module_concurrency_from_string(const char * concurrency);
+const char * module_concurrency_to_string(const int concurrency);
+int module_gate_enter(struct _device_type * device_type);
+void module_gate_leave(struct _device_type * device_type);
+void module_concurrency_lock(struct _benoic_config * config, struct _device_type * device_type, json_t * device);
+void module_concurrency_unlock(struct _benoic_config * config, struct _device_type * device_type, json_t * device);
+int module_call_enter(struct _benoic_config * config, struct _device_type * device_type, json_t * device);
+void module_call_leave(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const int result);
+void module_call_complete(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const int result);
+int module_link_enter(struct _benoic_config * config, struct _device_type * device_type, json_t * device, int * owned, int * linked);
+void module_link_leave(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const int owned, const int linked);
+int module_gate_init(struct _benoic_module_gate * gate);
+void module_gate_destroy(struct _benoic_module_gate * gate);
+int module_gate_close(struct _device_type * device_type, const long timeout);
+void module_gate_open(struct _device_type * device_type);
+int module_ping(struct _benoic_config * config, struct _device_type * device_type, json_t * device);
+int module_get_element(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const int element_type, const char * element_name, struct _b_element_result * result);
+int module_set_element(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const struct _b_element_command * command, struct _b_element_result * result);
+int module_get_elements(struct _benoic_config * config, struct _device_type * device_type, json_t * device, struct _b_element_get * element_list, size_t nb_elements);
+int module_set_elements(struct _benoic_config * config, struct _device_type * device_type, json_t * device, struct _b_element_set * element_list, size_t nb_elements);
+int module_has_get_elements(struct _device_type * device_type);
+int module_has_set_elements(struct _device_type * device_type);
+int module_get_element_async(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const int element_type, const char * element_name, b_element_completion_callback callback, struct _benoic_async_call * async_call);
+int module_set_element_async(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const struct _b_element_command * command, b_element_completion_callback callback, struct _benoic_async_call * async_call);
+struct _benoic_async_call * async_call_new(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, const char * mode);
+void async_call_free(struct _benoic_async_call * async_call);
+void async_call_release(struct _benoic_async_call * async_call, const int result);
+int module_overview_async(struct _benoic_config * config, struct _device_type * device_type, json_t * device, b_overview_completion_callback callback, struct _benoic_async_call * async_call);
 
 // Elements data management functions
 json_t * get_element_data(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, int create);
@@ -158,6 +688,126 @@ int element_remove_tag(struct _benoic_config * config, json_t * device, const in
 json_t * element_get_monitor(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, json_t * params);
 json_t * element_get_lists(struct _benoic_config * config, json_t * device);
 
+// Monitor functions
+int monitor_store_value(struct _benoic_config * config, json_int_t element_id, json_t * value, time_t timestamp);
+int monitor_store_heater(struct _benoic_config * config, json_int_t element_id, json_t * heater, time_t timestamp);
+int monitor_set_next(struct _benoic_config * config, json_int_t element_id, json_int_t monitored_every, time_t timestamp);
+int element_push_value(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, json_t * value, time_t timestamp);
+int device_value_changed(void * cls, const char * device_name, const int element_type, const char * element_name, json_t * value, time_t timestamp);
+
+// Elements index management functions
+int load_element_index(struct _benoic_config * config);
+void close_element_index(struct _benoic_config * config);
+json_int_t get_element_id(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name);
+json_int_t load_element_id(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name);
+int set_element_index(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, json_int_t element_id, const int monitored, const json_int_t monitored_every);
+int element_index_monitor_due(struct _benoic_config * config, json_int_t element_id, time_t timestamp, json_int_t * monitored_every);
+int set_element_index_monitor_next(struct _benoic_config * config, json_int_t element_id, time_t monitored_next);
+json_t * get_element_index_data(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, int * missing);
+int set_element_index_data(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, json_t * data);
+int remove_element_index(struct _benoic_config * config, const char * device_name);
+int set_element_value_cache(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, json_t * value);
+json_t * get_element_value_cache(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, const time_t max_age);
+int get_device_value_generation(struct _benoic_config * config, const char * device_name, const time_t max_age, unsigned long * generation);
+
+// Live events stream functions
+int init_event_bus(struct _benoic_event_bus * bus);
+void close_event_bus(struct _benoic_event_bus * bus);
+struct _benoic_event_subscriber * add_event_subscriber(struct _benoic_event_bus * bus, const char * device_name);
+void remove_event_subscriber(void * cls);
+void free_event_subscriber(struct _benoic_event_subscriber * subscriber);
+void free_journal_entry(struct _benoic_journal_entry * entry);
+int publish_event(struct _benoic_config * config, const char * event, const char * device_name, json_t * data, const int journaled);
+json_t * get_changes_since(struct _benoic_config * config, const json_int_t since, const char * device_name);
+ssize_t stream_event_subscriber(void * cls, uint64_t offset, char * out_buf, size_t max);
+void publish_element_value(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, json_t * value);
+void publish_device_connection(struct _benoic_config * config, const char * device_name, const int connected);
+int device_alert(void * cls, const char * device_name, const char * source, const char * message);
+
+// Device commands queue functions
+int init_device_state_list(struct _benoic_config * config);
+void close_device_state_list(struct _benoic_config * config);
+struct _benoic_device_state * get_device_state(struct _benoic_config * config, const char * device_name);
+struct _benoic_device_command * device_command_enqueue(struct _benoic_config * config, const char * device_name, const struct _b_element_command * b_command);
+json_t * device_command_run(struct _benoic_config * config, json_t * device, struct _benoic_device_command * device_command);
+void device_command_finish(struct _benoic_config * config, const char * device_name, struct _benoic_device_command * device_command, json_t * result);
+void * thread_device_command_run(void * args);
+int device_command_start(struct _benoic_config * config, struct _benoic_device_command * device_command);
+void device_command_complete(void * cls, json_t * result);
+void device_command_release(struct _benoic_device_command * device_command);
+json_t * device_send_command(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, const char * command, const char * mode, const long timeout);
+json_t * device_send_element_command(struct _benoic_config * config, json_t * device, const struct _b_element_command * b_command, const long timeout);
+struct _benoic_device_command * device_command_enqueue_list(struct _benoic_config * config, const char * device_name, json_t * command_list);
+json_t * device_command_execute(struct _benoic_config * config, json_t * device, struct _benoic_device_command * device_command);
+json_t * device_send_command_list(struct _benoic_config * config, json_t * device, json_t * command_list, const long timeout);
+void get_device_limits(struct _benoic_config * config, json_t * device, struct _benoic_device_limits * limits);
+json_t * get_device_limit_option_list(void);
+json_t * get_device_link_option_list(void);
+int is_device_lazy(json_t * device);
+time_t get_device_idle_timeout(json_t * device);
+int device_link_lock(struct _benoic_config * config, json_t * device, int * linked);
+void device_link_unlock(struct _benoic_config * config, json_t * device, const int owned, const int linked);
+int device_link_enter(struct _benoic_config * config, json_t * device);
+void device_link_leave(struct _benoic_config * config, json_t * device);
+int is_device_idle(struct _benoic_config * config, const char * device_name);
+void device_idle_disconnect(struct _benoic_config * config);
+int device_rate_check(struct _benoic_config * config, json_t * device, long * retry_after);
+int device_slot_acquire(struct _benoic_config * config, json_t * device, long * timeout);
+void device_slot_release(struct _benoic_config * config, json_t * device);
+void device_slot_hold(struct _benoic_config * config, const char * device_name);
+void device_slot_release_held(struct _benoic_config * config, const char * device_name, const unsigned int nb_slots);
+int device_admission_enter(struct _benoic_config * config, json_t * device, long * timeout, long * retry_after);
+
+// Asynchronous commands functions
+int init_job_queue(struct _benoic_config * config);
+void close_job_queue(struct _benoic_job_queue * queue);
+void free_job(struct _benoic_job * job);
+json_int_t add_job(struct _benoic_job_queue * queue, json_t * device, const int element_type, const char * element_name, const char * command, const char * mode, const size_t max_pending);
+int is_job_element(struct _benoic_job * job, const int element_type, const char * element_name);
+json_t * get_job(struct _benoic_job_queue * queue, const json_int_t id);
+json_t * job_to_json(struct _benoic_job * job);
+void * thread_job_worker_run(void * args);
+
+// Connection supervisor functions
+int init_supervisor(struct _benoic_config * config);
+void close_supervisor(struct _benoic_supervisor * supervisor);
+void * thread_supervisor_run(void * args);
+void supervise_devices(struct _benoic_supervisor * supervisor);
+int supervisor_reconnect_start(struct _benoic_supervisor * supervisor, json_t * device);
+void * thread_supervisor_reconnect_run(void * args);
+time_t get_reconnect_delay(struct _benoic_supervisor * supervisor, const unsigned int nb_failures);
+void device_health_ok(struct _benoic_config * config, const char * device_name);
+void device_health_failure(struct _benoic_config * config, const char * device_name);
+int device_health_check(struct _benoic_config * config, json_t * device, long * retry_after);
+json_t * get_device_breaker_option_list(void);
+unsigned int get_device_breaker_threshold(json_t * device);
+time_t get_device_breaker_cooldown(json_t * device);
+int device_breaker_enter(json_t * device, struct _benoic_device_state * device_state);
+int device_breaker_update(json_t * device, struct _benoic_device_state * device_state, const int result);
+void device_breaker_record(struct _benoic_config * config, json_t * device, const int result);
+json_t * device_breaker_to_json(struct _benoic_config * config, const char * device_name);
+
+// Embedding API
+// Those functions can be called from any thread between init_benoic and close_benoic
+// They return B_OK on success, B_ERROR_NOT_FOUND if the device or the element doesn't exist,
+// B_ERROR_PARAM if the device is disabled or disconnected or the command is invalid,
+// B_ERROR_BUSY if the admission limits of the device are reached, B_ERROR_TIMEOUT if timeout expired,
+// B_ERROR_UNAVAILABLE if the device stopped answering and is not reconnected yet or its calls keep failing,
+// B_ERROR_IO if the device failed
+// timeout is in milliseconds, 0 means no timeout
+// A device handle is opened once with benoic_device_open and can be used by any thread until benoic_device_close
+struct _benoic_device_handle * benoic_device_open(struct _benoic_config * config, const char * device_name);
+void benoic_device_close(struct _benoic_device_handle * handle);
+json_t * benoic_device_resolve(struct _benoic_device_handle * handle);
+int benoic_read_element(struct _benoic_device_handle * handle, const int element_type, const char * element_name, const time_t max_age, const long timeout, struct _benoic_element_value * value);
+int benoic_read_element_cached(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, const time_t max_age, struct _benoic_element_value * value);
+int benoic_set_switch(struct _benoic_device_handle * handle, const char * switch_name, const int command, const long timeout);
+int benoic_set_dimmer(struct _benoic_device_handle * handle, const char * dimmer_name, const int command, const long timeout, int * new_value);
+int benoic_set_heater(struct _benoic_device_handle * handle, const char * heater_name, const char * mode, const float command, const long timeout);
+int element_value_from_json(json_t * j_value, const int element_type, time_t date, struct _benoic_element_value * value);
+int benoic_send_command(struct _benoic_device_handle * handle, const struct _b_element_command * command, const long timeout, json_t ** result);
+int status_to_result(const json_int_t status);
+
 // benoic initialization function
 int init_benoic(struct _u_instance * instance, const char * url_prefix, struct _benoic_config * config);
 int close_benoic(struct _u_instance * instance, const char * url_prefix, struct _benoic_config * config);
@@ -165,15 +815,43 @@ void clean_benoic(struct _benoic_config * config);
 int init_device_type_list(struct _benoic_config * config);
 int close_device_type_list(struct _device_type * device_type_list);
 void close_device_type(struct _device_type device_type);
+int open_device_type(struct _benoic_config * config, const char * file_path, struct _device_type * device_type);
+int save_device_type(struct _benoic_config * config, struct _device_type * device_type);
+int reload_device_type(struct _benoic_config * config, const char * uid);
 void * get_device_ptr(struct _benoic_config * config, const char * device_name);
 int set_device_data(struct _benoic_config * config, const char * device_name, void * device_ptr);
 int remove_device_data(struct _benoic_config * config, const char * device_name);
 int disconnect_all_devices(struct _benoic_config * config);
+struct _benoic_flight * flight_join(struct _benoic_config * config, const char * key, const char * device_name, int * leader);
+json_t * flight_wait(struct _benoic_config * config, struct _benoic_flight * flight, const long timeout, int * timed_out);
+void flight_complete(struct _benoic_config * config, struct _benoic_flight * flight, json_t * result);
+void flight_release(struct _benoic_config * config, struct _benoic_flight * flight);
+json_t * flight_run(struct _benoic_config * config, const char * key, json_t * (* call) (struct _benoic_config * config, json_t * args), json_t * args, int * timed_out);
+json_t * flight_run_async(struct _benoic_config * config, const char * key, int (* start) (struct _benoic_config * config, json_t * args, struct _benoic_flight * flight), json_t * (* call) (struct _benoic_config * config, json_t * args), json_t * args, int * timed_out);
+void * thread_flight_run(void * args);
+void set_deadline(struct timespec * deadline, const long timeout);
+long get_deadline_remaining(const struct timespec * deadline);
+long get_request_timeout(struct _benoic_config * config, const struct _u_request * request);
+int admit_request(struct _benoic_config * config, json_t * device, long * timeout, struct _u_response * response);
+void set_response_too_many_requests(struct _u_response * response, const long retry_after);
+void set_response_unavailable(struct _u_response * response, const long retry_after);
+void bump_registry_generation(struct _benoic_config * config);
+unsigned long get_registry_generation(struct _benoic_config * config);
+void bump_last_seen_generation(struct _benoic_config * config);
+unsigned long get_last_seen_generation(struct _benoic_config * config);
+int check_etag(const struct _u_request * request, struct _u_response * response, const char * etag);
 void * thread_monitor_run(void * args);
+int run_device_batch(struct _benoic_config * config, json_t * j_entries, json_t * j_results, void * (* thread_run) (void *), const time_t max_age, const long timeout);
+void * thread_device_batch_pool_run(void * args);
+void * thread_device_batch_run(void * args);
+void * thread_device_read_run(void * args);
+void overview_fanout_release(struct _benoic_overview_fanout * fanout);
+void * thread_overview_run(void * args);
 
 // endpoints callback functions
 int callback_benoic_device_get_types (const struct _u_request * request, struct _u_response * response, void * user_data);
 int callback_benoic_device_reload_types (const struct _u_request * request, struct _u_response * response, void * user_data);
+int callback_benoic_device_reload_type (const struct _u_request * request, struct _u_response * response, void * user_data);
 int callback_benoic_device_get_list (const struct _u_request * request, struct _u_response * response, void * user_data);
 int callback_benoic_device_get (const struct _u_request * request, struct _u_response * response, void * user_data);
 int callback_benoic_device_add (const struct _u_request * request, struct _u_response * response, void * user_data);
@@ -185,13 +863,21 @@ int callback_benoic_device_ping (const struct _u_request * request, struct _u_re
 
 // Device overview callback function
 int callback_benoic_device_overview (const struct _u_request * request, struct _u_response * response, void * user_data);
+int callback_benoic_overview (const struct _u_request * request, struct _u_response * response, void * user_data);
+
+// Live events stream callback function
+int callback_benoic_stream (const struct _u_request * request, struct _u_response * response, void * user_data);
+int callback_benoic_changes (const struct _u_request * request, struct _u_response * response, void * user_data);
 
 // Elements callback functions
 int callback_benoic_device_element_get (const struct _u_request * request, struct _u_response * response, void * user_data);
 int callback_benoic_device_element_put (const struct _u_request * request, struct _u_response * response, void * user_data);
 int callback_benoic_device_element_set (const struct _u_request * request, struct _u_response * response, void * user_data);
+int callback_benoic_job_get (const struct _u_request * request, struct _u_response * response, void * user_data);
 int callback_benoic_device_element_add_tag (const struct _u_request * request, struct _u_response * response, void * user_data);
 int callback_benoic_device_element_remove_tag (const struct _u_request * request, struct _u_response * response, void * user_data);
 int callback_benoic_device_element_monitor(const struct _u_request * request, struct _u_response * response, void * user_data);
+int callback_benoic_element_command_batch (const struct _u_request * request, struct _u_response * response, void * user_data);
+int callback_benoic_element_read_batch (const struct _u_request * request, struct _u_response * response, void * user_data);
 
 #endif
@@ -83,6 +83,7 @@ json_t * element_get_lists(struct _benoic_config * config, json_t * device) {
  */
 int has_element(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name) {
   struct _device_type * device_type;
+  int res;
   
   if (device != NULL && json_object_get(device, "connected") == json_true()) {
     device_type = get_device_type(config, device);
@@ -90,7 +91,12 @@ int has_element(struct _benoic_config * config, json_t * device, const int eleme
       y_log_message(Y_LOG_LEVEL_ERROR, "has_element - Error getting device_type");
       return 0;
     } else {
-      return device_type->b_device_has_element(device, element_type, element_name, get_device_ptr(config, json_string_value(json_object_get(device, "name"))));
+      if (module_call_enter(config, device_type, device) != B_OK) {
+        return 0;
+      }
+      res = device_type->b_device_has_element(device, element_type, element_name, get_device_ptr(config, json_string_value(json_object_get(device, "name"))));
+      module_call_leave(config, device_type, device, BENOIC_BREAKER_NO_RESULT);
+      return res;
     }
   } else {
     return 0;
@@ -98,44 +104,62 @@ int has_element(struct _benoic_config * config, json_t * device, const int eleme
 }
 
 /**
- * get the sensor value and data
+ * Build the element json with the result of the module and keep the value in the values cache
  * return a json_t * containing the data, or NULL on error
  * returned value must be free'd after use
  */
-json_t * get_sensor(struct _benoic_config * config, json_t * device, const char * sensor_name) {
-  struct _device_type * device_type = get_device_type(config, device);
-  json_t * sensor_value, * sensor_data, * to_return, * value;
+json_t * element_from_result(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, const struct _b_element_result * result) {
+  json_t * element_value = element_result_to_json(result, element_type), * element_data, * to_return, * value;
   const char * key;
   
-  if (device_type == NULL) {
-    y_log_message(Y_LOG_LEVEL_ERROR, "get_sensor - Error getting device_type");
+  update_last_seen_device(config, device);
+  element_data = get_element_data(config, device, element_type, element_name, 1);
+  to_return = json_copy(element_data);
+  if (element_value == NULL || to_return == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "element_from_result - Error allocating resources");
+    json_decref(element_value);
+    json_decref(element_data);
+    json_decref(to_return);
     return NULL;
   }
+  set_element_value_cache(config, json_string_value(json_object_get(device, "name")), element_type, element_name, element_value);
+  json_object_foreach(element_value, key, value) {
+    json_object_set_new(to_return, key, json_copy(value));
+  }
+  json_decref(element_value);
+  json_decref(element_data);
+  return to_return;
+}
+
+/**
+ * get the element value and data using the module
+ * return a json_t * containing the data, or NULL on error
+ * returned value must be free'd after use
+ */
+json_t * call_get_element(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name) {
+  struct _device_type * device_type = get_device_type(config, device);
+  struct _b_element_result result;
+  json_t * to_return = NULL;
   
-  sensor_value = device_type->b_device_get_sensor(device, sensor_name, get_device_ptr(config, json_string_value(json_object_get(device, "name"))));
+  if (device_type == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "call_get_element - Error getting device_type");
+    return NULL;
+  }
   
-  // Look for the device type
-  if (sensor_value != NULL && json_integer_value(json_object_get(sensor_value, "result")) == DEVICE_RESULT_OK) {
-    update_last_seen_device(config, device);
-    sensor_data = get_element_data(config, device, BENOIC_ELEMENT_TYPE_SENSOR, sensor_name, 1);
-    to_return = json_copy(sensor_data);
-    if (to_return == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "get_sensor - Error allocating resources");
-      json_decref(sensor_value);
-      json_decref(sensor_data);
-      return NULL;
-    }
-    json_object_del(sensor_value, "result");
-    json_object_foreach(sensor_value, key, value) {
-      json_object_set_new(to_return, key, json_copy(value));
-    }
-    json_decref(sensor_value);
-    json_decref(sensor_data);
-    return to_return;
-  } else if (sensor_value != NULL) {
-    json_decref(sensor_value);
+  if (module_get_element(config, device_type, device, element_type, element_name, &result) == DEVICE_RESULT_OK) {
+    to_return = element_from_result(config, device, element_type, element_name, &result);
   }
-  return NULL;
+  element_result_clean(&result);
+  return to_return;
+}
+
+/**
+ * get the sensor value and data
+ * return a json_t * containing the data, or NULL on error
+ * returned value must be free'd after use
+ */
+json_t * get_sensor(struct _benoic_config * config, json_t * device, const char * sensor_name) {
+  return call_get_element(config, device, BENOIC_ELEMENT_TYPE_SENSOR, sensor_name);
 }
 
 /**
@@ -144,194 +168,498 @@ json_t * get_sensor(struct _benoic_config * config, json_t * device, const char
  * returned value must be free'd after use
  */
 json_t * get_switch(struct _benoic_config * config, json_t * device, const char * switch_name) {
+  return call_get_element(config, device, BENOIC_ELEMENT_TYPE_SWITCH, switch_name);
+}
+
+/**
+ * get the dimmer value and data
+ * return a json_t * containing the data, or NULL on error
+ * returned value must be free'd after use
+ */
+json_t * get_dimmer(struct _benoic_config * config, json_t * device, const char * dimmer_name) {
+  return call_get_element(config, device, BENOIC_ELEMENT_TYPE_DIMMER, dimmer_name);
+}
+
+/**
+ * get the heater value and data
+ * return a json_t * containing the data, or NULL on error
+ * returned value must be free'd after use
+ */
+json_t * get_heater(struct _benoic_config * config, json_t * device, const char * heater_name) {
+  return call_get_element(config, device, BENOIC_ELEMENT_TYPE_HEATER, heater_name);
+}
+
+/**
+ * Get the values and data of a list of elements using the module
+ * j_element_list is an array of objects containing element_type and element_name
+ * return a json array with the data of each element at the same index, or json null if it can't be read
+ * returned value must be free'd after use
+ */
+json_t * call_get_element_list(struct _benoic_config * config, json_t * device, json_t * j_element_list) {
   struct _device_type * device_type = get_device_type(config, device);
-  json_t * switch_value = device_type->b_device_get_switch(device, switch_name, get_device_ptr(config, json_string_value(json_object_get(device, "name")))), * switch_data, * to_return, * value;
-  const char * key;
+  struct _b_element_get * element_list;
+  json_t * to_return, * j_element, * element;
+  size_t index, nb_elements = json_array_size(j_element_list);
   
-  // Look for the device type
-  if (switch_value != NULL && json_integer_value(json_object_get(switch_value, "result")) == DEVICE_RESULT_OK) {
-    json_object_del(switch_value, "result");
-    update_last_seen_device(config, device);
-    switch_data = get_element_data(config, device, BENOIC_ELEMENT_TYPE_SWITCH, switch_name, 1);
-    to_return = json_copy(switch_data);
-    if (to_return == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "get_switch - Error allocating resources");
-      json_decref(switch_value);
-      json_decref(switch_data);
-      return NULL;
-    }
-    json_object_foreach(switch_value, key, value) {
-      json_object_set_new(to_return, key, json_copy(value));
+  if (device_type == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "call_get_element_list - Error getting device_type");
+    return NULL;
+  }
+  
+  to_return = json_array();
+  element_list = o_malloc((nb_elements + 1) * sizeof(struct _b_element_get));
+  if (to_return == NULL || element_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "call_get_element_list - Error allocating resources");
+    json_decref(to_return);
+    o_free(element_list);
+    return NULL;
+  }
+  json_array_foreach(j_element_list, index, j_element) {
+    element_list[index].element_type = json_integer_value(json_object_get(j_element, "element_type"));
+    element_list[index].element_name = json_string_value(json_object_get(j_element, "element_name"));
+  }
+  module_get_elements(config, device_type, device, element_list, nb_elements);
+  for (index=0; index<nb_elements; index++) {
+    element = NULL;
+    if (element_list[index].result.result == DEVICE_RESULT_OK) {
+      element = element_from_result(config, device, element_list[index].element_type, element_list[index].element_name, &element_list[index].result);
     }
-    json_decref(switch_value);
-    json_decref(switch_data);
-    return to_return;
-  } else if (switch_value != NULL) {
-    json_decref(switch_value);
+    json_array_append_new(to_return, element!=NULL?element:json_null());
+    element_result_clean(&element_list[index].result);
   }
-  return NULL;
+  o_free(element_list);
+  return to_return;
 }
 
 /**
- * set the switch command
- * return B_OK on success
+ * Send the command to the element using the module
+ * On success, the new value is set in the values cache
+ * return a json object containing the http status in the status field,
+ * and the new value of the element if any
+ * returned value must be free'd after use
  */
-int set_switch(struct _benoic_config * config, json_t * device, const char * switch_name, const int command) {
-  struct _device_type * device_type = get_device_type(config, device);
-  json_t * result;
-  int i_return;
-  
-  if (device_type != NULL) {
-    result = device_type->b_device_set_switch(device, switch_name, command, get_device_ptr(config, json_string_value(json_object_get(device, "name"))));
-    if (result != NULL) {
-      if (json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_OK) {
-        i_return =  B_OK;
-      } else if (json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_NOT_FOUND) {
-        i_return =  B_ERROR_NOT_FOUND;
-      } else if (json_integer_value(json_object_get(result, "result")) != DEVICE_RESULT_OK) {
-        i_return =  B_ERROR_IO;
-      } else {
-        i_return =  B_ERROR;
-      }
-      json_decref(result);
-    } else {
-      // Should not happen but I don't like gcc warnings
-      i_return =  B_ERROR_IO;
+json_t * element_command_result(struct _benoic_config * config, json_t * device, const struct _b_element_command * command, const struct _b_element_result * result) {
+  json_t * j_value = NULL, * to_return;
+  
+  if (result->result == DEVICE_RESULT_OK) {
+    to_return = json_pack("{si}", "status", 200);
+    if (command->element_type == BENOIC_ELEMENT_TYPE_DIMMER) {
+      j_value = json_pack("{sI}", "value", result->integer_value);
+      json_object_set_new(to_return, "value", json_integer(result->integer_value));
+    } else if (command->element_type == BENOIC_ELEMENT_TYPE_SWITCH && result->value_type == BENOIC_VALUE_INTEGER) {
+      j_value = json_pack("{sI}", "value", result->integer_value);
+    } else if (command->element_type == BENOIC_ELEMENT_TYPE_SWITCH && (command->command == 0 || command->command == 1)) {
+      j_value = json_pack("{si}", "value", command->command);
     }
+    // A toggle or a heater command gives no new value, so the cached one is invalidated
+    set_element_value_cache(config, json_string_value(json_object_get(device, "name")), command->element_type, command->element_name, j_value);
+    json_decref(j_value);
+  } else if (result->result == DEVICE_RESULT_PARAM) {
+    to_return = json_pack("{si}", "status", 400);
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "set_switch - Device type not found");
-    i_return =  B_ERROR_PARAM;
+    to_return = json_pack("{si}", "status", 500);
   }
-  return i_return;
+  return to_return;
 }
 
 /**
- * get the dimmer value and data
- * return a json_t * containing the data, or NULL on error
+ * get the element value and data from the value cache if it's not older than max_age seconds
+ * return a json_t * containing the data, or NULL if there is no such value
  * returned value must be free'd after use
  */
-json_t * get_dimmer(struct _benoic_config * config, json_t * device, const char * dimmer_name) {
-  struct _device_type * device_type = get_device_type(config, device);
-  json_t * dimmer_value = device_type->b_device_get_dimmer(device, dimmer_name, get_device_ptr(config, json_string_value(json_object_get(device, "name")))), * dimmer_data, * to_return, * value;
+json_t * get_element_cached(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, const time_t max_age) {
+  json_t * cached_value, * element_data, * to_return = NULL, * value;
   const char * key;
   
-  // Look for the device type
-  if (dimmer_value != NULL && json_integer_value(json_object_get(dimmer_value, "result")) == DEVICE_RESULT_OK) {
-    json_object_del(dimmer_value, "result");
-    update_last_seen_device(config, device);
-    dimmer_data = get_element_data(config, device, BENOIC_ELEMENT_TYPE_DIMMER, dimmer_name, 1);
-    to_return = json_copy(dimmer_data);
-    if (to_return == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "get_dimmer - Error allocating resources");
-      json_decref(dimmer_value);
-      json_decref(dimmer_data);
-      return NULL;
-    }
-    json_object_foreach(dimmer_value, key, value) {
-      json_object_set_new(to_return, key, json_copy(value));
+  cached_value = get_element_value_cache(config, json_string_value(json_object_get(device, "name")), element_type, element_name, max_age);
+  if (cached_value != NULL) {
+    element_data = get_element_data(config, device, element_type, element_name, 0);
+    if (element_data != NULL) {
+      to_return = json_copy(element_data);
+      json_object_foreach(cached_value, key, value) {
+        json_object_set_new(to_return, key, json_copy(value));
+      }
+      json_decref(element_data);
     }
-    json_decref(dimmer_value);
-    json_decref(dimmer_data);
-    return to_return;
-  } else if (dimmer_value != NULL) {
-    json_decref(dimmer_value);
+    json_decref(cached_value);
   }
-  return NULL;
+  return to_return;
 }
 
 /**
- * set the dimmer command
- * return B_OK on success
+ * get the element value and data
+ * use the value cache if max_age is positive and the cached value is not older than max_age seconds
+ * timeout is the request timeout in milliseconds, 0 if there is none
+ * return a json_t * containing the data, or NULL on error
+ * returned value must be free'd after use
+ */
+json_t * get_element(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, const time_t max_age, const long timeout, int * timed_out) {
+  json_t * to_return = get_element_cached(config, device, element_type, element_name, max_age), * args;
+  char * key;
+  
+  if (timed_out != NULL) {
+    *timed_out = 0;
+  }
+  if (to_return == NULL) {
+    // Identical reads running at the same time share the same module call
+    key = msprintf("element/%s/%d/%s", json_string_value(json_object_get(device, "name")), element_type, element_name);
+    args = json_pack("{sosiss}", "device", device_with_request_timeout(device, timeout), "element_type", element_type, "element_name", element_name);
+    to_return = flight_run_async(config, key, &flight_start_get_element, &flight_call_get_element, args, timed_out);
+    json_decref(args);
+    o_free(key);
+  }
+  return to_return;
+}
+
+/**
+ * Read the element described in args using the module
+ * args must contain device, element_type and element_name
+ * returned value must be free'd after use
+ */
+json_t * flight_call_get_element(struct _benoic_config * config, json_t * args) {
+  return call_get_element(config, json_object_get(args, "device"), json_integer_value(json_object_get(args, "element_type")), json_string_value(json_object_get(args, "element_name")));
+}
+
+/**
+ * Start reading the element described in args with the asynchronous function of the module
+ * args must contain device, element_type and element_name
+ * return B_OK if the read is started, the result is then given to the flight by element_get_complete
  */
-json_t * set_dimmer(struct _benoic_config * config, json_t * device, const char * dimmer_name, const int command) {
+int flight_start_get_element(struct _benoic_config * config, json_t * args, struct _benoic_flight * flight) {
+  json_t * device = json_object_get(args, "device");
   struct _device_type * device_type = get_device_type(config, device);
-  json_t * result, * j_return;
-
-  if (device_type != NULL) {
-    result = device_type->b_device_set_dimmer(device, dimmer_name, command, get_device_ptr(config, json_string_value(json_object_get(device, "name"))));
-    if (result != NULL) {
-      if (json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_OK) {
-        j_return = json_pack("{sisI}", "result", B_OK, "value", json_integer_value(json_object_get(result, "value")));
-      } else if (json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_NOT_FOUND) {
-        j_return = json_pack("{si}", "result", B_ERROR_NOT_FOUND);
-      } else {
-        j_return = json_pack("{si}", "result", B_ERROR_IO);
-      }
-      json_decref(result);
-    } else {
-      j_return = json_pack("{si}", "result", B_ERROR_IO);
-    }
+  struct _benoic_async_call * async_call;
+  
+  // Only a module of the version 3 can have a get_element_async, module_get_element_async checks the rest
+  if (device_type == NULL || device_type->abi_version < 3) {
+    return B_ERROR_PARAM;
+  }
+  async_call = async_call_new(config, device, json_integer_value(json_object_get(args, "element_type")), json_string_value(json_object_get(args, "element_name")), NULL);
+  if (async_call == NULL) {
+    return B_ERROR_MEMORY;
+  }
+  async_call->flight = flight;
+  if (module_get_element_async(config, device_type, device, async_call->element_type, async_call->element_name, &element_get_complete, async_call) != DEVICE_RESULT_OK) {
+    async_call_free(async_call);
+    return B_ERROR_PARAM;
+  }
+  return B_OK;
+}
+
+/**
+ * Completion of an asynchronous read, give the element to the callers waiting for it
+ */
+void element_get_complete(void * cls, struct _b_element_result * result) {
+  struct _benoic_async_call * async_call = (struct _benoic_async_call *)cls;
+  json_t * element = NULL;
+  
+  if (result != NULL && result->result == DEVICE_RESULT_OK) {
+    element = element_from_result(async_call->config, async_call->device, async_call->element_type, async_call->element_name, result);
+  }
+  flight_complete(async_call->config, async_call->flight, element);
+  json_decref(element);
+  if (result != NULL) {
+    element_result_clean(result);
+  }
+  async_call_release(async_call, (result != NULL)?result->result:DEVICE_RESULT_ERROR);
+}
+
+/**
+ * get the values and data of a list of elements of the device in one module call if the module can,
+ * the elements are read one by one otherwise
+ * j_element_list is an array of objects containing element_type and element_name
+ * timeout is the request timeout in milliseconds, 0 if there is none
+ * timed_out is optional, it's set to 1 if the request timeout expired
+ * return a json array with the data of each element at the same index, or json null if it can't be read
+ * returned value must be free'd after use
+ */
+json_t * get_element_list(struct _benoic_config * config, json_t * device, json_t * j_element_list, const long timeout, int * timed_out) {
+  json_t * to_return, * args;
+  char * key, * str_element_list = json_dumps(j_element_list, JSON_COMPACT);
+  
+  // Identical lists read at the same time share the same module call
+  key = msprintf("elements/%s/%s", json_string_value(json_object_get(device, "name")), str_element_list);
+  args = json_pack("{sosO}", "device", device_with_request_timeout(device, timeout), "element_list", j_element_list);
+  to_return = flight_run(config, key, &flight_call_get_element_list, args, timed_out);
+  json_decref(args);
+  o_free(key);
+  free(str_element_list);
+  return to_return;
+}
+
+/**
+ * Read the elements described in args using the module
+ * args must contain device and element_list
+ * returned value must be free'd after use
+ */
+json_t * flight_call_get_element_list(struct _benoic_config * config, json_t * args) {
+  return call_get_element_list(config, json_object_get(args, "device"), json_object_get(args, "element_list"));
+}
+
+/**
+ * return the element type corresponding to the name
+ * return BENOIC_ELEMENT_TYPE_NONE if the name is invalid
+ */
+int element_type_from_string(const char * element_type) {
+  if (0 == o_strcmp(element_type, "sensor")) {
+    return BENOIC_ELEMENT_TYPE_SENSOR;
+  } else if (0 == o_strcmp(element_type, "switch")) {
+    return BENOIC_ELEMENT_TYPE_SWITCH;
+  } else if (0 == o_strcmp(element_type, "dimmer")) {
+    return BENOIC_ELEMENT_TYPE_DIMMER;
+  } else if (0 == o_strcmp(element_type, "heater")) {
+    return BENOIC_ELEMENT_TYPE_HEATER;
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "set_dimmer - Device type not found");
-    j_return = json_pack("{si}", "result", B_ERROR_PARAM);
+    return BENOIC_ELEMENT_TYPE_NONE;
   }
-  return j_return;
 }
 
 /**
- * get the sensor value and data
- * return a json_t * containing the data, or NULL on error
+ * return the name of the element type
+ */
+const char * element_type_to_string(const int element_type) {
+  switch (element_type) {
+    case BENOIC_ELEMENT_TYPE_SENSOR:
+      return "sensor";
+    case BENOIC_ELEMENT_TYPE_SWITCH:
+      return "switch";
+    case BENOIC_ELEMENT_TYPE_DIMMER:
+      return "dimmer";
+    case BENOIC_ELEMENT_TYPE_HEATER:
+      return "heater";
+    default:
+      return "none";
+  }
+}
+
+/**
+ * Parse the command sent to the specified element
+ * command is the command as sent in the url, mode is optional and used for heaters only
+ * b_command is filled with the parsed command, its strings point to element_name and mode
+ * The command is checked by element_check_command when it's sent
+ * return NULL if the command can be parsed, or a json object containing the http status in the status field and an error message
  * returned value must be free'd after use
  */
-json_t * get_heater(struct _benoic_config * config, json_t * device, const char * heater_name) {
-  struct _device_type * device_type = get_device_type(config, device);
-  json_t * heater_value = device_type->b_device_get_heater(device, heater_name, get_device_ptr(config, json_string_value(json_object_get(device, "name")))), * heater_data, * to_return, * value;
-  const char * key;
+json_t * element_parse_command(const int element_type, const char * element_name, const char * command, const char * mode, struct _b_element_command * b_command) {
+  char * endptr = NULL;
   
-  // Look for the device type
-  if (heater_value != NULL && json_integer_value(json_object_get(heater_value, "result")) == DEVICE_RESULT_OK) {
-    json_object_del(heater_value, "result");
-    update_last_seen_device(config, device);
-    heater_data = get_element_data(config, device, BENOIC_ELEMENT_TYPE_HEATER, heater_name, 1);
-    to_return = json_copy(heater_data);
-    if (to_return == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "get_heater - Error allocating resources");
-      json_decref(heater_value);
-      json_decref(heater_data);
-      return NULL;
-    }
-    json_object_foreach(heater_value, key, value) {
-      json_object_set_new(to_return, key, json_copy(value));
-    }
-    json_decref(heater_value);
-    json_decref(heater_data);
-    return to_return;
-  } else if (heater_value != NULL) {
-    json_decref(heater_value);
+  if (element_type == BENOIC_ELEMENT_TYPE_NONE) {
+    return json_pack("{siss}", "status", 400, "error", "element type incorrect");
+  } else if (command == NULL) {
+    return json_pack("{siss}", "status", 400, "error", "command missing");
+  }
+  
+  b_command->element_type = element_type;
+  b_command->element_name = element_name;
+  b_command->command = 0;
+  b_command->heater_command = 0;
+  b_command->mode = NULL;
+  switch (element_type) {
+    case BENOIC_ELEMENT_TYPE_SWITCH:
+    case BENOIC_ELEMENT_TYPE_DIMMER:
+      b_command->command = strtol(command, &endptr, 10);
+      break;
+    case BENOIC_ELEMENT_TYPE_HEATER:
+      b_command->heater_command = strtof(command, &endptr);
+      b_command->mode = mode;
+      break;
+    default:
+      return json_pack("{siss}", "status", 400, "error", "element type incorrect");
+  }
+  if (*endptr != '\0') {
+    return element_command_error(element_type);
   }
   return NULL;
 }
 
 /**
- * set the heater command
- * return B_OK on success
+ * Return the error of an incorrect command for the element type
+ * returned value must be free'd after use
+ */
+json_t * element_command_error(const int element_type) {
+  switch (element_type) {
+    case BENOIC_ELEMENT_TYPE_SWITCH:
+      return json_pack("{siss}", "status", 400, "error", "incorrect command, must be -1 (toggle), 0 (off) or 1 (on)");
+    case BENOIC_ELEMENT_TYPE_DIMMER:
+      return json_pack("{siss}", "status", 400, "error", "incorrect command, must be between 0 and 101");
+    case BENOIC_ELEMENT_TYPE_HEATER:
+      return json_pack("{siss}", "status", 400, "error", "mode (optional) must be off, manual or auto, command must be a numeric value");
+    default:
+      return json_pack("{siss}", "status", 400, "error", "element type incorrect");
+  }
+}
+
+/**
+ * Check that the element of the command exists and that the command is valid for it
+ * return NULL if the command is valid, or a json object containing the http status in the status field and an error message
+ * returned value must be free'd after use
+ */
+json_t * element_check_command(struct _benoic_config * config, json_t * device, const struct _b_element_command * b_command) {
+  json_t * element;
+  
+  if (b_command->element_type != BENOIC_ELEMENT_TYPE_SWITCH && b_command->element_type != BENOIC_ELEMENT_TYPE_DIMMER && b_command->element_type != BENOIC_ELEMENT_TYPE_HEATER) {
+    return json_pack("{siss}", "status", 400, "error", "element type incorrect");
+  }
+  
+  element = get_element_data(config, device, b_command->element_type, b_command->element_name, 0);
+  if (element == NULL) {
+    return json_pack("{siss}", "status", 404, "error", "element not found");
+  }
+  json_decref(element);
+  
+  if ((b_command->element_type == BENOIC_ELEMENT_TYPE_SWITCH && (b_command->command < -1 || b_command->command > 1)) || 
+      (b_command->element_type == BENOIC_ELEMENT_TYPE_DIMMER && (b_command->command < 0 || b_command->command > 101))) {
+    return element_command_error(b_command->element_type);
+  }
+  return NULL;
+}
+
+/**
+ * Send a command to the specified element
+ * return a json object containing the http status in the status field,
+ * and an error message or the resulting value if any
+ * returned value must be free'd after use
+ */
+json_t * element_send_command(struct _benoic_config * config, json_t * device, const struct _b_element_command * b_command) {
+  struct _device_type * device_type;
+  struct _b_element_result result;
+  json_t * to_return;
+  
+  to_return = element_check_command(config, device, b_command);
+  if (to_return != NULL) {
+    return to_return;
+  }
+  
+  device_type = get_device_type(config, device);
+  if (device_type == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "element_send_command - Device type not found");
+    return json_pack("{si}", "status", 500);
+  }
+  module_set_element(config, device_type, device, b_command, &result);
+  to_return = element_command_result(config, device, b_command, &result);
+  element_result_clean(&result);
+  return to_return;
+}
+
+/**
+ * Start sending a command to the specified element with the asynchronous function of the module
+ * callback is called with cls and the result as returned by element_send_command, the result is free'd after the callback
+ * An invalid command gets its result before the function returns
+ * return B_OK if callback is or will be called, any other value if the module can't send the command asynchronously,
+ * it must then be sent with element_send_command
  */
-int set_heater(struct _benoic_config * config, json_t * device, const char * heater_name, const char * mode, const float command) {
+int element_send_command_async(struct _benoic_config * config, json_t * device, const struct _b_element_command * b_command, void (* callback) (void * cls, json_t * result), void * cls) {
   struct _device_type * device_type = get_device_type(config, device);
-  json_t * result;
-  int i_return;
-  
-  if (device_type != NULL) {
-    result = device_type->b_device_set_heater(device, heater_name, mode, command, get_device_ptr(config, json_string_value(json_object_get(device, "name"))));
-    if (result != NULL) {
-      if (json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_OK) {
-        i_return = B_OK;
-      } else if (json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_NOT_FOUND) {
-        i_return = B_ERROR_NOT_FOUND;
-      } else if (json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_PARAM) {
-        i_return = B_ERROR_PARAM;
-      } else {
-        i_return = B_ERROR_IO;
-      }
-      json_decref(result);
+  struct _benoic_async_call * async_call;
+  json_t * error;
+  
+  // Only a module of the version 3 can have a set_element_async, module_set_element_async checks the rest
+  if (device_type == NULL || device_type->abi_version < 3) {
+    return B_ERROR_PARAM;
+  }
+  async_call = async_call_new(config, device, b_command->element_type, b_command->element_name, b_command->mode);
+  if (async_call == NULL) {
+    return B_ERROR_MEMORY;
+  }
+  async_call->callback = callback;
+  async_call->cls = cls;
+  
+  // The command points to the strings of async_call, so it's valid until the module completes it
+  async_call->command = *b_command;
+  async_call->command.element_name = async_call->element_name;
+  async_call->command.mode = async_call->mode;
+  error = element_check_command(config, device, &async_call->command);
+  if (error != NULL) {
+    callback(cls, error);
+    json_decref(error);
+    async_call_free(async_call);
+    return B_OK;
+  }
+  if (module_set_element_async(config, device_type, device, &async_call->command, &element_set_complete, async_call) != DEVICE_RESULT_OK) {
+    async_call_free(async_call);
+    return B_ERROR_PARAM;
+  }
+  return B_OK;
+}
+
+/**
+ * Completion of an asynchronous command, give the result to the callback of the caller
+ */
+void element_set_complete(void * cls, struct _b_element_result * result) {
+  struct _benoic_async_call * async_call = (struct _benoic_async_call *)cls;
+  struct _b_element_result error_result;
+  json_t * j_result;
+  int res;
+  
+  if (result == NULL) {
+    element_result_init(&error_result);
+    result = &error_result;
+  }
+  j_result = element_command_result(async_call->config, async_call->device, &async_call->command, result);
+  async_call->callback(async_call->cls, j_result);
+  json_decref(j_result);
+  res = result->result;
+  element_result_clean(result);
+  async_call_release(async_call, res);
+}
+
+/**
+ * Send a list of commands to the device in one module call if the module can,
+ * the commands are sent one by one otherwise
+ * j_command_list is an array of objects containing element_type as a string, element_name, command and mode (optional)
+ * return a json array with the result of each command at the same index, as returned by element_send_command
+ * returned value must be free'd after use
+ */
+json_t * element_send_command_list(struct _benoic_config * config, json_t * device, json_t * j_command_list) {
+  struct _device_type * device_type = get_device_type(config, device);
+  struct _b_element_set * element_list;
+  json_t * to_return, * j_command, * error;
+  size_t index, i, nb_commands = 0, * command_index;
+  
+  if (device_type == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "element_send_command_list - Device type not found");
+    return NULL;
+  }
+  
+  to_return = json_array();
+  element_list = o_malloc((json_array_size(j_command_list) + 1) * sizeof(struct _b_element_set));
+  command_index = o_malloc((json_array_size(j_command_list) + 1) * sizeof(size_t));
+  if (to_return == NULL || element_list == NULL || command_index == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "element_send_command_list - Error allocating resources");
+    json_decref(to_return);
+    o_free(element_list);
+    o_free(command_index);
+    return NULL;
+  }
+  
+  // Invalid commands get their result now, the valid ones are sent together
+  json_array_foreach(j_command_list, index, j_command) {
+    error = element_parse_command(element_type_from_string(json_string_value(json_object_get(j_command, "element_type"))), 
+                                  json_string_value(json_object_get(j_command, "element_name")), 
+                                  json_string_value(json_object_get(j_command, "command")), 
+                                  json_string_value(json_object_get(j_command, "mode")), 
+                                  &element_list[nb_commands].command);
+    if (error == NULL) {
+      error = element_check_command(config, device, &element_list[nb_commands].command);
+    }
+    if (error != NULL) {
+      json_array_append_new(to_return, error);
     } else {
-      i_return = B_ERROR_IO;
+      json_array_append_new(to_return, json_null());
+      command_index[nb_commands++] = index;
     }
-  } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "set_heater - Device type not found");
-    i_return = B_ERROR_PARAM;
   }
-  return i_return;
+  
+  if (nb_commands > 0) {
+    module_set_elements(config, device_type, device, element_list, nb_commands);
+    for (i=0; i<nb_commands; i++) {
+      json_array_set_new(to_return, command_index[i], element_command_result(config, device, &element_list[i].command, &element_list[i].result));
+      element_result_clean(&element_list[i].result);
+    }
+  }
+  o_free(element_list);
+  o_free(command_index);
+  return to_return;
 }
 
 /**
@@ -340,25 +668,35 @@ int set_heater(struct _benoic_config * config, json_t * device, const char * hea
 
 /**
  * Get the element data
+ * The data kept in the element index are used if any, an element known as missing isn't read in the database
  * return a json_t * containing the element data, NULL on error
  * returned value must be free'd after use
  */
 json_t * get_element_data(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, int create) {
-  json_t * j_query = json_object(), * j_result, * j_return, * default_data;
-  int res;
+  json_t * j_query, * j_result, * j_return, * default_data;
+  int res, missing = 0;
   
-  if (config == NULL || device == NULL || element_name == NULL || j_query == NULL) {
-    json_decref(j_query);
+  if (config == NULL || device == NULL || element_name == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "get_element_data - Error input parameters");
     return NULL;
   }
   
+  j_return = get_element_index_data(config, json_string_value(json_object_get(device, "name")), element_type, element_name, &missing);
+  if (j_return != NULL || (missing && !create)) {
+    return j_return;
+  }
+  
+  j_query = json_object();
+  if (j_query == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_element_data - Error allocating resources for j_query");
+    return NULL;
+  }
+  
   json_object_set_new(j_query, "table", json_string(BENOIC_TABLE_ELEMENT));
   json_object_set_new(j_query, "where", json_pack("{sssiss}", "be_name", element_name, "be_type", element_type, "bd_name", json_string_value(json_object_get(device, "name"))));
   res = h_select(config->conn, j_query, &j_result, NULL);
   json_decref(j_query);
   if (res != H_OK) {
-    json_decref(j_query);
     y_log_message(Y_LOG_LEVEL_ERROR, "get_element_data - Error query select");
     return NULL;
   }
@@ -394,6 +732,9 @@ json_t * get_element_data(struct _benoic_config * config, json_t * device, const
   } else if (json_array_size(j_result) > 0) {
     j_return = parse_element_from_db(json_array_get(j_result, 0));
     json_decref(j_result);
+    if (j_return != NULL) {
+      set_element_index_data(config, json_string_value(json_object_get(device, "name")), element_type, element_name, j_return);
+    }
     return j_return;
   } else {
     json_decref(j_result);
@@ -440,6 +781,10 @@ int set_element_data(struct _benoic_config * config, json_t * device, const char
   }
   json_decref(j_query);
   if (res == H_OK) {
+    // The element may be remembered as missing by the index, and its data may have changed
+    set_element_index_data(config, json_string_value(json_object_get(device, "name")), element_type, element_name, NULL);
+    load_element_id(config, json_string_value(json_object_get(device, "name")), element_type, element_name);
+    bump_registry_generation(config);
     return B_OK;
   } else {
     return B_ERROR_DB;
@@ -686,7 +1031,9 @@ int element_remove_tag(struct _benoic_config * config, json_t * device, const in
  */
 json_t * element_get_monitor(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, json_t * params) {
   json_t * j_query = json_object(), * j_result = NULL, * j_where = json_object();
-  char * tmp = NULL, * escaped_device, * escaped_name;
+  char * tmp = NULL, * column;
+  const char * date_column, * field = json_string_value(json_object_get(params, "field"));
+  json_int_t element_id;
   int res;
   
   if (j_query == NULL || j_where == NULL) {
@@ -696,20 +1043,42 @@ json_t * element_get_monitor(struct _benoic_config * config, json_t * device, co
     return NULL;
   }
   
-  json_object_set_new(j_query, "table", json_string(BENOIC_TABLE_MONITOR));
-  if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
-    json_object_set_new(j_query, "columns", json_pack("[ss]", "UNIX_TIMESTAMP(bm_date) AS timestamp", "bm_value AS value"));
+  if (element_type == BENOIC_ELEMENT_TYPE_HEATER) {
+    // Heaters samples are stored with one column per field
+    date_column = "bmh_date";
+    json_object_set_new(j_query, "table", json_string(BENOIC_TABLE_MONITOR_HEATER));
+    if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
+      json_object_set_new(j_query, "columns", json_pack("[s]", "UNIX_TIMESTAMP(bmh_date) AS timestamp"));
+    } else {
+      json_object_set_new(j_query, "columns", json_pack("[s]", "bmh_date AS timestamp"));
+    }
+    if (field != NULL) {
+      column = msprintf("bmh_%s AS value", field);
+      json_array_append_new(json_object_get(j_query, "columns"), json_string(column));
+      o_free(column);
+    } else {
+      json_array_append_new(json_object_get(j_query, "columns"), json_string("bmh_mode AS mode"));
+      json_array_append_new(json_object_get(j_query, "columns"), json_string("bmh_command AS command"));
+      json_array_append_new(json_object_get(j_query, "columns"), json_string("bmh_on AS `on`"));
+    }
   } else {
-    json_object_set_new(j_query, "columns", json_pack("[ss]", "bm_date AS timestamp", "bm_value AS value"));
+    date_column = "bm_date";
+    json_object_set_new(j_query, "table", json_string(BENOIC_TABLE_MONITOR));
+    if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
+      json_object_set_new(j_query, "columns", json_pack("[ss]", "UNIX_TIMESTAMP(bm_date) AS timestamp", "bm_value AS value"));
+    } else {
+      json_object_set_new(j_query, "columns", json_pack("[ss]", "bm_date AS timestamp", "bm_value AS value"));
+    }
   }
   
-  escaped_device = h_escape_string(config->conn, json_string_value(json_object_get(device, "name")));
-  escaped_name = h_escape_string(config->conn, element_name);
-  tmp = msprintf("= (SELECT `be_id` FROM `b_element` WHERE `be_name` = '%s' AND `be_type` = %d AND `bd_name` = '%s')", escaped_name, element_type, escaped_device);
-  o_free(escaped_device);
-  o_free(escaped_name);
-  json_object_set_new(j_where, "be_id", json_pack("{ssss}", "operator", "raw", "value", tmp));
-  o_free(tmp);
+  element_id = get_element_id(config, json_string_value(json_object_get(device, "name")), element_type, element_name);
+  if (element_id == 0) {
+    // Element has never been stored, so it has no history
+    json_decref(j_query);
+    json_decref(j_where);
+    return json_array();
+  }
+  json_object_set_new(j_where, "be_id", json_integer(element_id));
   
   if (json_object_get(params, "from") != NULL) {
     if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
@@ -717,23 +1086,26 @@ json_t * element_get_monitor(struct _benoic_config * config, json_t * device, co
     } else {
       tmp = msprintf("> '%" JSON_INTEGER_FORMAT "'", json_integer_value(json_object_get(params, "from")));
     }
-    json_object_set_new(j_where, "bm_date", json_pack("{ssss}", "operator", "raw", "value", tmp));
+    json_object_set_new(j_where, date_column, json_pack("{ssss}", "operator", "raw", "value", tmp));
     o_free(tmp);
   } else {
     if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
-      json_object_set_new(j_where, "bm_date", json_pack("{ssss}", "operator", "raw", "value", "> DATE_SUB(CURDATE(), INTERVAL 1 DAY)"));
+      json_object_set_new(j_where, date_column, json_pack("{ssss}", "operator", "raw", "value", "> DATE_SUB(CURDATE(), INTERVAL 1 DAY)"));
     } else {
-      json_object_set_new(j_where, "bm_date", json_pack("{ssss}", "operator", "raw", "value", "> strftime('%s','now', '-1 day')"));
+      json_object_set_new(j_where, date_column, json_pack("{ssss}", "operator", "raw", "value", "> strftime('%s','now', '-1 day')"));
     }
   }
   
   if (json_object_get(params, "to") != NULL) {
+    // The lower bound already uses the date column as key, so the upper bound is set on the date as a number
     if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
-      tmp = msprintf("< FROM_UNIXTIME(%" JSON_INTEGER_FORMAT ")", json_integer_value(json_object_get(params, "to")));
+      column = msprintf("UNIX_TIMESTAMP(%s)", date_column);
     } else {
-      tmp = msprintf("< '%" JSON_INTEGER_FORMAT "'", json_integer_value(json_object_get(params, "from")));
+      column = msprintf("CAST(%s AS INTEGER)", date_column);
     }
-    json_object_set_new(j_where, "bm_date", json_pack("{ssss}", "operator", "raw", "value", tmp));
+    tmp = msprintf("< %" JSON_INTEGER_FORMAT, json_integer_value(json_object_get(params, "to")));
+    json_object_set_new(j_where, column, json_pack("{ssss}", "operator", "raw", "value", tmp));
+    o_free(column);
     o_free(tmp);
   }
   
@@ -748,3 +1120,682 @@ json_t * element_get_monitor(struct _benoic_config * config, json_t * device, co
     return j_result;
   }
 }
+
+/**
+ * Store a heater sample in the heater monitor table for the specified element
+ * heater can be the heater object itself or contain it in its value field
+ * if timestamp is 0, the current date is used
+ * return B_OK on success
+ */
+int monitor_store_heater(struct _benoic_config * config, json_int_t element_id, json_t * heater, time_t timestamp) {
+  json_t * j_query, * j_values;
+  char * s_date;
+  int res;
+  
+  if (config == NULL || element_id == 0) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "monitor_store_heater - Error input parameters");
+    return B_ERROR_PARAM;
+  }
+  
+  if (json_is_object(json_object_get(heater, "value"))) {
+    heater = json_object_get(heater, "value");
+  }
+  if (!json_is_object(heater) || (json_object_get(heater, "mode") == NULL && json_object_get(heater, "command") == NULL && json_object_get(heater, "on") == NULL)) {
+    // Nothing to monitor
+    return B_ERROR_PARAM;
+  }
+  
+  j_values = json_pack("{sI}", "be_id", element_id);
+  if (j_values == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "monitor_store_heater - Error allocating resources for j_values");
+    return B_ERROR_MEMORY;
+  }
+  if (json_is_string(json_object_get(heater, "mode"))) {
+    json_object_set(j_values, "bmh_mode", json_object_get(heater, "mode"));
+  }
+  if (json_is_number(json_object_get(heater, "command"))) {
+    json_object_set_new(j_values, "bmh_command", json_real(json_number_value(json_object_get(heater, "command"))));
+  }
+  if (json_is_boolean(json_object_get(heater, "on"))) {
+    json_object_set_new(j_values, "bmh_on", json_integer(json_is_true(json_object_get(heater, "on"))?1:0));
+  }
+  if (timestamp > 0) {
+    if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
+      s_date = msprintf("FROM_UNIXTIME(%lld)", (long long)timestamp);
+      json_object_set_new(j_values, "bmh_date", json_pack("{ss}", "raw", s_date));
+      o_free(s_date);
+    } else {
+      json_object_set_new(j_values, "bmh_date", json_integer(timestamp));
+    }
+  }
+  
+  j_query = json_pack("{ssso}", "table", BENOIC_TABLE_MONITOR_HEATER, "values", j_values);
+  if (j_query == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "monitor_store_heater - Error allocating resources for j_query");
+    return B_ERROR_MEMORY;
+  }
+  res = h_insert(config->conn, j_query, NULL);
+  json_decref(j_query);
+  if (res != H_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "monitor_store_heater - Error inserting data for element %" JSON_INTEGER_FORMAT, element_id);
+    return B_ERROR_DB;
+  }
+  return B_OK;
+}
+
+/**
+ * Store a value in the monitor table for the specified element
+ * if timestamp is 0, the current date is used
+ * return B_OK on success
+ */
+int monitor_store_value(struct _benoic_config * config, json_int_t element_id, json_t * value, time_t timestamp) {
+  json_t * j_query;
+  char * s_value = NULL, * s_date;
+  int res;
+  
+  if (config == NULL || element_id == 0) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "monitor_store_value - Error input parameters");
+    return B_ERROR_PARAM;
+  }
+  
+  if (json_is_integer(value)) {
+    s_value = msprintf("%" JSON_INTEGER_FORMAT, json_integer_value(value));
+  } else if (json_is_number(value)) {
+    s_value = msprintf("%.2f", json_number_value(value));
+  } else if (json_is_string(value)) {
+    s_value = o_strdup(json_string_value(value));
+  } else if (json_is_boolean(value)) {
+    s_value = o_strdup(json_is_true(value)?"1":"0");
+  }
+  if (s_value == NULL) {
+    // Value can't be monitored
+    return B_ERROR_PARAM;
+  }
+  
+  j_query = json_pack("{sss{sIss}}", 
+                      "table", 
+                      BENOIC_TABLE_MONITOR, 
+                      "values", 
+                        "be_id", 
+                        element_id, 
+                        "bm_value", 
+                        s_value);
+  o_free(s_value);
+  if (j_query == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "monitor_store_value - Error allocating resources for j_query");
+    return B_ERROR_MEMORY;
+  }
+  if (timestamp > 0) {
+    if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
+      s_date = msprintf("FROM_UNIXTIME(%lld)", (long long)timestamp);
+      json_object_set_new(json_object_get(j_query, "values"), "bm_date", json_pack("{ss}", "raw", s_date));
+      o_free(s_date);
+    } else {
+      json_object_set_new(json_object_get(j_query, "values"), "bm_date", json_integer(timestamp));
+    }
+  }
+  res = h_insert(config->conn, j_query, NULL);
+  json_decref(j_query);
+  if (res != H_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "monitor_store_value - Error inserting data for element %" JSON_INTEGER_FORMAT, element_id);
+    return B_ERROR_DB;
+  }
+  return B_OK;
+}
+
+/**
+ * Set the next monitor date of the element to timestamp + monitored_every
+ * if timestamp is 0, the current date is used
+ * return B_OK on success
+ */
+int monitor_set_next(struct _benoic_config * config, json_int_t element_id, json_int_t monitored_every, time_t timestamp) {
+  json_t * j_query;
+  char * s_next_time;
+  int res;
+  
+  if (config == NULL || element_id == 0) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "monitor_set_next - Error input parameters");
+    return B_ERROR_PARAM;
+  }
+  
+  if (timestamp > 0) {
+    if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
+      s_next_time = msprintf("FROM_UNIXTIME(%lld)", (long long)timestamp + monitored_every);
+    } else {
+      s_next_time = msprintf("%lld", (long long)timestamp + monitored_every);
+    }
+  } else {
+    if (config->conn->type == HOEL_DB_TYPE_MARIADB) {
+      s_next_time = msprintf("CURRENT_TIMESTAMP + INTERVAL %" JSON_INTEGER_FORMAT " SECOND", monitored_every);
+    } else {
+      s_next_time = msprintf("strftime('%%s','now')+%" JSON_INTEGER_FORMAT, monitored_every);
+    }
+  }
+  j_query = json_pack("{sss{s{ss}}s{sI}}", "table", BENOIC_TABLE_ELEMENT, "set", "be_monitored_next", "raw", s_next_time, "where", "be_id", element_id);
+  o_free(s_next_time);
+  if (j_query == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "monitor_set_next - Error allocating resources for j_query");
+    return B_ERROR_MEMORY;
+  }
+  res = h_update(config->conn, j_query, NULL);
+  json_decref(j_query);
+  if (res != H_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "monitor_set_next - Error updating next_time for element %" JSON_INTEGER_FORMAT, element_id);
+    return B_ERROR_DB;
+  }
+  // The pushed values use the index to know when the next sample is due
+  set_element_index_monitor_next(config, element_id, (timestamp>0?timestamp:time(NULL)) + monitored_every);
+  return B_OK;
+}
+
+/**
+ * Record a value pushed by a module for the specified element
+ * If the element is monitored and its next monitor date is reached, the value is stored in the monitor table
+ * and the next poll is postponed, so polling is only a fallback when no value is pushed
+ * return B_OK on success
+ */
+int element_push_value(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, json_t * value, time_t timestamp) {
+  json_t * j_value;
+  json_int_t element_id, monitored_every = 0;
+  int to_return = B_OK;
+  
+  if (config == NULL || device_name == NULL || element_name == NULL || value == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "element_push_value - Error input parameters");
+    return B_ERROR_PARAM;
+  }
+  
+  element_id = get_element_id(config, device_name, element_type, element_name);
+  if (element_id == 0) {
+    // Element unknown in the database, therefore not monitored
+    return B_ERROR_NOT_FOUND;
+  }
+  
+  if (timestamp == 0) {
+    time(&timestamp);
+  }
+  
+  // The cached value of a heater is the heater object itself, like the module gives it
+  j_value = (element_type==BENOIC_ELEMENT_TYPE_HEATER)?json_deep_copy(value):json_pack("{sO}", "value", value);
+  set_element_value_cache(config, device_name, element_type, element_name, j_value);
+  json_decref(j_value);
+  
+  // The monitor settings are kept in the index, the element isn't read in the database
+  // Like the polling monitor, only one sample every monitored_every seconds is stored
+  if (element_index_monitor_due(config, element_id, timestamp, &monitored_every) == B_OK) {
+    if (element_type == BENOIC_ELEMENT_TYPE_HEATER) {
+      to_return = monitor_store_heater(config, element_id, value, timestamp);
+    } else {
+      to_return = monitor_store_value(config, element_id, value, timestamp);
+    }
+    if (to_return == B_OK) {
+      to_return = monitor_set_next(config, element_id, monitored_every, timestamp);
+    }
+  }
+  return to_return;
+}
+
+/**
+ * Element index functions
+ */
+
+/**
+ * Load the index of all the elements stored in the database
+ * return B_OK on success
+ */
+int load_element_index(struct _benoic_config * config) {
+  json_t * j_query, * j_result, * element;
+  int res, to_return = B_OK;
+  size_t index;
+  
+  if (config == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "load_element_index - Error input parameters");
+    return B_ERROR_PARAM;
+  }
+  
+  j_query = json_pack("{sss[ssssss]}", 
+                      "table", 
+                      BENOIC_TABLE_ELEMENT,
+                      "columns",
+                        "be_id",
+                        "bd_name",
+                        "be_type",
+                        "be_name",
+                        "be_monitored",
+                        "be_monitored_every");
+  if (j_query == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "load_element_index - Error allocating resources for j_query");
+    return B_ERROR_MEMORY;
+  }
+  res = h_select(config->conn, j_query, &j_result, NULL);
+  json_decref(j_query);
+  if (res == H_OK) {
+    close_element_index(config);
+    json_array_foreach(j_result, index, element) {
+      if (set_element_index(config, 
+                            json_string_value(json_object_get(element, "bd_name")), 
+                            json_integer_value(json_object_get(element, "be_type")), 
+                            json_string_value(json_object_get(element, "be_name")), 
+                            json_integer_value(json_object_get(element, "be_id")), 
+                            json_integer_value(json_object_get(element, "be_monitored")) == 1, 
+                            json_integer_value(json_object_get(element, "be_monitored_every"))) != B_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "load_element_index - Error adding element %s/%s to the index", json_string_value(json_object_get(element, "bd_name")), json_string_value(json_object_get(element, "be_name")));
+        to_return = B_ERROR_MEMORY;
+        break;
+      }
+    }
+    json_decref(j_result);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "load_element_index - Error executing j_query");
+    to_return = B_ERROR_DB;
+  }
+  return to_return;
+}
+
+/**
+ * Free all the entries of the element index
+ */
+void close_element_index(struct _benoic_config * config) {
+  int i;
+  
+  if (config != NULL) {
+    pthread_mutex_lock(&config->element_index_lock);
+    for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+      o_free(config->element_index_list[i].device_name);
+      o_free(config->element_index_list[i].element_name);
+      json_decref(config->element_index_list[i].data);
+      json_decref(config->element_index_list[i].value);
+    }
+    o_free(config->element_index_list);
+    config->element_index_list = NULL;
+    pthread_mutex_unlock(&config->element_index_lock);
+  }
+}
+
+/**
+ * Return the be_id of the specified element
+ * Look in the index first, then in the database if the element isn't indexed yet
+ * or if it was missing more than BENOIC_ELEMENT_MISSING_TTL seconds ago
+ * return 0 if the element doesn't exist
+ */
+json_int_t get_element_id(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name) {
+  json_int_t element_id = 0;
+  int i, indexed = 0;
+  
+  if (config == NULL || device_name == NULL || element_name == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_element_id - Error input parameters");
+    return 0;
+  }
+  
+  pthread_mutex_lock(&config->element_index_lock);
+  for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+    if (config->element_index_list[i].element_type == element_type && 
+        0 == o_strcmp(config->element_index_list[i].element_name, element_name) && 
+        0 == o_strcmp(config->element_index_list[i].device_name, device_name)) {
+      element_id = config->element_index_list[i].element_id;
+      indexed = (element_id != 0 || config->element_index_list[i].missing_date + BENOIC_ELEMENT_MISSING_TTL >= time(NULL));
+      break;
+    }
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  
+  if (!indexed) {
+    // Element not indexed yet, e.g. created since the index was loaded
+    element_id = load_element_id(config, device_name, element_type, element_name);
+  }
+  return element_id;
+}
+
+/**
+ * Read the be_id of the specified element in the database and store it in the index,
+ * an element missing in the database is stored too, so it's not read again before BENOIC_ELEMENT_MISSING_TTL seconds
+ * return 0 if the element doesn't exist
+ */
+json_int_t load_element_id(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name) {
+  json_t * j_query, * j_result, * j_element;
+  json_int_t element_id = 0;
+  int res;
+  
+  j_query = json_pack("{sss[sss]s{sssiss}}", 
+                      "table", 
+                      BENOIC_TABLE_ELEMENT,
+                      "columns",
+                        "be_id",
+                        "be_monitored",
+                        "be_monitored_every",
+                      "where",
+                        "be_name",
+                        element_name,
+                        "be_type",
+                        element_type,
+                        "bd_name",
+                        device_name);
+  if (j_query == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "load_element_id - Error allocating resources for j_query");
+    return 0;
+  }
+  res = h_select(config->conn, j_query, &j_result, NULL);
+  json_decref(j_query);
+  if (res == H_OK) {
+    j_element = json_array_get(j_result, 0);
+    element_id = json_integer_value(json_object_get(j_element, "be_id"));
+    if (set_element_index(config, 
+                          device_name, 
+                          element_type, 
+                          element_name, 
+                          element_id, 
+                          json_integer_value(json_object_get(j_element, "be_monitored")) == 1, 
+                          json_integer_value(json_object_get(j_element, "be_monitored_every"))) != B_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "load_element_id - Error adding element %s/%s to the index", device_name, element_name);
+    }
+    json_decref(j_result);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "load_element_id - Error executing j_query");
+  }
+  return element_id;
+}
+
+/**
+ * Add an element to the index if it's not already present, or update its be_id and monitor settings
+ * element_id 0 means the element is missing in the database
+ * return B_OK on success
+ */
+int set_element_index(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, json_int_t element_id, const int monitored, const json_int_t monitored_every) {
+  struct _benoic_element_index * tmp;
+  size_t element_index_size;
+  char * new_device_name, * new_element_name;
+  
+  if (config == NULL || device_name == NULL || element_name == NULL) {
+    return B_ERROR_PARAM;
+  }
+  
+  pthread_mutex_lock(&config->element_index_lock);
+  for (element_index_size = 0; config->element_index_list != NULL && config->element_index_list[element_index_size].device_name != NULL; element_index_size++) {
+    if (config->element_index_list[element_index_size].element_type == element_type && 
+        0 == o_strcmp(config->element_index_list[element_index_size].element_name, element_name) && 
+        0 == o_strcmp(config->element_index_list[element_index_size].device_name, device_name)) {
+      config->element_index_list[element_index_size].element_id = element_id;
+      config->element_index_list[element_index_size].missing_date = element_id==0?time(NULL):0;
+      if (config->element_index_list[element_index_size].monitored_every != monitored_every) {
+        config->element_index_list[element_index_size].monitored_next = 0;
+      }
+      config->element_index_list[element_index_size].monitored = monitored;
+      config->element_index_list[element_index_size].monitored_every = monitored_every;
+      pthread_mutex_unlock(&config->element_index_lock);
+      return B_OK;
+    }
+  }
+  new_device_name = o_strdup(device_name);
+  new_element_name = o_strdup(element_name);
+  tmp = o_realloc(config->element_index_list, (element_index_size + 2)*sizeof(struct _benoic_element_index));
+  if (new_device_name == NULL || new_element_name == NULL || tmp == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "set_element_index - Error allocating resources for new index entry");
+    if (tmp != NULL) {
+      config->element_index_list = tmp;
+    }
+    pthread_mutex_unlock(&config->element_index_lock);
+    o_free(new_device_name);
+    o_free(new_element_name);
+    return B_ERROR_MEMORY;
+  }
+  config->element_index_list = tmp;
+  config->element_index_list[element_index_size].device_name = new_device_name;
+  config->element_index_list[element_index_size].element_name = new_element_name;
+  config->element_index_list[element_index_size].element_type = element_type;
+  config->element_index_list[element_index_size].element_id = element_id;
+  config->element_index_list[element_index_size].missing_date = element_id==0?time(NULL):0;
+  config->element_index_list[element_index_size].monitored = monitored;
+  config->element_index_list[element_index_size].monitored_every = monitored_every;
+  config->element_index_list[element_index_size].monitored_next = 0;
+  config->element_index_list[element_index_size].data = NULL;
+  config->element_index_list[element_index_size].value = NULL;
+  config->element_index_list[element_index_size].value_date = 0;
+  config->element_index_list[element_index_size].value_generation = 0;
+  config->element_index_list[element_index_size + 1].device_name = NULL;
+  config->element_index_list[element_index_size + 1].element_name = NULL;
+  pthread_mutex_unlock(&config->element_index_lock);
+  return B_OK;
+}
+
+/**
+ * Check if a sample of the monitored element taken at timestamp must be stored
+ * If so, the next monitor date in the index is set to timestamp + monitored_every,
+ * so the samples pushed in between are not stored
+ * return B_OK if the sample must be stored, B_ERROR_NOT_FOUND if the element isn't indexed or monitored,
+ * B_ERROR_BUSY if the next monitor date isn't reached yet
+ */
+int element_index_monitor_due(struct _benoic_config * config, json_int_t element_id, time_t timestamp, json_int_t * monitored_every) {
+  int i, to_return = B_ERROR_NOT_FOUND;
+  
+  if (config == NULL || element_id == 0 || monitored_every == NULL) {
+    return B_ERROR_PARAM;
+  }
+  
+  pthread_mutex_lock(&config->element_index_lock);
+  for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+    if (config->element_index_list[i].element_id == element_id) {
+      if (config->element_index_list[i].monitored) {
+        if (timestamp >= config->element_index_list[i].monitored_next) {
+          *monitored_every = config->element_index_list[i].monitored_every;
+          config->element_index_list[i].monitored_next = timestamp + config->element_index_list[i].monitored_every;
+          to_return = B_OK;
+        } else {
+          to_return = B_ERROR_BUSY;
+        }
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  return to_return;
+}
+
+/**
+ * Set the next monitor date of the element in the index
+ * return B_OK on success, B_ERROR_NOT_FOUND if the element isn't indexed
+ */
+int set_element_index_monitor_next(struct _benoic_config * config, json_int_t element_id, time_t monitored_next) {
+  int i, to_return = B_ERROR_NOT_FOUND;
+  
+  if (config == NULL || element_id == 0) {
+    return B_ERROR_PARAM;
+  }
+  
+  pthread_mutex_lock(&config->element_index_lock);
+  for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+    if (config->element_index_list[i].element_id == element_id) {
+      config->element_index_list[i].monitored_next = monitored_next;
+      to_return = B_OK;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  return to_return;
+}
+
+/**
+ * Get the data of the element kept in the index
+ * missing is set to 1 if the element is known as missing in the database
+ * return NULL if the data aren't in the index
+ * returned value must be free'd after use
+ */
+json_t * get_element_index_data(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, int * missing) {
+  json_t * to_return = NULL;
+  int i;
+  
+  if (config == NULL || device_name == NULL || element_name == NULL || missing == NULL) {
+    return NULL;
+  }
+  
+  *missing = 0;
+  pthread_mutex_lock(&config->element_index_lock);
+  for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+    if (config->element_index_list[i].element_type == element_type && 
+        0 == o_strcmp(config->element_index_list[i].element_name, element_name) && 
+        0 == o_strcmp(config->element_index_list[i].device_name, device_name)) {
+      if (config->element_index_list[i].element_id != 0) {
+        to_return = json_deep_copy(config->element_index_list[i].data);
+      } else {
+        *missing = (config->element_index_list[i].missing_date + BENOIC_ELEMENT_MISSING_TTL >= time(NULL));
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  return to_return;
+}
+
+/**
+ * Keep the data of the element in the index, a NULL data drops the data kept
+ * return B_OK on success, B_ERROR_NOT_FOUND if the element isn't indexed
+ */
+int set_element_index_data(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, json_t * data) {
+  int i, to_return = B_ERROR_NOT_FOUND;
+  
+  if (config == NULL || device_name == NULL || element_name == NULL) {
+    return B_ERROR_PARAM;
+  }
+  
+  pthread_mutex_lock(&config->element_index_lock);
+  for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+    if (config->element_index_list[i].element_type == element_type && 
+        0 == o_strcmp(config->element_index_list[i].element_name, element_name) && 
+        0 == o_strcmp(config->element_index_list[i].device_name, device_name)) {
+      json_decref(config->element_index_list[i].data);
+      config->element_index_list[i].data = json_deep_copy(data);
+      to_return = B_OK;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  return to_return;
+}
+
+/**
+ * Remove all the elements of the specified device from the index
+ * return B_OK on success
+ */
+int remove_element_index(struct _benoic_config * config, const char * device_name) {
+  int i, j;
+  
+  if (config == NULL || device_name == NULL) {
+    return B_ERROR_PARAM;
+  }
+  
+  pthread_mutex_lock(&config->element_index_lock);
+  if (config->element_index_list != NULL) {
+    for (i=0, j=0; config->element_index_list[i].device_name != NULL; i++) {
+      if (0 == o_strcmp(config->element_index_list[i].device_name, device_name)) {
+        o_free(config->element_index_list[i].device_name);
+        o_free(config->element_index_list[i].element_name);
+        json_decref(config->element_index_list[i].data);
+        json_decref(config->element_index_list[i].value);
+      } else {
+        config->element_index_list[j++] = config->element_index_list[i];
+      }
+    }
+    config->element_index_list[j].device_name = NULL;
+    config->element_index_list[j].element_name = NULL;
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  return B_OK;
+}
+
+/**
+ * Store the last known value of the element in the index
+ * value is the json object returned by the module without the result field
+ * a NULL value invalidates the cached value
+ * return B_OK on success
+ */
+int set_element_value_cache(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, json_t * value) {
+  int i, to_return = B_ERROR_NOT_FOUND, changed = 0;
+  
+  // Make sure the element is in the index
+  if (get_element_id(config, device_name, element_type, element_name) == 0) {
+    return B_ERROR_NOT_FOUND;
+  }
+  
+  pthread_mutex_lock(&config->element_index_lock);
+  for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+    if (config->element_index_list[i].element_type == element_type && 
+        0 == o_strcmp(config->element_index_list[i].element_name, element_name) && 
+        0 == o_strcmp(config->element_index_list[i].device_name, device_name)) {
+      // The generation only moves when the value actually changes, so a refresh keeps the ETag valid
+      if (value == NULL || config->element_index_list[i].value == NULL || !json_equal(value, config->element_index_list[i].value)) {
+        config->element_index_list[i].value_generation = ++config->value_generation;
+        changed = (value != NULL);
+      }
+      json_decref(config->element_index_list[i].value);
+      config->element_index_list[i].value = json_deep_copy(value);
+      config->element_index_list[i].value_date = time(NULL);
+      to_return = B_OK;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  if (changed) {
+    publish_element_value(config, device_name, element_type, element_name, value);
+  }
+  return to_return;
+}
+
+/**
+ * Return the last known value of the element if it's not older than max_age seconds
+ * return NULL if there is no such value
+ * returned value must be free'd after use
+ */
+json_t * get_element_value_cache(struct _benoic_config * config, const char * device_name, const int element_type, const char * element_name, const time_t max_age) {
+  json_t * to_return = NULL;
+  time_t now;
+  int i;
+  
+  if (config == NULL || device_name == NULL || element_name == NULL || max_age <= 0) {
+    return NULL;
+  }
+  
+  time(&now);
+  pthread_mutex_lock(&config->element_index_lock);
+  for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+    if (config->element_index_list[i].element_type == element_type && 
+        0 == o_strcmp(config->element_index_list[i].element_name, element_name) && 
+        0 == o_strcmp(config->element_index_list[i].device_name, device_name)) {
+      if (config->element_index_list[i].value != NULL && config->element_index_list[i].value_date + max_age >= now) {
+        to_return = json_deep_copy(config->element_index_list[i].value);
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  return to_return;
+}
+
+/**
+ * Check that all the indexed elements of the device have a cached value not older than max_age seconds
+ * and set generation to the highest value generation of those elements
+ * return B_OK if the device values can be served from the cache
+ */
+int get_device_value_generation(struct _benoic_config * config, const char * device_name, const time_t max_age, unsigned long * generation) {
+  int i, to_return = B_ERROR_NOT_FOUND;
+  time_t now;
+  
+  if (config == NULL || device_name == NULL || generation == NULL || max_age <= 0) {
+    return B_ERROR_PARAM;
+  }
+  
+  time(&now);
+  *generation = 0;
+  pthread_mutex_lock(&config->element_index_lock);
+  for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+    if (config->element_index_list[i].element_id != 0 && 0 == o_strcmp(config->element_index_list[i].device_name, device_name)) {
+      if (config->element_index_list[i].value == NULL || config->element_index_list[i].value_date + max_age < now) {
+        to_return = B_ERROR_NOT_FOUND;
+        break;
+      }
+      if (config->element_index_list[i].value_generation > *generation) {
+        *generation = config->element_index_list[i].value_generation;
+      }
+      to_return = B_OK;
+    }
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  return to_return;
+}
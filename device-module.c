@@ -0,0 +1,850 @@
+/**
+ *
+ * Benoic House Automation service
+ *
+ * Command house automation devices via an HTTP REST interface
+ *
+ * Device modules interface functions
+ * Load the modules and call their element functions,
+ * the modules using the older json interface are called through a compatibility layer
+ *
+ * Copyright 2016 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <dlfcn.h>
+
+#include "benoic.h"
+
+/**
+ * Get the functions of the module opened in device_type->dl_handle
+ * The module descriptor is used if the module exports one, the older functions are looked up otherwise
+ * return B_OK on success, B_ERROR_PARAM if a mandatory function is missing
+ */
+int load_device_module(struct _device_type * device_type, const char * file_path) {
+  const struct _b_device_module * module;
+  
+  device_type->b_device_get_sensor = NULL;
+  device_type->b_device_get_switch = NULL;
+  device_type->b_device_set_switch = NULL;
+  device_type->b_device_get_dimmer = NULL;
+  device_type->b_device_set_dimmer = NULL;
+  device_type->b_device_get_heater = NULL;
+  device_type->b_device_set_heater = NULL;
+  device_type->b_device_ping = NULL;
+  
+  dlerror();
+  module = (const struct _b_device_module *)dlsym(device_type->dl_handle, BENOIC_MODULE_DESCRIPTOR);
+  if (module != NULL) {
+    if (module->abi_version < BENOIC_MODULE_ABI_VERSION_MIN || module->abi_version > BENOIC_MODULE_ABI_VERSION) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "load_device_module - Module %s uses the interface version %u, expected %u to %u", file_path, module->abi_version, BENOIC_MODULE_ABI_VERSION_MIN, BENOIC_MODULE_ABI_VERSION);
+      return B_ERROR_PARAM;
+    }
+    if (module->type_init == NULL || module->connect == NULL || module->disconnect == NULL || module->ping == NULL || module->overview == NULL ||
+        module->has_element == NULL || module->get_element == NULL || module->set_element == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "load_device_module - Error getting all function handles for module %s: type_init %p, connect %p, disconnect %p, ping %p, overview %p, has_element %p, get_element %p, set_element %p", file_path,
+      module->type_init, module->connect, module->disconnect, module->ping, module->overview, module->has_element, module->get_element, module->set_element);
+      return B_ERROR_PARAM;
+    }
+    device_type->abi_version = module->abi_version;
+    device_type->module = module;
+    device_type->b_device_type_init = module->type_init;
+    device_type->b_device_connect = module->connect;
+    device_type->b_device_disconnect = module->disconnect;
+    device_type->b_device_overview = module->overview;
+    device_type->b_device_has_element = module->has_element;
+    device_type->b_device_type_set_value_callback = module->set_value_callback;
+    device_type->b_device_type_set_alert_callback = module->set_alert_callback;
+    return B_OK;
+  }
+  
+  device_type->abi_version = 1;
+  device_type->module = NULL;
+  *(void **) (&device_type->b_device_type_init) = dlsym(device_type->dl_handle, "b_device_type_init");
+  *(void **) (&device_type->b_device_connect) = dlsym(device_type->dl_handle, "b_device_connect");
+  *(void **) (&device_type->b_device_disconnect) = dlsym(device_type->dl_handle, "b_device_disconnect");
+  *(void **) (&device_type->b_device_ping) = dlsym(device_type->dl_handle, "b_device_ping");
+  *(void **) (&device_type->b_device_overview) = dlsym(device_type->dl_handle, "b_device_overview");
+  *(void **) (&device_type->b_device_get_sensor) = dlsym(device_type->dl_handle, "b_device_get_sensor");
+  *(void **) (&device_type->b_device_get_switch) = dlsym(device_type->dl_handle, "b_device_get_switch");
+  *(void **) (&device_type->b_device_set_switch) = dlsym(device_type->dl_handle, "b_device_set_switch");
+  *(void **) (&device_type->b_device_get_dimmer) = dlsym(device_type->dl_handle, "b_device_get_dimmer");
+  *(void **) (&device_type->b_device_set_dimmer) = dlsym(device_type->dl_handle, "b_device_set_dimmer");
+  *(void **) (&device_type->b_device_get_heater) = dlsym(device_type->dl_handle, "b_device_get_heater");
+  *(void **) (&device_type->b_device_set_heater) = dlsym(device_type->dl_handle, "b_device_set_heater");
+  *(void **) (&device_type->b_device_has_element) = dlsym(device_type->dl_handle, "b_device_has_element");
+  *(void **) (&device_type->b_device_type_set_value_callback) = dlsym(device_type->dl_handle, "b_device_type_set_value_callback");
+  *(void **) (&device_type->b_device_type_set_alert_callback) = dlsym(device_type->dl_handle, "b_device_type_set_alert_callback");
+  
+  if ((device_type->b_device_type_init != NULL) && (device_type->b_device_connect != NULL) && (device_type->b_device_disconnect != NULL) && (device_type->b_device_ping != NULL) && (device_type->b_device_overview != NULL) &&
+      (device_type->b_device_get_sensor != NULL) && (device_type->b_device_get_switch != NULL) && (device_type->b_device_set_switch != NULL) &&
+      (device_type->b_device_get_dimmer != NULL) && (device_type->b_device_set_dimmer != NULL) && (device_type->b_device_get_heater != NULL) &&
+      (device_type->b_device_set_heater != NULL) && (device_type->b_device_has_element != NULL)) {
+    return B_OK;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "load_device_module - Error getting all function handles for module %s: b_device_type_init %p, b_device_connect %p, b_device_disconnect %p, b_device_ping %p, b_device_overview %p, b_device_get_sensor_value %p, b_device_get_switch_value %p, b_device_set_switch_value %p, b_device_get_dimmer_value %p, b_device_set_dimmer_value %p, b_device_get_heater_value %p, b_device_set_heater_value %p, b_device_has_element %p", file_path,
+    device_type->b_device_type_init, device_type->b_device_connect, device_type->b_device_disconnect, device_type->b_device_ping, device_type->b_device_overview, device_type->b_device_get_sensor,
+    device_type->b_device_get_switch, device_type->b_device_set_switch, device_type->b_device_get_dimmer, device_type->b_device_set_dimmer,
+    device_type->b_device_get_heater, device_type->b_device_set_heater, device_type->b_device_has_element);
+    return B_ERROR_PARAM;
+  }
+}
+
+/**
+ * Return the concurrency contract corresponding to the value declared by the module
+ * A module declaring nothing is not called from many threads at once
+ */
+int module_concurrency_from_string(const char * concurrency) {
+  if (0 == o_strcmp(concurrency, BENOIC_MODULE_CONCURRENCY_THREAD_SAFE)) {
+    return BENOIC_CONCURRENCY_THREAD_SAFE;
+  } else if (0 == o_strcmp(concurrency, BENOIC_MODULE_CONCURRENCY_DEVICE)) {
+    return BENOIC_CONCURRENCY_DEVICE;
+  } else {
+    return BENOIC_CONCURRENCY_MODULE;
+  }
+}
+
+/**
+ * Return the name of the concurrency contract
+ */
+const char * module_concurrency_to_string(const int concurrency) {
+  switch (concurrency) {
+    case BENOIC_CONCURRENCY_THREAD_SAFE:
+      return BENOIC_MODULE_CONCURRENCY_THREAD_SAFE;
+    case BENOIC_CONCURRENCY_DEVICE:
+      return BENOIC_MODULE_CONCURRENCY_DEVICE;
+    default:
+      return BENOIC_MODULE_CONCURRENCY_MODULE;
+  }
+}
+
+/**
+ * Count a call to the module, if the module is being reloaded, wait for the reload to end
+ * return B_OK if the module can be called, module_gate_leave must then be called after the call,
+ * B_ERROR_NOT_FOUND if the module isn't available anymore
+ */
+int module_gate_enter(struct _device_type * device_type) {
+  int available = 1;
+  
+  if (device_type->gate != NULL) {
+    pthread_mutex_lock(&device_type->gate->lock);
+    while (device_type->gate->reloading && !pthread_equal(device_type->gate->reload_thread, pthread_self())) {
+      pthread_cond_wait(&device_type->gate->cond, &device_type->gate->lock);
+    }
+    available = (device_type->dl_handle != NULL);
+    if (available) {
+      device_type->gate->nb_calls++;
+    }
+    pthread_mutex_unlock(&device_type->gate->lock);
+  }
+  if (!available) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "module_gate_enter - Module of device type %s is not available", device_type->uid);
+    return B_ERROR_NOT_FOUND;
+  }
+  return B_OK;
+}
+
+/**
+ * End the call counted by module_gate_enter
+ */
+void module_gate_leave(struct _device_type * device_type) {
+  if (device_type->gate != NULL) {
+    pthread_mutex_lock(&device_type->gate->lock);
+    if (--device_type->gate->nb_calls == 0) {
+      pthread_cond_broadcast(&device_type->gate->cond);
+    }
+    pthread_mutex_unlock(&device_type->gate->lock);
+  }
+}
+
+/**
+ * Take the lock required by the module before calling it for the device
+ * Nothing is locked for a thread-safe module
+ */
+void module_concurrency_lock(struct _benoic_config * config, struct _device_type * device_type, json_t * device) {
+  struct _benoic_device_state * device_state;
+  
+  if (device_type->concurrency == BENOIC_CONCURRENCY_MODULE && device_type->module_lock != NULL) {
+    pthread_mutex_lock(device_type->module_lock);
+  } else if (device_type->concurrency == BENOIC_CONCURRENCY_DEVICE) {
+    // A device state is never free'd while benoic is running, so it can be used outside of device_state_lock
+    pthread_mutex_lock(&config->device_state_lock);
+    device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+    pthread_mutex_unlock(&config->device_state_lock);
+    if (device_state != NULL) {
+      pthread_mutex_lock(&device_state->module_lock);
+    }
+  }
+}
+
+/**
+ * Release the lock taken by module_concurrency_lock
+ */
+void module_concurrency_unlock(struct _benoic_config * config, struct _device_type * device_type, json_t * device) {
+  struct _benoic_device_state * device_state;
+  
+  if (device_type->concurrency == BENOIC_CONCURRENCY_MODULE && device_type->module_lock != NULL) {
+    pthread_mutex_unlock(device_type->module_lock);
+  } else if (device_type->concurrency == BENOIC_CONCURRENCY_DEVICE) {
+    pthread_mutex_lock(&config->device_state_lock);
+    device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+    pthread_mutex_unlock(&config->device_state_lock);
+    if (device_state != NULL) {
+      pthread_mutex_unlock(&device_state->module_lock);
+    }
+  }
+}
+
+/**
+ * Prepare a call to the module for the device
+ * Wait for a reload of the module, or a connection or disconnection of the device, to end,
+ * connect a lazy device if needed, then take the lock required by the module
+ * return B_OK if the module can be called, module_call_leave must then be called after the call,
+ * B_ERROR_NOT_FOUND if the module isn't available anymore, B_ERROR_IO if the lazy device couldn't be connected,
+ * B_ERROR_UNAVAILABLE if the device is down or its circuit breaker is open
+ */
+int module_call_enter(struct _benoic_config * config, struct _device_type * device_type, json_t * device) {
+  int res = module_gate_enter(device_type);
+  
+  if (res == B_OK) {
+    res = device_link_enter(config, device);
+    if (res == B_OK) {
+      module_concurrency_lock(config, device_type, device);
+    } else {
+      module_gate_leave(device_type);
+    }
+  }
+  return res;
+}
+
+/**
+ * End the call prepared by module_call_enter
+ * result is the DEVICE_RESULT_* value of the call, recorded by the circuit breaker of the device,
+ * or BENOIC_BREAKER_NO_RESULT if the call tells nothing about the device
+ */
+void module_call_leave(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const int result) {
+  module_concurrency_unlock(config, device_type, device);
+  module_call_complete(config, device_type, device, result);
+}
+
+/**
+ * End the call prepared by module_call_enter once the lock required by the module is released
+ * Used by the asynchronous calls, the module stays counted until their completion
+ */
+void module_call_complete(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const int result) {
+  device_breaker_record(config, device, result);
+  device_link_leave(config, device);
+  module_gate_leave(device_type);
+}
+
+/**
+ * Prepare a connection or a disconnection of the device
+ * Same as module_call_enter, but the other calls for the device wait until module_link_leave
+ * owned is set to 0 if the calling thread was already connecting the device, e.g. a lazy connection,
+ * linked is set to true if the device is connected, if it's not NULL
+ * return B_OK if the module can be called, module_link_leave must then be called after the call
+ */
+int module_link_enter(struct _benoic_config * config, struct _device_type * device_type, json_t * device, int * owned, int * linked) {
+  int res = module_gate_enter(device_type);
+  
+  if (res == B_OK) {
+    *owned = device_link_lock(config, device, linked);
+    module_concurrency_lock(config, device_type, device);
+  }
+  return res;
+}
+
+/**
+ * End the connection or disconnection prepared by module_link_enter
+ * linked tells if the device is connected after the call
+ */
+void module_link_leave(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const int owned, const int linked) {
+  module_concurrency_unlock(config, device_type, device);
+  device_link_unlock(config, device, owned, linked);
+  module_gate_leave(device_type);
+}
+
+/**
+ * Initialize the gate of the calls to a module
+ */
+int module_gate_init(struct _benoic_module_gate * gate) {
+  if (pthread_mutex_init(&gate->lock, NULL) || pthread_cond_init(&gate->cond, NULL)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "module_gate_init - Error initializing gate");
+    return B_ERROR_MEMORY;
+  }
+  gate->nb_calls = 0;
+  gate->reloading = 0;
+  return B_OK;
+}
+
+/**
+ * Free the resources of the gate of the calls to a module
+ */
+void module_gate_destroy(struct _benoic_module_gate * gate) {
+  pthread_mutex_destroy(&gate->lock);
+  pthread_cond_destroy(&gate->cond);
+}
+
+/**
+ * Close the gate of the module and wait for the calls in progress to end
+ * The calling thread can still call the module until module_gate_open
+ * return B_OK when there is no call left, B_ERROR_BUSY if another reload is running,
+ * B_ERROR_TIMEOUT if calls were still running after timeout milliseconds, the gate is then open again
+ */
+int module_gate_close(struct _device_type * device_type, const long timeout) {
+  struct timespec deadline;
+  int res = 0, to_return = B_OK;
+  
+  if (device_type->gate == NULL) {
+    return B_ERROR_PARAM;
+  }
+  set_deadline(&deadline, timeout);
+  pthread_mutex_lock(&device_type->gate->lock);
+  if (device_type->gate->reloading) {
+    pthread_mutex_unlock(&device_type->gate->lock);
+    return B_ERROR_BUSY;
+  }
+  device_type->gate->reloading = 1;
+  device_type->gate->reload_thread = pthread_self();
+  while (device_type->gate->nb_calls > 0 && res != ETIMEDOUT) {
+    res = pthread_cond_timedwait(&device_type->gate->cond, &device_type->gate->lock, &deadline);
+  }
+  if (device_type->gate->nb_calls > 0) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "module_gate_close - %u calls to module %s still running", device_type->gate->nb_calls, device_type->uid);
+    device_type->gate->reloading = 0;
+    pthread_cond_broadcast(&device_type->gate->cond);
+    to_return = B_ERROR_TIMEOUT;
+  }
+  pthread_mutex_unlock(&device_type->gate->lock);
+  return to_return;
+}
+
+/**
+ * Open the gate of the module, the calls waiting for it can run
+ */
+void module_gate_open(struct _device_type * device_type) {
+  if (device_type->gate != NULL) {
+    pthread_mutex_lock(&device_type->gate->lock);
+    device_type->gate->reloading = 0;
+    pthread_cond_broadcast(&device_type->gate->cond);
+    pthread_mutex_unlock(&device_type->gate->lock);
+  }
+}
+
+/**
+ * Initialize an element result before it's given to a module
+ */
+void element_result_init(struct _b_element_result * result) {
+  result->result = DEVICE_RESULT_ERROR;
+  result->value_type = BENOIC_VALUE_NONE;
+  result->integer_value = 0;
+  result->double_value = 0;
+  result->string_value[0] = '\0';
+  result->mode[0] = '\0';
+  result->on = 0;
+  result->extra = NULL;
+}
+
+/**
+ * Free the resources of an element result
+ */
+void element_result_clean(struct _b_element_result * result) {
+  json_decref(result->extra);
+  result->extra = NULL;
+}
+
+/**
+ * Fill result with the json result of a module using the older interface
+ * The properties other than the result and the value are kept in result->extra
+ * return the result of the module
+ */
+int element_result_from_json(json_t * j_result, const int element_type, struct _b_element_result * result) {
+  json_t * j_value, * value;
+  const char * key;
+  
+  element_result_init(result);
+  if (j_result == NULL) {
+    return result->result;
+  }
+  result->result = (int)json_integer_value(json_object_get(j_result, "result"));
+  j_value = json_object_get(j_result, (element_type == BENOIC_ELEMENT_TYPE_HEATER)?"command":"value");
+  if (json_is_integer(j_value)) {
+    result->value_type = BENOIC_VALUE_INTEGER;
+    result->integer_value = json_integer_value(j_value);
+    result->double_value = (double)result->integer_value;
+  } else if (json_is_real(j_value)) {
+    result->value_type = BENOIC_VALUE_DOUBLE;
+    result->double_value = json_real_value(j_value);
+  } else if (json_is_string(j_value)) {
+    result->value_type = BENOIC_VALUE_STRING;
+    snprintf(result->string_value, sizeof(result->string_value), "%s", json_string_value(j_value));
+  }
+  if (element_type == BENOIC_ELEMENT_TYPE_HEATER) {
+    if (json_is_string(json_object_get(j_result, "mode"))) {
+      snprintf(result->mode, sizeof(result->mode), "%s", json_string_value(json_object_get(j_result, "mode")));
+    }
+    result->on = (json_object_get(j_result, "on") == json_true());
+  }
+  json_object_foreach(j_result, key, value) {
+    if (0 != o_strcmp(key, "result") && 0 != o_strcmp(key, "value") &&
+        (element_type != BENOIC_ELEMENT_TYPE_HEATER || (0 != o_strcmp(key, "command") && 0 != o_strcmp(key, "mode") && 0 != o_strcmp(key, "on")))) {
+      if (result->extra == NULL) {
+        result->extra = json_object();
+      }
+      json_object_set(result->extra, key, value);
+    }
+  }
+  return result->result;
+}
+
+/**
+ * Return the json value of an element result, as used in the values cache and in the element json
+ * returned value must be free'd after use
+ */
+json_t * element_result_to_json(const struct _b_element_result * result, const int element_type) {
+  json_t * to_return = json_object();
+  
+  if (to_return == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "element_result_to_json - Error allocating resources for to_return");
+    return NULL;
+  }
+  if (element_type == BENOIC_ELEMENT_TYPE_HEATER) {
+    if (result->value_type != BENOIC_VALUE_NONE) {
+      json_object_set_new(to_return, "command", json_real(result->double_value));
+    }
+    if (result->mode[0] != '\0') {
+      json_object_set_new(to_return, "mode", json_string(result->mode));
+    }
+    json_object_set_new(to_return, "on", json_boolean(result->on));
+  } else if (result->value_type == BENOIC_VALUE_INTEGER) {
+    json_object_set_new(to_return, "value", json_integer(result->integer_value));
+  } else if (result->value_type == BENOIC_VALUE_DOUBLE) {
+    json_object_set_new(to_return, "value", json_real(result->double_value));
+  } else if (result->value_type == BENOIC_VALUE_STRING) {
+    json_object_set_new(to_return, "value", json_string(result->string_value));
+  }
+  if (json_is_object(result->extra)) {
+    json_object_update_missing(to_return, result->extra);
+  }
+  return to_return;
+}
+
+/**
+ * Ping the device with the module
+ * return a DEVICE_RESULT_* value, or BENOIC_BREAKER_REJECTED if the module wasn't called
+ * because the device is down or its circuit is open, this isn't a failure of the device
+ */
+int module_ping(struct _benoic_config * config, struct _device_type * device_type, json_t * device) {
+  json_t * j_result;
+  void * device_ptr;
+  int res;
+  
+  res = module_call_enter(config, device_type, device);
+  if (res == B_ERROR_UNAVAILABLE) {
+    return BENOIC_BREAKER_REJECTED;
+  } else if (res != B_OK) {
+    return DEVICE_RESULT_ERROR;
+  }
+  // The device is connected by module_call_enter if it's lazy, its pointer is valid until module_call_leave
+  device_ptr = get_device_ptr(config, json_string_value(json_object_get(device, "name")));
+  if (device_type->module != NULL) {
+    res = device_type->module->ping(device, device_ptr);
+  } else {
+    j_result = device_type->b_device_ping(device, device_ptr);
+    res = (j_result != NULL)?(int)json_integer_value(json_object_get(j_result, "result")):DEVICE_RESULT_ERROR;
+    json_decref(j_result);
+  }
+  module_call_leave(config, device_type, device, res);
+  return res;
+}
+
+/**
+ * Get the value of the element with the module
+ * result must be cleaned with element_result_clean after use
+ * return a DEVICE_RESULT_* value
+ */
+int module_get_element(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const int element_type, const char * element_name, struct _b_element_result * result) {
+  const struct _b_device_module * module;
+  json_t * j_result = NULL;
+  void * device_ptr;
+  
+  element_result_init(result);
+  if (module_call_enter(config, device_type, device) != B_OK) {
+    return result->result;
+  }
+  // The device is connected by module_call_enter if it's lazy, its pointer is valid until module_call_leave
+  device_ptr = get_device_ptr(config, json_string_value(json_object_get(device, "name")));
+  // The module is read once the gate is passed, it can't be reloaded before module_call_leave
+  module = device_type->module;
+  if (module != NULL) {
+    result->result = module->get_element(device, element_type, element_name, result, device_ptr);
+  } else {
+    switch (element_type) {
+      case BENOIC_ELEMENT_TYPE_SENSOR:
+        j_result = device_type->b_device_get_sensor(device, element_name, device_ptr);
+        break;
+      case BENOIC_ELEMENT_TYPE_SWITCH:
+        j_result = device_type->b_device_get_switch(device, element_name, device_ptr);
+        break;
+      case BENOIC_ELEMENT_TYPE_DIMMER:
+        j_result = device_type->b_device_get_dimmer(device, element_name, device_ptr);
+        break;
+      case BENOIC_ELEMENT_TYPE_HEATER:
+        j_result = device_type->b_device_get_heater(device, element_name, device_ptr);
+        break;
+      default:
+        module_call_leave(config, device_type, device, BENOIC_BREAKER_NO_RESULT);
+        result->result = DEVICE_RESULT_PARAM;
+        return result->result;
+    }
+  }
+  if (module == NULL) {
+    element_result_from_json(j_result, element_type, result);
+    json_decref(j_result);
+  }
+  module_call_leave(config, device_type, device, result->result);
+  return result->result;
+}
+
+/**
+ * Send the command to the element with the module
+ * result must be cleaned with element_result_clean after use
+ * return a DEVICE_RESULT_* value
+ */
+int module_set_element(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const struct _b_element_command * command, struct _b_element_result * result) {
+  const struct _b_device_module * module;
+  json_t * j_result = NULL;
+  void * device_ptr;
+  
+  element_result_init(result);
+  if (module_call_enter(config, device_type, device) != B_OK) {
+    return result->result;
+  }
+  // The device is connected by module_call_enter if it's lazy, its pointer is valid until module_call_leave
+  device_ptr = get_device_ptr(config, json_string_value(json_object_get(device, "name")));
+  module = device_type->module;
+  if (module != NULL) {
+    result->result = module->set_element(device, command, result, device_ptr);
+  } else {
+    switch (command->element_type) {
+      case BENOIC_ELEMENT_TYPE_SWITCH:
+        j_result = device_type->b_device_set_switch(device, command->element_name, command->command, device_ptr);
+        break;
+      case BENOIC_ELEMENT_TYPE_DIMMER:
+        j_result = device_type->b_device_set_dimmer(device, command->element_name, command->command, device_ptr);
+        break;
+      case BENOIC_ELEMENT_TYPE_HEATER:
+        j_result = device_type->b_device_set_heater(device, command->element_name, command->mode, command->heater_command, device_ptr);
+        break;
+      default:
+        module_call_leave(config, device_type, device, BENOIC_BREAKER_NO_RESULT);
+        result->result = DEVICE_RESULT_PARAM;
+        return result->result;
+    }
+  }
+  if (module == NULL) {
+    element_result_from_json(j_result, command->element_type, result);
+    json_decref(j_result);
+  }
+  module_call_leave(config, device_type, device, result->result);
+  return result->result;
+}
+
+/**
+ * Get the values of a list of elements with the module
+ * The elements are read one by one if the module has no batch get
+ * Each result must be cleaned with element_result_clean after use
+ * return a DEVICE_RESULT_* value
+ */
+int module_get_elements(struct _benoic_config * config, struct _device_type * device_type, json_t * device, struct _b_element_get * element_list, size_t nb_elements) {
+  size_t i;
+  void * device_ptr;
+  int res;
+  
+  for (i=0; i<nb_elements; i++) {
+    element_result_init(&element_list[i].result);
+  }
+  if (module_call_enter(config, device_type, device) != B_OK) {
+    return DEVICE_RESULT_ERROR;
+  }
+  if (module_has_get_elements(device_type)) {
+    // The device is connected by module_call_enter if it's lazy, its pointer is valid until module_call_leave
+    device_ptr = get_device_ptr(config, json_string_value(json_object_get(device, "name")));
+    res = device_type->module->get_elements(device, element_list, nb_elements, device_ptr);
+    module_call_leave(config, device_type, device, res);
+    if (res != DEVICE_RESULT_OK) {
+      for (i=0; i<nb_elements; i++) {
+        element_result_clean(&element_list[i].result);
+        element_list[i].result.result = res;
+      }
+    }
+    return res;
+  }
+  // The elements are recorded one by one
+  module_call_leave(config, device_type, device, BENOIC_BREAKER_NO_RESULT);
+  for (i=0; i<nb_elements; i++) {
+    module_get_element(config, device_type, device, element_list[i].element_type, element_list[i].element_name, &element_list[i].result);
+  }
+  return DEVICE_RESULT_OK;
+}
+
+/**
+ * Send a list of commands with the module
+ * The commands are sent one by one if the module has no batch set
+ * Each result must be cleaned with element_result_clean after use
+ * return a DEVICE_RESULT_* value
+ */
+int module_set_elements(struct _benoic_config * config, struct _device_type * device_type, json_t * device, struct _b_element_set * element_list, size_t nb_elements) {
+  size_t i;
+  void * device_ptr;
+  int res;
+  
+  for (i=0; i<nb_elements; i++) {
+    element_result_init(&element_list[i].result);
+  }
+  if (module_call_enter(config, device_type, device) != B_OK) {
+    return DEVICE_RESULT_ERROR;
+  }
+  if (module_has_set_elements(device_type)) {
+    // The device is connected by module_call_enter if it's lazy, its pointer is valid until module_call_leave
+    device_ptr = get_device_ptr(config, json_string_value(json_object_get(device, "name")));
+    res = device_type->module->set_elements(device, element_list, nb_elements, device_ptr);
+    module_call_leave(config, device_type, device, res);
+    if (res != DEVICE_RESULT_OK) {
+      for (i=0; i<nb_elements; i++) {
+        element_result_clean(&element_list[i].result);
+        element_list[i].result.result = res;
+      }
+    }
+    return res;
+  }
+  // The elements are recorded one by one
+  module_call_leave(config, device_type, device, BENOIC_BREAKER_NO_RESULT);
+  for (i=0; i<nb_elements; i++) {
+    module_set_element(config, device_type, device, &element_list[i].command, &element_list[i].result);
+  }
+  return DEVICE_RESULT_OK;
+}
+
+/**
+ * Return true if the module can read many elements in one call
+ */
+int module_has_get_elements(struct _device_type * device_type) {
+  int res;
+  
+  if (device_type == NULL || device_type->gate == NULL) {
+    return 0;
+  }
+  // The gate lock keeps the module from being reloaded while it's read
+  pthread_mutex_lock(&device_type->gate->lock);
+  res = (device_type->module != NULL && device_type->module->get_elements != NULL);
+  pthread_mutex_unlock(&device_type->gate->lock);
+  return res;
+}
+
+/**
+ * Return true if the module can send many commands in one call
+ */
+int module_has_set_elements(struct _device_type * device_type) {
+  int res;
+  
+  if (device_type == NULL || device_type->gate == NULL) {
+    return 0;
+  }
+  pthread_mutex_lock(&device_type->gate->lock);
+  res = (device_type->module != NULL && device_type->module->set_elements != NULL);
+  pthread_mutex_unlock(&device_type->gate->lock);
+  return res;
+}
+
+/**
+ * Allocate the context of an asynchronous module call
+ * element_name and mode are copied and can be NULL
+ * returned value must be free'd with async_call_free after use
+ */
+struct _benoic_async_call * async_call_new(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, const char * mode) {
+  struct _benoic_async_call * async_call = o_malloc(sizeof(struct _benoic_async_call));
+  
+  if (async_call == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "async_call_new - Error allocating resources for async_call");
+    return NULL;
+  }
+  async_call->config = config;
+  async_call->device_type = NULL;
+  pthread_mutex_init(&async_call->lock, NULL);
+  async_call->nb_holds = 0;
+  async_call->result = BENOIC_BREAKER_NO_RESULT;
+  async_call->device = json_deep_copy(device);
+  async_call->element_type = element_type;
+  async_call->element_name = o_strdup(element_name);
+  async_call->mode = o_strdup(mode);
+  async_call->flight = NULL;
+  async_call->callback = NULL;
+  async_call->cls = NULL;
+  return async_call;
+}
+
+/**
+ * Free the context of an asynchronous module call
+ */
+void async_call_free(struct _benoic_async_call * async_call) {
+  if (async_call != NULL) {
+    json_decref(async_call->device);
+    o_free(async_call->element_name);
+    o_free(async_call->mode);
+    pthread_mutex_destroy(&async_call->lock);
+    o_free(async_call);
+  }
+}
+
+/**
+ * Release the hold of the starting thread or of the completion on a started asynchronous call
+ * result is the DEVICE_RESULT_* value given by the completion, BENOIC_BREAKER_NO_RESULT for the starting thread
+ * The last one ends the module call and frees async_call, so the module can't be reloaded
+ * and the device can't be disconnected while the module still runs the call
+ */
+void async_call_release(struct _benoic_async_call * async_call, const int result) {
+  int nb_holds;
+  
+  pthread_mutex_lock(&async_call->lock);
+  if (result != BENOIC_BREAKER_NO_RESULT) {
+    async_call->result = result;
+  }
+  nb_holds = --async_call->nb_holds;
+  pthread_mutex_unlock(&async_call->lock);
+  if (nb_holds == 0) {
+    module_call_complete(async_call->config, async_call->device_type, async_call->device, async_call->result);
+    async_call_free(async_call);
+  }
+}
+
+/**
+ * Start reading the element with the asynchronous function of the module
+ * callback is called with async_call as cls and the result when the module has read the element,
+ * it must call async_call_release
+ * return DEVICE_RESULT_OK if the read is started, any other value if the module can't read it asynchronously,
+ * callback is then never called
+ */
+int module_get_element_async(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const int element_type, const char * element_name, b_element_completion_callback callback, struct _benoic_async_call * async_call) {
+  void * device_ptr;
+  int res;
+  
+  // A module without the asynchronous function is called synchronously by the caller, the call doesn't enter the module twice
+  if (device_type->module == NULL || device_type->abi_version < 3 || device_type->module->get_element_async == NULL) {
+    return DEVICE_RESULT_PARAM;
+  }
+  if (module_call_enter(config, device_type, device) != B_OK) {
+    return DEVICE_RESULT_ERROR;
+  }
+  // The device is connected by module_call_enter if it's lazy, its pointer is valid until module_call_leave
+  // The module can be reloaded before the call enters it, so it's checked again
+  device_ptr = get_device_ptr(config, json_string_value(json_object_get(device, "name")));
+  if (device_type->module != NULL && device_type->abi_version >= 3 && device_type->module->get_element_async != NULL) {
+    // The completion can run before the module function returns, even in another thread
+    async_call->device_type = device_type;
+    async_call->nb_holds = 2;
+    res = device_type->module->get_element_async(device, element_type, element_name, callback, async_call, device_ptr);
+  } else {
+    res = DEVICE_RESULT_PARAM;
+  }
+  if (res == DEVICE_RESULT_OK) {
+    // The module call ends when the completion ran too, its result is recorded then
+    module_concurrency_unlock(config, device_type, device);
+    async_call_release(async_call, BENOIC_BREAKER_NO_RESULT);
+  } else {
+    module_call_leave(config, device_type, device, res);
+  }
+  return res;
+}
+
+/**
+ * Start sending the command to the element with the asynchronous function of the module
+ * callback is called with async_call as cls and the result when the module has sent the command,
+ * it must call async_call_release
+ * return DEVICE_RESULT_OK if the command is started, any other value if the module can't send it asynchronously,
+ * callback is then never called
+ */
+int module_set_element_async(struct _benoic_config * config, struct _device_type * device_type, json_t * device, const struct _b_element_command * command, b_element_completion_callback callback, struct _benoic_async_call * async_call) {
+  void * device_ptr;
+  int res;
+  
+  // A module without the asynchronous function is called synchronously by the caller, the call doesn't enter the module twice
+  if (device_type->module == NULL || device_type->abi_version < 3 || device_type->module->set_element_async == NULL) {
+    return DEVICE_RESULT_PARAM;
+  }
+  if (module_call_enter(config, device_type, device) != B_OK) {
+    return DEVICE_RESULT_ERROR;
+  }
+  // The device is connected by module_call_enter if it's lazy, its pointer is valid until module_call_leave
+  // The module can be reloaded before the call enters it, so it's checked again
+  device_ptr = get_device_ptr(config, json_string_value(json_object_get(device, "name")));
+  if (device_type->module != NULL && device_type->abi_version >= 3 && device_type->module->set_element_async != NULL) {
+    // The completion can run before the module function returns, even in another thread
+    async_call->device_type = device_type;
+    async_call->nb_holds = 2;
+    res = device_type->module->set_element_async(device, command, callback, async_call, device_ptr);
+  } else {
+    res = DEVICE_RESULT_PARAM;
+  }
+  if (res == DEVICE_RESULT_OK) {
+    // The module call ends when the completion ran too, its result is recorded then
+    module_concurrency_unlock(config, device_type, device);
+    async_call_release(async_call, BENOIC_BREAKER_NO_RESULT);
+  } else {
+    module_call_leave(config, device_type, device, res);
+  }
+  return res;
+}
+
+/**
+ * Start getting the overview of the device with the asynchronous function of the module
+ * callback is called with async_call as cls and the overview when the module has it,
+ * it must call async_call_release
+ * return DEVICE_RESULT_OK if the overview is started, any other value if the module can't get it asynchronously,
+ * callback is then never called
+ */
+int module_overview_async(struct _benoic_config * config, struct _device_type * device_type, json_t * device, b_overview_completion_callback callback, struct _benoic_async_call * async_call) {
+  void * device_ptr;
+  int res;
+  
+  // A module without the asynchronous function is called synchronously by the caller, the call doesn't enter the module twice
+  if (device_type->module == NULL || device_type->abi_version < 3 || device_type->module->overview_async == NULL) {
+    return DEVICE_RESULT_PARAM;
+  }
+  if (module_call_enter(config, device_type, device) != B_OK) {
+    return DEVICE_RESULT_ERROR;
+  }
+  // The device is connected by module_call_enter if it's lazy, its pointer is valid until module_call_leave
+  // The module can be reloaded before the call enters it, so it's checked again
+  device_ptr = get_device_ptr(config, json_string_value(json_object_get(device, "name")));
+  if (device_type->module != NULL && device_type->abi_version >= 3 && device_type->module->overview_async != NULL) {
+    // The completion can run before the module function returns, even in another thread
+    async_call->device_type = device_type;
+    async_call->nb_holds = 2;
+    res = device_type->module->overview_async(device, callback, async_call, device_ptr);
+  } else {
+    res = DEVICE_RESULT_PARAM;
+  }
+  if (res == DEVICE_RESULT_OK) {
+    // The module call ends when the completion ran too, its result is recorded then
+    module_concurrency_unlock(config, device_type, device);
+    async_call_release(async_call, BENOIC_BREAKER_NO_RESULT);
+  } else {
+    module_call_leave(config, device_type, device, res);
+  }
+  return res;
+}
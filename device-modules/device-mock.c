@@ -24,17 +24,7 @@
 #include <yder.h>
 #include <orcania.h>
 
-#define WEBSERVICE_RESULT_ERROR     0
-#define WEBSERVICE_RESULT_OK        1
-#define WEBSERVICE_RESULT_NOT_FOUND 2
-#define WEBSERVICE_RESULT_TIMEOUT   3
-#define WEBSERVICE_RESULT_PARAM     4
-
-#define ELEMENT_TYPE_NONE   0
-#define ELEMENT_TYPE_SENSOR 1
-#define ELEMENT_TYPE_SWITCH 2
-#define ELEMENT_TYPE_DIMMER 3
-#define ELEMENT_TYPE_HEATER 4
+#include "../benoic-module.h"
 
 #define BENOIC_ELEMENT_HEATER_MODE_OFF     "off"
 #define BENOIC_ELEMENT_HEATER_MODE_MANUAL  "manual"
@@ -42,10 +32,6 @@
 
 #define NB_SECONDS_PER_DAY 86400
 
-json_t * b_device_get_switch (json_t * device, const char * switch_name, void * device_ptr);
-json_t * b_device_get_dimmer (json_t * device, const char * dimmer_name, void * device_ptr);
-json_t * b_device_get_heater (json_t * device, const char * heater_name, void * device_ptr);
-
 /**
  * Get the value sensor of a sensor using a sinus model
  */
@@ -69,12 +55,14 @@ json_t * b_device_type_init () {
   json_array_append_new(options, json_pack("{ssssssso}", "name", "baud", "type", "numeric", "description", "speed of the device communication", "optional", json_false()));
   json_array_append_new(options, json_pack("{ssssssso}", "name", "do_not_check_certificate", "type", "boolean", "description", "check the certificate of the device if needed", "optional", json_true()));
   json_array_append_new(options, json_pack("{ssssssso}", "name", "device_specified", "type", "string", "description", "specified by the device when connected for the first time, then must be sent back at every other connection", "optional", json_true()));
-  return json_pack("{sissssssso}", 
-                    "result", WEBSERVICE_RESULT_OK,
+  // The state of a mock device is kept in its device_ptr without any lock
+  return json_pack("{sisssssssoss}", 
+                    "result", DEVICE_RESULT_OK,
                     "uid", "00-00-00", 
                     "name", "Another Mock Device", 
                     "description", "This is another mock device, for development and debug purposes", 
-                    "options", options);
+                    "options", options,
+                    "concurrency", BENOIC_MODULE_CONCURRENCY_DEVICE);
 }
 
 /**
@@ -99,10 +87,10 @@ json_t * b_device_connect (json_t * device, void ** device_ptr) {
   
   if (o_strstr(json_string_value(json_object_get(json_object_get(device, "options"), "device_specified")), "batman") == NULL) {
     param = msprintf("%s says I'm batman with the alert_url %s", json_string_value(json_object_get(device, "name")), json_string_value(json_object_get(json_object_get(device, "options"), "alert_url")));
-    j_param = json_pack("{sis{ss}}", "result", WEBSERVICE_RESULT_OK, "options", "device_specified", param);
+    j_param = json_pack("{sis{ss}}", "result", DEVICE_RESULT_OK, "options", "device_specified", param);
     o_free(param);
   } else {
-    j_param = json_pack("{si}", "result", WEBSERVICE_RESULT_OK);
+    j_param = json_pack("{si}", "result", DEVICE_RESULT_OK);
   }
   return j_param;
 }
@@ -116,16 +104,16 @@ json_t * b_device_disconnect (json_t * device, void * device_ptr) {
     // Free device_ptr
     json_decref((json_t *)device_ptr);
   }
-  return json_pack("{si}", "result", WEBSERVICE_RESULT_OK);
+  return json_pack("{si}", "result", DEVICE_RESULT_OK);
 }
 
 /**
  * Ping the device type
  */
-json_t * b_device_ping (json_t * device, void * device_ptr) {
+int b_device_ping (json_t * device, void * device_ptr) {
   UNUSED(device);
   UNUSED(device_ptr);
-  return json_pack("{si}", "result", WEBSERVICE_RESULT_OK);
+  return DEVICE_RESULT_OK;
 }
 
 /**
@@ -134,18 +122,13 @@ json_t * b_device_ping (json_t * device, void * device_ptr) {
  */
 json_t * b_device_overview (json_t * device, void * device_ptr) {
   y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command overview for device %s", json_string_value(json_object_get(device, "name")));
-  json_t * sw1 = b_device_get_switch(device, "sw1", device_ptr),
-         * sw2 = b_device_get_switch(device, "sw2", device_ptr),
-         * di1 = b_device_get_dimmer(device, "di1", device_ptr),
-         * di2 = b_device_get_dimmer(device, "di2", device_ptr),
-         * he1 = b_device_get_heater(device, "he1", device_ptr),
-         * he2 = b_device_get_heater(device, "he2", device_ptr);
-  json_object_del(he1, "result");
-  json_object_del(he2, "result");
-    
+  json_t * switches = json_object_get((json_t *)device_ptr, "switches"),
+         * dimmers = json_object_get((json_t *)device_ptr, "dimmers"),
+         * heaters = json_object_get((json_t *)device_ptr, "heaters");
+  
   json_t * result = json_pack("{sis{s{sssf}s{sosf}}s{sIsI}s{sIsI}s{soso}}",
                              "result", 
-                             WEBSERVICE_RESULT_OK,
+                             DEVICE_RESULT_OK,
                              "sensors", 
                                 "se1", 
                                   "unit", "C",
@@ -154,133 +137,171 @@ json_t * b_device_overview (json_t * device, void * device_ptr) {
                                   "trigger", json_true(),
                                   "value", get_sensor_value("se2"),
                              "switches", 
-                                "sw1", json_integer_value(json_object_get(sw1, "value")), 
-                                "sw2", json_integer_value(json_object_get(sw2, "value")),
+                                "sw1", json_integer_value(json_object_get(switches, "sw1")), 
+                                "sw2", json_integer_value(json_object_get(switches, "sw2")),
                              "dimmers", 
-                                "di1", json_integer_value(json_object_get(di1, "value")), 
-                                "di2", json_integer_value(json_object_get(di2, "value")),
+                                "di1", json_integer_value(json_object_get(dimmers, "di1")), 
+                                "di2", json_integer_value(json_object_get(dimmers, "di2")),
                              "heaters", 
-                               "he1", he1,
-                               "he2", he2);
-  json_decref(sw1);
-  json_decref(sw2);
-  json_decref(di1);
-  json_decref(di2);
+                               "he1", json_copy(json_object_get(heaters, "he1")),
+                               "he2", json_copy(json_object_get(heaters, "he2")));
   return result;
 }
 
 /**
- * Get the sensor value
+ * Get the element value
  */
-json_t * b_device_get_sensor (json_t * device, const char * sensor_name, void * device_ptr) {
-  UNUSED(device);
-  UNUSED(device_ptr);
-  y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command sensor for sensor %s on device %s", sensor_name, json_string_value(json_object_get(device, "name")));
-  if (0 == o_strcmp(sensor_name, "se1") || 0 == o_strcmp(sensor_name, "se2")) {
-    return json_pack("{sisf}", "result", WEBSERVICE_RESULT_OK, "value", get_sensor_value(sensor_name));
-  } else {
-    return json_pack("{si}", "result", WEBSERVICE_RESULT_NOT_FOUND);
+int b_device_get_element (json_t * device, const int element_type, const char * element_name, struct _b_element_result * result, void * device_ptr) {
+  json_t * heater;
+  
+  y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command get_element for element %s of type %d on device %s", element_name, element_type, json_string_value(json_object_get(device, "name")));
+  switch (element_type) {
+    case BENOIC_ELEMENT_TYPE_SENSOR:
+      if (0 == o_strcmp(element_name, "se1") || 0 == o_strcmp(element_name, "se2")) {
+        result->value_type = BENOIC_VALUE_DOUBLE;
+        result->double_value = get_sensor_value(element_name);
+        return DEVICE_RESULT_OK;
+      }
+      break;
+    case BENOIC_ELEMENT_TYPE_SWITCH:
+      if (0 == o_strcmp(element_name, "sw1") || 0 == o_strcmp(element_name, "sw2")) {
+        result->value_type = BENOIC_VALUE_INTEGER;
+        result->integer_value = json_integer_value(json_object_get(json_object_get((json_t *)device_ptr, "switches"), element_name));
+        return DEVICE_RESULT_OK;
+      }
+      break;
+    case BENOIC_ELEMENT_TYPE_DIMMER:
+      if (0 == o_strcmp(element_name, "di1") || 0 == o_strcmp(element_name, "di2")) {
+        result->value_type = BENOIC_VALUE_INTEGER;
+        result->integer_value = json_integer_value(json_object_get(json_object_get((json_t *)device_ptr, "dimmers"), element_name));
+        return DEVICE_RESULT_OK;
+      }
+      break;
+    case BENOIC_ELEMENT_TYPE_HEATER:
+      if (0 == o_strcmp(element_name, "he1") || 0 == o_strcmp(element_name, "he2")) {
+        heater = json_object_get(json_object_get((json_t *)device_ptr, "heaters"), element_name);
+        result->value_type = BENOIC_VALUE_DOUBLE;
+        result->double_value = json_number_value(json_object_get(heater, "command"));
+        snprintf(result->mode, sizeof(result->mode), "%s", json_string_value(json_object_get(heater, "mode")));
+        result->on = (json_object_get(heater, "on") == json_true());
+        result->extra = json_pack("{sO}", "availableModes", json_object_get(heater, "availableModes"));
+        return DEVICE_RESULT_OK;
+      }
+      break;
   }
+  return DEVICE_RESULT_NOT_FOUND;
 }
 
 /**
- * Get the switch value
+ * Set the element command
  */
-json_t * b_device_get_switch (json_t * device, const char * switch_name, void * device_ptr) {
-  y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command get_switch for switch %s on device %s", switch_name, json_string_value(json_object_get(device, "name")));
-  if (0 == o_strcmp(switch_name, "sw1")) {
-    return json_pack("{sisi}", "result", WEBSERVICE_RESULT_OK, "value", json_integer_value(json_object_get(json_object_get((json_t *)device_ptr, "switches"), "sw1")));
-  } else if (0 == o_strcmp(switch_name, "sw2")) {
-    return json_pack("{sisi}", "result", WEBSERVICE_RESULT_OK, "value", json_integer_value(json_object_get(json_object_get((json_t *)device_ptr, "switches"), "sw2")));
-  } else {
-    return json_pack("{si}", "result", WEBSERVICE_RESULT_NOT_FOUND);
+int b_device_set_element (json_t * device, const struct _b_element_command * command, struct _b_element_result * result, void * device_ptr) {
+  json_t * heater;
+  
+  switch (command->element_type) {
+    case BENOIC_ELEMENT_TYPE_SWITCH:
+      y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command set_switch for switch %s on device %s with the value %d", command->element_name, json_string_value(json_object_get(device, "name")), command->command);
+      if (0 == o_strcmp(command->element_name, "sw1") || 0 == o_strcmp(command->element_name, "sw2")) {
+        json_object_set_new(json_object_get((json_t *)device_ptr, "switches"), command->element_name, json_integer(command->command));
+        return DEVICE_RESULT_OK;
+      }
+      break;
+    case BENOIC_ELEMENT_TYPE_DIMMER:
+      y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command set_dimmer for dimmer %s on device %s with the value %d", command->element_name, json_string_value(json_object_get(device, "name")), command->command);
+      if (0 == o_strcmp(command->element_name, "di1") || 0 == o_strcmp(command->element_name, "di2")) {
+        if (command->command < 101) {
+          json_object_set_new(json_object_get((json_t *)device_ptr, "dimmers"), command->element_name, json_integer(command->command));
+          if (command->command > 0) {
+            json_object_set_new(json_object_get((json_t *)device_ptr, "dimmers_values"), command->element_name, json_integer(command->command));
+          }
+        } else {
+          json_object_set_new(json_object_get((json_t *)device_ptr, "dimmers"), command->element_name, json_copy(json_object_get(json_object_get((json_t *)device_ptr, "dimmers_values"), command->element_name)));
+        }
+        result->value_type = BENOIC_VALUE_INTEGER;
+        result->integer_value = json_integer_value(json_object_get(json_object_get((json_t *)device_ptr, "dimmers"), command->element_name));
+        return DEVICE_RESULT_OK;
+      }
+      break;
+    case BENOIC_ELEMENT_TYPE_HEATER:
+      y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command set_heater for heater %s on device %s with the value %f and the mode %s", command->element_name, json_string_value(json_object_get(device, "name")), command->heater_command, command->mode);
+      if (0 == o_strcmp(command->element_name, "he1") || 0 == o_strcmp(command->element_name, "he2")) {
+        heater = json_object_get(json_object_get((json_t *)device_ptr, "heaters"), command->element_name);
+        if (command->mode != NULL && 0 == o_strcmp(command->mode, BENOIC_ELEMENT_HEATER_MODE_MANUAL)) {
+          json_object_set_new(heater, "mode", json_string(BENOIC_ELEMENT_HEATER_MODE_MANUAL));
+        } else if (command->mode != NULL && 0 == o_strcmp(command->mode,  BENOIC_ELEMENT_HEATER_MODE_AUTO)) {
+          json_object_set_new(heater, "mode", json_string(BENOIC_ELEMENT_HEATER_MODE_AUTO));
+        } else if (command->mode != NULL && 0 == o_strcmp(command->mode, BENOIC_ELEMENT_HEATER_MODE_OFF)) {
+          json_object_set_new(heater, "mode", json_string(BENOIC_ELEMENT_HEATER_MODE_OFF));
+        } else if (command->mode != NULL) {
+          return DEVICE_RESULT_PARAM;
+        }
+        json_object_set_new(heater, "command", json_real(command->heater_command));
+        return DEVICE_RESULT_OK;
+      }
+      break;
+    default:
+      return DEVICE_RESULT_PARAM;
   }
+  return DEVICE_RESULT_NOT_FOUND;
 }
 
 /**
- * Set the switch command
+ * Get the values of a list of elements
  */
-json_t * b_device_set_switch (json_t * device, const char * switch_name, const int command, void * device_ptr) {
-  y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command set_switch for switch %s on device %s with the value %d", switch_name, json_string_value(json_object_get(device, "name")), command);
-  if (0 == o_strcmp(switch_name, "sw1") || 0 == o_strcmp(switch_name, "sw2")) {
-    json_object_set_new(json_object_get((json_t *)device_ptr, "switches"), switch_name, json_integer(command));
-    return json_pack("{si}", "result", WEBSERVICE_RESULT_OK);
-  } else {
-    return json_pack("{si}", "result", WEBSERVICE_RESULT_NOT_FOUND);
+int b_device_get_elements (json_t * device, struct _b_element_get * element_list, size_t nb_elements, void * device_ptr) {
+  size_t i;
+  
+  y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command get_elements for %zu elements on device %s", nb_elements, json_string_value(json_object_get(device, "name")));
+  for (i=0; i<nb_elements; i++) {
+    element_list[i].result.result = b_device_get_element(device, element_list[i].element_type, element_list[i].element_name, &element_list[i].result, device_ptr);
   }
+  return DEVICE_RESULT_OK;
 }
 
 /**
- * Get the dimmer value
+ * Send a list of commands
  */
-json_t * b_device_get_dimmer (json_t * device, const char * dimmer_name, void * device_ptr) {
-  y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command get_dimmer for dimmer %s on device %s", dimmer_name, json_string_value(json_object_get(device, "name")));
-  if (0 == o_strcmp(dimmer_name, "di1") || 0 == o_strcmp(dimmer_name, "di2")) {
-    return json_pack("{sisI}", "result", WEBSERVICE_RESULT_OK, "value", json_integer_value(json_object_get(json_object_get((json_t *)device_ptr, "dimmers"), dimmer_name)));
-  } else {
-    return json_pack("{si}", "result", WEBSERVICE_RESULT_NOT_FOUND);
+int b_device_set_elements (json_t * device, struct _b_element_set * element_list, size_t nb_elements, void * device_ptr) {
+  size_t i;
+  
+  y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command set_elements for %zu elements on device %s", nb_elements, json_string_value(json_object_get(device, "name")));
+  for (i=0; i<nb_elements; i++) {
+    element_list[i].result.result = b_device_set_element(device, &element_list[i].command, &element_list[i].result, device_ptr);
   }
+  return DEVICE_RESULT_OK;
 }
 
 /**
- * Set the dimmer command
+ * Get the element value asynchronously
+ * The mock device answers at once, so the callback is called before the function returns
  */
-json_t * b_device_set_dimmer (json_t * device, const char * dimmer_name, const int command, void * device_ptr) {
-  y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command set_dimmer for dimmer %s on device %s with the value %d", dimmer_name, json_string_value(json_object_get(device, "name")), command);
-  if (0 == o_strcmp(dimmer_name, "di1") || 0 == o_strcmp(dimmer_name, "di2")) {
-    if (command < 101) {
-      json_object_set_new(json_object_get((json_t *)device_ptr, "dimmers"), dimmer_name, json_integer(command));
-      if (command > 0) {
-        json_object_set_new(json_object_get((json_t *)device_ptr, "dimmers_values"), dimmer_name, json_integer(command));
-      }
-    } else {
-      json_object_set_new(json_object_get((json_t *)device_ptr, "dimmers"), dimmer_name, json_copy(json_object_get(json_object_get((json_t *)device_ptr, "dimmers_values"), dimmer_name)));
-    }
-    return json_pack("{sisI}", "result", WEBSERVICE_RESULT_OK, "value", json_integer_value(json_object_get(json_object_get((json_t *)device_ptr, "dimmers"), dimmer_name)));
-  } else {
-    return json_pack("{si}", "result", WEBSERVICE_RESULT_NOT_FOUND);
-  }
+int b_device_get_element_async (json_t * device, const int element_type, const char * element_name, b_element_completion_callback callback, void * cls, void * device_ptr) {
+  struct _b_element_result result;
+  
+  memset(&result, 0, sizeof(struct _b_element_result));
+  result.result = b_device_get_element(device, element_type, element_name, &result, device_ptr);
+  callback(cls, &result);
+  return DEVICE_RESULT_OK;
 }
 
 /**
- * Get the heater value
+ * Set the element command asynchronously
  */
-json_t * b_device_get_heater (json_t * device, const char * heater_name, void * device_ptr) {
-  y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command get_heater for heater %s on device %s", heater_name, json_string_value(json_object_get(device, "name")));
-  if (0 == o_strcmp(heater_name, "he1")) {
-    json_t * heater = json_copy(json_object_get(json_object_get((json_t *)device_ptr, "heaters"), heater_name));
-    json_object_set_new(heater, "result", json_integer(WEBSERVICE_RESULT_OK));
-    return heater;
-  } else if (0 == o_strcmp(heater_name, "he2")) {
-    json_t * heater = json_copy(json_object_get(json_object_get((json_t *)device_ptr, "heaters"), heater_name));
-    json_object_set_new(heater, "result", json_integer(WEBSERVICE_RESULT_OK));
-    return heater;
-  } else {
-    return json_pack("{si}", "result", WEBSERVICE_RESULT_NOT_FOUND);
-  }
+int b_device_set_element_async (json_t * device, const struct _b_element_command * command, b_element_completion_callback callback, void * cls, void * device_ptr) {
+  struct _b_element_result result;
+  
+  memset(&result, 0, sizeof(struct _b_element_result));
+  result.result = b_device_set_element(device, command, &result, device_ptr);
+  callback(cls, &result);
+  return DEVICE_RESULT_OK;
 }
 
 /**
- * Set the heater command
+ * Get the device overview asynchronously
  */
-json_t * b_device_set_heater (json_t * device, const char * heater_name, const char * mode, const float command, void * device_ptr) {
-  y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Running command set_heater for heater %s on device %s with the value %f and the mode %s", heater_name, json_string_value(json_object_get(device, "name")), command, mode);
-  if (0 == o_strcmp(heater_name, "he1") || 0 == o_strcmp(heater_name, "he2")) {
-    json_t * heater = json_object_get(json_object_get((json_t *)device_ptr, "heaters"), heater_name);
-    if (mode != NULL && 0 == o_strcmp(mode, BENOIC_ELEMENT_HEATER_MODE_MANUAL)) {
-      json_object_set_new(heater, "mode", json_string(BENOIC_ELEMENT_HEATER_MODE_MANUAL));
-    } else if (mode != NULL && 0 == o_strcmp(mode,  BENOIC_ELEMENT_HEATER_MODE_AUTO)) {
-      json_object_set_new(heater, "mode", json_string(BENOIC_ELEMENT_HEATER_MODE_AUTO));
-    } else if (mode != NULL && 0 == o_strcmp(mode, BENOIC_ELEMENT_HEATER_MODE_OFF)) {
-      json_object_set_new(heater, "mode", json_string(BENOIC_ELEMENT_HEATER_MODE_OFF));
-    } else if (mode != NULL) {
-      return json_pack("{si}", "result", WEBSERVICE_RESULT_PARAM);
-    }
-    json_object_set_new(heater, "command", json_real(command));
-    return json_pack("{si}", "result", WEBSERVICE_RESULT_OK);
-  } else {
-    return json_pack("{si}", "result", WEBSERVICE_RESULT_NOT_FOUND);
-  }
+int b_device_overview_async (json_t * device, b_overview_completion_callback callback, void * cls, void * device_ptr) {
+  callback(cls, b_device_overview(device, device_ptr));
+  return DEVICE_RESULT_OK;
 }
 
 /**
@@ -291,16 +312,16 @@ int b_device_has_element (json_t * device, int element_type, const char * elemen
   UNUSED(device_ptr);
   y_log_message(Y_LOG_LEVEL_INFO, "device-mock - Checking if element '%s' of type %d exists in device %s", element_name, element_type, json_string_value(json_object_get(device, "name")));
   switch (element_type) {
-    case ELEMENT_TYPE_SENSOR:
+    case BENOIC_ELEMENT_TYPE_SENSOR:
       return (0 == o_strcmp(element_name, "se1") || 0 == o_strcmp(element_name, "se2"));
       break;
-    case ELEMENT_TYPE_SWITCH:
+    case BENOIC_ELEMENT_TYPE_SWITCH:
       return (0 == o_strcmp(element_name, "sw1") || 0 == o_strcmp(element_name, "sw2"));
       break;
-    case ELEMENT_TYPE_DIMMER:
+    case BENOIC_ELEMENT_TYPE_DIMMER:
       return (0 == o_strcmp(element_name, "di1") || 0 == o_strcmp(element_name, "di2"));
       break;
-    case ELEMENT_TYPE_HEATER:
+    case BENOIC_ELEMENT_TYPE_HEATER:
       return (0 == o_strcmp(element_name, "he1") || 0 == o_strcmp(element_name, "he2"));
       break;
     default:
@@ -308,3 +329,25 @@ int b_device_has_element (json_t * device, int element_type, const char * elemen
       break;
   }
 }
+
+/**
+ * Module descriptor, gives benoic the functions of the module
+ */
+const struct _b_device_module b_device_module_descriptor = {
+  BENOIC_MODULE_ABI_VERSION,
+  &b_device_type_init,
+  &b_device_connect,
+  &b_device_disconnect,
+  &b_device_ping,
+  &b_device_overview,
+  &b_device_has_element,
+  &b_device_get_element,
+  &b_device_set_element,
+  &b_device_get_elements,
+  &b_device_set_elements,
+  NULL,
+  NULL,
+  &b_device_get_element_async,
+  &b_device_set_element_async,
+  &b_device_overview_async
+};
@@ -87,8 +87,12 @@ char * print_map(const struct _u_map * map) {
 
 void init_request_for_device(struct _u_request * req, json_t * device, const char * command) {
   ulfius_init_request(req);
-  // Set request timeout to 20 seconds
-  req->timeout = 20;
+  // Set request timeout to the request timeout of benoic if any, or to 20 seconds
+  if (json_integer_value(json_object_get(json_object_get(device, "options"), "request_timeout")) > 0) {
+    req->timeout = (json_integer_value(json_object_get(json_object_get(device, "options"), "request_timeout")) + 999) / 1000;
+  } else {
+    req->timeout = 20;
+  }
   if (json_object_get(json_object_get(device, "options"), "do_not_check_certificate") == json_true()) {
     req->check_server_certificate = 0;
   }
@@ -112,12 +116,17 @@ json_t * b_device_type_init () {
   json_array_append_new(options, json_pack("{ssssssso}", "name", "old_version", "type", "boolean", "description", "Is the device an old Taulas device or a new one?", "optional", json_true()));
   json_array_append_new(options, json_pack("{ssssssso}", "name", "user", "type", "string", "description", "Username to connect to the device", "optional", json_true()));
   json_array_append_new(options, json_pack("{ssssssso}", "name", "password", "type", "string", "description", "Password to connect to the device", "optional", json_true()));
-  return json_pack("{sissssssso}", 
+  // A Taulas microcontroller handles one request at a time, the devices don't share anything
+  return json_pack("{sissssssso so{sisi} ss}", 
                     "result", WEBSERVICE_RESULT_OK,
                     "uid", "24-67-85", 
                     "name", "Taulas Device", 
                     "description", "Connect to a Taulas device", 
-                    "options", options);
+                    "options", options,
+                    "limits",
+                      "max_concurrency", 1,
+                      "max_queued", 16,
+                    "concurrency", "device");
 }
 
 /**
@@ -71,10 +71,13 @@ extern "C" {
 #include <jansson.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
 #include <yder.h>
 #include <orcania.h>
 #include <ulfius.h>
 
+#include "../benoic-module.h"
+
 #ifdef __cplusplus
 }
 #endif
@@ -90,17 +93,6 @@ extern "C" {
 #include "ValueBool.h"
 #include "Log.h"
 
-#define RESULT_ERROR     0
-#define RESULT_OK        1
-#define RESULT_NOT_FOUND 2
-#define RESULT_TIMEOUT   3
-
-#define ELEMENT_TYPE_NONE   0
-#define ELEMENT_TYPE_SENSOR 1
-#define ELEMENT_TYPE_SWITCH 2
-#define ELEMENT_TYPE_DIMMER 3
-#define ELEMENT_TYPE_HEATER 4
-
 #define UNDEFINED_HOME_ID 0
 
 #define DEFAULT_CONFIG_PATH  "/usr/local/etc/openzwave"
@@ -148,6 +140,7 @@ struct zwave_context {
   uint32          home_id;
   int             init_failed;
   list<node*>   * nodes_list;
+  pthread_mutex_t nodes_lock;        // nodes_list is updated by the notifications thread
   char            uri[256];
   char            usb_file[512];     // filename pattern of the usb dongle
   char            config_path[256];
@@ -160,6 +153,32 @@ struct zwave_context {
   struct _u_map * dimmer_values;
 };
 
+/**
+ * Lock the nodes list of the context for the lifetime of the object
+ */
+class nodes_list_lock {
+  public:
+    nodes_list_lock(void * context) : context((zwave_context *)context) {
+      if (this->context != NULL) {
+        pthread_mutex_lock(&this->context->nodes_lock);
+      }
+    }
+    ~nodes_list_lock() {
+      if (this->context != NULL) {
+        pthread_mutex_unlock(&this->context->nodes_lock);
+      }
+    }
+  private:
+    zwave_context * context;
+};
+
+// Callbacks given by benoic to push value changes and alerts, declared in benoic-module.h
+static b_device_value_callback value_callback = NULL;
+static void * value_callback_cls = NULL;
+
+static b_device_alert_callback alert_callback = NULL;
+static void * alert_callback_cls = NULL;
+
 /**
  * return a name based on the value label,
  * by replacing spaces and $ with _
@@ -326,14 +345,89 @@ ValueID * get_device_value_id_by_element_name(zwave_context * zcontext, const ch
   }
 }
 
+/**
+ * Push the new value of a ValueID to benoic
+ * only switches, dimmers and sensors are pushed,
+ * heaters are built from several values and are still polled
+ */
+void push_value_changed(zwave_context * zcontext, ValueID value_id) {
+  char * element_name = NULL, * named_label, * end_ptr_d;
+  int element_type = BENOIC_ELEMENT_TYPE_NONE;
+  json_t * value = NULL;
+  string s_status;
+  bool b_status;
+  double d_value;
+  
+  if (value_callback == NULL || zcontext == NULL) {
+    return;
+  }
+  
+  switch (value_id.GetCommandClassId()) {
+    case COMMAND_CLASS_SWITCH_BINARY:
+      if (Manager::Get()->GetValueAsBool(value_id, &b_status)) {
+        element_type = BENOIC_ELEMENT_TYPE_SWITCH;
+        element_name = msprintf("sw$%02d", value_id.GetNodeId());
+        value = json_integer(b_status?1:0);
+      }
+      break;
+    case COMMAND_CLASS_SWITCH_MULTILEVEL:
+      if (Manager::Get()->GetValueAsString(value_id, &s_status)) {
+        element_type = BENOIC_ELEMENT_TYPE_DIMMER;
+        element_name = msprintf("di$%02d", value_id.GetNodeId());
+        if (s_status.compare("0")) {
+          u_map_put(zcontext->dimmer_values, element_name, s_status.c_str());
+        }
+        value = json_integer(strtol(s_status.c_str(), NULL, 10));
+      }
+      break;
+    case COMMAND_CLASS_SENSOR_BINARY:
+      if (Manager::Get()->GetValueAsBool(value_id, &b_status)) {
+        element_type = BENOIC_ELEMENT_TYPE_SENSOR;
+        named_label = naming_label(Manager::Get()->GetValueLabel(value_id).c_str());
+        element_name = msprintf("se$%02d$%s", value_id.GetNodeId(), named_label);
+        free(named_label);
+        value = b_status?json_true():json_false();
+      }
+      break;
+    case COMMAND_CLASS_SENSOR_MULTILEVEL:
+      if (Manager::Get()->GetValueAsString(value_id, &s_status)) {
+        element_type = BENOIC_ELEMENT_TYPE_SENSOR;
+        named_label = naming_label(Manager::Get()->GetValueLabel(value_id).c_str());
+        element_name = msprintf("se$%02d$%s", value_id.GetNodeId(), named_label);
+        free(named_label);
+        d_value = strtof(s_status.c_str(), &end_ptr_d);
+        if (end_ptr_d != s_status.c_str()) {
+          value = json_real(d_value);
+        } else {
+          value = json_string(s_status.c_str());
+        }
+      }
+      break;
+    default:
+      break;
+  }
+  
+  if (element_name != NULL && value != NULL) {
+    value_callback(value_callback_cls, zcontext->device_name, element_type, element_name, value, time(NULL));
+  }
+  json_decref(value);
+  o_free(element_name);
+}
+
 int send_angharad_alert(zwave_context * zcontext, char * source) {
   struct _u_request request;
   int res;
   
   if (zcontext == NULL || source == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "send_angharad_alert - Error input parameters");
-    return RESULT_ERROR;
-  } else if (zcontext->alert_url != NULL) {
+    return DEVICE_RESULT_ERROR;
+  }
+  
+  if (alert_callback != NULL) {
+    alert_callback(alert_callback_cls, zcontext->device_name, source, "NOTIFICATION");
+  }
+  
+  if (zcontext->alert_url != NULL) {
     ulfius_init_request(&request);
     request.http_verb = o_strdup("GET");
     request.http_url = msprintf(zcontext->alert_url, "benoic", zcontext->device_name, source, "NOTIFICATION");
@@ -342,10 +436,10 @@ int send_angharad_alert(zwave_context * zcontext, char * source) {
       y_log_message(Y_LOG_LEVEL_ERROR, "ZWave device, Error sending http request for alert");
     }
     ulfius_clean_request(&request);
-    return RESULT_OK;
+    return DEVICE_RESULT_OK;
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "send_angharad_alert - no alert url");
-    return RESULT_OK;
+    return DEVICE_RESULT_OK;
   }
 }
 
@@ -354,6 +448,7 @@ int send_angharad_alert(zwave_context * zcontext, char * source) {
  * Callback that is triggered when a value, group or node changes
  */
 void on_notification_zwave ( Notification const * _notification, void * _context ) {
+  nodes_list_lock lock(_context);
   zwave_context * zcontext = (zwave_context *)_context;
   list<node*> * nodes_list = (list<node*> *) zcontext ->nodes_list;
   
@@ -391,9 +486,11 @@ void on_notification_zwave ( Notification const * _notification, void * _context
     }
 
     case Notification::Type_ValueChanged: {
-      // One of the node values has changed
-      // Nothing there
+      // One of the node values has changed, push it to benoic
       //y_log_message(Y_LOG_LEVEL_DEBUG, "Notification::Type_ValueChanged for NodeID %d and ValueID %d", _notification->GetNodeId(), _notification->GetValueID());
+      if (get_device_node( zcontext, _notification->GetNodeId() ) != NULL) {
+        push_value_changed(zcontext, _notification->GetValueID());
+      }
       break;
     }
 
@@ -519,12 +616,33 @@ extern "C" json_t * b_device_type_init () {
   json_array_append_new(options, json_pack("{ssssssso}", "name", "user_path", "type", "string", "description", "Path to openzwave user files", "optional", json_true()));
   json_array_append_new(options, json_pack("{ssssssso}", "name", "command_line", "type", "string", "description", "Openzwave command line options", "optional", json_true()));
   json_array_append_new(options, json_pack("{ssssssso}", "name", "log_path", "type", "string", "description", "Path to openzwave log files", "optional", json_true()));
-  return json_pack("{sissssssso}", 
-                    "result", RESULT_OK,
+  // Don't flood the Z-Wave radio queue, the OpenZWave Manager is shared by all the devices
+  return json_pack("{sissssssso so{sfsi} ss}", 
+                    "result", DEVICE_RESULT_OK,
                     "uid", "24-67-99", 
                     "name", "Openzwave Device", 
                     "description", "Openzwave supported device", 
-                    "options", options);
+                    "options", options,
+                    "limits",
+                      "rate_limit", 10.0,
+                      "rate_burst", 20,
+                    "concurrency", "module");
+}
+
+/**
+ * Set the callback used to push value changes to benoic
+ */
+extern "C" void b_device_type_set_value_callback (b_device_value_callback callback, void * cls) {
+  value_callback = callback;
+  value_callback_cls = cls;
+}
+
+/**
+ * Set the callback used to push alerts to benoic
+ */
+extern "C" void b_device_type_set_alert_callback (b_device_alert_callback callback, void * cls) {
+  alert_callback = callback;
+  alert_callback_cls = cls;
 }
 
 /**
@@ -564,6 +682,7 @@ extern "C" json_t * b_device_connect (json_t * device, void ** device_ptr) {
   ((struct zwave_context *) * device_ptr)->device_name = o_strdup(json_string_value(json_object_get(device, "name")));
   
   ((struct zwave_context *) *device_ptr)->nodes_list = new list<node*>();
+  pthread_mutex_init(&((struct zwave_context *) *device_ptr)->nodes_lock, NULL);
   ((struct zwave_context *) *device_ptr)->alarms = new struct _u_map;
   u_map_init(((struct zwave_context *) *device_ptr)->alarms);
   ((struct zwave_context *) *device_ptr)->dimmer_values = new struct _u_map;
@@ -596,10 +715,10 @@ extern "C" json_t * b_device_connect (json_t * device, void ** device_ptr) {
     snprintf(filename, 512*sizeof(char), "%s%d", ((struct zwave_context *) *device_ptr)->uri, i);
     if (Manager::Get()->AddDriver( filename )) {
       snprintf(((struct zwave_context *) *device_ptr)->usb_file, 512*sizeof(char), "%s", filename);
-      return json_pack("{si}", "result", RESULT_OK);
+      return json_pack("{si}", "result", DEVICE_RESULT_OK);
     }
   }
-  return json_pack("{si}", "result", RESULT_ERROR);
+  return json_pack("{si}", "result", DEVICE_RESULT_ERROR);
 }
 
 /**
@@ -610,13 +729,14 @@ extern "C" json_t * b_device_disconnect (json_t * device, void * device_ptr) {
     Options::Destroy();
     Manager::Destroy();
     delete ((struct zwave_context *) device_ptr)->nodes_list;
+    pthread_mutex_destroy(&((struct zwave_context *) device_ptr)->nodes_lock);
     o_free(((struct zwave_context *) device_ptr)->alert_url);
     o_free(((struct zwave_context *) device_ptr)->device_name);
     u_map_clean_full(((struct zwave_context *) device_ptr)->alarms);
     u_map_clean_full(((struct zwave_context *) device_ptr)->dimmer_values);
     o_free(device_ptr);
   }
-  return json_pack("{si}", "result", RESULT_OK);
+  return json_pack("{si}", "result", DEVICE_RESULT_OK);
 }
 
 /**
@@ -624,9 +744,9 @@ extern "C" json_t * b_device_disconnect (json_t * device, void * device_ptr) {
  */
 extern "C" json_t * b_device_ping (json_t * device, void * device_ptr) {
   if (device_ptr != NULL) {
-    return json_pack("{si}", "result", RESULT_OK);
+    return json_pack("{si}", "result", DEVICE_RESULT_OK);
   } else {
-    return json_pack("{si}", "result", RESULT_ERROR);
+    return json_pack("{si}", "result", DEVICE_RESULT_ERROR);
   }
 }
 
@@ -634,6 +754,7 @@ extern "C" json_t * b_device_ping (json_t * device, void * device_ptr) {
  * Get the sensor value
  */
 extern "C" json_t * b_device_get_sensor (json_t * device, const char * sensor_name, void * device_ptr) {
+  nodes_list_lock lock(device_ptr);
   char * str_type, * str_node_id, * str_label, * save_ptr, * end_ptr_d, * dup_name_save, * dup_name = dup_name_save = o_strdup(sensor_name);
   ValueID * value;
   string s_status;
@@ -650,9 +771,9 @@ extern "C" json_t * b_device_get_sensor (json_t * device, const char * sensor_na
   str_label = strtok_r(NULL, "$", &save_ptr);
   
   if (u_map_has_key(((zwave_context *)device_ptr)->alarms, sensor_name)) {
-    result = json_pack("{sisi}", "result", RESULT_OK, "value", 0);
+    result = json_pack("{sisi}", "result", DEVICE_RESULT_OK, "value", 0);
   } else if (str_type == NULL || str_node_id == NULL || str_label == NULL) {
-    result = json_pack("{si}", "result", RESULT_ERROR);
+    result = json_pack("{si}", "result", DEVICE_RESULT_ERROR);
   } else {
     value = get_device_value_id_by_label(get_device_node((zwave_context *)device_ptr, strtol(str_node_id, NULL, 10)), COMMAND_CLASS_SENSOR_BINARY, str_label);
     if (value == NULL) {
@@ -666,22 +787,22 @@ extern "C" json_t * b_device_get_sensor (json_t * device, const char * sensor_na
         if (Manager::Get()->GetValueAsString((*value), &s_status)) {
           d_value = strtof(s_status.c_str(), &end_ptr_d);
           if (end_ptr_d != s_status.c_str()) {
-            result = json_pack("{sisf}", "result", RESULT_OK, "value", d_value);
+            result = json_pack("{sisf}", "result", DEVICE_RESULT_OK, "value", d_value);
           } else {
-            result = json_pack("{siss}", "result", RESULT_OK, "value", s_status.c_str());
+            result = json_pack("{siss}", "result", DEVICE_RESULT_OK, "value", s_status.c_str());
           }
         } else {
-          result = json_pack("{si}", "result", RESULT_ERROR);
+          result = json_pack("{si}", "result", DEVICE_RESULT_ERROR);
         }
       } else {
         if (Manager::Get()->GetValueAsBool((*value), &b_status)) {
-          result = json_pack("{siso}", "result", RESULT_OK, "value", b_status?json_true():json_false());
+          result = json_pack("{siso}", "result", DEVICE_RESULT_OK, "value", b_status?json_true():json_false());
         } else {
-          result = json_pack("{si}", "result", RESULT_ERROR);
+          result = json_pack("{si}", "result", DEVICE_RESULT_ERROR);
         }
       }
     } else {
-      result = json_pack("{si}", "result", RESULT_NOT_FOUND);
+      result = json_pack("{si}", "result", DEVICE_RESULT_NOT_FOUND);
     }
   }
   free(dup_name_save);
@@ -692,6 +813,7 @@ extern "C" json_t * b_device_get_sensor (json_t * device, const char * sensor_na
  * Get the switch value
  */
 extern "C" json_t * b_device_get_switch (json_t * device, const char * switch_name, void * device_ptr) {
+  nodes_list_lock lock(device_ptr);
   ValueID * value = NULL;
   bool b_status;
   json_t * result = NULL;
@@ -700,12 +822,12 @@ extern "C" json_t * b_device_get_switch (json_t * device, const char * switch_na
   if (value != NULL) {
     Manager::Get()->RefreshValue(*value);
     if (Manager::Get()->GetValueAsBool(*value, &b_status)) {
-      result = json_pack("{sisi}", "result", RESULT_OK, "value", (b_status?1:0));
+      result = json_pack("{sisi}", "result", DEVICE_RESULT_OK, "value", (b_status?1:0));
     } else {
-      result = json_pack("{si}", "result", RESULT_ERROR);
+      result = json_pack("{si}", "result", DEVICE_RESULT_ERROR);
     }
   } else {
-    result = json_pack("{si}", "result", RESULT_NOT_FOUND);
+    result = json_pack("{si}", "result", DEVICE_RESULT_NOT_FOUND);
   }
   return result;
 }
@@ -714,18 +836,19 @@ extern "C" json_t * b_device_get_switch (json_t * device, const char * switch_na
  * Set the switch command
  */
 extern "C" json_t * b_device_set_switch (json_t * device, const char * switch_name, const int command, void * device_ptr) {
+  nodes_list_lock lock(device_ptr);
   ValueID * value = NULL;
   json_t * result = NULL;
   
   value = get_device_value_id_by_element_name((zwave_context *)device_ptr, switch_name);
   if (value != NULL) {
     if (Manager::Get()->SetValue((*value), (command?true:false))) {
-      result = json_pack("{si}", "result", RESULT_OK);
+      result = json_pack("{si}", "result", DEVICE_RESULT_OK);
     } else {
-      result = json_pack("{si}", "result", RESULT_ERROR);
+      result = json_pack("{si}", "result", DEVICE_RESULT_ERROR);
     }
   } else {
-    result = json_pack("{si}", "result", RESULT_NOT_FOUND);
+    result = json_pack("{si}", "result", DEVICE_RESULT_NOT_FOUND);
   }
   return result;
 }
@@ -734,6 +857,7 @@ extern "C" json_t * b_device_set_switch (json_t * device, const char * switch_na
  * Get the dimmer value
  */
 extern "C" json_t * b_device_get_dimmer (json_t * device, const char * dimmer_name, void * device_ptr) {
+  nodes_list_lock lock(device_ptr);
   ValueID * value = NULL;
   string s_status;
   json_t * result = NULL;
@@ -745,12 +869,12 @@ extern "C" json_t * b_device_get_dimmer (json_t * device, const char * dimmer_na
       if (s_status.compare("0")) {
         u_map_put(((zwave_context *)device_ptr)->dimmer_values, dimmer_name, s_status.c_str());
       }
-      result = json_pack("{sisi}", "result", RESULT_OK, "value", strtol(s_status.c_str(), NULL, 10));
+      result = json_pack("{sisi}", "result", DEVICE_RESULT_OK, "value", strtol(s_status.c_str(), NULL, 10));
     } else {
-      result = json_pack("{si}", "result", RESULT_ERROR);
+      result = json_pack("{si}", "result", DEVICE_RESULT_ERROR);
     }
   } else {
-    result = json_pack("{si}", "result", RESULT_NOT_FOUND);
+    result = json_pack("{si}", "result", DEVICE_RESULT_NOT_FOUND);
   }
   return result;
 }
@@ -759,6 +883,7 @@ extern "C" json_t * b_device_get_dimmer (json_t * device, const char * dimmer_na
  * Set the dimmer command
  */
 extern "C" json_t * b_device_set_dimmer (json_t * device, const char * dimmer_name, const int command, void * device_ptr) {
+  nodes_list_lock lock(device_ptr);
   ValueID * value = NULL;
   string s_status;
   json_t * result = NULL;
@@ -782,12 +907,12 @@ extern "C" json_t * b_device_set_dimmer (json_t * device, const char * dimmer_na
       o_strcpy(val, "0");
     }
     if (Manager::Get()->SetValue((*value), string(val)) ) {
-      result = json_pack("{sisi}", "result", RESULT_OK, "value", strtol(val, NULL, 10));
+      result = json_pack("{sisi}", "result", DEVICE_RESULT_OK, "value", strtol(val, NULL, 10));
     } else {
-      result = json_pack("{si}", "result", RESULT_ERROR);
+      result = json_pack("{si}", "result", DEVICE_RESULT_ERROR);
     }
   } else {
-    result = json_pack("{si}", "result", RESULT_NOT_FOUND);
+    result = json_pack("{si}", "result", DEVICE_RESULT_NOT_FOUND);
   }
   return result;
 }
@@ -796,6 +921,7 @@ extern "C" json_t * b_device_set_dimmer (json_t * device, const char * dimmer_na
  * Get the heater value
  */
 extern "C" json_t * b_device_get_heater (json_t * device, const char * heater_name, void * device_ptr) {
+  nodes_list_lock lock(device_ptr);
   ValueID * value = NULL;
   string s_status;
   uint8 node_id;
@@ -804,7 +930,7 @@ extern "C" json_t * b_device_get_heater (json_t * device, const char * heater_na
   
   if (heater == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "b_device_get_heater - Error allocating resources for heater");
-    return json_pack("{si}", "result", RESULT_ERROR);
+    return json_pack("{si}", "result", DEVICE_RESULT_ERROR);
   }
 
   node_id = strtol(strstr(heater_name, "$") + 1, &end_ptr, 10);
@@ -843,10 +969,10 @@ extern "C" json_t * b_device_get_heater (json_t * device, const char * heater_na
       Manager::Get()->GetValueAsString(*value, &s_status);
       json_object_set_new(heater, "command", json_real(strtod(s_status.c_str(), NULL)));
     }
-    return json_pack("{siso}", "result", RESULT_OK, "value", heater);
+    return json_pack("{siso}", "result", DEVICE_RESULT_OK, "value", heater);
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "b_device_get_heater - Error node not found");
-    return json_pack("{si}", "result", RESULT_NOT_FOUND);
+    return json_pack("{si}", "result", DEVICE_RESULT_NOT_FOUND);
   }
 }
 
@@ -854,6 +980,7 @@ extern "C" json_t * b_device_get_heater (json_t * device, const char * heater_na
  * Set the heater command
  */
 extern "C" json_t * b_device_set_heater (json_t * device, const char * heater_name, const char * mode, const float command, void * device_ptr) {
+  nodes_list_lock lock(device_ptr);
   ValueID * value = NULL;
   string s_status;
   uint8 node_id;
@@ -878,10 +1005,10 @@ extern "C" json_t * b_device_set_heater (json_t * device, const char * heater_na
       }
     }
     
-    return json_pack("{si}", "result", RESULT_OK);
+    return json_pack("{si}", "result", DEVICE_RESULT_OK);
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "b_device_get_heater - Error node not found");
-    return json_pack("{si}", "result", RESULT_NOT_FOUND);
+    return json_pack("{si}", "result", DEVICE_RESULT_NOT_FOUND);
   }
 }
 
@@ -889,12 +1016,13 @@ extern "C" json_t * b_device_set_heater (json_t * device, const char * heater_na
  * Return true if an element with the specified name and the specified type exist in this device
  */
 extern "C" int b_device_has_element (json_t * device, int element_type, const char * element_name, void * device_ptr) {
+  nodes_list_lock lock(device_ptr);
   char * str_type, * str_node_id, * str_label, * save_ptr, * dup_name_save, * dup_name = dup_name_save = o_strdup(element_name);
   ValueID * value;
   
-  if (u_map_has_key(((zwave_context *)device_ptr)->alarms, element_name) && element_type == ELEMENT_TYPE_SENSOR) {
+  if (u_map_has_key(((zwave_context *)device_ptr)->alarms, element_name) && element_type == BENOIC_ELEMENT_TYPE_SENSOR) {
     return 1;
-  } else if (element_type == ELEMENT_TYPE_SENSOR) {
+  } else if (element_type == BENOIC_ELEMENT_TYPE_SENSOR) {
     // first token is the type, supposed to be "se" in this case
     str_type = strtok_r(dup_name, "$", &save_ptr);
     
@@ -921,13 +1049,13 @@ extern "C" int b_device_has_element (json_t * device, int element_type, const ch
       return 0;
     } else {
       switch (element_type) {
-        case ELEMENT_TYPE_SWITCH:
+        case BENOIC_ELEMENT_TYPE_SWITCH:
           value = get_device_value_id(get_device_node((zwave_context *)device_ptr, strtol(str_node_id, NULL, 10)), COMMAND_CLASS_SWITCH_BINARY);
           break;
-        case ELEMENT_TYPE_DIMMER:
+        case BENOIC_ELEMENT_TYPE_DIMMER:
           value = get_device_value_id(get_device_node((zwave_context *)device_ptr, strtol(str_node_id, NULL, 10)), COMMAND_CLASS_SWITCH_MULTILEVEL);
           break;
-        case ELEMENT_TYPE_HEATER:
+        case BENOIC_ELEMENT_TYPE_HEATER:
           value = get_device_value_id(get_device_node((zwave_context *)device_ptr, strtol(str_node_id, NULL, 10)), COMMAND_CLASS_THERMOSTAT_SETPOINT);
           break;
         default:
@@ -946,6 +1074,7 @@ extern "C" int b_device_has_element (json_t * device, int element_type, const ch
  * This seems to work on my devices, where I have switches, dimmers and heaters that are one per node, but I also have a multisensor aeotech, which has multiple values
  */
 extern "C" json_t * b_device_overview (json_t * device, void * device_ptr) {  
+  nodes_list_lock lock(device_ptr);
   json_t * overview = json_object(), * value;
   char * name, * unit, * end_ptr_d;
 	const char * cur_node = NULL;
@@ -1048,7 +1177,7 @@ extern "C" json_t * b_device_overview (json_t * device, void * device_ptr) {
         cur_node = "heaters";
         if (json_object_get(json_object_get(overview, cur_node), name) == NULL) {
           value = b_device_get_heater(device, name, device_ptr);
-          if (value != NULL && json_integer_value(json_object_get(value, "result")) == RESULT_OK) {
+          if (value != NULL && json_integer_value(json_object_get(value, "result")) == DEVICE_RESULT_OK) {
             if (json_object_get(overview, cur_node) == NULL) {
               json_object_set_new(overview, cur_node, json_object());
             }
@@ -1069,6 +1198,6 @@ extern "C" json_t * b_device_overview (json_t * device, void * device_ptr) {
     }
     json_object_set_new(json_object_get(overview, cur_node), keys[i], json_pack("{sosi}", "trigger", json_true(), "value", 0));
   }
-  json_object_set_new(overview, "result", json_integer(RESULT_OK));
+  json_object_set_new(overview, "result", json_integer(DEVICE_RESULT_OK));
   return overview;
 }
@@ -0,0 +1,914 @@
+/**
+ *
+ * Benoic House Automation service
+ *
+ * Command house automation devices via an HTTP REST interface
+ *
+ * Device commands queue functions
+ *
+ * Copyright 2016 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "benoic.h"
+
+/**
+ * Initialize the list of device states
+ */
+int init_device_state_list(struct _benoic_config * config) {
+  if (pthread_mutex_init(&config->device_state_lock, NULL)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "init_device_state_list - Error initializing lock");
+    return B_ERROR;
+  }
+  config->device_state_list = o_malloc(sizeof(struct _benoic_device_state *));
+  if (config->device_state_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "init_device_state_list - Error allocating resources for device_state_list");
+    return B_ERROR_MEMORY;
+  }
+  config->device_state_list[0] = NULL;
+  return B_OK;
+}
+
+/**
+ * Free the list of device states
+ * Must be called when no command is running anymore
+ */
+void close_device_state_list(struct _benoic_config * config) {
+  size_t j;
+  int i;
+  
+  for (i=0; config->device_state_list != NULL && config->device_state_list[i] != NULL; i++) {
+    for (j=0; j<config->device_state_list[i]->nb_commands; j++) {
+      device_command_release(config->device_state_list[i]->command_list[j]);
+    }
+    o_free(config->device_state_list[i]->device_name);
+    o_free(config->device_state_list[i]->command_list);
+    pthread_cond_destroy(&config->device_state_list[i]->cond);
+    pthread_mutex_destroy(&config->device_state_list[i]->module_lock);
+    o_free(config->device_state_list[i]);
+  }
+  o_free(config->device_state_list);
+  config->device_state_list = NULL;
+  pthread_mutex_destroy(&config->device_state_lock);
+}
+
+/**
+ * Return the state of the device, create it if it doesn't exist yet
+ * device_state_lock must be locked by the caller
+ */
+struct _benoic_device_state * get_device_state(struct _benoic_config * config, const char * device_name) {
+  struct _benoic_device_state * device_state, ** device_state_list;
+  int i;
+  
+  for (i=0; config->device_state_list[i] != NULL; i++) {
+    if (0 == o_strcmp(config->device_state_list[i]->device_name, device_name)) {
+      return config->device_state_list[i];
+    }
+  }
+  
+  device_state_list = o_realloc(config->device_state_list, (i + 2) * sizeof(struct _benoic_device_state *));
+  device_state = o_malloc(sizeof(struct _benoic_device_state));
+  if (device_state_list == NULL || device_state == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "get_device_state - Error allocating resources for device_state");
+    if (device_state_list != NULL) {
+      config->device_state_list = device_state_list;
+    }
+    o_free(device_state);
+    return NULL;
+  }
+  config->device_state_list = device_state_list;
+  device_state->device_name = o_strdup(device_name);
+  pthread_cond_init(&device_state->cond, NULL);
+  pthread_mutex_init(&device_state->module_lock, NULL);
+  device_state->command_list = NULL;
+  device_state->nb_commands = 0;
+  device_state->running = 0;
+  device_state->tokens = 0;
+  device_state->last_refill.tv_sec = 0;
+  device_state->last_refill.tv_nsec = 0;
+  device_state->nb_requests = 0;
+  device_state->nb_waiting_requests = 0;
+  device_state->down = 0;
+  device_state->nb_failures = 0;
+  device_state->next_check = 0;
+  device_state->reconnecting = 0;
+  device_state->last_seen_saved = 0;
+  device_state->linked = 0;
+  device_state->link_busy = 0;
+  device_state->nb_link_calls = 0;
+  device_state->last_used = 0;
+  device_state->idle_timeout = 0;
+  device_state->breaker_state = BENOIC_BREAKER_CLOSED;
+  device_state->breaker_failures = 0;
+  device_state->breaker_opened = 0;
+  device_state->breaker_probe = 0;
+  config->device_state_list[i] = device_state;
+  config->device_state_list[i + 1] = NULL;
+  return device_state;
+}
+
+/**
+ * Add a command at the end of the queue of the device
+ * A command to the same element still waiting in the queue is superseded by the new one:
+ * it's removed from the queue and its result is set to superseded
+ * b_command is NULL for a list of commands
+ * The returned command must be released with device_command_release after use
+ */
+struct _benoic_device_command * device_command_enqueue(struct _benoic_config * config, const char * device_name, const struct _b_element_command * b_command) {
+  struct _benoic_device_state * device_state;
+  struct _benoic_device_command * device_command, ** command_list, * cur_command;
+  int element_type = (b_command != NULL)?b_command->element_type:BENOIC_ELEMENT_TYPE_NONE;
+  const char * element_name = (b_command != NULL)?b_command->element_name:NULL;
+  size_t i, j;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  device_command = o_malloc(sizeof(struct _benoic_device_command));
+  command_list = (device_state != NULL)?o_realloc(device_state->command_list, (device_state->nb_commands + 1) * sizeof(struct _benoic_device_command *)):NULL;
+  if (device_state == NULL || device_command == NULL || command_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "device_command_enqueue - Error allocating resources for device_command");
+    if (command_list != NULL) {
+      device_state->command_list = command_list;
+    }
+    o_free(device_command);
+    pthread_mutex_unlock(&config->device_state_lock);
+    return NULL;
+  }
+  device_state->command_list = command_list;
+  
+  // The first command is running if the device is busy, it can't be superseded
+  for (i=(device_state->running?1:0), j=i; i<device_state->nb_commands; i++) {
+    cur_command = device_state->command_list[i];
+    if (element_type != BENOIC_ELEMENT_TYPE_NONE && cur_command->element_type == element_type && 0 == o_strcmp(cur_command->element_name, element_name)) {
+      cur_command->result = json_pack("{sisb}", "status", 200, "superseded", 1);
+      cur_command->done = 1;
+      device_command_release(cur_command);
+    } else {
+      device_state->command_list[j++] = cur_command;
+    }
+  }
+  device_state->nb_commands = j;
+  
+  device_command->element_type = element_type;
+  device_command->element_name = o_strdup(element_name);
+  device_command->mode = (b_command != NULL)?o_strdup(b_command->mode):NULL;
+  // The strings of the queued command are owned by device_command
+  if (b_command != NULL) {
+    device_command->element_command = *b_command;
+  } else {
+    memset(&device_command->element_command, 0, sizeof(struct _b_element_command));
+  }
+  device_command->element_command.element_name = device_command->element_name;
+  device_command->element_command.mode = device_command->mode;
+  device_command->command_list = NULL;
+  device_command->result = NULL;
+  device_command->done = 0;
+  device_command->nb_held_slots = 0;
+  device_command->device = NULL;
+  device_command->config = config;
+  // One reference for the queue, one for the caller
+  device_command->refcount = 2;
+  device_state->command_list[device_state->nb_commands++] = device_command;
+  pthread_cond_broadcast(&device_state->cond);
+  pthread_mutex_unlock(&config->device_state_lock);
+  return device_command;
+}
+
+/**
+ * Wait for the command to be the first in the queue of the device and run it
+ * If the command was superseded while waiting, it's not run
+ * If the device has a request timeout, the caller gives up when it expires:
+ * a command still waiting is removed from the queue, a running command is finished in a separate thread,
+ * or by the module itself if it can complete the command asynchronously
+ * returned value must be free'd after use
+ */
+json_t * device_command_run(struct _benoic_config * config, json_t * device, struct _benoic_device_command * device_command) {
+  struct _benoic_device_state * device_state;
+  struct timespec deadline;
+  pthread_t thread_command;
+  json_t * result;
+  long timeout = get_device_request_timeout(device);
+  size_t i, j;
+  int res = 0, started;
+  
+  if (timeout > 0) {
+    set_deadline(&deadline, timeout);
+  }
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+  if (device_state == NULL) {
+    pthread_mutex_unlock(&config->device_state_lock);
+    return json_pack("{si}", "status", 500);
+  }
+  while (!device_command->done && (device_state->running || device_state->nb_commands == 0 || device_state->command_list[0] != device_command) && res != ETIMEDOUT) {
+    if (timeout > 0) {
+      res = pthread_cond_timedwait(&device_state->cond, &config->device_state_lock, &deadline);
+    } else {
+      pthread_cond_wait(&device_state->cond, &config->device_state_lock);
+    }
+  }
+  if (device_command->done) {
+    result = json_copy(device_command->result);
+    pthread_mutex_unlock(&config->device_state_lock);
+    return result;
+  }
+  if (device_state->running || device_state->command_list[0] != device_command) {
+    // Timeout expired while waiting in the queue
+    for (i=0, j=0; i<device_state->nb_commands; i++) {
+      if (device_state->command_list[i] != device_command) {
+        device_state->command_list[j++] = device_state->command_list[i];
+      }
+    }
+    device_state->nb_commands = j;
+    device_command->result = json_pack("{siss}", "status", 504, "error", "timeout");
+    device_command->done = 1;
+    result = json_copy(device_command->result);
+    device_command_release(device_command);
+    pthread_cond_broadcast(&device_state->cond);
+    pthread_mutex_unlock(&config->device_state_lock);
+    return result;
+  }
+  device_state->running = 1;
+  
+  // The module or the thread running the command has its own reference to it, the command can end after the caller gave up
+  device_command->device = json_deep_copy(device);
+  device_command->config = config;
+  device_command->refcount++;
+  pthread_mutex_unlock(&config->device_state_lock);
+  
+  // A module completing the command on its own doesn't need a thread to wait for it
+  started = (device_command_start(config, device_command) == B_OK);
+  if (!started && timeout > 0) {
+    if (!pthread_create(&thread_command, NULL, thread_device_command_run, (void *)device_command)) {
+      pthread_detach(thread_command);
+      started = 1;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "device_command_run - Error creating thread, run command without timeout");
+    }
+  }
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  if (started) {
+    res = 0;
+    while (!device_command->done && res != ETIMEDOUT) {
+      if (timeout > 0) {
+        res = pthread_cond_timedwait(&device_state->cond, &config->device_state_lock, &deadline);
+      } else {
+        pthread_cond_wait(&device_state->cond, &config->device_state_lock);
+      }
+    }
+    if (device_command->done) {
+      result = json_copy(device_command->result);
+    } else {
+      // The module call is still running, it keeps a slot of the device until it returns
+      device_command->nb_held_slots++;
+      device_state->nb_requests++;
+      result = json_pack("{siss}", "status", 504, "error", "timeout");
+    }
+    pthread_mutex_unlock(&config->device_state_lock);
+    return result;
+  }
+  device_command->refcount--;
+  pthread_mutex_unlock(&config->device_state_lock);
+  
+  result = device_command_execute(config, device, device_command);
+  device_command_finish(config, json_string_value(json_object_get(device, "name")), device_command, result);
+  return result;
+}
+
+/**
+ * Set the result of the running command, remove it from the queue of the device
+ * and let the next command run
+ */
+void device_command_finish(struct _benoic_config * config, const char * device_name, struct _benoic_device_command * device_command, json_t * result) {
+  struct _benoic_device_state * device_state;
+  size_t i;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  device_command->result = json_copy(result);
+  device_command->done = 1;
+  if (device_state != NULL) {
+    for (i=1; i<device_state->nb_commands; i++) {
+      device_state->command_list[i - 1] = device_state->command_list[i];
+    }
+    device_state->nb_commands--;
+    device_state->running = 0;
+    // The slots kept for the callers who gave up are free now that the module call returned
+    device_state->nb_requests -= (device_command->nb_held_slots<device_state->nb_requests)?device_command->nb_held_slots:device_state->nb_requests;
+    device_command->nb_held_slots = 0;
+    pthread_cond_broadcast(&device_state->cond);
+  }
+  device_command_release(device_command);
+  pthread_mutex_unlock(&config->device_state_lock);
+}
+
+/**
+ * Run the command in a separate thread, so the caller can give up waiting for it
+ */
+void * thread_device_command_run(void * args) {
+  struct _benoic_device_command * device_command = (struct _benoic_device_command *)args;
+  struct _benoic_config * config = device_command->config;
+  json_t * result = device_command_execute(config, device_command->device, device_command);
+  
+  device_command_finish(config, json_string_value(json_object_get(device_command->device, "name")), device_command, result);
+  json_decref(result);
+  pthread_mutex_lock(&config->device_state_lock);
+  device_command_release(device_command);
+  pthread_mutex_unlock(&config->device_state_lock);
+  return NULL;
+}
+
+/**
+ * Start the command with the asynchronous function of the module
+ * Lists of commands are always sent synchronously
+ * return B_OK if the command is started, device_command_complete is then called when it's complete
+ */
+int device_command_start(struct _benoic_config * config, struct _benoic_device_command * device_command) {
+  if (device_command->command_list != NULL) {
+    return B_ERROR_PARAM;
+  }
+  return element_send_command_async(config, device_command->device, &device_command->element_command, &device_command_complete, (void *)device_command);
+}
+
+/**
+ * Completion of a command started by device_command_start, let the next command run
+ */
+void device_command_complete(void * cls, json_t * result) {
+  struct _benoic_device_command * device_command = (struct _benoic_device_command *)cls;
+  struct _benoic_config * config = device_command->config;
+  
+  device_command_finish(config, json_string_value(json_object_get(device_command->device, "name")), device_command, result);
+  pthread_mutex_lock(&config->device_state_lock);
+  device_command_release(device_command);
+  pthread_mutex_unlock(&config->device_state_lock);
+}
+
+/**
+ * Release a reference to the command, free it when it's not used anymore
+ * device_state_lock must be locked by the caller
+ */
+void device_command_release(struct _benoic_device_command * device_command) {
+  if (device_command != NULL && --device_command->refcount == 0) {
+    o_free(device_command->element_name);
+    o_free(device_command->mode);
+    json_decref(device_command->command_list);
+    json_decref(device_command->result);
+    json_decref(device_command->device);
+    o_free(device_command);
+  }
+}
+
+/**
+ * Send a command to the element through the queue of the device
+ * command is the command as sent in the url, mode is optional and used for heaters only
+ * timeout is the request timeout in milliseconds, 0 if there is none
+ * returned value must be free'd after use
+ */
+json_t * device_send_command(struct _benoic_config * config, json_t * device, const int element_type, const char * element_name, const char * command, const char * mode, const long timeout) {
+  struct _b_element_command b_command;
+  json_t * error = element_parse_command(element_type, element_name, command, mode, &b_command);
+  
+  if (error != NULL) {
+    return error;
+  }
+  return device_send_element_command(config, device, &b_command, timeout);
+}
+
+/**
+ * Send a parsed command to the element through the queue of the device
+ * timeout is the request timeout in milliseconds, 0 if there is none
+ * returned value must be free'd after use
+ */
+json_t * device_send_element_command(struct _benoic_config * config, json_t * device, const struct _b_element_command * b_command, const long timeout) {
+  struct _benoic_device_command * device_command = device_command_enqueue(config, json_string_value(json_object_get(device, "name")), b_command);
+  json_t * result, * module_device;
+  
+  if (device_command == NULL) {
+    return json_pack("{si}", "status", 500);
+  }
+  module_device = device_with_request_timeout(device, timeout);
+  result = device_command_run(config, module_device, device_command);
+  json_decref(module_device);
+  pthread_mutex_lock(&config->device_state_lock);
+  device_command_release(device_command);
+  pthread_mutex_unlock(&config->device_state_lock);
+  return result;
+}
+
+/**
+ * Add a list of commands sent together at the end of the queue of the device
+ * The list doesn't supersede the pending commands and can't be superseded
+ * The returned command must be released with device_command_release after use
+ */
+struct _benoic_device_command * device_command_enqueue_list(struct _benoic_config * config, const char * device_name, json_t * command_list) {
+  struct _benoic_device_command * device_command = device_command_enqueue(config, device_name, NULL);
+  
+  if (device_command != NULL) {
+    // The command is only run by the caller, so the list is set before it's used
+    pthread_mutex_lock(&config->device_state_lock);
+    device_command->command_list = json_deep_copy(command_list);
+    pthread_mutex_unlock(&config->device_state_lock);
+  }
+  return device_command;
+}
+
+/**
+ * Send the command, or the list of commands, to the device
+ * The result of a list is a json object containing the status and the array of the results of each command
+ * returned value must be free'd after use
+ */
+json_t * device_command_execute(struct _benoic_config * config, json_t * device, struct _benoic_device_command * device_command) {
+  json_t * results;
+  
+  if (device_command->command_list != NULL) {
+    results = element_send_command_list(config, device, device_command->command_list);
+    if (results == NULL) {
+      return json_pack("{si}", "status", 500);
+    }
+    return json_pack("{siso}", "status", 200, "results", results);
+  } else {
+    return element_send_command(config, device, &device_command->element_command);
+  }
+}
+
+/**
+ * Send a list of commands to the device through the queue of the device
+ * timeout is the request timeout in milliseconds, 0 if there is none
+ * returned value must be free'd after use
+ */
+json_t * device_send_command_list(struct _benoic_config * config, json_t * device, json_t * command_list, const long timeout) {
+  struct _benoic_device_command * device_command = device_command_enqueue_list(config, json_string_value(json_object_get(device, "name")), command_list);
+  json_t * result, * module_device;
+  
+  if (device_command == NULL) {
+    return json_pack("{si}", "status", 500);
+  }
+  module_device = device_with_request_timeout(device, timeout);
+  result = device_command_run(config, module_device, device_command);
+  json_decref(module_device);
+  pthread_mutex_lock(&config->device_state_lock);
+  device_command_release(device_command);
+  pthread_mutex_unlock(&config->device_state_lock);
+  return result;
+}
+
+/**
+ * Get the admission limits of the device
+ * The limits of the device type are overwritten by the options of the device
+ */
+void get_device_limits(struct _benoic_config * config, json_t * device, struct _benoic_device_limits * limits) {
+  struct _device_type * device_type = get_device_type(config, device);
+  json_t * j_limits[2] = {NULL, json_object_get(device, "options")};
+  int i;
+  
+  if (device_type != NULL && device_type->gate != NULL) {
+    // The limits of the type are replaced when its module is reloaded
+    pthread_mutex_lock(&device_type->gate->lock);
+    j_limits[0] = json_incref(device_type->limits);
+    pthread_mutex_unlock(&device_type->gate->lock);
+  }
+  
+  limits->rate_limit = 0;
+  limits->rate_burst = 0;
+  limits->max_concurrency = 0;
+  limits->max_queued = 0;
+  for (i=0; i<2; i++) {
+    if (json_is_number(json_object_get(j_limits[i], "rate_limit"))) {
+      limits->rate_limit = json_number_value(json_object_get(j_limits[i], "rate_limit"));
+    }
+    if (json_is_integer(json_object_get(j_limits[i], "rate_burst"))) {
+      limits->rate_burst = (unsigned int)json_integer_value(json_object_get(j_limits[i], "rate_burst"));
+    }
+    if (json_is_integer(json_object_get(j_limits[i], "max_concurrency"))) {
+      limits->max_concurrency = (unsigned int)json_integer_value(json_object_get(j_limits[i], "max_concurrency"));
+    }
+    if (json_is_integer(json_object_get(j_limits[i], "max_queued"))) {
+      limits->max_queued = (unsigned int)json_integer_value(json_object_get(j_limits[i], "max_queued"));
+    }
+  }
+  if (limits->rate_limit < 0) {
+    limits->rate_limit = 0;
+  }
+  if (limits->rate_limit > 0 && limits->rate_burst == 0) {
+    limits->rate_burst = (limits->rate_limit > 1)?(unsigned int)limits->rate_limit:1;
+  }
+  json_decref(j_limits[0]);
+}
+
+/**
+ * Return the format of the admission limits options, available for all device types
+ * returned value must be free'd after use
+ */
+json_t * get_device_limit_option_list(void) {
+  return json_pack("[{sssssssb}{sssssssb}{sssssssb}{sssssssb}]",
+                   "name", "rate_limit", "type", "double", "description", "Maximum number of requests per second sent to the device", "optional", 1,
+                   "name", "rate_burst", "type", "integer", "description", "Number of requests allowed at once when the device was idle", "optional", 1,
+                   "name", "max_concurrency", "type", "integer", "description", "Maximum number of requests sent to the device at the same time", "optional", 1,
+                   "name", "max_queued", "type", "integer", "description", "Maximum number of requests waiting for their turn", "optional", 1);
+}
+
+/**
+ * Return the format of the connection options, available for all device types
+ * returned value must be free'd after use
+ */
+json_t * get_device_link_option_list(void) {
+  return json_pack("[{sssssssb}{sssssssb}]",
+                   "name", "lazy_connect", "type", "boolean", "description", "Connect the device on the first request and disconnect it when it's idle", "optional", 1,
+                   "name", "idle_timeout", "type", "integer", "description", "Seconds without request before a lazy device is disconnected", "optional", 1);
+}
+
+/**
+ * Return true if the device is connected on demand
+ */
+int is_device_lazy(json_t * device) {
+  return (json_object_get(json_object_get(device, "options"), "lazy_connect") == json_true());
+}
+
+/**
+ * Return the number of seconds without request before the lazy device is disconnected
+ */
+time_t get_device_idle_timeout(json_t * device) {
+  json_t * j_idle_timeout = json_object_get(json_object_get(device, "options"), "idle_timeout");
+  
+  if (json_is_integer(j_idle_timeout) && json_integer_value(j_idle_timeout) > 0) {
+    return (time_t)json_integer_value(j_idle_timeout);
+  } else {
+    return BENOIC_LAZY_DEFAULT_IDLE_TIMEOUT;
+  }
+}
+
+/**
+ * Take the link of the device before connecting or disconnecting it
+ * The other threads wait for device_link_unlock before calling the module for this device
+ * linked is set to true if the device is connected, if it's not NULL
+ * return 1 if the link was taken, 0 if the calling thread already had it
+ */
+int device_link_lock(struct _benoic_config * config, json_t * device, int * linked) {
+  struct _benoic_device_state * device_state;
+  int owned = 0;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+  if (device_state != NULL) {
+    if (!device_state->link_busy || !pthread_equal(device_state->link_thread, pthread_self())) {
+      while (device_state->link_busy) {
+        pthread_cond_wait(&device_state->cond, &config->device_state_lock);
+      }
+      device_state->link_busy = 1;
+      device_state->link_thread = pthread_self();
+      owned = 1;
+    }
+    if (linked != NULL) {
+      *linked = device_state->linked;
+    }
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+  return owned;
+}
+
+/**
+ * Set whether the device is connected, and release its link if it was taken by device_link_lock
+ * The idle timer of a lazy device starts when it's connected
+ */
+void device_link_unlock(struct _benoic_config * config, json_t * device, const int owned, const int linked) {
+  struct _benoic_device_state * device_state;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+  if (device_state != NULL) {
+    device_state->linked = linked;
+    if (linked) {
+      device_state->down = 0;
+      device_state->nb_failures = 0;
+    }
+    device_state->idle_timeout = is_device_lazy(device)?get_device_idle_timeout(device):0;
+    time(&device_state->last_used);
+    if (owned) {
+      device_state->link_busy = 0;
+      pthread_cond_broadcast(&device_state->cond);
+    }
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+}
+
+/**
+ * Count a module call for the device, after the device is connected or disconnected if it's in progress
+ * A lazy device is connected first if it isn't yet, by one thread only, the other ones wait for it
+ * The call must be ended with device_link_leave
+ * return B_OK if the module can be called, B_ERROR_IO if the lazy device couldn't be connected,
+ * B_ERROR_UNAVAILABLE if the supervisor found the device down or its circuit breaker is open
+ */
+int device_link_enter(struct _benoic_config * config, json_t * device) {
+  struct _benoic_device_state * device_state;
+  const char * device_name = json_string_value(json_object_get(device, "name"));
+  json_t * j_device;
+  int lazy = is_device_lazy(device), res, changed;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  if (device_state == NULL) {
+    pthread_mutex_unlock(&config->device_state_lock);
+    return B_ERROR_MEMORY;
+  }
+  if (!device_state->link_busy || !pthread_equal(device_state->link_thread, pthread_self())) {
+    while (device_state->link_busy) {
+      pthread_cond_wait(&device_state->cond, &config->device_state_lock);
+    }
+    if (device_state->down) {
+      // The supervisor will connect the device again, don't wait for the module timeout
+      pthread_mutex_unlock(&config->device_state_lock);
+      return B_ERROR_UNAVAILABLE;
+    }
+    if (device_breaker_enter(device, device_state) != B_OK) {
+      // The last calls failed, don't wait for the module timeout until the cooldown expires
+      pthread_mutex_unlock(&config->device_state_lock);
+      return B_ERROR_UNAVAILABLE;
+    }
+    if (lazy && !device_state->linked && json_object_get(device, "connected") == json_true()) {
+      device_state->link_busy = 1;
+      device_state->link_thread = pthread_self();
+      pthread_mutex_unlock(&config->device_state_lock);
+      
+      // connect_device modifies the options of the device, the caller keeps its own,
+      // a failed connection is transient, the device stays marked connected in the database
+      y_log_message(Y_LOG_LEVEL_INFO, "Connect lazy device %s", device_name);
+      j_device = json_deep_copy(device);
+      res = connect_device(config, j_device, 0, get_device_request_timeout(device));
+      json_decref(j_device);
+      
+      pthread_mutex_lock(&config->device_state_lock);
+      device_state->link_busy = 0;
+      pthread_cond_broadcast(&device_state->cond);
+      if (res != B_OK) {
+        changed = device_breaker_update(device, device_state, DEVICE_RESULT_ERROR);
+        pthread_mutex_unlock(&config->device_state_lock);
+        y_log_message(Y_LOG_LEVEL_ERROR, "device_link_enter - Error connecting lazy device %s", device_name);
+        if (changed) {
+          bump_registry_generation(config);
+        }
+        return B_ERROR_IO;
+      }
+    }
+  }
+  device_state->nb_link_calls++;
+  device_state->idle_timeout = lazy?get_device_idle_timeout(device):0;
+  pthread_mutex_unlock(&config->device_state_lock);
+  return B_OK;
+}
+
+/**
+ * End the module call counted by device_link_enter
+ */
+void device_link_leave(struct _benoic_config * config, json_t * device) {
+  struct _benoic_device_state * device_state;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+  if (device_state != NULL && device_state->nb_link_calls > 0) {
+    device_state->nb_link_calls--;
+    time(&device_state->last_used);
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+}
+
+/**
+ * Return true if the lazy device is connected and had no module call for longer than its idle timeout
+ */
+int is_device_idle(struct _benoic_config * config, const char * device_name) {
+  struct _benoic_device_state * device_state;
+  int idle = 0;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  if (device_state != NULL) {
+    idle = (device_state->idle_timeout > 0 &&
+            device_state->linked &&
+            device_state->nb_link_calls == 0 &&
+            device_state->last_used + device_state->idle_timeout <= time(NULL));
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+  return idle;
+}
+
+/**
+ * Disconnect the lazy devices without module call for longer than their idle timeout
+ * The devices stay marked connected, they are connected again on their next request
+ */
+void device_idle_disconnect(struct _benoic_config * config) {
+  json_t * j_idle_list = json_array(), * j_name, * device, * result;
+  struct _device_type * device_type;
+  size_t index;
+  int i, owned, linked;
+  
+  if (j_idle_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "device_idle_disconnect - Error allocating resources for j_idle_list");
+    return;
+  }
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  for (i=0; config->device_state_list != NULL && config->device_state_list[i] != NULL; i++) {
+    if (config->device_state_list[i]->idle_timeout > 0 && config->device_state_list[i]->linked) {
+      json_array_append_new(j_idle_list, json_string(config->device_state_list[i]->device_name));
+    }
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+  
+  json_array_foreach(j_idle_list, index, j_name) {
+    if (!is_device_idle(config, json_string_value(j_name))) {
+      continue;
+    }
+    device = get_device(config, json_string_value(j_name));
+    device_type = get_device_type(config, device);
+    if (device_type != NULL && module_link_enter(config, device_type, device, &owned, &linked) == B_OK) {
+      // A request may have used the device while the link was taken
+      if (is_device_idle(config, json_string_value(j_name))) {
+        y_log_message(Y_LOG_LEVEL_INFO, "Disconnect idle lazy device %s", json_string_value(j_name));
+        result = device_type->b_device_disconnect(device, get_device_ptr(config, json_string_value(j_name)));
+        if (result == NULL || json_integer_value(json_object_get(result, "result")) != DEVICE_RESULT_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "device_idle_disconnect - Error disconnecting device %s", json_string_value(j_name));
+        }
+        json_decref(result);
+        if (get_device_ptr(config, json_string_value(j_name)) != NULL) {
+          remove_device_data(config, json_string_value(j_name));
+        }
+        linked = 0;
+      }
+      module_link_leave(config, device_type, device, owned, linked);
+    }
+    json_decref(device);
+  }
+  json_decref(j_idle_list);
+}
+
+/**
+ * Take a token in the bucket of the device
+ * return B_OK if the request can be sent, B_ERROR_BUSY if the rate limit is reached,
+ * retry_after is then set to the number of seconds to wait before a token is available
+ */
+int device_rate_check(struct _benoic_config * config, json_t * device, long * retry_after) {
+  struct _benoic_device_limits limits;
+  struct _benoic_device_state * device_state;
+  struct timespec now;
+  int res = B_OK;
+  
+  get_device_limits(config, device, &limits);
+  if (limits.rate_limit <= 0) {
+    return B_OK;
+  }
+  
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+  if (device_state == NULL) {
+    res = B_ERROR_MEMORY;
+  } else {
+    if (device_state->last_refill.tv_sec == 0 && device_state->last_refill.tv_nsec == 0) {
+      device_state->tokens = limits.rate_burst;
+    } else {
+      device_state->tokens += ((now.tv_sec - device_state->last_refill.tv_sec) + (now.tv_nsec - device_state->last_refill.tv_nsec) / 1000000000.0) * limits.rate_limit;
+      if (device_state->tokens > limits.rate_burst) {
+        device_state->tokens = limits.rate_burst;
+      }
+    }
+    device_state->last_refill = now;
+    if (device_state->tokens >= 1) {
+      device_state->tokens--;
+    } else {
+      if (retry_after != NULL) {
+        *retry_after = (long)((1 - device_state->tokens) / limits.rate_limit) + 1;
+      }
+      res = B_ERROR_BUSY;
+    }
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+  return res;
+}
+
+/**
+ * Take a slot to send a request to the device
+ * If all the slots are taken, the request waits for its turn, until the request timeout expires
+ * timeout is optional, it's the request timeout in milliseconds, 0 if there is none,
+ * the time spent waiting is taken from it
+ * return B_OK if the request can be sent, B_ERROR_BUSY if too many requests are already waiting,
+ * B_ERROR_TIMEOUT if the request timeout expired
+ * On success, the slot must be released with device_slot_release after the request
+ */
+int device_slot_acquire(struct _benoic_config * config, json_t * device, long * timeout) {
+  struct _benoic_device_limits limits;
+  struct _benoic_device_state * device_state;
+  struct timespec deadline;
+  int res = 0;
+  
+  get_device_limits(config, device, &limits);
+  if (timeout != NULL && *timeout > 0) {
+    set_deadline(&deadline, *timeout);
+  }
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+  if (device_state == NULL) {
+    pthread_mutex_unlock(&config->device_state_lock);
+    return B_ERROR_MEMORY;
+  }
+  if (limits.max_concurrency > 0 && device_state->nb_requests >= limits.max_concurrency) {
+    if (device_state->nb_waiting_requests >= limits.max_queued) {
+      pthread_mutex_unlock(&config->device_state_lock);
+      return B_ERROR_BUSY;
+    }
+    device_state->nb_waiting_requests++;
+    while (device_state->nb_requests >= limits.max_concurrency && res != ETIMEDOUT) {
+      if (timeout != NULL && *timeout > 0) {
+        res = pthread_cond_timedwait(&device_state->cond, &config->device_state_lock, &deadline);
+      } else {
+        pthread_cond_wait(&device_state->cond, &config->device_state_lock);
+      }
+    }
+    device_state->nb_waiting_requests--;
+    if (device_state->nb_requests >= limits.max_concurrency || (timeout != NULL && *timeout > 0 && get_deadline_remaining(&deadline) == 0)) {
+      pthread_mutex_unlock(&config->device_state_lock);
+      return B_ERROR_TIMEOUT;
+    }
+    if (timeout != NULL && *timeout > 0) {
+      // The time spent waiting is taken from the request timeout
+      *timeout = get_deadline_remaining(&deadline);
+    }
+  }
+  device_state->nb_requests++;
+  pthread_mutex_unlock(&config->device_state_lock);
+  return B_OK;
+}
+
+/**
+ * Release the slot taken by device_slot_acquire and let the next request waiting run
+ */
+void device_slot_release(struct _benoic_config * config, json_t * device) {
+  device_slot_release_held(config, json_string_value(json_object_get(device, "name")), 1);
+}
+
+/**
+ * Take a slot of the device for a module call still running after its caller gave up,
+ * so the caller can release its own slot without letting another request run while the call is running
+ * The slot is released with device_slot_release_held when the module call returns
+ */
+void device_slot_hold(struct _benoic_config * config, const char * device_name) {
+  struct _benoic_device_state * device_state;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  if (device_state != NULL) {
+    device_state->nb_requests++;
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+}
+
+/**
+ * Release nb_slots slots of the device and let the next requests waiting run
+ */
+void device_slot_release_held(struct _benoic_config * config, const char * device_name, const unsigned int nb_slots) {
+  struct _benoic_device_state * device_state;
+  
+  if (nb_slots == 0) {
+    return;
+  }
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  if (device_state != NULL && device_state->nb_requests > 0) {
+    device_state->nb_requests -= (nb_slots<device_state->nb_requests)?nb_slots:device_state->nb_requests;
+    pthread_cond_broadcast(&device_state->cond);
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+}
+
+/**
+ * Check the device is not down and the rate limit of the device, then take a slot to send the request
+ * timeout is optional, the time spent waiting for a slot is taken from it, see device_slot_acquire
+ * return B_OK if the request can be sent, B_ERROR_UNAVAILABLE, B_ERROR_BUSY or B_ERROR_TIMEOUT otherwise
+ * On success, the slot must be released with device_slot_release after the request
+ */
+int device_admission_enter(struct _benoic_config * config, json_t * device, long * timeout, long * retry_after) {
+  int res = device_health_check(config, device, retry_after);
+  
+  if (res == B_OK) {
+    res = device_rate_check(config, device, retry_after);
+  }
+  if (res == B_OK) {
+    res = device_slot_acquire(config, device, timeout);
+    if (res == B_ERROR_BUSY && retry_after != NULL) {
+      *retry_after = 1;
+    }
+  }
+  return res;
+}
@@ -0,0 +1,472 @@
+/**
+ *
+ * Benoic House Automation service
+ *
+ * Command house automation devices via an HTTP REST interface
+ *
+ * Connection supervisor functions
+ * Ping the connected devices and reconnect the ones that stopped answering
+ * Stop calling the modules of the devices that keep failing
+ *
+ * Copyright 2016 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "benoic.h"
+
+/**
+ * Initialize the supervisor and start its thread
+ */
+int init_supervisor(struct _benoic_config * config) {
+  struct _benoic_supervisor * supervisor = &config->supervisor;
+  
+  supervisor->config = config;
+  if (pthread_mutex_init(&supervisor->lock, NULL) || pthread_cond_init(&supervisor->cond, NULL)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "init_supervisor - Error initializing lock");
+    return B_ERROR;
+  }
+  if (supervisor->interval <= 0) {
+    supervisor->interval = BENOIC_SUPERVISOR_DEFAULT_INTERVAL;
+  }
+  if (supervisor->backoff_min <= 0) {
+    supervisor->backoff_min = BENOIC_SUPERVISOR_DEFAULT_BACKOFF_MIN;
+  }
+  if (supervisor->backoff_max < supervisor->backoff_min) {
+    supervisor->backoff_max = supervisor->backoff_min>BENOIC_SUPERVISOR_DEFAULT_BACKOFF_MAX?supervisor->backoff_min:BENOIC_SUPERVISOR_DEFAULT_BACKOFF_MAX;
+  }
+  supervisor->seed = (unsigned int)time(NULL);
+  supervisor->nb_reconnects = 0;
+  supervisor->closed = 0;
+  
+  if (pthread_create(&supervisor->thread, NULL, thread_supervisor_run, (void *)supervisor)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "init_supervisor - Error creating supervisor thread");
+    pthread_mutex_destroy(&supervisor->lock);
+    pthread_cond_destroy(&supervisor->cond);
+    return B_ERROR;
+  }
+  return B_OK;
+}
+
+/**
+ * Stop the supervisor, a ping or the reconnections in progress are finished first
+ */
+void close_supervisor(struct _benoic_supervisor * supervisor) {
+  pthread_mutex_lock(&supervisor->lock);
+  supervisor->closed = 1;
+  pthread_cond_broadcast(&supervisor->cond);
+  pthread_mutex_unlock(&supervisor->lock);
+  
+  pthread_join(supervisor->thread, NULL);
+  pthread_mutex_lock(&supervisor->lock);
+  while (supervisor->nb_reconnects > 0) {
+    pthread_cond_wait(&supervisor->cond, &supervisor->lock);
+  }
+  pthread_mutex_unlock(&supervisor->lock);
+  pthread_mutex_destroy(&supervisor->lock);
+  pthread_cond_destroy(&supervisor->cond);
+}
+
+/**
+ * Supervisor thread, check the devices every BENOIC_SUPERVISOR_TICK seconds until the supervisor is closed
+ */
+void * thread_supervisor_run(void * args) {
+  struct _benoic_supervisor * supervisor = (struct _benoic_supervisor *)args;
+  struct timespec deadline;
+  
+  pthread_mutex_lock(&supervisor->lock);
+  while (!supervisor->closed) {
+    set_deadline(&deadline, BENOIC_SUPERVISOR_TICK * 1000);
+    pthread_cond_timedwait(&supervisor->cond, &supervisor->lock, &deadline);
+    if (!supervisor->closed) {
+      pthread_mutex_unlock(&supervisor->lock);
+      supervise_devices(supervisor);
+      pthread_mutex_lock(&supervisor->lock);
+    }
+  }
+  pthread_mutex_unlock(&supervisor->lock);
+  return NULL;
+}
+
+/**
+ * Ping the connected devices due for a check, and try to reconnect the ones down
+ * A device not answering is disconnected, so its module frees its resources,
+ * it's still marked connected in the database, so it's connected again when it's back
+ * A ping refused by the circuit breaker of the device isn't a failure, the ping probes the device when it's half-open
+ * Lazy devices are not supervised, they are connected and disconnected by their requests
+ */
+void supervise_devices(struct _benoic_supervisor * supervisor) {
+  struct _benoic_config * config = supervisor->config;
+  struct _benoic_device_state * device_state;
+  json_t * device_list = get_device(config, NULL), * device;
+  const char * device_name;
+  size_t index;
+  time_t now;
+  int due, down, res;
+  
+  json_array_foreach(device_list, index, device) {
+    if (json_object_get(device, "enabled") != json_true() || json_object_get(device, "connected") != json_true() || is_device_lazy(device)) {
+      continue;
+    }
+    device_name = json_string_value(json_object_get(device, "name"));
+  
+    time(&now);
+    pthread_mutex_lock(&config->device_state_lock);
+    device_state = get_device_state(config, device_name);
+    due = (device_state != NULL && device_state->next_check <= now && !device_state->reconnecting);
+    down = (device_state != NULL && device_state->down);
+    if (device_state != NULL && device_state->next_check == 0) {
+      // First time the device is seen, it was just connected
+      device_state->next_check = now + supervisor->interval;
+      due = 0;
+    }
+    pthread_mutex_unlock(&config->device_state_lock);
+    if (!due) {
+      continue;
+    }
+  
+    if (!down) {
+      res = ping_device(config, device, config->request_timeout>0?config->request_timeout:BENOIC_SUPERVISOR_DEFAULT_TIMEOUT);
+      if (res == B_OK) {
+        device_health_ok(config, device_name);
+      } else if (res == B_ERROR_UNAVAILABLE) {
+        // The circuit of the device is open, the ping is sent again on the next tick,
+        // it probes the device once the cooldown expired
+        continue;
+      } else {
+        y_log_message(Y_LOG_LEVEL_WARNING, "supervise_devices - Device %s doesn't answer, reason: %d", device_name, res);
+        device_health_failure(config, device_name);
+        disconnect_device(config, device, 0);
+        publish_device_connection(config, device_name, 0);
+      }
+    } else {
+      // If all the reconnection threads are busy, the device is still due on the next tick
+      supervisor_reconnect_start(supervisor, device);
+    }
+  }
+  json_decref(device_list);
+}
+
+/**
+ * Start the reconnection of the device down in its own thread, so a slow connection doesn't delay the pings
+ * return B_OK if the reconnection is started, B_ERROR_BUSY if connect_concurrency reconnections are already running
+ */
+int supervisor_reconnect_start(struct _benoic_supervisor * supervisor, json_t * device) {
+  struct _benoic_config * config = supervisor->config;
+  struct _benoic_supervisor_reconnect * reconnect;
+  struct _benoic_device_state * device_state;
+  unsigned int max_reconnects = config->connect_concurrency>0?config->connect_concurrency:BENOIC_CONNECT_DEFAULT_CONCURRENCY;
+  pthread_t thread;
+  
+  pthread_mutex_lock(&supervisor->lock);
+  if (supervisor->closed || supervisor->nb_reconnects >= max_reconnects) {
+    pthread_mutex_unlock(&supervisor->lock);
+    return B_ERROR_BUSY;
+  }
+  reconnect = o_malloc(sizeof(struct _benoic_supervisor_reconnect));
+  if (reconnect == NULL) {
+    pthread_mutex_unlock(&supervisor->lock);
+    y_log_message(Y_LOG_LEVEL_ERROR, "supervisor_reconnect_start - Error allocating resources for reconnect");
+    return B_ERROR_MEMORY;
+  }
+  reconnect->supervisor = supervisor;
+  reconnect->device = json_deep_copy(device);
+  supervisor->nb_reconnects++;
+  pthread_mutex_unlock(&supervisor->lock);
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+  if (device_state != NULL) {
+    device_state->reconnecting = 1;
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+  
+  if (pthread_create(&thread, NULL, thread_supervisor_reconnect_run, (void *)reconnect)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "supervisor_reconnect_start - Error creating reconnection thread");
+    pthread_mutex_lock(&config->device_state_lock);
+    if (device_state != NULL) {
+      device_state->reconnecting = 0;
+    }
+    pthread_mutex_unlock(&config->device_state_lock);
+    pthread_mutex_lock(&supervisor->lock);
+    supervisor->nb_reconnects--;
+    pthread_mutex_unlock(&supervisor->lock);
+    json_decref(reconnect->device);
+    o_free(reconnect);
+    return B_ERROR;
+  }
+  pthread_detach(thread);
+  return B_OK;
+}
+
+/**
+ * Reconnection thread, connect the device again and schedule its next ping or reconnection attempt
+ */
+void * thread_supervisor_reconnect_run(void * args) {
+  struct _benoic_supervisor_reconnect * reconnect = (struct _benoic_supervisor_reconnect *)args;
+  struct _benoic_supervisor * supervisor = reconnect->supervisor;
+  struct _benoic_config * config = supervisor->config;
+  struct _benoic_device_state * device_state;
+  const char * device_name = json_string_value(json_object_get(reconnect->device, "name"));
+  
+  if (connect_device(config, reconnect->device, 0, config->request_timeout>0?config->request_timeout:BENOIC_SUPERVISOR_DEFAULT_TIMEOUT) == B_OK) {
+    y_log_message(Y_LOG_LEVEL_INFO, "thread_supervisor_reconnect_run - Device %s reconnected", device_name);
+    device_health_ok(config, device_name);
+  } else {
+    device_health_failure(config, device_name);
+  }
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  if (device_state != NULL) {
+    device_state->reconnecting = 0;
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+  json_decref(reconnect->device);
+  o_free(reconnect);
+  
+  pthread_mutex_lock(&supervisor->lock);
+  supervisor->nb_reconnects--;
+  if (supervisor->closed) {
+    pthread_cond_broadcast(&supervisor->cond);
+  }
+  pthread_mutex_unlock(&supervisor->lock);
+  return NULL;
+}
+
+/**
+ * Return the number of seconds before the next reconnection attempt after nb_failures failures
+ * The delay doubles with each failure, half of it is random so the devices down together don't retry together
+ */
+time_t get_reconnect_delay(struct _benoic_supervisor * supervisor, const unsigned int nb_failures) {
+  time_t delay = supervisor->backoff_min;
+  unsigned int i;
+  
+  for (i=1; i<nb_failures && delay < supervisor->backoff_max; i++) {
+    delay *= 2;
+  }
+  if (delay > supervisor->backoff_max) {
+    delay = supervisor->backoff_max;
+  }
+  return delay / 2 + (time_t)(rand_r(&supervisor->seed) % (delay - delay / 2 + 1));
+}
+
+/**
+ * Mark the device up, its next ping is in interval seconds
+ */
+void device_health_ok(struct _benoic_config * config, const char * device_name) {
+  struct _benoic_device_state * device_state;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  if (device_state != NULL) {
+    device_state->down = 0;
+    device_state->nb_failures = 0;
+    device_state->next_check = time(NULL) + config->supervisor.interval;
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+}
+
+/**
+ * Mark the device down, its next reconnection attempt is delayed according to the number of failures
+ */
+void device_health_failure(struct _benoic_config * config, const char * device_name) {
+  struct _benoic_device_state * device_state;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  if (device_state != NULL) {
+    device_state->down = 1;
+    device_state->nb_failures++;
+    device_state->next_check = time(NULL) + get_reconnect_delay(&config->supervisor, device_state->nb_failures);
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+}
+
+/**
+ * Check if the supervisor found the device down, or if the circuit breaker of the device is open
+ * return B_OK if the device can be called, B_ERROR_UNAVAILABLE if it's down or its circuit is open,
+ * retry_after is then set to the number of seconds before the next reconnection attempt or probe
+ */
+int device_health_check(struct _benoic_config * config, json_t * device, long * retry_after) {
+  struct _benoic_device_state * device_state;
+  int res = B_OK;
+  time_t now = time(NULL), probe;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+  if (device_state != NULL && device_state->down) {
+    res = B_ERROR_UNAVAILABLE;
+    if (retry_after != NULL) {
+      *retry_after = (device_state->next_check > now)?(long)(device_state->next_check - now):1;
+    }
+  } else if (device_state != NULL && device_state->breaker_state == BENOIC_BREAKER_OPEN) {
+    probe = device_state->breaker_opened + get_device_breaker_cooldown(device);
+    if (probe > now) {
+      res = B_ERROR_UNAVAILABLE;
+      if (retry_after != NULL) {
+        *retry_after = (long)(probe - now);
+      }
+    }
+  } else if (device_state != NULL && device_state->breaker_state == BENOIC_BREAKER_HALF_OPEN && device_state->breaker_probe) {
+    res = B_ERROR_UNAVAILABLE;
+    if (retry_after != NULL) {
+      *retry_after = 1;
+    }
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+  return res;
+}
+
+/**
+ * Return the format of the circuit breaker options, available for all device types
+ * returned value must be free'd after use
+ */
+json_t * get_device_breaker_option_list(void) {
+  return json_pack("[{sssssssb}{sssssssb}]",
+                   "name", "breaker_threshold", "type", "integer", "description", "Consecutive failed calls before the device is not called anymore, 0 to disable", "optional", 1,
+                   "name", "breaker_cooldown", "type", "integer", "description", "Seconds before the device is called again after its calls failed", "optional", 1);
+}
+
+/**
+ * Return the number of consecutive failed calls that open the circuit of the device, 0 if it's disabled
+ */
+unsigned int get_device_breaker_threshold(json_t * device) {
+  json_t * j_threshold = json_object_get(json_object_get(device, "options"), "breaker_threshold");
+  
+  if (json_is_integer(j_threshold) && json_integer_value(j_threshold) >= 0) {
+    return (unsigned int)json_integer_value(j_threshold);
+  } else {
+    return BENOIC_BREAKER_DEFAULT_THRESHOLD;
+  }
+}
+
+/**
+ * Return the number of seconds the circuit of the device stays open before it's probed
+ */
+time_t get_device_breaker_cooldown(json_t * device) {
+  json_t * j_cooldown = json_object_get(json_object_get(device, "options"), "breaker_cooldown");
+  
+  if (json_is_integer(j_cooldown) && json_integer_value(j_cooldown) > 0) {
+    return (time_t)json_integer_value(j_cooldown);
+  } else {
+    return BENOIC_BREAKER_DEFAULT_COOLDOWN;
+  }
+}
+
+/**
+ * Check the circuit breaker of the device before a module call, device_state_lock must be held
+ * An open circuit becomes half-open when its cooldown expires, the calling thread is then the one probing the device
+ * return B_OK if the module can be called, B_ERROR_UNAVAILABLE if the circuit is open or another call is probing it
+ */
+int device_breaker_enter(json_t * device, struct _benoic_device_state * device_state) {
+  if (device_state->breaker_state == BENOIC_BREAKER_OPEN && device_state->breaker_opened + get_device_breaker_cooldown(device) <= time(NULL)) {
+    device_state->breaker_state = BENOIC_BREAKER_HALF_OPEN;
+    device_state->breaker_probe = 0;
+  }
+  if (device_state->breaker_state == BENOIC_BREAKER_OPEN) {
+    return B_ERROR_UNAVAILABLE;
+  } else if (device_state->breaker_state == BENOIC_BREAKER_HALF_OPEN) {
+    if (device_state->breaker_probe) {
+      return B_ERROR_UNAVAILABLE;
+    }
+    y_log_message(Y_LOG_LEVEL_INFO, "Probe device %s", device_state->device_name);
+    device_state->breaker_probe = 1;
+  }
+  return B_OK;
+}
+
+/**
+ * Update the circuit breaker of the device with the result of a module call, device_state_lock must be held
+ * result is a DEVICE_RESULT_* value, an error or a timeout counts as a failure, ok or not found as a success,
+ * the other values don't change the circuit
+ * return true if the state of the circuit changed
+ */
+int device_breaker_update(json_t * device, struct _benoic_device_state * device_state, const int result) {
+  unsigned int threshold;
+  
+  if (result == DEVICE_RESULT_OK || result == DEVICE_RESULT_NOT_FOUND) {
+    device_state->breaker_failures = 0;
+    device_state->breaker_probe = 0;
+    if (device_state->breaker_state != BENOIC_BREAKER_CLOSED) {
+      y_log_message(Y_LOG_LEVEL_INFO, "Device %s answers again, close its circuit", device_state->device_name);
+      device_state->breaker_state = BENOIC_BREAKER_CLOSED;
+      return 1;
+    }
+  } else if (result == DEVICE_RESULT_ERROR || result == DEVICE_RESULT_TIMEOUT) {
+    device_state->breaker_failures++;
+    threshold = get_device_breaker_threshold(device);
+    if (device_state->breaker_state == BENOIC_BREAKER_HALF_OPEN ||
+        (device_state->breaker_state == BENOIC_BREAKER_CLOSED && threshold > 0 && device_state->breaker_failures >= threshold)) {
+      y_log_message(Y_LOG_LEVEL_WARNING, "Device %s failed %u times, open its circuit", device_state->device_name, device_state->breaker_failures);
+      device_state->breaker_state = BENOIC_BREAKER_OPEN;
+      device_state->breaker_probe = 0;
+      time(&device_state->breaker_opened);
+      return 1;
+    }
+  } else if (device_state->breaker_state == BENOIC_BREAKER_HALF_OPEN) {
+    // The probe tells nothing, the next call probes the device
+    device_state->breaker_probe = 0;
+  }
+  return 0;
+}
+
+/**
+ * Record the result of a module call in the circuit breaker of the device
+ * result is a DEVICE_RESULT_* value, or BENOIC_BREAKER_NO_RESULT if the call tells nothing about the device
+ * The device data change when its circuit opens or closes
+ */
+void device_breaker_record(struct _benoic_config * config, json_t * device, const int result) {
+  struct _benoic_device_state * device_state;
+  int changed = 0;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+  if (device_state != NULL) {
+    changed = device_breaker_update(device, device_state, result);
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+  if (changed) {
+    bump_registry_generation(config);
+  }
+}
+
+/**
+ * Return the state of the circuit breaker of the device, as shown in the device data
+ * returned value must be free'd after use
+ */
+json_t * device_breaker_to_json(struct _benoic_config * config, const char * device_name) {
+  struct _benoic_device_state * device_state;
+  json_t * to_return = NULL;
+  
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  if (device_state != NULL) {
+    switch (device_state->breaker_state) {
+      case BENOIC_BREAKER_OPEN:
+        to_return = json_pack("{sssI}", "state", "open", "opened_at", (json_int_t)device_state->breaker_opened);
+        break;
+      case BENOIC_BREAKER_HALF_OPEN:
+        to_return = json_pack("{sssI}", "state", "half_open", "opened_at", (json_int_t)device_state->breaker_opened);
+        break;
+      default:
+        to_return = json_pack("{ss}", "state", "closed");
+        break;
+    }
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+  return to_return;
+}
@@ -35,13 +35,36 @@ void close_device_type(struct _device_type device_type) {
   o_free(device_type.uid);
   o_free(device_type.name);
   o_free(device_type.description);
-  dlclose(device_type.dl_handle);
+  o_free(device_type.file_path);
+  if (device_type.dl_handle != NULL) {
+    dlclose(device_type.dl_handle);
+  }
   json_decref(device_type.options);
+  json_decref(device_type.limits);
+  if (device_type.module_lock != NULL) {
+    pthread_mutex_destroy(device_type.module_lock);
+    o_free(device_type.module_lock);
+  }
+  if (device_type.gate != NULL) {
+    module_gate_destroy(device_type.gate);
+    o_free(device_type.gate);
+  }
   device_type.uid = NULL;
   device_type.name = NULL;
   device_type.description = NULL;
   device_type.dl_handle = NULL;
   device_type.options = NULL;
+  device_type.limits = NULL;
+  device_type.file_path = NULL;
+  device_type.module_lock = NULL;
+  device_type.gate = NULL;
+}
+
+/**
+ * Callback given to the modules to push element value changes
+ */
+int device_value_changed(void * cls, const char * device_name, const int element_type, const char * element_name, json_t * value, time_t timestamp) {
+  return element_push_value((struct _benoic_config *)cls, device_name, element_type, element_name, value, timestamp);
 }
 
 /**
@@ -63,11 +86,11 @@ int close_device_type_list(struct _device_type * device_type_list) {
  * Initializes the struct _device_type according to all the devices types libraries present in config->modules_path
  */
 int init_device_type_list(struct _benoic_config * config) {
-  json_t * j_query, * j_result, * device_handshake;
+  json_t * j_query;
   DIR * modules_directory;
   struct dirent * in_file;
+  struct _device_type cur_device;
   char * file_path;
-  void * file_handle;
   int res;
   size_t nb_device_types = 0;
   
@@ -83,6 +106,8 @@ int init_device_type_list(struct _benoic_config * config) {
     config->device_type_list->dl_handle = NULL;
     config->device_type_list->name = NULL;
     config->device_type_list->description = NULL;
+    config->device_type_list->module_lock = NULL;
+    config->device_type_list->gate = NULL;
     
     // Disable all types in the database
     j_query = json_object();
@@ -120,135 +145,30 @@ int init_device_type_list(struct _benoic_config * config) {
         return B_ERROR_MEMORY;
       }
       
-      file_handle = dlopen(file_path, RTLD_LAZY);
-      
-      if (file_handle != NULL) {
-        y_log_message(Y_LOG_LEVEL_INFO, "Open module from file %s", file_path);
-        struct _device_type cur_device;
+      if (open_device_type(config, file_path, &cur_device) == B_OK) {
+        nb_device_types++;
+        config->device_type_list = o_realloc(config->device_type_list, (nb_device_types+1)*sizeof(struct _device_type));
+        if (config->device_type_list == NULL) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error allocating resources for device_type_list");
+          close_device_type(cur_device);
+          o_free(file_path);
+          closedir(modules_directory);
+          return B_ERROR_MEMORY;
+        }
+        config->device_type_list[nb_device_types - 1] = cur_device;
+        y_log_message(Y_LOG_LEVEL_DEBUG, "Device type %s concurrency: %s", cur_device.name, module_concurrency_to_string(cur_device.concurrency));
         
-        dlerror();
-        cur_device.dl_handle = file_handle;
-        *(void **) (&cur_device.b_device_type_init) = dlsym(cur_device.dl_handle, "b_device_type_init");
-        *(void **) (&cur_device.b_device_connect) = dlsym(cur_device.dl_handle, "b_device_connect");
-        *(void **) (&cur_device.b_device_disconnect) = dlsym(cur_device.dl_handle, "b_device_disconnect");
-        *(void **) (&cur_device.b_device_ping) = dlsym(cur_device.dl_handle, "b_device_ping");
-        *(void **) (&cur_device.b_device_overview) = dlsym(cur_device.dl_handle, "b_device_overview");
-        *(void **) (&cur_device.b_device_get_sensor) = dlsym(cur_device.dl_handle, "b_device_get_sensor");
-        *(void **) (&cur_device.b_device_get_switch) = dlsym(cur_device.dl_handle, "b_device_get_switch");
-        *(void **) (&cur_device.b_device_set_switch) = dlsym(cur_device.dl_handle, "b_device_set_switch");
-        *(void **) (&cur_device.b_device_get_dimmer) = dlsym(cur_device.dl_handle, "b_device_get_dimmer");
-        *(void **) (&cur_device.b_device_set_dimmer) = dlsym(cur_device.dl_handle, "b_device_set_dimmer");
-        *(void **) (&cur_device.b_device_get_heater) = dlsym(cur_device.dl_handle, "b_device_get_heater");
-        *(void **) (&cur_device.b_device_set_heater) = dlsym(cur_device.dl_handle, "b_device_set_heater");
-        *(void **) (&cur_device.b_device_has_element) = dlsym(cur_device.dl_handle, "b_device_has_element");
+        config->device_type_list[nb_device_types].uid = NULL;
+        config->device_type_list[nb_device_types].name = NULL;
+        config->device_type_list[nb_device_types].description = NULL;
+        config->device_type_list[nb_device_types].dl_handle = NULL;
+        config->device_type_list[nb_device_types].module_lock = NULL;
+        config->device_type_list[nb_device_types].gate = NULL;
         
-        if ((cur_device.b_device_type_init != NULL) && (cur_device.b_device_connect != NULL) && (cur_device.b_device_disconnect != NULL) && (cur_device.b_device_ping != NULL) && (cur_device.b_device_overview != NULL) &&
-            (cur_device.b_device_get_sensor != NULL) && (cur_device.b_device_get_switch != NULL) && (cur_device.b_device_set_switch != NULL) &&
-            (cur_device.b_device_get_dimmer != NULL) && (cur_device.b_device_set_dimmer != NULL) && (cur_device.b_device_get_heater != NULL) && 
-            (cur_device.b_device_set_heater != NULL) && (cur_device.b_device_has_element != NULL)) {
-          device_handshake = (*cur_device.b_device_type_init)();
-          cur_device.uid = o_strdup(json_string_value(json_object_get(device_handshake, "uid")));
-          cur_device.name = o_strdup(json_string_value(json_object_get(device_handshake, "name")));
-          cur_device.description = o_strdup(json_string_value(json_object_get(device_handshake, "description")));
-          cur_device.options = json_copy(json_object_get(device_handshake, "options"));
-          json_decref(device_handshake);
-          device_handshake = NULL;
-          
-          if (cur_device.uid != NULL && cur_device.name != NULL && cur_device.description != NULL) {
-            nb_device_types++;
-            config->device_type_list = o_realloc(config->device_type_list, (nb_device_types+1)*sizeof(struct _device_type));
-            if (config->device_type_list == NULL) {
-              y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error allocating resources for device_type_list");
-              close_device_type_list(config->device_type_list);
-              o_free(config->device_type_list);
-              config->device_type_list = NULL;
-              return B_ERROR_MEMORY;
-            }
-            config->device_type_list[nb_device_types - 1].uid = cur_device.uid;
-            config->device_type_list[nb_device_types - 1].name = cur_device.name;
-            config->device_type_list[nb_device_types - 1].description = cur_device.description;
-            config->device_type_list[nb_device_types - 1].options = cur_device.options;
-            
-            config->device_type_list[nb_device_types - 1].dl_handle = cur_device.dl_handle;
-            config->device_type_list[nb_device_types - 1].b_device_type_init = cur_device.b_device_type_init;
-            config->device_type_list[nb_device_types - 1].b_device_connect = cur_device.b_device_connect;
-            config->device_type_list[nb_device_types - 1].b_device_disconnect = cur_device.b_device_disconnect;
-            config->device_type_list[nb_device_types - 1].b_device_ping = cur_device.b_device_ping;
-            config->device_type_list[nb_device_types - 1].b_device_overview = cur_device.b_device_overview;
-            config->device_type_list[nb_device_types - 1].b_device_get_sensor = cur_device.b_device_get_sensor;
-            config->device_type_list[nb_device_types - 1].b_device_get_switch = cur_device.b_device_get_switch;
-            config->device_type_list[nb_device_types - 1].b_device_set_switch = cur_device.b_device_set_switch;
-            config->device_type_list[nb_device_types - 1].b_device_get_dimmer = cur_device.b_device_get_dimmer;
-            config->device_type_list[nb_device_types - 1].b_device_set_dimmer = cur_device.b_device_set_dimmer;
-            config->device_type_list[nb_device_types - 1].b_device_get_heater = cur_device.b_device_get_heater;
-            config->device_type_list[nb_device_types - 1].b_device_set_heater = cur_device.b_device_set_heater;
-            config->device_type_list[nb_device_types - 1].b_device_has_element = cur_device.b_device_has_element;
-
-            config->device_type_list[nb_device_types].uid = NULL;
-            config->device_type_list[nb_device_types].name = NULL;
-            config->device_type_list[nb_device_types].description = NULL;
-            config->device_type_list[nb_device_types].dl_handle = NULL;
-            
-            // Insert or update device type in database
-            j_query = json_object();
-            if (j_query == NULL) {
-              y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error allocating resources for j_query");
-              return B_ERROR_DB;
-            }
-            json_object_set_new(j_query, "table", json_string(BENOIC_TABLE_DEVICE_TYPE));
-            json_object_set_new(j_query, "where", json_pack("{ss}", "bdt_uid", cur_device.uid));
-            res = h_select(config->conn, j_query, &j_result, NULL);
-            json_decref(j_query);
-            if (res != H_OK) {
-              y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error getting type");
-            } else {
-              j_query = json_object();
-              char * s_options = json_dumps(cur_device.options, JSON_COMPACT);
-              if (j_query == NULL) {
-                y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error allocating resources for j_query");
-                return B_ERROR_MEMORY;
-              }
-              json_object_set_new(j_query, "table", json_string(BENOIC_TABLE_DEVICE_TYPE));
-              if (json_array_size(j_result) == 0) {
-                // Insert new device_type
-                json_object_set_new(j_query, "values", json_pack("{sssssssiss}", 
-                                                        "bdt_uid", cur_device.uid, 
-                                                        "bdt_name", cur_device.name, 
-                                                        "bdt_description", cur_device.description, 
-                                                        "bdt_enabled", 1, 
-                                                        "bdt_options", s_options
-                                                      ));
-                res = h_insert(config->conn, j_query, NULL);
-              } else {
-                // Update existing device type
-                json_object_set_new(j_query, "set", json_pack("{sssssiss}", 
-                                                              "bdt_name", cur_device.name, 
-                                                              "bdt_description", cur_device.description, 
-                                                              "bdt_enabled", 1, 
-                                                              "bdt_options", s_options
-                                                            ));
-                json_object_set_new(j_query, "where", json_pack("{ss}", "bdt_uid", cur_device.uid));
-                res = h_update(config->conn, j_query, NULL);
-              }
-              free(s_options);
-              json_decref(j_query);
-              json_decref(j_result);
-              if (res != H_OK) {
-                y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error setting device types in database");
-              }
-            }
-          } else {
-            close_device_type(cur_device);
-            y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error handshake for module %s", file_path);
-          }
-        } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error getting all function handles for module %s: b_device_type_init %p, b_device_connect %p, b_device_disconnect %p, b_device_ping %p, b_device_overview %p, b_device_get_sensor_value %p, b_device_get_switch_value %p, b_device_set_switch_value %p, b_device_get_dimmer_value %p, b_device_set_dimmer_value %p, b_device_get_heater_value %p, b_device_set_heater_value %p, b_device_has_element %p", file_path,
-          cur_device.b_device_type_init, cur_device.b_device_connect, cur_device.b_device_disconnect, cur_device.b_device_ping, cur_device.b_device_overview, cur_device.b_device_get_sensor,
-          cur_device.b_device_get_switch, cur_device.b_device_set_switch, cur_device.b_device_get_dimmer, cur_device.b_device_set_dimmer,
-          cur_device.b_device_get_heater, cur_device.b_device_set_heater, cur_device.b_device_has_element);
+        // Insert or update device type in database
+        if (save_device_type(config, &cur_device) != B_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error setting device types in database");
         }
-      } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "Error opening benoic module file %s, reason: %s", file_path, dlerror());
       }
       o_free(file_path);
     }
@@ -257,6 +177,7 @@ int init_device_type_list(struct _benoic_config * config) {
     if (nb_device_types == 0) {
       y_log_message(Y_LOG_LEVEL_WARNING, "No device type found for benoic subsystem. If not needed, you can disable it");
     }
+    bump_registry_generation(config);
     return B_OK;
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error input parameters");
@@ -264,28 +185,452 @@ int init_device_type_list(struct _benoic_config * config) {
   }
 }
 
-int connect_enabled_devices(struct _benoic_config * config) {
-  // Connect all devices that are marked connected in the database
-  json_t * device_list = get_device(config, NULL), * device;
+/**
+ * Open the module library file_path and fill device_type with its functions and its handshake
+ * return B_OK on success, device_type must then be closed with close_device_type
+ */
+int open_device_type(struct _benoic_config * config, const char * file_path, struct _device_type * device_type) {
+  json_t * device_handshake;
+  
+  device_type->uid = NULL;
+  device_type->name = NULL;
+  device_type->description = NULL;
+  device_type->options = NULL;
+  device_type->limits = NULL;
+  device_type->file_path = NULL;
+  device_type->module_lock = NULL;
+  device_type->gate = NULL;
+  device_type->dl_handle = dlopen(file_path, RTLD_LAZY);
+  if (device_type->dl_handle == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Error opening benoic module file %s, reason: %s", file_path, dlerror());
+    return B_ERROR_IO;
+  }
+  
+  y_log_message(Y_LOG_LEVEL_INFO, "Open module from file %s", file_path);
+  if (load_device_module(device_type, file_path) != B_OK) {
+    dlclose(device_type->dl_handle);
+    device_type->dl_handle = NULL;
+    return B_ERROR_PARAM;
+  }
+  
+  device_handshake = (*device_type->b_device_type_init)();
+  device_type->uid = o_strdup(json_string_value(json_object_get(device_handshake, "uid")));
+  device_type->name = o_strdup(json_string_value(json_object_get(device_handshake, "name")));
+  device_type->description = o_strdup(json_string_value(json_object_get(device_handshake, "description")));
+  device_type->options = json_copy(json_object_get(device_handshake, "options"));
+  // Limits declared by the module, overwritten by the limits of the configuration
+  device_type->limits = json_is_object(json_object_get(device_handshake, "limits"))?json_deep_copy(json_object_get(device_handshake, "limits")):json_object();
+  if (device_type->uid != NULL && device_type->limits != NULL && json_is_object(json_object_get(config->device_type_limits, device_type->uid))) {
+    json_object_update(device_type->limits, json_object_get(config->device_type_limits, device_type->uid));
+  }
+  // Modules not declaring their concurrency contract are not called from many threads at once
+  device_type->concurrency = module_concurrency_from_string(json_string_value(json_object_get(device_handshake, "concurrency")));
+  json_decref(device_handshake);
+  
+  device_type->file_path = o_strdup(file_path);
+  device_type->module_lock = o_malloc(sizeof(pthread_mutex_t));
+  device_type->gate = o_malloc(sizeof(struct _benoic_module_gate));
+  if (device_type->module_lock == NULL || device_type->gate == NULL || module_gate_init(device_type->gate) != B_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "open_device_type - Error allocating resources for module %s", file_path);
+    o_free(device_type->module_lock);
+    o_free(device_type->gate);
+    device_type->module_lock = NULL;
+    device_type->gate = NULL;
+    close_device_type(*device_type);
+    return B_ERROR_MEMORY;
+  }
+  pthread_mutex_init(device_type->module_lock, NULL);
+  
+  if (device_type->uid == NULL || device_type->name == NULL || device_type->description == NULL || device_type->file_path == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "open_device_type - Error handshake for module %s", file_path);
+    close_device_type(*device_type);
+    return B_ERROR_PARAM;
+  }
+  
+  // Give the module a way to push element value changes if it can
+  if (device_type->b_device_type_set_value_callback != NULL) {
+    (*device_type->b_device_type_set_value_callback)(&device_value_changed, (void *)config);
+  }
+  
+  // Same for the alerts sent by the devices
+  if (device_type->b_device_type_set_alert_callback != NULL) {
+    (*device_type->b_device_type_set_alert_callback)(&device_alert, (void *)config);
+  }
+  return B_OK;
+}
+
+/**
+ * Insert or update the device type in the database and mark it enabled
+ * return B_OK on success
+ */
+int save_device_type(struct _benoic_config * config, struct _device_type * device_type) {
+  json_t * j_query, * j_result;
+  char * s_options;
+  int res;
+  
+  j_query = json_object();
+  if (j_query == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "save_device_type - Error allocating resources for j_query");
+    return B_ERROR_MEMORY;
+  }
+  json_object_set_new(j_query, "table", json_string(BENOIC_TABLE_DEVICE_TYPE));
+  json_object_set_new(j_query, "where", json_pack("{ss}", "bdt_uid", device_type->uid));
+  res = h_select(config->conn, j_query, &j_result, NULL);
+  json_decref(j_query);
+  if (res != H_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "save_device_type - Error getting type");
+    return B_ERROR_DB;
+  }
+  
+  j_query = json_object();
+  s_options = json_dumps(device_type->options, JSON_COMPACT);
+  if (j_query == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "save_device_type - Error allocating resources for j_query");
+    free(s_options);
+    json_decref(j_result);
+    return B_ERROR_MEMORY;
+  }
+  json_object_set_new(j_query, "table", json_string(BENOIC_TABLE_DEVICE_TYPE));
+  if (json_array_size(j_result) == 0) {
+    // Insert new device_type
+    json_object_set_new(j_query, "values", json_pack("{sssssssiss}", 
+                                            "bdt_uid", device_type->uid, 
+                                            "bdt_name", device_type->name, 
+                                            "bdt_description", device_type->description, 
+                                            "bdt_enabled", 1, 
+                                            "bdt_options", s_options
+                                          ));
+    res = h_insert(config->conn, j_query, NULL);
+  } else {
+    // Update existing device type
+    json_object_set_new(j_query, "set", json_pack("{sssssiss}", 
+                                                  "bdt_name", device_type->name, 
+                                                  "bdt_description", device_type->description, 
+                                                  "bdt_enabled", 1, 
+                                                  "bdt_options", s_options
+                                                ));
+    json_object_set_new(j_query, "where", json_pack("{ss}", "bdt_uid", device_type->uid));
+    res = h_update(config->conn, j_query, NULL);
+  }
+  free(s_options);
+  json_decref(j_query);
+  json_decref(j_result);
+  return (res == H_OK)?B_OK:B_ERROR_DB;
+}
+
+/**
+ * Reload the module of the device type uid, the other device types keep running
+ * The calls in progress to the module are drained first, the new calls wait for the reload to end.
+ * The connected devices of the type are disconnected, the library is opened again,
+ * then the devices are connected again with the new module
+ * return B_OK on success, B_ERROR_NOT_FOUND if the type doesn't exist, B_ERROR_BUSY if it's already being reloaded,
+ * B_ERROR_TIMEOUT if the calls in progress didn't end in time, B_ERROR_IO if the new module can't be opened,
+ * the type is then unavailable until a successful reload
+ */
+int reload_device_type(struct _benoic_config * config, const char * uid) {
+  struct _device_type * device_type = NULL, new_type;
+  json_t * device_list, * device, * connected_list, * old_options, * old_limits;
   size_t index;
+  int i, res;
   
-  if (device_list != NULL) {
-    json_array_foreach(device_list, index, device) {
-      if (json_object_get(device, "connected") == json_true()) {
-        int res = connect_device(config, device);
-        if (res == B_OK) {
-          y_log_message(Y_LOG_LEVEL_INFO, "Device %s connected", json_string_value(json_object_get(device, "name")));
-        } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "Error connecting device %s, reason: %d", json_string_value(json_object_get(device, "name")), res);
-        }
+  for (i=0; config->device_type_list != NULL && config->device_type_list[i].uid != NULL; i++) {
+    if (0 == o_strcmp(config->device_type_list[i].uid, uid)) {
+      device_type = config->device_type_list + i;
+      break;
+    }
+  }
+  if (device_type == NULL) {
+    return B_ERROR_NOT_FOUND;
+  }
+  
+  res = module_gate_close(device_type, BENOIC_MODULE_RELOAD_DRAIN_TIMEOUT);
+  if (res != B_OK) {
+    return res;
+  }
+  y_log_message(Y_LOG_LEVEL_INFO, "Reload module of device type %s", uid);
+  
+  // Disconnect the devices of the type, but keep them marked connected in the database
+  connected_list = json_array();
+  device_list = get_device(config, NULL);
+  json_array_foreach(device_list, index, device) {
+    if (0 == o_strcmp(json_string_value(json_object_get(device, "type_uid")), uid) && json_object_get(device, "connected") == json_true()) {
+      if (device_type->dl_handle != NULL) {
+        disconnect_device(config, device, 0);
       }
+      json_array_append_new(connected_list, json_copy(json_object_get(device, "name")));
+    }
+  }
+  json_decref(device_list);
+  
+  // The old library must be closed first, dlopen would return it again otherwise
+  pthread_mutex_lock(&device_type->gate->lock);
+  if (device_type->dl_handle != NULL) {
+    dlclose(device_type->dl_handle);
+    device_type->dl_handle = NULL;
+  }
+  if (open_device_type(config, device_type->file_path, &new_type) == B_OK) {
+    if (0 == o_strcmp(new_type.uid, uid)) {
+      // The type keeps its uid, its file path and its locks, the rest comes from the new module
+      old_options = device_type->options;
+      old_limits = device_type->limits;
+      o_free(device_type->name);
+      o_free(device_type->description);
+      device_type->name = new_type.name;
+      device_type->description = new_type.description;
+      device_type->options = new_type.options;
+      device_type->limits = new_type.limits;
+      device_type->dl_handle = new_type.dl_handle;
+      device_type->abi_version = new_type.abi_version;
+      device_type->module = new_type.module;
+      device_type->concurrency = new_type.concurrency;
+      device_type->b_device_type_init = new_type.b_device_type_init;
+      device_type->b_device_connect = new_type.b_device_connect;
+      device_type->b_device_disconnect = new_type.b_device_disconnect;
+      device_type->b_device_ping = new_type.b_device_ping;
+      device_type->b_device_overview = new_type.b_device_overview;
+      device_type->b_device_get_sensor = new_type.b_device_get_sensor;
+      device_type->b_device_get_switch = new_type.b_device_get_switch;
+      device_type->b_device_set_switch = new_type.b_device_set_switch;
+      device_type->b_device_get_dimmer = new_type.b_device_get_dimmer;
+      device_type->b_device_set_dimmer = new_type.b_device_set_dimmer;
+      device_type->b_device_get_heater = new_type.b_device_get_heater;
+      device_type->b_device_set_heater = new_type.b_device_set_heater;
+      device_type->b_device_has_element = new_type.b_device_has_element;
+      device_type->b_device_type_set_value_callback = new_type.b_device_type_set_value_callback;
+      device_type->b_device_type_set_alert_callback = new_type.b_device_type_set_alert_callback;
+      new_type.name = NULL;
+      new_type.description = NULL;
+      new_type.options = old_options;
+      new_type.limits = old_limits;
+      new_type.dl_handle = NULL;
+      res = B_OK;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "reload_device_type - Module %s has now the uid %s instead of %s", device_type->file_path, new_type.uid, uid);
+      res = B_ERROR_PARAM;
+    }
+    close_device_type(new_type);
+  } else {
+    res = B_ERROR_IO;
+  }
+  pthread_mutex_unlock(&device_type->gate->lock);
+  
+  if (res == B_OK) {
+    if (save_device_type(config, device_type) != B_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "reload_device_type - Error setting device type %s in database", uid);
+    }
+    // Connect the devices again with the new module
+    json_array_foreach(connected_list, index, device) {
+      device_list = get_device(config, json_string_value(device));
+      if (device_list != NULL && !is_device_lazy(device_list) && connect_device(config, device_list, 1, 0) != B_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "reload_device_type - Error connecting device %s", json_string_value(device));
+      }
+      json_decref(device_list);
     }
-    json_decref(device_list);
-    return B_OK;
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "init_device_type_list - Error getting device list");
+    y_log_message(Y_LOG_LEVEL_ERROR, "reload_device_type - Error reloading module of device type %s, the type is unavailable", uid);
+  }
+  json_decref(connected_list);
+  module_gate_open(device_type);
+  bump_registry_generation(config);
+  return res;
+}
+
+/**
+ * Connect the devices of the pool until there is none left
+ * A device connected after the deadline of the pool was marked down by connect_enabled_devices,
+ * its health is then updated with the result of the connection
+ */
+void * thread_connect_pool_run(void * args) {
+  struct _benoic_connect_pool * pool = (struct _benoic_connect_pool *)args;
+  json_t * device;
+  size_t index;
+  int res, late;
+  
+  while (1) {
+    pthread_mutex_lock(&pool->lock);
+    index = pool->next;
+    device = json_array_get(pool->device_list, index);
+    pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    if (device == NULL) {
+      break;
+    }
+    res = connect_device(pool->config, device, 1, pool->timeout);
+    if (res == B_OK) {
+      y_log_message(Y_LOG_LEVEL_INFO, "Device %s connected", json_string_value(json_object_get(device, "name")));
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Error connecting device %s, reason: %d", json_string_value(json_object_get(device, "name")), res);
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->done_list[index] = 1;
+    late = pool->closed;
+    pthread_mutex_unlock(&pool->lock);
+    if (late) {
+      connect_pool_late_complete(pool->config, json_string_value(json_object_get(device, "name")), res);
+    }
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->nb_running--;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  connect_pool_release(pool);
+  return NULL;
+}
+
+/**
+ * Update the health of a device connected after the deadline of the pool, the supervisor takes it over
+ */
+void connect_pool_late_complete(struct _benoic_config * config, const char * device_name, const int result) {
+  struct _benoic_device_state * device_state;
+  
+  if (result == B_OK) {
+    y_log_message(Y_LOG_LEVEL_INFO, "Device %s connected after the connection deadline", device_name);
+    device_health_ok(config, device_name);
+  } else {
+    device_health_failure(config, device_name);
+  }
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, device_name);
+  if (device_state != NULL) {
+    device_state->reconnecting = 0;
+  }
+  pthread_mutex_unlock(&config->device_state_lock);
+}
+
+/**
+ * Release a reference to the pool, free it when it's not used anymore
+ */
+void connect_pool_release(struct _benoic_connect_pool * pool) {
+  int nb_holds;
+  
+  pthread_mutex_lock(&pool->lock);
+  nb_holds = --pool->nb_holds;
+  pthread_mutex_unlock(&pool->lock);
+  if (nb_holds == 0) {
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    json_decref(pool->device_list);
+    o_free(pool->done_list);
+    o_free(pool);
+  }
+}
+
+/**
+ * Connect all devices that are marked connected in the database
+ * The devices are connected concurrently by config->connect_concurrency threads,
+ * so an unreachable device doesn't delay the other ones
+ * If the connection timeout is set, the pool is given the time to connect each device with the timeout,
+ * the devices not connected in time are marked down and keep connecting in the background,
+ * so a module that doesn't respect the timeout doesn't delay the startup
+ */
+int connect_enabled_devices(struct _benoic_config * config) {
+  json_t * device_list = get_device(config, NULL), * device;
+  struct _benoic_connect_pool * pool;
+  struct _benoic_device_state * device_state;
+  struct timespec deadline;
+  pthread_t thread;
+  size_t index, nb_devices, nb_threads, nb_started = 0;
+  int res = 0;
+  
+  if (device_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "connect_enabled_devices - Error getting device list");
     return B_ERROR_DB;
   }
+  
+  pool = o_malloc(sizeof(struct _benoic_connect_pool));
+  if (pool == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "connect_enabled_devices - Error allocating resources for pool");
+    json_decref(device_list);
+    return B_ERROR_MEMORY;
+  }
+  pool->config = config;
+  pool->device_list = json_array();
+  pool->next = 0;
+  pool->timeout = config->connect_timeout>0?config->connect_timeout:config->request_timeout;
+  pool->nb_running = 0;
+  pool->nb_holds = 1;
+  pool->closed = 0;
+  json_array_foreach(device_list, index, device) {
+    // Lazy devices are connected on their first request
+    if (json_object_get(device, "connected") == json_true() && !is_device_lazy(device)) {
+      json_array_append(pool->device_list, device);
+    }
+  }
+  json_decref(device_list);
+  nb_devices = json_array_size(pool->device_list);
+  pool->done_list = o_malloc((nb_devices + 1) * sizeof(int));
+  if (pool->done_list == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "connect_enabled_devices - Error allocating resources for done_list");
+    json_decref(pool->device_list);
+    o_free(pool);
+    return B_ERROR_MEMORY;
+  }
+  memset(pool->done_list, 0, (nb_devices + 1) * sizeof(int));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  
+  nb_threads = config->connect_concurrency>0?config->connect_concurrency:BENOIC_CONNECT_DEFAULT_CONCURRENCY;
+  if (nb_threads > nb_devices) {
+    nb_threads = nb_devices;
+  }
+  for (nb_started = 0; nb_started < nb_threads; nb_started++) {
+    pthread_mutex_lock(&pool->lock);
+    pool->nb_running++;
+    pool->nb_holds++;
+    pthread_mutex_unlock(&pool->lock);
+    if (pthread_create(&thread, NULL, thread_connect_pool_run, (void *)pool)) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "connect_enabled_devices - Error creating thread, %zu threads running", nb_started);
+      pthread_mutex_lock(&pool->lock);
+      pool->nb_running--;
+      pool->nb_holds--;
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    pthread_detach(thread);
+  }
+  
+  if (nb_started == 0) {
+    // Without any thread, the devices are connected sequentially
+    pthread_mutex_lock(&pool->lock);
+    pool->nb_running++;
+    pool->nb_holds++;
+    pthread_mutex_unlock(&pool->lock);
+    thread_connect_pool_run((void *)pool);
+  } else {
+    // Each thread connects its share of the devices, each one within the timeout
+    if (pool->timeout > 0) {
+      set_deadline(&deadline, pool->timeout * (long)((nb_devices + nb_started - 1) / nb_started));
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (pool->nb_running > 0 && res != ETIMEDOUT) {
+      if (pool->timeout > 0) {
+        res = pthread_cond_timedwait(&pool->cond, &pool->lock, &deadline);
+      } else {
+        pthread_cond_wait(&pool->cond, &pool->lock);
+      }
+    }
+    if (pool->nb_running > 0) {
+      // The devices not connected yet are marked down until their connection completes in the background,
+      // they're marked while the pool is locked, so a connection completing now is seen as late
+      pool->closed = 1;
+      for (index = 0; index < nb_devices; index++) {
+        if (!pool->done_list[index]) {
+          device = json_array_get(pool->device_list, index);
+          y_log_message(Y_LOG_LEVEL_WARNING, "connect_enabled_devices - Device %s not connected before the deadline, keep connecting in the background", json_string_value(json_object_get(device, "name")));
+          device_health_failure(config, json_string_value(json_object_get(device, "name")));
+          pthread_mutex_lock(&config->device_state_lock);
+          device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+          if (device_state != NULL) {
+            device_state->reconnecting = 1;
+          }
+          pthread_mutex_unlock(&config->device_state_lock);
+        }
+      }
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+  connect_pool_release(pool);
+  return B_OK;
 }
 
 /**
@@ -509,7 +854,7 @@ json_t * is_device_valid(struct _benoic_config * config, json_t * device, const
  * returned value must be free'd after use
  */
 json_t * is_device_option_list_valid(struct _benoic_config * config, json_t * device) {
-  json_t * result = json_array(), * j_option_valid;
+  json_t * result = json_array(), * j_option_valid, * j_limit_option_list, * j_type_options;
   int i, found = 0;
   
   if (result == NULL) {
@@ -527,12 +872,43 @@ json_t * is_device_option_list_valid(struct _benoic_config * config, json_t * de
     if (0 == o_strcmp(config->device_type_list[i].uid, json_string_value(json_object_get(device, "type_uid")))) {
       found = 1;
       
-      // Loop in all options and check each of them
-      j_option_valid = is_device_option_valid(config->device_type_list[i].options, json_object_get(device, "options"));
+      // Loop in all options and check each of them, the options of the type are replaced when its module is reloaded
+      pthread_mutex_lock(&config->device_type_list[i].gate->lock);
+      j_type_options = json_incref(config->device_type_list[i].options);
+      pthread_mutex_unlock(&config->device_type_list[i].gate->lock);
+      j_option_valid = is_device_option_valid(j_type_options, json_object_get(device, "options"));
+      json_decref(j_type_options);
       if (j_option_valid != NULL && json_array_size(j_option_valid) > 0) {
         json_array_extend(result, j_option_valid);
       }
       json_decref(j_option_valid);
+      
+      // Check the admission limits options, available for all device types
+      j_limit_option_list = get_device_limit_option_list();
+      j_option_valid = is_device_option_valid(j_limit_option_list, json_object_get(device, "options"));
+      if (j_option_valid != NULL && json_array_size(j_option_valid) > 0) {
+        json_array_extend(result, j_option_valid);
+      }
+      json_decref(j_option_valid);
+      json_decref(j_limit_option_list);
+      
+      // Same for the connection options
+      j_limit_option_list = get_device_link_option_list();
+      j_option_valid = is_device_option_valid(j_limit_option_list, json_object_get(device, "options"));
+      if (j_option_valid != NULL && json_array_size(j_option_valid) > 0) {
+        json_array_extend(result, j_option_valid);
+      }
+      json_decref(j_option_valid);
+      json_decref(j_limit_option_list);
+      
+      // Same for the circuit breaker options
+      j_limit_option_list = get_device_breaker_option_list();
+      j_option_valid = is_device_option_valid(j_limit_option_list, json_object_get(device, "options"));
+      if (j_option_valid != NULL && json_array_size(j_option_valid) > 0) {
+        json_array_extend(result, j_option_valid);
+      }
+      json_decref(j_option_valid);
+      json_decref(j_limit_option_list);
     }
   }
   
@@ -605,6 +981,7 @@ int add_device(struct _benoic_config * config, const json_t * device) {
     res = h_insert(config->conn, j_query, NULL);
     json_decref(j_query);
     if (res == H_OK) {
+      bump_registry_generation(config);
       return B_OK;
     } else {
       return B_ERROR_DB;
@@ -631,6 +1008,7 @@ int modify_device(struct _benoic_config * config, const json_t * device, const c
     res = h_update(config->conn, j_query, NULL);
     json_decref(j_query);
     if (res == H_OK) {
+      bump_registry_generation(config);
       return B_OK;
     } else {
       return B_ERROR_DB;
@@ -640,6 +1018,7 @@ int modify_device(struct _benoic_config * config, const json_t * device, const c
 
 /**
  * update the connected flag of the specified device
+ * The database is only written if the flag changes
  * return B_OK on success
  */
 int set_device_connection(struct _benoic_config * config, const json_t * device, const int connected) {
@@ -650,13 +1029,22 @@ int set_device_connection(struct _benoic_config * config, const json_t * device,
     y_log_message(Y_LOG_LEVEL_ERROR, "set_device_connection - Error allocating resources or input parameters");
     json_decref(j_query);
     return 0;
+  } else if ((json_object_get(device, "connected") == json_true()) == (connected != 0)) {
+    // The connection state doesn't change, the device data stay the same
+    json_decref(j_query);
+    return B_OK;
   } else {
     json_object_set_new(j_query, "table", json_string(BENOIC_TABLE_DEVICE));
     json_object_set_new(j_query, "set", json_pack("{so}", "bd_connected", connected?json_integer(1):json_integer(0)));
-    json_object_set_new(j_query, "where", json_pack("{ss}", "bd_name", json_object_get(device, "name")));
+    json_object_set_new(j_query, "where", json_pack("{ss}", "bd_name", json_string_value(json_object_get(device, "name"))));
     res = h_update(config->conn, j_query, NULL);
     json_decref(j_query);
-    return ((res == H_OK)?B_OK:B_ERROR_DB);
+    if (res == H_OK) {
+      bump_registry_generation(config);
+      return B_OK;
+    } else {
+      return B_ERROR_DB;
+    }
   }
 }
 
@@ -677,7 +1065,13 @@ int delete_device(struct _benoic_config * config, const char * name) {
     json_object_set_new(j_query, "where", json_pack("{ss}", "bd_name", name));
     res = h_delete(config->conn, j_query, NULL);
     json_decref(j_query);
-    return ((res == H_OK)?B_OK:B_ERROR_DB);
+    if (res == H_OK) {
+      remove_element_index(config, name);
+      bump_registry_generation(config);
+      return B_OK;
+    } else {
+      return B_ERROR_DB;
+    }
   }
 }
 
@@ -714,16 +1108,18 @@ struct _device_type * get_device_type(struct _benoic_config * config, json_t * d
 /**
  * Connect the device
  * Update the device options attribute if the module sends new data
+ * If update_db_status is false, a failed connection doesn't mark the device disconnected in the database
+ * timeout is the request timeout given to the module in milliseconds, 0 if there is none
  * return B_OK on success
  */
-int connect_device(struct _benoic_config * config, json_t * device) {
+int connect_device(struct _benoic_config * config, json_t * device, int update_db_status, const long timeout) {
   json_t * result, * result_options, * value, * j_db_device, * j_element_lists;
   struct _device_type * device_type = NULL;
   const char * key;
   char * device_name;
   int res;
   void * device_ptr = NULL;
-  int to_return = B_OK;
+  int to_return = B_OK, owned = 0, linked = 0;
   
   if (json_object_get(device, "enabled") != json_true()) {
     y_log_message(Y_LOG_LEVEL_ERROR, "Device disabled");
@@ -744,20 +1140,30 @@ int connect_device(struct _benoic_config * config, json_t * device) {
       json_object_set_new(json_object_get(device, "options"), "element", json_pack("{s[]s[]s[]s[]}", "switches", "dimmers", "sensors", "heaters"));
     }
     json_decref(j_element_lists);
+    if (timeout > 0) {
+      json_object_set_new(json_object_get(device, "options"), "request_timeout", json_integer(timeout));
+    }
     
-    result = device_type->b_device_connect(device, &device_ptr);
+    if (module_link_enter(config, device_type, device, &owned, NULL) == B_OK) {
+      result = device_type->b_device_connect(device, &device_ptr);
+      linked = (result != NULL && json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_OK);
+      // Update device_data array before the other calls for the device can run
+      if (linked && device_ptr != NULL) {
+        if (set_device_data(config, json_string_value(json_object_get(device, "name")), device_ptr) != B_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "Error setting device_data for device %s", json_string_value(json_object_get(device, "name")));
+        }
+      }
+      module_link_leave(config, device_type, device, owned, linked);
+    } else {
+      result = NULL;
+    }
     
-    // Remove element list
+    // Remove element list and request timeout, they are not stored
     json_object_del(json_object_get(device, "options"), "element");
+    json_object_del(json_object_get(device, "options"), "request_timeout");
     
     if (result != NULL && json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_OK) {
       y_log_message(Y_LOG_LEVEL_INFO, "Connect device %s: success", json_string_value(json_object_get(device, "name")));
-      // Update device_data array
-      if (device_ptr != NULL) {
-        if (set_device_data(config, json_string_value(json_object_get(device, "name")), device_ptr) != B_OK) {
-          y_log_message(Y_LOG_LEVEL_ERROR, "Error setting device_data for device %s", json_string_value(json_object_get(device, "name")));
-        }
-      }
       // update database with options sent back if exist
       result_options = json_object_get(result, "options");
       if (result_options != NULL) {
@@ -773,15 +1179,19 @@ int connect_device(struct _benoic_config * config, json_t * device) {
       o_free(device_name);
       json_decref(j_db_device);
       update_last_seen_device(config, device);
+      publish_device_connection(config, json_string_value(json_object_get(device, "name")), 1);
       to_return = res;
     } else if (result != NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "Error connecting device %s, result code is %" JSON_INTEGER_FORMAT, json_string_value(json_object_get(device, "name")), json_integer_value(json_object_get(result, "result")));
-      device_name = o_strdup(json_string_value(json_object_get(device, "name")));
-      j_db_device = parse_device_to_db(device, 1);
-      json_object_set_new(j_db_device, "bd_connected", json_integer(0));
-      modify_device(config, j_db_device, device_name);
-      o_free(device_name);
-      json_decref(j_db_device);
+      if (update_db_status) {
+        device_name = o_strdup(json_string_value(json_object_get(device, "name")));
+        j_db_device = parse_device_to_db(device, 1);
+        json_object_set_new(j_db_device, "bd_connected", json_integer(0));
+        modify_device(config, j_db_device, device_name);
+        publish_device_connection(config, device_name, 0);
+        o_free(device_name);
+        json_decref(j_db_device);
+      }
       to_return = B_ERROR_IO;
     } else {
       to_return = B_ERROR_IO;
@@ -807,7 +1217,7 @@ int disconnect_device(struct _benoic_config * config, json_t * device, int updat
   struct _device_type * device_type;
   const char * key;
   char * device_name;
-  int res;
+  int res, owned = 0, linked = 0;
   
   if (json_object_get(device, "enabled") != json_true() || json_object_get(device, "connected") != json_true()) {
     y_log_message(Y_LOG_LEVEL_ERROR, "Device disabled or disconnected");
@@ -817,11 +1227,22 @@ int disconnect_device(struct _benoic_config * config, json_t * device, int updat
   
   // Look for the device type
   if (device_type != NULL) {
-    result = device_type->b_device_disconnect(device, get_device_ptr(config, json_string_value(json_object_get(device, "name"))));
+    if (module_link_enter(config, device_type, device, &owned, &linked) != B_OK) {
+      return B_ERROR_IO;
+    }
+    if (is_device_lazy(device) && !linked) {
+      // A lazy device not connected yet has nothing to disconnect
+      result = json_pack("{si}", "result", DEVICE_RESULT_OK);
+    } else {
+      result = device_type->b_device_disconnect(device, get_device_ptr(config, json_string_value(json_object_get(device, "name"))));
+    }
     if (get_device_ptr(config, json_string_value(json_object_get(device, "name"))) != NULL && remove_device_data(config, json_string_value(json_object_get(device, "name"))) != B_OK) {
+      module_link_leave(config, device_type, device, owned, 0);
       y_log_message(Y_LOG_LEVEL_ERROR, "Error removing device_data for device %s", json_string_value(json_object_get(device, "name")));
+      json_decref(result);
       return B_ERROR_MEMORY;
     }
+    module_link_leave(config, device_type, device, owned, 0);
     if (result != NULL && json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_OK) {
       y_log_message(Y_LOG_LEVEL_INFO, "Disconnect device %s: success", json_string_value(json_object_get(device, "name")));
       // update database with options sent back if exist
@@ -838,6 +1259,9 @@ int disconnect_device(struct _benoic_config * config, json_t * device, int updat
         json_object_set_new(j_db_device, "bd_connected", json_integer(0));
       }
       res = modify_device(config, j_db_device, device_name);
+      if (update_db_status) {
+        publish_device_connection(config, device_name, 0);
+      }
       o_free(device_name);
       json_decref(result);
       json_decref(j_db_device);
@@ -845,13 +1269,15 @@ int disconnect_device(struct _benoic_config * config, json_t * device, int updat
       return res;
     } else if (result != NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "Error disconnect device %s, result code is %" JSON_INTEGER_FORMAT, json_string_value(json_object_get(device, "name")), json_integer_value(json_object_get(result, "result")));
-      json_decref(result);
       device_name = o_strdup(json_string_value(json_object_get(device, "name")));
       j_db_device = parse_device_to_db(device, 1);
       if (update_db_status) {
         json_object_set_new(j_db_device, "bd_connected", json_integer(0));
       }
       modify_device(config, j_db_device, device_name);
+      if (update_db_status) {
+        publish_device_connection(config, device_name, 0);
+      }
       o_free(device_name);
       json_decref(result);
       json_decref(j_db_device);
@@ -865,13 +1291,72 @@ int disconnect_device(struct _benoic_config * config, json_t * device, int updat
   }
 }
 
+/**
+ * Return the device to give to the module for a request with the specified timeout
+ * The timeout is set in the options of a copy of the device, so the modules can use it,
+ * the device itself is unchanged
+ * timeout is in milliseconds, if it's not positive the device is returned as is
+ * returned value must be free'd after use
+ */
+json_t * device_with_request_timeout(json_t * device, const long timeout) {
+  json_t * to_return;
+  
+  if (timeout > 0 && json_is_object(json_object_get(device, "options"))) {
+    to_return = json_copy(device);
+    if (to_return != NULL) {
+      json_object_set_new(to_return, "options", json_copy(json_object_get(device, "options")));
+      json_object_set_new(json_object_get(to_return, "options"), "request_timeout", json_integer(timeout));
+      return to_return;
+    }
+  }
+  return json_incref(device);
+}
+
+/**
+ * Return the request timeout of the device given to the module in milliseconds, 0 if there is none
+ */
+long get_device_request_timeout(json_t * device) {
+  return (long)json_integer_value(json_object_get(json_object_get(device, "options"), "request_timeout"));
+}
+
 /**
  * Ping the device
- * return B_OK on success
+ * Identical pings running at the same time share the same module call
+ * timeout is the request timeout in milliseconds, 0 if there is none
+ * return B_OK on success, B_ERROR_TIMEOUT if the request timeout expired,
+ * B_ERROR_UNAVAILABLE if the device wasn't pinged because its circuit is open
  */
-int ping_device(struct _benoic_config * config, json_t * device) {
+int ping_device(struct _benoic_config * config, json_t * device, const long timeout) {
+  json_t * result, * args = json_pack("{so}", "device", device_with_request_timeout(device, timeout));
+  char * key = msprintf("ping/%s", json_string_value(json_object_get(device, "name")));
+  int res, timed_out = 0;
+  
+  result = flight_run(config, key, &flight_call_ping_device, args, &timed_out);
+  if (timed_out) {
+    res = B_ERROR_TIMEOUT;
+  } else {
+    res = result!=NULL?json_integer_value(result):B_ERROR;
+  }
+  json_decref(result);
+  json_decref(args);
+  o_free(key);
+  return res;
+}
+
+/**
+ * Ping the device of args using the module
+ * return the result as a json integer
+ */
+json_t * flight_call_ping_device(struct _benoic_config * config, json_t * args) {
+  return json_integer(call_ping_device(config, json_object_get(args, "device")));
+}
+
+/**
+ * Ping the device using the module
+ * return B_OK on success, B_ERROR_UNAVAILABLE if the device wasn't pinged because its circuit is open
+ */
+int call_ping_device(struct _benoic_config * config, json_t * device) {
   struct _device_type * device_type = NULL;
-  json_t * result;
   int i_result;
   
   if (json_object_get(device, "enabled") != json_true()) {
@@ -882,21 +1367,16 @@ int ping_device(struct _benoic_config * config, json_t * device) {
   
   // Look for the device type
   if (device_type != NULL) {
-    result = device_type->b_device_ping(device, get_device_ptr(config, json_string_value(json_object_get(device, "name"))));
-    if (result != NULL) {
-      i_result = json_integer_value(json_object_get(result, "result"));
-      json_decref(result);
-      if (i_result == DEVICE_RESULT_OK) {
-        update_last_seen_device(config, device);
-        set_device_connection(config, device, 1);
-        return B_OK;
-      } else if (json_integer_value(json_object_get(result, "result")) == DEVICE_RESULT_NOT_FOUND) {
-        set_device_connection(config, device, 1);
-        return B_ERROR_NOT_FOUND;
-      } else {
-        set_device_connection(config, device, 1);
-        return B_ERROR_IO;
-      }
+    i_result = module_ping(config, device_type, device);
+    if (i_result == BENOIC_BREAKER_REJECTED) {
+      return B_ERROR_UNAVAILABLE;
+    } else if (i_result == DEVICE_RESULT_OK) {
+      update_last_seen_device(config, device);
+      set_device_connection(config, device, 1);
+      return B_OK;
+    } else if (i_result == DEVICE_RESULT_NOT_FOUND) {
+      set_device_connection(config, device, 1);
+      return B_ERROR_NOT_FOUND;
     } else {
       set_device_connection(config, device, 1);
       return B_ERROR_IO;
@@ -909,13 +1389,77 @@ int ping_device(struct _benoic_config * config, json_t * device) {
 
 /**
  * get the device overview: return all the device elements and their status
+ * Identical overviews running at the same time share the same module call
+ * timeout is the request timeout in milliseconds, 0 if there is none
+ * timed_out is optional, it's set to 1 if the request timeout expired
  * return a json_t * pointer contianing the result
  * returned value must be free'd after use
  */
-json_t * overview_device(struct _benoic_config * config, json_t * device) {
+json_t * overview_device(struct _benoic_config * config, json_t * device, const long timeout, int * timed_out) {
+  json_t * to_return, * args = json_pack("{so}", "device", device_with_request_timeout(device, timeout));
+  char * key = msprintf("overview/%s", json_string_value(json_object_get(device, "name")));
+  
+  to_return = flight_run_async(config, key, &flight_start_overview_device, &flight_call_overview_device, args, timed_out);
+  json_decref(args);
+  o_free(key);
+  return to_return;
+}
+
+/**
+ * get the overview of the device of args using the module
+ * returned value must be free'd after use
+ */
+json_t * flight_call_overview_device(struct _benoic_config * config, json_t * args) {
+  return call_overview_device(config, json_object_get(args, "device"));
+}
+
+/**
+ * Start getting the overview of the device of args with the asynchronous function of the module
+ * return B_OK if the overview is started, the result is then given to the flight by overview_device_complete
+ */
+int flight_start_overview_device(struct _benoic_config * config, json_t * args, struct _benoic_flight * flight) {
+  json_t * device = json_object_get(args, "device");
+  struct _device_type * device_type = get_device_type(config, device);
+  struct _benoic_async_call * async_call;
+  
+  // Only a module of the version 3 can have an overview_async, module_overview_async checks the rest
+  if (json_object_get(device, "enabled") != json_true() || device_type == NULL || device_type->abi_version < 3) {
+    return B_ERROR_PARAM;
+  }
+  async_call = async_call_new(config, device, BENOIC_ELEMENT_TYPE_NONE, NULL, NULL);
+  if (async_call == NULL) {
+    return B_ERROR_MEMORY;
+  }
+  async_call->flight = flight;
+  if (module_overview_async(config, device_type, device, &overview_device_complete, async_call) != DEVICE_RESULT_OK) {
+    async_call_free(async_call);
+    return B_ERROR_PARAM;
+  }
+  return B_OK;
+}
+
+/**
+ * Completion of an asynchronous overview, give the result to the callers waiting for it
+ */
+void overview_device_complete(void * cls, json_t * overview) {
+  struct _benoic_async_call * async_call = (struct _benoic_async_call *)cls;
+  json_t * to_return;
+  int res = (overview != NULL)?(int)json_integer_value(json_object_get(overview, "result")):DEVICE_RESULT_ERROR;
+  
+  to_return = overview_from_module(async_call->config, async_call->device, overview);
+  flight_complete(async_call->config, async_call->flight, to_return);
+  json_decref(to_return);
+  async_call_release(async_call, res);
+}
+
+/**
+ * get the device overview using the module
+ * return a json_t * pointer contianing the result
+ * returned value must be free'd after use
+ */
+json_t * call_overview_device(struct _benoic_config * config, json_t * device) {
   struct _device_type * device_type = NULL;
-  json_t * overview, * element, * element_array, * to_return, * value;
-  const char * key;
+  json_t * overview;
   
   if (json_object_get(device, "enabled") != json_true()) {
     y_log_message(Y_LOG_LEVEL_ERROR, "Device disabled");
@@ -925,157 +1469,291 @@ json_t * overview_device(struct _benoic_config * config, json_t * device) {
   
   // Look for the device type
   if (device_type != NULL) {
+    if (module_call_enter(config, device_type, device) != B_OK) {
+      return NULL;
+    }
     overview = device_type->b_device_overview(device, get_device_ptr(config, json_string_value(json_object_get(device, "name"))));
-    if (overview != NULL && json_integer_value(json_object_get(overview, "result")) == DEVICE_RESULT_OK) {
-      to_return = json_object();
-      if (to_return == NULL) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error allocating resources for to_return");
-        json_decref(overview);
-        return NULL;
-      }
-      update_last_seen_device(config, device);
-      // Parse elements
-      element_array = json_object_get(overview, "sensors");
-      if (element_array != NULL) {
-        json_object_set_new(to_return, "sensors", json_object());
-        if (json_is_object(element_array)) {
-          json_object_foreach(element_array, key, value) {
-            element = get_element_data(config, device, BENOIC_ELEMENT_TYPE_SENSOR, key, 1);
-            if (element != NULL) {
-              if (json_is_object(value)) {
-                if (json_object_get(value, "unit") != NULL) {
-                  const char * elt_unit = json_string_value(json_object_get(json_object_get(element, "options"), "unit"));
-                  if (elt_unit == NULL || strlen(elt_unit) == 0) {
-                    json_object_set_new(json_object_get(element, "options"), "unit", json_copy(json_object_get(value, "unit")));
-                  }
-                }
-                if (json_object_get(value, "trigger") != NULL) {
-                  json_object_set_new(json_object_get(element, "options"), "trigger", json_copy(json_object_get(value, "trigger")));
+    module_call_leave(config, device_type, device, (overview != NULL)?(int)json_integer_value(json_object_get(overview, "result")):DEVICE_RESULT_ERROR);
+    return overview_from_module(config, device, overview);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - No type found for this device");
+    return NULL;
+  }
+}
+
+/**
+ * Build the device overview with the overview returned by the module
+ * overview is free'd by the function
+ * return a json_t * pointer contianing the result
+ * returned value must be free'd after use
+ */
+json_t * overview_from_module(struct _benoic_config * config, json_t * device, json_t * overview) {
+  json_t * element, * element_array, * to_return, * value;
+  const char * key;
+  
+  if (overview != NULL && json_integer_value(json_object_get(overview, "result")) == DEVICE_RESULT_OK) {
+    to_return = json_object();
+    if (to_return == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error allocating resources for to_return");
+      json_decref(overview);
+      return NULL;
+    }
+    update_last_seen_device(config, device);
+    // Parse elements
+    element_array = json_object_get(overview, "sensors");
+    if (element_array != NULL) {
+      json_object_set_new(to_return, "sensors", json_object());
+      if (json_is_object(element_array)) {
+        json_object_foreach(element_array, key, value) {
+          element = get_element_data(config, device, BENOIC_ELEMENT_TYPE_SENSOR, key, 1);
+          if (element != NULL) {
+            if (json_is_object(value)) {
+              if (json_object_get(value, "unit") != NULL) {
+                const char * elt_unit = json_string_value(json_object_get(json_object_get(element, "options"), "unit"));
+                if (elt_unit == NULL || strlen(elt_unit) == 0) {
+                  json_object_set_new(json_object_get(element, "options"), "unit", json_copy(json_object_get(value, "unit")));
                 }
-                json_object_set_new(element, "value", json_copy(json_object_get(value, "value")));
-              } else {
-                json_object_set_new(element, "value", json_copy(value));
               }
-              json_object_set_new(json_object_get(to_return, "sensors"), key, element);
-            } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error getting sensor %s from device %s", key, json_string_value(json_object_get(device, "name")));
-            }
-          }
-        } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error overview sensors");
-        }
-      }
-      
-      element_array = json_object_get(overview, "switches");
-      if (element_array != NULL) {
-        json_object_set_new(to_return, "switches", json_object());
-        if (json_is_object(element_array)) {
-          json_object_foreach(element_array, key, value) {
-            element = get_element_data(config, device, BENOIC_ELEMENT_TYPE_SWITCH, key, 1);
-            if (element != NULL) {
-              if (json_is_object(value)) {
-                if (json_object_get(value, "unit") != NULL) {
-                  const char * elt_unit = json_string_value(json_object_get(json_object_get(element, "options"), "unit"));
-                  if (elt_unit == NULL || strlen(elt_unit) == 0) {
-                    json_object_set_new(json_object_get(element, "options"), "unit", json_copy(json_object_get(value, "unit")));
-                  }
-                }
-                json_object_set_new(element, "value", json_copy(json_object_get(value, "value")));
-              } else {
-                json_object_set_new(element, "value", json_copy(value));
+              if (json_object_get(value, "trigger") != NULL) {
+                json_object_set_new(json_object_get(element, "options"), "trigger", json_copy(json_object_get(value, "trigger")));
               }
-              json_object_set_new(json_object_get(to_return, "switches"), key, element);
+              json_object_set_new(element, "value", json_copy(json_object_get(value, "value")));
             } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error getting switch %s from device %s", key, json_string_value(json_object_get(device, "name")));
+              json_object_set_new(element, "value", json_copy(value));
             }
+            json_object_set_new(json_object_get(to_return, "sensors"), key, element);
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error getting sensor %s from device %s", key, json_string_value(json_object_get(device, "name")));
           }
-        } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error overview switches");
         }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error overview sensors");
       }
-      
-      element_array = json_object_get(overview, "dimmers");
-      if (element_array != NULL) {
-        json_object_set_new(to_return, "dimmers", json_object());
-        if (json_is_object(element_array)) {
-          json_object_foreach(element_array, key, value) {
-            element = get_element_data(config, device, BENOIC_ELEMENT_TYPE_DIMMER, key, 1);
-            if (element != NULL) {
-              if (json_is_object(value)) {
-                if (json_object_get(value, "unit") != NULL) {
-                  const char * elt_unit = json_string_value(json_object_get(json_object_get(element, "options"), "unit"));
-                  if (elt_unit == NULL || strlen(elt_unit) == 0) {
-                    json_object_set_new(json_object_get(element, "options"), "unit", json_copy(json_object_get(value, "unit")));
-                  }
+    }
+    
+    element_array = json_object_get(overview, "switches");
+    if (element_array != NULL) {
+      json_object_set_new(to_return, "switches", json_object());
+      if (json_is_object(element_array)) {
+        json_object_foreach(element_array, key, value) {
+          element = get_element_data(config, device, BENOIC_ELEMENT_TYPE_SWITCH, key, 1);
+          if (element != NULL) {
+            if (json_is_object(value)) {
+              if (json_object_get(value, "unit") != NULL) {
+                const char * elt_unit = json_string_value(json_object_get(json_object_get(element, "options"), "unit"));
+                if (elt_unit == NULL || strlen(elt_unit) == 0) {
+                  json_object_set_new(json_object_get(element, "options"), "unit", json_copy(json_object_get(value, "unit")));
                 }
-                json_object_set_new(element, "value", json_copy(json_object_get(value, "value")));
-              } else {
-                json_object_set_new(element, "value", json_copy(value));
               }
-              json_object_set_new(json_object_get(to_return, "dimmers"), key, element);
+              json_object_set_new(element, "value", json_copy(json_object_get(value, "value")));
             } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error getting dimmer %s from device %s", key, json_string_value(json_object_get(device, "name")));
+              json_object_set_new(element, "value", json_copy(value));
             }
+            json_object_set_new(json_object_get(to_return, "switches"), key, element);
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error getting switch %s from device %s", key, json_string_value(json_object_get(device, "name")));
           }
-        } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error overview dimmers");
         }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error overview switches");
       }
-      
-      element_array = json_object_get(overview, "heaters");
-      if (element_array != NULL) {
-        json_object_set_new(to_return, "heaters", json_object());
-        if (json_is_object(element_array)) {
-          json_object_foreach(element_array, key, value) {
-            element = get_element_data(config, device, BENOIC_ELEMENT_TYPE_HEATER, key, 1);
-            if (element != NULL) {
+    }
+    
+    element_array = json_object_get(overview, "dimmers");
+    if (element_array != NULL) {
+      json_object_set_new(to_return, "dimmers", json_object());
+      if (json_is_object(element_array)) {
+        json_object_foreach(element_array, key, value) {
+          element = get_element_data(config, device, BENOIC_ELEMENT_TYPE_DIMMER, key, 1);
+          if (element != NULL) {
+            if (json_is_object(value)) {
               if (json_object_get(value, "unit") != NULL) {
                 const char * elt_unit = json_string_value(json_object_get(json_object_get(element, "options"), "unit"));
                 if (elt_unit == NULL || strlen(elt_unit) == 0) {
                   json_object_set_new(json_object_get(element, "options"), "unit", json_copy(json_object_get(value, "unit")));
                 }
-                json_object_del(value, "unit");
               }
-              json_object_set_new(element, "value", json_copy(value));
-              json_object_set_new(json_object_get(to_return, "heaters"), key, element);
+              json_object_set_new(element, "value", json_copy(json_object_get(value, "value")));
             } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error getting heater %s from device %s", key, json_string_value(json_object_get(device, "name")));
+              json_object_set_new(element, "value", json_copy(value));
             }
+            json_object_set_new(json_object_get(to_return, "dimmers"), key, element);
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error getting dimmer %s from device %s", key, json_string_value(json_object_get(device, "name")));
           }
-        } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error overview heaters");
         }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error overview dimmers");
+      }
+    }
+    
+    element_array = json_object_get(overview, "heaters");
+    if (element_array != NULL) {
+      json_object_set_new(to_return, "heaters", json_object());
+      if (json_is_object(element_array)) {
+        json_object_foreach(element_array, key, value) {
+          element = get_element_data(config, device, BENOIC_ELEMENT_TYPE_HEATER, key, 1);
+          if (element != NULL) {
+            if (json_object_get(value, "unit") != NULL) {
+              const char * elt_unit = json_string_value(json_object_get(json_object_get(element, "options"), "unit"));
+              if (elt_unit == NULL || strlen(elt_unit) == 0) {
+                json_object_set_new(json_object_get(element, "options"), "unit", json_copy(json_object_get(value, "unit")));
+              }
+              json_object_del(value, "unit");
+            }
+            json_object_set_new(element, "value", json_copy(value));
+            json_object_set_new(json_object_get(to_return, "heaters"), key, element);
+          } else {
+            y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error getting heater %s from device %s", key, json_string_value(json_object_get(device, "name")));
+          }
+        }
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error overview heaters");
       }
-      json_decref(overview);
-      return to_return;
-    } else {
-      json_decref(overview);
-      y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error getting overview");
-      return NULL;
     }
+    
+    // Update the value cache of all the elements
+    overview_update_value_cache(config, device, json_object_get(to_return, "sensors"), BENOIC_ELEMENT_TYPE_SENSOR);
+    overview_update_value_cache(config, device, json_object_get(to_return, "switches"), BENOIC_ELEMENT_TYPE_SWITCH);
+    overview_update_value_cache(config, device, json_object_get(to_return, "dimmers"), BENOIC_ELEMENT_TYPE_DIMMER);
+    overview_update_value_cache(config, device, json_object_get(to_return, "heaters"), BENOIC_ELEMENT_TYPE_HEATER);
+    json_decref(overview);
+    return to_return;
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - No type found for this device");
+    json_decref(overview);
+    y_log_message(Y_LOG_LEVEL_ERROR, "overview_device - Error getting overview");
     return NULL;
   }
 }
 
+/**
+ * Update the value cache with the values of an overview elements list
+ */
+void overview_update_value_cache(struct _benoic_config * config, json_t * device, json_t * element_list, const int element_type) {
+  json_t * element, * j_value;
+  const char * key;
+  
+  json_object_foreach(element_list, key, element) {
+    if (json_object_get(element, "value") != NULL) {
+      // The cached value of a heater is the heater object itself, like get_heater gives it
+      if (element_type == BENOIC_ELEMENT_TYPE_HEATER) {
+        j_value = json_deep_copy(json_object_get(element, "value"));
+      } else {
+        j_value = json_pack("{sO}", "value", json_object_get(element, "value"));
+      }
+      set_element_value_cache(config, json_string_value(json_object_get(device, "name")), element_type, key, j_value);
+      json_decref(j_value);
+    }
+  }
+}
+
+/**
+ * Build the overview of the device from the value cache
+ * return NULL if one of the elements of the device has no cached value not older than max_age seconds
+ * returned value must be free'd after use
+ */
+json_t * overview_device_cached(struct _benoic_config * config, json_t * device, const time_t max_age) {
+  json_t * element_list = json_array(), * j_element, * element, * cached_value, * to_return = json_object();
+  const char * device_name = json_string_value(json_object_get(device, "name")), * overview_key;
+  size_t index;
+  int i;
+  
+  if (element_list == NULL || to_return == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "overview_device_cached - Error allocating resources");
+    json_decref(element_list);
+    json_decref(to_return);
+    return NULL;
+  }
+  
+  // List the elements of the device
+  pthread_mutex_lock(&config->element_index_lock);
+  for (i=0; config->element_index_list != NULL && config->element_index_list[i].device_name != NULL; i++) {
+    if (config->element_index_list[i].element_id != 0 && 0 == o_strcmp(config->element_index_list[i].device_name, device_name)) {
+      json_array_append_new(element_list, json_pack("{siss}", "type", config->element_index_list[i].element_type, "name", config->element_index_list[i].element_name));
+    }
+  }
+  pthread_mutex_unlock(&config->element_index_lock);
+  
+  if (json_array_size(element_list) == 0) {
+    json_decref(element_list);
+    json_decref(to_return);
+    return NULL;
+  }
+  
+  json_array_foreach(element_list, index, j_element) {
+    if (json_integer_value(json_object_get(j_element, "type")) == BENOIC_ELEMENT_TYPE_HEATER) {
+      // The overview gives the heater object in the value of the element
+      element = NULL;
+      cached_value = get_element_value_cache(config, device_name, BENOIC_ELEMENT_TYPE_HEATER, json_string_value(json_object_get(j_element, "name")), max_age);
+      if (cached_value != NULL) {
+        element = get_element_data(config, device, BENOIC_ELEMENT_TYPE_HEATER, json_string_value(json_object_get(j_element, "name")), 0);
+        json_object_set(element, "value", cached_value);
+        json_decref(cached_value);
+      }
+    } else {
+      element = get_element_cached(config, device, json_integer_value(json_object_get(j_element, "type")), json_string_value(json_object_get(j_element, "name")), max_age);
+    }
+    if (element == NULL) {
+      json_decref(to_return);
+      to_return = NULL;
+      break;
+    }
+    switch (json_integer_value(json_object_get(j_element, "type"))) {
+      case BENOIC_ELEMENT_TYPE_SENSOR:
+        overview_key = "sensors";
+        break;
+      case BENOIC_ELEMENT_TYPE_SWITCH:
+        overview_key = "switches";
+        break;
+      case BENOIC_ELEMENT_TYPE_DIMMER:
+        overview_key = "dimmers";
+        break;
+      default:
+        overview_key = "heaters";
+        break;
+    }
+    if (json_object_get(to_return, overview_key) == NULL) {
+      json_object_set_new(to_return, overview_key, json_object());
+    }
+    json_object_set_new(json_object_get(to_return, overview_key), json_string_value(json_object_get(j_element, "name")), element);
+  }
+  json_decref(element_list);
+  return to_return;
+}
+
 /**
  * Update the last seen parameter for the specified device to the current date
  * return B_OK on success
  */
 int update_last_seen_device(struct _benoic_config * config, json_t * device) {
   json_t * j_query;
+  struct _benoic_device_state * device_state;
+  time_t now;
   int res;
   
+  if (config == NULL || device == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "update_last_seen_device - Error input parameters");
+    return B_ERROR_PARAM;
+  }
+  
   if (json_object_get(device, "enabled") != json_true()) {
     y_log_message(Y_LOG_LEVEL_ERROR, "Device disabled");
     return B_ERROR_PARAM;
   }
   
-  if (config == NULL || device == NULL) {
-    y_log_message(Y_LOG_LEVEL_ERROR, "update_last_seen_device - Error input parameters");
-    return B_ERROR_PARAM;
+  // last_seen is part of the device data, it's only written every BENOIC_LAST_SEEN_RESOLUTION seconds,
+  // so the device data don't change on every call to the device
+  time(&now);
+  pthread_mutex_lock(&config->device_state_lock);
+  device_state = get_device_state(config, json_string_value(json_object_get(device, "name")));
+  if (device_state != NULL) {
+    if (device_state->last_seen_saved + BENOIC_LAST_SEEN_RESOLUTION > now) {
+      pthread_mutex_unlock(&config->device_state_lock);
+      return B_OK;
+    }
+    device_state->last_seen_saved = now;
   }
+  pthread_mutex_unlock(&config->device_state_lock);
   
   j_query = json_object();
   if (j_query == NULL) {
@@ -1091,6 +1769,7 @@ int update_last_seen_device(struct _benoic_config * config, json_t * device) {
   json_decref(j_query);
   
   if (res == H_OK) {
+    bump_last_seen_generation(config);
     return B_OK;
   } else {
     return B_ERROR_DB;
@@ -4,6 +4,7 @@
 -- FLUSH PRIVILEGES;
 -- USE `benoic_dev`;
 
+DROP TABLE IF EXISTS `b_monitor_heater`;
 DROP TABLE IF EXISTS `b_monitor`;
 DROP TABLE IF EXISTS `b_element`;
 DROP TABLE IF EXISTS `b_device`;
@@ -50,3 +51,14 @@ CREATE TABLE `b_monitor` (
   `bm_date` TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
   `bm_value` VARCHAR(16)
 );
+
+CREATE TABLE `b_monitor_heater` (
+  `bmh_id` INT(11) PRIMARY KEY AUTO_INCREMENT,
+  `be_id` INT(11),
+  `bmh_date` TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+  `bmh_mode` VARCHAR(16),
+  `bmh_command` FLOAT,
+  `bmh_on` TINYINT(1)
+);
+
+CREATE INDEX `idx_bmh_element_date` ON `b_monitor_heater` (`be_id`, `bmh_date`);
@@ -1,4 +1,5 @@
 
+DROP TABLE IF EXISTS `b_monitor_heater`;
 DROP TABLE IF EXISTS `b_monitor`;
 DROP TABLE IF EXISTS `b_element`;
 DROP TABLE IF EXISTS `b_device`;
@@ -44,3 +45,14 @@ CREATE TABLE `b_monitor` (
   `bm_date` INT DEFAULT (strftime('%s', 'now')),
   `bm_value` TEXT
 );
+
+CREATE TABLE `b_monitor_heater` (
+  `bmh_id` INTEGER PRIMARY KEY AUTOINCREMENT,
+  `be_id` INTEGER,
+  `bmh_date` INT DEFAULT (strftime('%s', 'now')),
+  `bmh_mode` TEXT,
+  `bmh_command` REAL,
+  `bmh_on` INTEGER
+);
+
+CREATE INDEX `idx_bmh_element_date` ON `b_monitor_heater` (`be_id`, `bmh_date`);
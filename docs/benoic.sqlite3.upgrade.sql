@@ -0,0 +1,19 @@
+-- Upgrade a database created before the table b_monitor_heater
+-- Heaters samples stored in b_monitor are moved to b_monitor_heater, only their command was stored
+
+CREATE TABLE IF NOT EXISTS `b_monitor_heater` (
+  `bmh_id` INTEGER PRIMARY KEY AUTOINCREMENT,
+  `be_id` INTEGER,
+  `bmh_date` INT DEFAULT (strftime('%s', 'now')),
+  `bmh_mode` TEXT,
+  `bmh_command` REAL,
+  `bmh_on` INTEGER
+);
+
+CREATE INDEX IF NOT EXISTS `idx_bmh_element_date` ON `b_monitor_heater` (`be_id`, `bmh_date`);
+
+INSERT INTO `b_monitor_heater` (`be_id`, `bmh_date`, `bmh_command`)
+  SELECT `b_monitor`.`be_id`, `b_monitor`.`bm_date`, `b_monitor`.`bm_value` FROM `b_monitor`, `b_element`
+  WHERE `b_monitor`.`be_id` = `b_element`.`be_id` AND `b_element`.`be_type` = 4;
+
+DELETE FROM `b_monitor` WHERE `be_id` IN (SELECT `be_id` FROM `b_element` WHERE `be_type` = 4);
@@ -0,0 +1,75 @@
+/**
+ *
+ * Benoic House Automation service
+ *
+ * Command house automation devices via an HTTP REST interface
+ *
+ * Test of the device_data list: set, get and remove the modules data of the connected devices
+ *
+ * Copyright 2016 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU GENERAL PUBLIC LICENSE
+ * License as published by the Free Software Foundation;
+ * version 3 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../benoic.h"
+
+#define CHECK(test, message) if (!(test)) { fprintf(stderr, "%s:%d - %s\n", __FILE__, __LINE__, message); nb_errors++; }
+
+/**
+ * Remove the entry in the middle of the list, then the last one, then the first one
+ * The remaining devices must still be found with their own data, and the removed ones must not be found
+ */
+int main(void) {
+  struct _benoic_config config;
+  int data_a = 1, data_b = 2, data_c = 3, nb_errors = 0;
+  
+  memset(&config, 0, sizeof(struct _benoic_config));
+  pthread_mutex_init(&config.device_data_lock, NULL);
+  
+  CHECK(set_device_data(&config, "dev_a", &data_a) == B_OK, "set dev_a");
+  CHECK(set_device_data(&config, "dev_b", &data_b) == B_OK, "set dev_b");
+  CHECK(set_device_data(&config, "dev_c", &data_c) == B_OK, "set dev_c");
+  
+  CHECK(remove_device_data(&config, "dev_b") == B_OK, "remove dev_b");
+  CHECK(get_device_ptr(&config, "dev_a") == &data_a, "dev_a after removing dev_b");
+  CHECK(get_device_ptr(&config, "dev_b") == NULL, "dev_b after removing dev_b");
+  CHECK(get_device_ptr(&config, "dev_c") == &data_c, "dev_c after removing dev_b");
+  CHECK(config.device_data_list[2].device_name == NULL && config.device_data_list[2].device_ptr == NULL, "end of the list after removing dev_b");
+  
+  CHECK(remove_device_data(&config, "dev_c") == B_OK, "remove dev_c");
+  CHECK(get_device_ptr(&config, "dev_a") == &data_a, "dev_a after removing dev_c");
+  CHECK(get_device_ptr(&config, "dev_c") == NULL, "dev_c after removing dev_c");
+  CHECK(config.device_data_list[1].device_name == NULL, "end of the list after removing dev_c");
+  
+  CHECK(set_device_data(&config, "dev_b", &data_b) == B_OK, "set dev_b again");
+  CHECK(remove_device_data(&config, "dev_a") == B_OK, "remove dev_a");
+  CHECK(get_device_ptr(&config, "dev_a") == NULL, "dev_a after removing dev_a");
+  CHECK(get_device_ptr(&config, "dev_b") == &data_b, "dev_b after removing dev_a");
+  
+  CHECK(remove_device_data(&config, "dev_b") == B_OK, "remove dev_b again");
+  CHECK(config.device_data_list[0].device_name == NULL, "empty list");
+  
+  o_free(config.device_data_list);
+  pthread_mutex_destroy(&config.device_data_lock);
+  if (nb_errors) {
+    fprintf(stderr, "device-data: %d error(s)\n", nb_errors);
+    return 1;
+  }
+  printf("device-data: ok\n");
+  return 0;
+}